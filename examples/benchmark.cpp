@@ -0,0 +1,142 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Penumbra
+#include <penumbra/penumbra.h>
+
+// Times PSSA calculations for every surface of a synthetic building (a grid of windowed wall
+// panels, each with an awning and a fin) over a set of sun positions, with each backend.
+
+constexpr unsigned int panel_columns{10u};
+constexpr unsigned int panel_rows{5u};
+constexpr unsigned int sun_position_count{24u};
+
+void add_panels(Penumbra::Penumbra &penumbra) {
+  for (unsigned int row = 0; row < panel_rows; ++row) {
+    for (unsigned int column = 0; column < panel_columns; ++column) {
+      auto const x = static_cast<float>(column);
+      auto const z = static_cast<float>(row);
+      Penumbra::Polygon window_vertices = {x + 0.25f, 0.f, z + 0.25f, x + 0.75f, 0.f, z + 0.25f,
+                                           x + 0.75f, 0.f, z + 0.75f, x + 0.25f, 0.f, z + 0.75f};
+      Penumbra::Surface wall(
+          {x, 0.f, z, x + 1.f, 0.f, z, x + 1.f, 0.f, z + 1.f, x, 0.f, z + 1.f});
+      wall.add_hole(window_vertices);
+      penumbra.add_surface(wall);
+      penumbra.add_surface(Penumbra::Surface(window_vertices));
+      penumbra.add_surface(Penumbra::Surface({x + 0.25f, 0.f, z + 0.8f, x + 0.75f, 0.f, z + 0.8f,
+                                              x + 0.75f, -0.4f, z + 0.8f, x + 0.25f, -0.4f,
+                                              z + 0.8f}));
+      penumbra.add_surface(Penumbra::Surface({x + 0.9f, 0.f, z + 0.1f, x + 0.9f, -0.3f, z + 0.1f,
+                                              x + 0.9f, -0.3f, z + 0.9f, x + 0.9f, 0.f,
+                                              z + 0.9f}));
+    }
+  }
+  penumbra.set_model();
+}
+
+// Collects every PSSA (by sun position, then surface) if results are given
+double time_calculations(Penumbra::Penumbra &penumbra, std::vector<float> *results = nullptr) {
+  auto const start = std::chrono::steady_clock::now();
+  double total_pssa{0.};
+  for (unsigned int i = 0; i < sun_position_count; ++i) {
+    auto const azimuth = -1.2f + 2.4f * static_cast<float>(i) / sun_position_count;
+    auto const altitude = 0.1f + 1.2f * static_cast<float>(i % 6u) / 6.f;
+    penumbra.set_sun_position(azimuth, altitude);
+    for (auto const pssa : penumbra.calculate_pssa()) {
+      total_pssa += pssa;
+      if (results) {
+        results->push_back(pssa);
+      }
+    }
+  }
+  std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "  Total PSSA: " << total_pssa << std::endl;
+  return elapsed.count();
+}
+
+double get_rms_error(const std::vector<float> &results, const std::vector<float> &exact_results) {
+  double sum_of_squares{0.};
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    sum_of_squares += (results[i] - exact_results[i]) * (results[i] - exact_results[i]);
+  }
+  return std::sqrt(sum_of_squares / static_cast<double>(results.size()));
+}
+
+int main() {
+  std::cout << panel_columns * panel_rows * 4u << " surfaces, " << sun_position_count
+            << " sun positions" << std::endl;
+
+  {
+    Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::software_rasterizer);
+    add_panels(penumbra);
+    auto const seconds = time_calculations(penumbra);
+    std::cout << "Software rasterizer: " << seconds << " s" << std::endl;
+  }
+
+  {
+    Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::software_rasterizer);
+    penumbra.set_calculation_mode(Penumbra::CalculationMode::shared_depth_buffer);
+    add_panels(penumbra);
+    auto const seconds = time_calculations(penumbra);
+    std::cout << "Software rasterizer (shared depth buffer): " << seconds << " s" << std::endl;
+  }
+
+  std::vector<float> exact_results;
+  {
+    Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::polygon_clipping);
+    add_panels(penumbra);
+    auto const seconds = time_calculations(penumbra, &exact_results);
+    std::cout << "Polygon clipping: " << seconds << " s" << std::endl;
+  }
+
+  {
+    Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::ray_casting);
+    add_panels(penumbra);
+    auto const seconds = time_calculations(penumbra);
+    std::cout << "Ray casting: " << seconds << " s" << std::endl;
+  }
+
+  if (Penumbra::Penumbra::is_valid_backend(Penumbra::CalculationBackend::vulkan)) {
+    Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::vulkan);
+    add_panels(penumbra);
+    auto const seconds = time_calculations(penumbra);
+    std::cout << "Vulkan: " << seconds << " s" << std::endl;
+  }
+
+  if (Penumbra::Penumbra::is_valid_context()) {
+    Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::opengl);
+    add_panels(penumbra);
+    auto const seconds = time_calculations(penumbra);
+    std::cout << "OpenGL: " << seconds << " s" << std::endl;
+
+    Penumbra::Penumbra shared_depth(512u, Penumbra::CalculationBackend::opengl);
+    shared_depth.set_calculation_mode(Penumbra::CalculationMode::shared_depth_buffer);
+    add_panels(shared_depth);
+    auto const shared_depth_seconds = time_calculations(shared_depth);
+    std::cout << "OpenGL (shared depth buffer): " << shared_depth_seconds << " s" << std::endl;
+
+    // Single sampling at a high resolution versus multisampling at a low resolution, with the
+    // RMS error of each relative to polygon clipping
+    for (auto const &[size, samples] :
+         {std::pair{1024u, 1u}, std::pair{512u, 1u}, std::pair{256u, 8u}}) {
+      Penumbra::Penumbra sampled(size, Penumbra::CalculationBackend::opengl);
+      sampled.set_samples_per_pixel(samples);
+      add_panels(sampled);
+      std::vector<float> results;
+      auto const sampled_seconds = time_calculations(sampled, &results);
+      std::cout << "OpenGL (" << size << " x " << size << ", " << sampled.get_samples_per_pixel()
+                << " samples per pixel): " << sampled_seconds
+                << " s, RMS error: " << get_rms_error(results, exact_results) << std::endl;
+    }
+  } else {
+    std::cout << "OpenGL: no valid context" << std::endl;
+  }
+
+  return 0;
+}
@@ -10,6 +10,7 @@
 #include <vector>
 #include <array>
 #include <unordered_map>
+#include <utility>
 
 // Penumbra
 #include <penumbra/surface.h>
@@ -19,6 +20,29 @@ namespace Penumbra {
 
 enum class VendorType { unknown, nvidia, amd, intel, vmware, mesa };
 
+// How PSSAs of several surfaces share renderings (see README)
+enum class CalculationMode { per_surface, surface_id_buffer, shared_depth_buffer, coplanar_groups };
+
+// Platform creating the OpenGL context. Automatic tries the headless EGL and OSMesa first.
+enum class GLPlatform { automatic, egl, osmesa, glfw };
+
+// Where PSSAs are calculated. Only opengl needs an OpenGL context (see README).
+enum class CalculationBackend {
+  opengl,
+  software_rasterizer,
+  polygon_clipping,
+  ray_casting,
+  vulkan
+};
+
+// PSSAs (per surface and sun position) found analytically, by each reason, or rendered
+struct PssaStatistics {
+  unsigned long long sun_below_horizon{0u};
+  unsigned long long back_facing{0u};
+  unsigned long long unshaded{0u};
+  unsigned long long rendered{0u};
+};
+
 class PenumbraImplementation;
 
 class Penumbra {
@@ -28,18 +52,59 @@ public:
 
   explicit Penumbra(const std::shared_ptr<Courierr::Courierr> &logger);
 
+  Penumbra(unsigned int size, GLPlatform platform,
+           const std::shared_ptr<Courierr::Courierr> &logger = std::make_shared<PenumbraLogger>());
+
+  Penumbra(unsigned int size, CalculationBackend backend,
+           const std::shared_ptr<Courierr::Courierr> &logger = std::make_shared<PenumbraLogger>());
+
   ~Penumbra();
 
 public:
-  static bool is_valid_context();
+  static bool is_valid_context(GLPlatform platform = GLPlatform::automatic);
+  // Whether the backend can be used by this build on this machine
+  static bool is_valid_backend(CalculationBackend backend);
   unsigned int add_surface(const Surface &surface);
+  // Adds a surface per transform, sharing the prototype's tessellation. Returns the first index.
+  unsigned int add_surface_instances(const Surface &prototype,
+                                     const std::vector<std::array<float, 16>> &transforms);
+  // Tessellates the surfaces into the model, or applies the surface changes since the last call
   void set_model();
-  void clear_model();
+  void clear_model(); // Also removes every surface
+  // Replaces a surface's polygon and holes (and name, if named), keeping its index
+  void update_surface(unsigned int surface_index, const Surface &surface);
+  // Discards a surface's geometry, keeping the indices of every surface
+  void remove_surface(unsigned int surface_index);
+  // Disabled surfaces are left out of the model, but keep their tessellation
+  void set_surface_enabled(unsigned int surface_index, bool enabled);
+  bool get_surface_enabled(unsigned int surface_index);
+  // Rigid transform (column-major 4 x 4) from the surface's polygon to the model. Identity default.
+  void set_surface_transform(unsigned int surface_index, const std::array<float, 16> &transform);
+  std::array<float, 16> get_surface_transform(unsigned int surface_index);
   void set_sun_position(float azimuth, // in radians, clockwise, north = 0
                         float altitude // in radians, horizon = 0, vertical = pi/2
   );
   float get_sun_azimuth();
   float get_sun_altitude();
+  void set_calculation_mode(CalculationMode mode);
+  CalculationMode get_calculation_mode();
+  // Surfaces spanning fewer shared depth buffer pixels are rendered individually. Default zero.
+  void set_minimum_shared_depth_pixels(unsigned int pixels);
+  unsigned int get_minimum_shared_depth_pixels();
+  // Relative error each surface's resolution is chosen to meet. Zero (default) renders at size.
+  void set_target_accuracy(float relative_error);
+  float get_target_accuracy();
+  // Multisampling (OpenGL only). get_samples_per_pixel() returns the count the hardware uses.
+  void set_samples_per_pixel(unsigned int samples);
+  unsigned int get_samples_per_pixel();
+  // Sizes beyond this are rendered in tiles (OpenGL only). Zero (default) uses the hardware limit.
+  void set_maximum_tile_size(unsigned int size);
+  // Surfaces lit from behind have zero PSSA. Disabled by default.
+  void set_back_face_culling(bool enabled);
+  bool get_back_face_culling();
+  // Every PSSA is zero with the sun below the horizon. Disabled by default.
+  void set_horizon_culling(bool enabled);
+  bool get_horizon_culling();
   void submit_pssa(unsigned int surface_index);
   void submit_pssa(const std::vector<unsigned int> &surface_indices);
   void submit_pssa();
@@ -50,14 +115,41 @@ public:
   float calculate_pssa(unsigned int surface_index);
   std::vector<float> calculate_pssa(const std::vector<unsigned int> &surface_indices);
   std::vector<float> calculate_pssa();
+  // Calculate PSSA of one surface for several sun positions (azimuth, altitude pairs in radians)
+  std::vector<float> calculate_pssa(unsigned int surface_index,
+                                    const std::vector<std::pair<float, float>> &sun_positions);
+  // Estimated absolute error of the surface's last submitted PSSA (zero if exact)
+  float get_pssa_error(unsigned int surface_index);
+  std::vector<float> get_pssa_error(); // Every surface of the model set
+  // Queues PSSAs at the current sun position, to retrieve later. Up to four may be queued.
+  unsigned int queue_pssa(const std::vector<unsigned int> &surface_indices);
+  unsigned int queue_pssa();
+  bool is_pssa_ready(unsigned int ticket);
+  std::vector<float> retrieve_queued_pssa(unsigned int ticket); // Blocks until ready
+  // Precalculates every surface's PSSA on a refined grid of sun positions (see README)
+  void calculate_sky_grid(unsigned int azimuth_cells, unsigned int altitude_cells,
+                          float tolerance = 0.f, unsigned int max_refinements = 0u);
+  // Every surface's PSSA at a sun position (in radians), interpolated from the sky grid
+  std::vector<float> interpolate_pssa(float azimuth, float altitude);
+  unsigned int get_sky_grid_size(); // Sun positions calculated for the sky grid (zero if none)
+  void clear_sky_grid();
   std::unordered_map<unsigned int, float>
   calculate_interior_pssas(const std::vector<unsigned int> &transparent_surface_indices,
                            const std::vector<unsigned int> &interior_surface_indices);
+  // Surfaces with any part in front of the surface, found by set_model()
+  std::vector<unsigned int> get_potential_shaders(unsigned int surface_index);
+  std::vector<std::vector<unsigned int>> get_potential_shaders(); // Every surface of the model set
+  // Paths taken by PSSA calculations (not interior PSSAs) since construction or the last reset
+  PssaStatistics get_pssa_statistics();
+  void reset_pssa_statistics();
+  // Rendering requires the OpenGL backend
   void render_scene(unsigned int surface_index); // Primarily for debug purposes
   void render_interior_scene(
       const std::vector<unsigned int> &transparent_surface_indices,
       const std::vector<unsigned int> &interior_surface_indices); // Primarily for debug purposes
   VendorType get_vendor_name();
+  GLPlatform get_gl_platform();
+  CalculationBackend get_calculation_backend();
   std::shared_ptr<Courierr::Courierr> get_logger();
 
 private:
@@ -0,0 +1,322 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <cmath>
+
+// Penumbra
+#include <penumbra/logging.h>
+#include "clipping/context.h"
+
+namespace Penumbra {
+
+ClippingContext::ClippingContext(int size_in, ThreadPool &thread_pool_in,
+                                 Courierr::Courierr *logger_in)
+    : Context(size_in, logger_in), thread_pool(thread_pool_in), queue(logger_in) {}
+
+namespace {
+Region get_region(const SurfaceImplementation &surface) {
+  auto const to_contour = [&](const Polygon &polygon) {
+    Contour contour;
+    contour.reserve(polygon.size() / 3u);
+    for (std::size_t i = 0; i + 2 < polygon.size(); i += 3u) {
+      contour.push_back({polygon[i], polygon[i + 1], polygon[i + 2]});
+    }
+    return contour;
+  };
+  Region region{to_contour(surface.transform_contour(surface.polygon))};
+  for (auto const &hole : surface.holes) {
+    region.push_back(to_contour(surface.transform_contour(hole)));
+  }
+  return region;
+}
+} // namespace
+
+void ClippingContext::set_surfaces(const std::vector<SurfaceImplementation> &surfaces) {
+  Context::set_surfaces(surfaces);
+  surface_regions.clear();
+  surface_regions.reserve(surfaces.size());
+  Rectangle bounds{MAX_FLOAT, MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT};
+  double min_z{MAX_FLOAT}, max_z{-MAX_FLOAT};
+  for (auto const &surface : surfaces) {
+    surface_regions.push_back(get_region(surface));
+    for (auto const &point : surface_regions.back().front()) {
+      bounds.min_x = std::min(point.x, bounds.min_x);
+      bounds.max_x = std::max(point.x, bounds.max_x);
+      bounds.min_y = std::min(point.y, bounds.min_y);
+      bounds.max_y = std::max(point.y, bounds.max_y);
+      min_z = std::min(point.z, min_z);
+      max_z = std::max(point.z, max_z);
+    }
+  }
+
+  // Relative to the size of the model, well above the precision of single precision input
+  static constexpr double relative_tolerance{1e-5};
+  coplanar_tolerance =
+      relative_tolerance * std::sqrt((bounds.max_x - bounds.min_x) * (bounds.max_x - bounds.min_x) +
+                                     (bounds.max_y - bounds.min_y) * (bounds.max_y - bounds.min_y) +
+                                     (max_z - min_z) * (max_z - min_z));
+  pssas.assign(surface_regions.size(), 0.f);
+}
+
+void ClippingContext::update_surfaces(const std::vector<SurfaceImplementation> &surfaces,
+                                      const std::vector<unsigned int> &changed_surfaces) {
+  if (surface_regions.size() != surfaces.size()) {
+    set_surfaces(surfaces);
+    return;
+  }
+  // The coplanar tolerance is kept until the surfaces are next set
+  Context::update_surfaces(surfaces, changed_surfaces);
+  for (auto const surface_index : changed_surfaces) {
+    surface_regions[surface_index] = get_region(surfaces[surface_index]);
+  }
+}
+
+void ClippingContext::set_model(const std::vector<float> &vertices_in,
+                                const std::vector<unsigned int> &indices_in,
+                                const std::vector<SurfaceBuffer> &surface_buffers_in) {
+  Context::set_model(vertices_in, indices_in, surface_buffers_in);
+  for (std::size_t i = 0; i < surface_regions.size() && i < surface_buffers.size(); ++i) {
+    if (surface_buffers[i].count == 0u) {
+      surface_regions[i].clear();
+    }
+  }
+}
+
+void ClippingContext::update_model(const std::vector<float> &vertices_in,
+                                   const std::vector<unsigned int> &indices_in,
+                                   const std::vector<SurfaceBuffer> &surface_buffers_in,
+                                   const std::vector<unsigned int> &changed_surfaces,
+                                   const std::vector<std::pair<unsigned int, unsigned int>>
+                                       &rewritten_vertices) {
+  if (!model_is_set || surface_buffers_in.size() != surface_buffers.size()) {
+    set_model(vertices_in, indices_in, surface_buffers_in);
+    return;
+  }
+  Context::update_model(vertices_in, indices_in, surface_buffers_in, changed_surfaces,
+                        rewritten_vertices);
+  for (auto const surface_index : changed_surfaces) {
+    if (surface_index < surface_regions.size() && surface_buffers[surface_index].count == 0u) {
+      surface_regions[surface_index].clear();
+    }
+  }
+}
+
+void ClippingContext::clear_model() {
+  Context::clear_model();
+  surface_regions.clear();
+  pssas.clear();
+  queue.clear();
+}
+
+void ClippingContext::check_model_is_set() const {
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot set scene.", *logger);
+  }
+}
+
+ClippingContext::ViewRegions ClippingContext::get_view_regions(mat4x4 sun_view) const {
+  // Rotate only (as in calculate_projection). Translation does not affect projected areas.
+  ViewRegions view_regions{surface_regions, {}};
+  view_regions.bounds.reserve(surface_regions.size());
+  for (auto &region : view_regions.regions) {
+    for (auto &contour : region) {
+      for (auto &point : contour) {
+        Point const model_point = point;
+        point.x = sun_view[0][0] * model_point.x + sun_view[1][0] * model_point.y +
+                  sun_view[2][0] * model_point.z;
+        point.y = sun_view[0][1] * model_point.x + sun_view[1][1] * model_point.y +
+                  sun_view[2][1] * model_point.z;
+        point.z = sun_view[0][2] * model_point.x + sun_view[1][2] * model_point.y +
+                  sun_view[2][2] * model_point.z;
+      }
+    }
+    view_regions.bounds.push_back(bounding_rectangle(region));
+  }
+  return view_regions;
+}
+
+float ClippingContext::calculate_pssa(const unsigned int receiver_index, mat4x4 sun_view,
+                                      const ViewRegions &view_regions,
+                                      const std::vector<unsigned int> &excluded_indices,
+                                      const Rectangle *aperture) const {
+  const Region &receiver = view_regions.regions[receiver_index];
+  if (receiver.empty() || receiver[0].size() < 3) {
+    return 0.f;
+  }
+
+  // Receiver plane normal (Newell's method)
+  double normal_x{0.}, normal_y{0.}, normal_z{0.};
+  const Contour &outline = receiver[0];
+  for (std::size_t i = 0; i < outline.size(); ++i) {
+    const Point &a = outline[i];
+    const Point &b = outline[(i + 1) % outline.size()];
+    normal_x += (a.y - b.y) * (a.z + b.z);
+    normal_y += (a.z - b.z) * (a.x + b.x);
+    normal_z += (a.x - b.x) * (a.y + b.y);
+  }
+  double const normal_length =
+      std::sqrt(normal_x * normal_x + normal_y * normal_y + normal_z * normal_z);
+  static constexpr double edge_on_tolerance{1e-9};
+  if (std::abs(normal_z) <= edge_on_tolerance * normal_length) {
+    return 0.f; // Parallel to the sun. No projected area.
+  }
+
+  // Distance above the receiver's plane, toward the sun
+  const Point &origin = outline[0];
+  auto height_above_receiver = [&](const Point &point) {
+    return (normal_x * (point.x - origin.x) + normal_y * (point.y - origin.y) +
+            normal_z * (point.z - origin.z)) /
+               normal_z -
+           coplanar_tolerance;
+  };
+
+  Region const subject = aperture ? clip_region(receiver, *aperture) : receiver;
+  if (subject.empty()) {
+    return 0.f;
+  }
+  Rectangle const bounds = bounding_rectangle(subject);
+
+  // With the sun in front of the receiver, only its potential shaders may cover it
+  bool const is_lit_from_front = normal_z > 0.;
+
+  // Candidates are the surfaces in the receiver's view (see find_surfaces_in_view), as found by
+  // calculate_analytic_pssa if it classified the receiver for this sun view
+  auto const *receiver_view = get_receiver_view(receiver_index, sun_view);
+  std::vector<unsigned int> surfaces_in_view;
+  if (!receiver_view) {
+    auto const &receiver_buffer = surface_buffers[receiver_index];
+    find_surfaces_in_view(sun_view, calculate_projection(sun_view, &receiver_buffer),
+                          &receiver_buffer, surfaces_in_view);
+  }
+
+  std::vector<Region> covers;
+  for (auto const index : receiver_view ? receiver_view->surfaces_in_view : surfaces_in_view) {
+    if (index == receiver_index ||
+        (is_lit_from_front && !is_potential_shader(receiver_index, index)) ||
+        std::find(excluded_indices.begin(), excluded_indices.end(), index) !=
+            excluded_indices.end() ||
+        !overlaps(view_regions.bounds[index], bounds)) {
+      continue;
+    }
+    Region in_front;
+    for (auto const &contour : view_regions.regions[index]) {
+      auto clipped = clip_contour(contour, height_above_receiver);
+      if (!clipped.empty()) {
+        in_front.push_back(std::move(clipped));
+      }
+    }
+    if (!in_front.empty()) {
+      in_front = clip_region(in_front, bounds);
+      if (!in_front.empty()) {
+        covers.push_back(std::move(in_front));
+      }
+    }
+  }
+
+  return static_cast<float>(uncovered_area(subject, covers));
+}
+
+void ClippingContext::calculate_pssas(const std::vector<unsigned int> &surface_indices,
+                                      mat4x4 sun_view, std::vector<float> &results) {
+  check_model_is_set();
+  results.resize(surface_regions.size());
+  auto const clipped_surface_indices =
+      calculate_analytic_pssas(surface_indices, sun_view, results);
+  if (clipped_surface_indices.empty()) {
+    return;
+  }
+  auto const view_regions = get_view_regions(sun_view);
+  thread_pool.parallel_for(clipped_surface_indices.size(), [&](std::size_t i, unsigned int) {
+    results[clipped_surface_indices[i]] =
+        calculate_pssa(clipped_surface_indices[i], sun_view, view_regions);
+  });
+}
+
+void ClippingContext::submit_pssa(const unsigned int surface_index, mat4x4 sun_view) {
+  calculate_pssas(std::vector<unsigned int>{surface_index}, sun_view, pssas);
+}
+
+void ClippingContext::submit_pssas(const std::vector<unsigned int> &surface_indices,
+                                   mat4x4 sun_view) {
+  calculate_pssas(surface_indices, sun_view, pssas);
+}
+
+float ClippingContext::retrieve_pssa(const unsigned int surface_index) {
+  return pssas.at(surface_index);
+}
+
+std::vector<float> ClippingContext::calculate_pssas(const unsigned int surface_index,
+                                                    const std::vector<mat4x4_ptr> &sun_views) {
+  check_model_is_set();
+  std::vector<float> results(sun_views.size());
+  std::vector<std::size_t> clipped_views;
+  for (std::size_t i = 0; i < sun_views.size(); ++i) {
+    if (!calculate_analytic_pssa(surface_index, sun_views[i], results[i])) {
+      clipped_views.push_back(i);
+    }
+  }
+  thread_pool.parallel_for(clipped_views.size(), [&](std::size_t i, unsigned int) {
+    auto const view_index = clipped_views[i];
+    results[view_index] = calculate_pssa(surface_index, sun_views[view_index],
+                                         get_view_regions(sun_views[view_index]));
+  });
+  return results;
+}
+
+unsigned int ClippingContext::queue_pssas(const std::vector<unsigned int> &surface_indices,
+                                          mat4x4 sun_view) {
+  // Calculations complete before returning. Queuing is supported for parity with the OpenGL
+  // backend.
+  std::vector<float> results;
+  calculate_pssas(surface_indices, sun_view, results);
+  std::vector<float> queued_results;
+  queued_results.reserve(surface_indices.size());
+  for (auto const surface_index : surface_indices) {
+    queued_results.push_back(results[surface_index]);
+  }
+  return queue.push(std::move(queued_results));
+}
+
+bool ClippingContext::is_queued_pssa_ready(const unsigned int ticket) {
+  queue.check_ticket(ticket);
+  return true;
+}
+
+std::vector<float> ClippingContext::retrieve_queued_pssas(const unsigned int ticket) {
+  return queue.pop(ticket);
+}
+
+unsigned int ClippingContext::get_queued_pssa_count() const {
+  return queue.size();
+}
+
+unsigned int ClippingContext::get_queue_capacity() const {
+  return CompletedQueue::max_size;
+}
+
+std::unordered_map<unsigned int, float>
+ClippingContext::calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                                          const std::vector<unsigned int> &interior_surface_indices,
+                                          mat4x4 sun_view) {
+  check_model_is_set();
+  auto const view_regions = get_view_regions(sun_view);
+
+  // As with pixel counting, sunlight enters through the extents of the first hidden surface
+  Rectangle const aperture = view_regions.bounds.at(hidden_surface_indices.at(0));
+
+  std::vector<float> results(interior_surface_indices.size());
+  thread_pool.parallel_for(interior_surface_indices.size(), [&](std::size_t i, unsigned int) {
+    results[i] = calculate_pssa(interior_surface_indices[i], sun_view, view_regions,
+                                hidden_surface_indices, &aperture);
+  });
+
+  std::unordered_map<unsigned int, float> interior_pssas;
+  for (std::size_t i = 0; i < interior_surface_indices.size(); ++i) {
+    interior_pssas[interior_surface_indices[i]] = results[i];
+  }
+  return interior_pssas;
+}
+
+} // namespace Penumbra
@@ -0,0 +1,85 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef CLIPPING_CONTEXT_H_
+#define CLIPPING_CONTEXT_H_
+
+// Standard
+#include <unordered_map>
+#include <vector>
+
+// Vendor
+#include <courierr/courierr.h>
+
+// Penumbra
+#include "../context.h"
+#include "clipping/polygon.h"
+#include "cpu/thread-pool.h"
+
+namespace Penumbra {
+
+// Calculates exact PSSAs by clipping surface polygons rather than counting pixels. Each receiving
+// surface is handled on its own thread: the parts of other surfaces in front of the receiver's
+// plane are projected along the sun direction, and the receiver's projected area outside all of
+// them is its PSSA. Results do not depend on the size (resolution) or calculation mode.
+class ClippingContext : public Context {
+
+public:
+  ClippingContext(int size, ThreadPool &thread_pool, Courierr::Courierr *logger);
+  ~ClippingContext() override = default;
+  void set_surfaces(const std::vector<SurfaceImplementation> &surfaces) override;
+  void update_surfaces(const std::vector<SurfaceImplementation> &surfaces,
+                       const std::vector<unsigned int> &changed_surfaces) override;
+  // Surfaces without triangles (e.g., disabled surfaces) are left out of the regions clipped
+  void set_model(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                 const std::vector<SurfaceBuffer> &surface_buffers) override;
+  void update_model(
+      const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+      const std::vector<SurfaceBuffer> &surface_buffers,
+      const std::vector<unsigned int> &changed_surfaces,
+      const std::vector<std::pair<unsigned int, unsigned int>> &rewritten_vertices) override;
+  void clear_model() override;
+  using Context::submit_pssa;
+  void submit_pssa(unsigned int surface_index, mat4x4 sun_view) override;
+  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) override;
+  using Context::retrieve_pssa;
+  float retrieve_pssa(unsigned int surface_index) override;
+  std::vector<float> calculate_pssas(unsigned int surface_index,
+                                     const std::vector<mat4x4_ptr> &sun_views) override;
+  unsigned int queue_pssas(const std::vector<unsigned int> &surface_indices,
+                           mat4x4 sun_view) override;
+  bool is_queued_pssa_ready(unsigned int ticket) override;
+  std::vector<float> retrieve_queued_pssas(unsigned int ticket) override;
+  [[nodiscard]] unsigned int get_queued_pssa_count() const override;
+  [[nodiscard]] unsigned int get_queue_capacity() const override;
+
+  std::unordered_map<unsigned int, float>
+  calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                           const std::vector<unsigned int> &interior_surface_indices,
+                           mat4x4 sun_view) override;
+
+private:
+  ThreadPool &thread_pool; // Owned by PenumbraImplementation
+  std::vector<Region> surface_regions; // Polygon and holes of each surface, in model coordinates
+  double coplanar_tolerance{0.};       // Surfaces closer than this to a receiver do not shade it
+  std::vector<float> pssas;            // Results of the last submission
+  CompletedQueue queue;
+
+  // Surface regions in sun view coordinates (z increases toward the sun), and their bounds
+  struct ViewRegions {
+    std::vector<Region> regions;
+    std::vector<Rectangle> bounds;
+  };
+  [[nodiscard]] ViewRegions get_view_regions(mat4x4 sun_view) const;
+  [[nodiscard]] float calculate_pssa(unsigned int receiver_index, mat4x4 sun_view,
+                                     const ViewRegions &view_regions,
+                                     const std::vector<unsigned int> &excluded_indices = {},
+                                     const Rectangle *aperture = nullptr) const;
+  void calculate_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                       std::vector<float> &results);
+  void check_model_is_set() const;
+};
+
+} // namespace Penumbra
+
+#endif // CLIPPING_CONTEXT_H_
@@ -0,0 +1,167 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <limits>
+
+// Penumbra
+#include "clipping/polygon.h"
+
+namespace Penumbra {
+
+Rectangle bounding_rectangle(const Region &region) {
+  Rectangle rectangle{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                      std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+  for (auto const &contour : region) {
+    for (auto const &point : contour) {
+      rectangle.min_x = std::min(point.x, rectangle.min_x);
+      rectangle.min_y = std::min(point.y, rectangle.min_y);
+      rectangle.max_x = std::max(point.x, rectangle.max_x);
+      rectangle.max_y = std::max(point.y, rectangle.max_y);
+    }
+  }
+  return rectangle;
+}
+
+bool overlaps(const Rectangle &a, const Rectangle &b) {
+  return a.min_x < b.max_x && b.min_x < a.max_x && a.min_y < b.max_y && b.min_y < a.max_y;
+}
+
+Region clip_region(const Region &region, const Rectangle &rectangle) {
+  Region clipped;
+  for (auto const &contour : region) {
+    auto clipped_contour =
+        clip_contour(contour, [&](const Point &p) { return p.x - rectangle.min_x; });
+    clipped_contour =
+        clip_contour(clipped_contour, [&](const Point &p) { return rectangle.max_x - p.x; });
+    clipped_contour =
+        clip_contour(clipped_contour, [&](const Point &p) { return p.y - rectangle.min_y; });
+    clipped_contour =
+        clip_contour(clipped_contour, [&](const Point &p) { return rectangle.max_y - p.y; });
+    if (!clipped_contour.empty()) {
+      clipped.push_back(std::move(clipped_contour));
+    }
+  }
+  return clipped;
+}
+
+namespace {
+
+struct Edge {
+  double x0, y0, x1, y1; // x0 < x1
+  int owner;             // Index of the cover, or -1 for the subject
+
+  [[nodiscard]] double y_at(double x) const {
+    return y0 + (y1 - y0) * (x - x0) / (x1 - x0);
+  }
+};
+
+void add_edges(const Region &region, int owner, std::vector<Edge> &edges) {
+  for (auto const &contour : region) {
+    for (std::size_t i = 0; i < contour.size(); ++i) {
+      const Point &a = contour[i];
+      const Point &b = contour[(i + 1) % contour.size()];
+      // Vertical edges lie on slab boundaries, so they never bound a trapezoid
+      if (a.x < b.x) {
+        edges.push_back({a.x, a.y, b.x, b.y, owner});
+      } else if (b.x < a.x) {
+        edges.push_back({b.x, b.y, a.x, a.y, owner});
+      }
+    }
+  }
+}
+
+} // namespace
+
+double uncovered_area(const Region &subject, const std::vector<Region> &covers) {
+  std::vector<Edge> edges;
+  add_edges(subject, -1, edges);
+  for (std::size_t i = 0; i < covers.size(); ++i) {
+    add_edges(covers[i], static_cast<int>(i), edges);
+  }
+  if (edges.empty()) {
+    return 0.;
+  }
+
+  // Slab boundaries: every vertex and every crossing of two edges
+  std::vector<double> boundaries;
+  boundaries.reserve(edges.size() * 2);
+  for (auto const &edge : edges) {
+    boundaries.push_back(edge.x0);
+    boundaries.push_back(edge.x1);
+  }
+  std::sort(edges.begin(), edges.end(),
+            [](const Edge &a, const Edge &b) { return a.x0 < b.x0; });
+  for (std::size_t i = 0; i < edges.size(); ++i) {
+    const Edge &a = edges[i];
+    for (std::size_t j = i + 1; j < edges.size() && edges[j].x0 < a.x1; ++j) {
+      const Edge &b = edges[j];
+      double const left = std::max(a.x0, b.x0);
+      double const right = std::min(a.x1, b.x1);
+      if (left >= right) {
+        continue;
+      }
+      double const left_difference = a.y_at(left) - b.y_at(left);
+      double const right_difference = a.y_at(right) - b.y_at(right);
+      if ((left_difference < 0. && right_difference > 0.) ||
+          (left_difference > 0. && right_difference < 0.)) {
+        boundaries.push_back(left + (right - left) * left_difference /
+                                        (left_difference - right_difference));
+      }
+    }
+  }
+  std::sort(boundaries.begin(), boundaries.end());
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+
+  struct Crossing {
+    double y_left, y_middle, y_right;
+    int owner;
+  };
+  std::vector<Crossing> crossings;
+  std::vector<bool> inside_cover(covers.size());
+  double area{0.};
+  std::size_t first_edge{0};
+  for (std::size_t slab = 0; slab + 1 < boundaries.size(); ++slab) {
+    double const left = boundaries[slab];
+    double const right = boundaries[slab + 1];
+    double const middle = 0.5 * (left + right);
+
+    // Edges are sorted by their left end, so skip those that end before this slab
+    while (first_edge < edges.size() && edges[first_edge].x1 <= left) {
+      ++first_edge;
+    }
+    crossings.clear();
+    for (std::size_t i = first_edge; i < edges.size() && edges[i].x0 < right; ++i) {
+      const Edge &edge = edges[i];
+      if (edge.x0 <= left && edge.x1 >= right) {
+        crossings.push_back(
+            {edge.y_at(left), edge.y_at(middle), edge.y_at(right), edge.owner});
+      }
+    }
+    std::sort(crossings.begin(), crossings.end(),
+              [](const Crossing &a, const Crossing &b) { return a.y_middle < b.y_middle; });
+
+    // Walk up through the slab, tracking the odd winding rule of each region
+    bool inside_subject{false};
+    std::fill(inside_cover.begin(), inside_cover.end(), false);
+    int covered_count{0};
+    for (std::size_t i = 0; i + 1 < crossings.size(); ++i) {
+      auto const owner = crossings[i].owner;
+      if (owner < 0) {
+        inside_subject = !inside_subject;
+      } else {
+        inside_cover[owner] = !inside_cover[owner];
+        covered_count += inside_cover[owner] ? 1 : -1;
+      }
+      if (inside_subject && covered_count == 0) {
+        area += 0.5 * (right - left) *
+                ((crossings[i + 1].y_left - crossings[i].y_left) +
+                 (crossings[i + 1].y_right - crossings[i].y_right));
+      }
+    }
+  }
+  return area;
+}
+
+} // namespace Penumbra
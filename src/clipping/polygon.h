@@ -0,0 +1,61 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef POLYGON_H_
+#define POLYGON_H_
+
+// Standard
+#include <vector>
+
+namespace Penumbra {
+
+struct Point {
+  double x, y, z;
+};
+
+// Closed loop of points. Regions are sets of contours combined by the odd winding rule (as used to
+// tessellate surfaces), so holes are simply additional contours.
+using Contour = std::vector<Point>;
+using Region = std::vector<Contour>;
+
+// Keeps the part of a contour where distance(point) >= 0 for a linear distance function
+// (Sutherland-Hodgman). Clipping every contour of a region this way clips the region itself.
+template <typename Distance> Contour clip_contour(const Contour &contour, Distance distance) {
+  Contour clipped;
+  clipped.reserve(contour.size() + 2);
+  for (std::size_t i = 0; i < contour.size(); ++i) {
+    const Point &current = contour[i];
+    const Point &next = contour[(i + 1) % contour.size()];
+    double const current_distance = distance(current);
+    double const next_distance = distance(next);
+    if (current_distance >= 0.) {
+      clipped.push_back(current);
+    }
+    if ((current_distance >= 0.) != (next_distance >= 0.)) {
+      double const t = current_distance / (current_distance - next_distance);
+      clipped.push_back({current.x + t * (next.x - current.x), current.y + t * (next.y - current.y),
+                         current.z + t * (next.z - current.z)});
+    }
+  }
+  if (clipped.size() < 3) {
+    clipped.clear();
+  }
+  return clipped;
+}
+
+struct Rectangle {
+  double min_x, min_y, max_x, max_y;
+};
+
+[[nodiscard]] Rectangle bounding_rectangle(const Region &region);
+[[nodiscard]] bool overlaps(const Rectangle &a, const Rectangle &b);
+[[nodiscard]] Region clip_region(const Region &region, const Rectangle &rectangle);
+
+// Area, in the x-y plane, of the part of the subject that is outside every cover. Computed exactly
+// (to rounding) by splitting the plane into vertical slabs at every vertex and edge intersection,
+// within which all edges are straight, non-crossing segments bounding trapezoids.
+[[nodiscard]] double uncovered_area(const Region &subject, const std::vector<Region> &covers);
+
+} // namespace Penumbra
+
+#endif // POLYGON_H_
@@ -0,0 +1,1142 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+
+// Vendor
+#include <fmt/format.h>
+
+// Penumbra
+#include <penumbra/logging.h>
+#include "context.h"
+
+namespace Penumbra {
+
+SurfaceBuffer::SurfaceBuffer(unsigned int begin, unsigned int count, int index)
+    : begin(begin), count(count), index(index) {}
+
+CompletedQueue::CompletedQueue(Courierr::Courierr *logger) : logger(logger) {}
+
+unsigned int CompletedQueue::push(std::vector<float> &&pssas) {
+  if (queued_pssas.size() >= max_size) {
+    throw PenumbraException(
+        fmt::format("Unable to queue more than {} PSSA calculations. Retrieve a queued "
+                    "calculation before queuing another.",
+                    max_size),
+        *logger);
+  }
+  auto const ticket = next_ticket;
+  queued_pssas[ticket] = std::move(pssas);
+  // Skip zero, which is never a valid ticket
+  next_ticket = next_ticket == std::numeric_limits<unsigned int>::max() ? 1u : next_ticket + 1u;
+  return ticket;
+}
+
+void CompletedQueue::check_ticket(const unsigned int ticket) const {
+  if (queued_pssas.count(ticket) == 0) {
+    throw PenumbraException(
+        fmt::format("PSSA ticket, {}, does not refer to a queued calculation.", ticket), *logger);
+  }
+}
+
+std::vector<float> CompletedQueue::pop(const unsigned int ticket) {
+  check_ticket(ticket);
+  auto pssas = std::move(queued_pssas[ticket]);
+  queued_pssas.erase(ticket);
+  return pssas;
+}
+
+void CompletedQueue::clear() {
+  queued_pssas.clear();
+}
+
+unsigned int CompletedQueue::size() const {
+  return static_cast<unsigned int>(queued_pssas.size());
+}
+
+Context::Context(int size, Courierr::Courierr *logger) : size(size), logger(logger) {}
+
+void Context::set_surfaces(const std::vector<SurfaceImplementation> &surfaces) {
+  surface_boundaries.resize(surfaces.size());
+  surface_normals.resize(surfaces.size());
+  for (std::size_t i = 0; i < surfaces.size(); ++i) {
+    set_surface(static_cast<unsigned int>(i), surfaces[i]);
+  }
+}
+
+void Context::update_surfaces(const std::vector<SurfaceImplementation> &surfaces,
+                              const std::vector<unsigned int> &changed_surfaces) {
+  if (surface_boundaries.size() != surfaces.size() || surface_normals.size() != surfaces.size()) {
+    set_surfaces(surfaces);
+    return;
+  }
+  for (auto const surface_index : changed_surfaces) {
+    set_surface(surface_index, surfaces[surface_index]);
+  }
+}
+
+void Context::set_surface(const unsigned int surface_index, const SurfaceImplementation &surface) {
+  auto &boundaries = surface_boundaries[surface_index];
+  boundaries = {surface.transform_contour(surface.polygon)};
+  for (auto const &hole : surface.holes) {
+    boundaries.push_back(surface.transform_contour(hole));
+  }
+
+  // Newell's method, which follows the polygon's winding
+  auto const &polygon = boundaries[0];
+  auto &normal = surface_normals[surface_index];
+  normal = {0.f, 0.f, 0.f};
+  for (std::size_t j = 0; j + 2 < polygon.size(); j += vertex_size) {
+    auto const k = j + vertex_size + 2 < polygon.size() ? j + vertex_size : 0u;
+    normal[0] += (polygon[j + 1] - polygon[k + 1]) * (polygon[j + 2] + polygon[k + 2]);
+    normal[1] += (polygon[j + 2] - polygon[k + 2]) * (polygon[j] + polygon[k]);
+    normal[2] += (polygon[j] - polygon[k]) * (polygon[j + 1] + polygon[k + 1]);
+  }
+  float const length = vec3_len(normal.data());
+  if (length > 0.f) {
+    vec3_scale(normal.data(), normal.data(), 1.f / length);
+  }
+}
+
+void Context::show_rendering(unsigned int, mat4x4) {
+  throw PenumbraException("Rendering scenes is only available with the OpenGL backend.", *logger);
+}
+
+void Context::show_interior_rendering(const std::vector<unsigned int> &, unsigned int, mat4x4) {
+  throw PenumbraException("Rendering scenes is only available with the OpenGL backend.", *logger);
+}
+
+void Context::clear_model() {
+  vertices.clear();
+  indices.clear();
+  surface_buffers.clear();
+  spatial_index.clear();
+  potential_shaders.clear();
+  shading_plane_offsets.clear();
+  coplanar_groups.clear();
+  surface_groups.clear();
+  surface_areas.clear();
+  pssa_errors.clear();
+  receiver_views.clear();
+  receiver_view_generations.clear();
+  model_is_set = false;
+}
+
+void Context::set_model(const std::vector<float> &vertices_in,
+                        const std::vector<unsigned int> &indices_in,
+                        const std::vector<SurfaceBuffer> &surface_buffers_in) {
+  vertices = vertices_in;
+  indices = indices_in;
+  surface_buffers = surface_buffers_in;
+
+  float minimum[3] = {MAX_FLOAT, MAX_FLOAT, MAX_FLOAT};
+  float maximum[3] = {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT};
+  for (std::size_t i = 0; i < vertices.size(); i += vertex_size) {
+    for (std::size_t axis = 0; axis < vertex_size; ++axis) {
+      minimum[axis] = std::min(vertices[i + axis], minimum[axis]);
+      maximum[axis] = std::max(vertices[i + axis], maximum[axis]);
+    }
+  }
+  set_model_bounding_box(minimum, maximum);
+
+  spatial_index.build(vertices, indices, surface_buffers);
+  set_potential_shaders();
+  set_coplanar_groups();
+
+  surface_areas.assign(surface_buffers.size(), 0.f);
+  boundaries_from_triangles = surface_boundaries.size() != surface_buffers.size();
+  if (boundaries_from_triangles) {
+    // Surface polygons were not given. Each triangle's edges overestimate the boundary.
+    surface_boundaries.assign(surface_buffers.size(), {});
+  }
+  for (unsigned int i = 0; i < surface_buffers.size(); ++i) {
+    set_surface_area(i);
+  }
+  pssa_errors.assign(surface_buffers.size(), 0.f);
+  receiver_views.resize(surface_buffers.size());
+  receiver_view_generations.assign(surface_buffers.size(), 0u);
+  clear_receiver_views();
+
+  model_is_set = true;
+}
+
+void Context::set_model_bounding_box(const float (&minimum)[3], const float (&maximum)[3]) {
+  // Corners in binary order of x, y, and z, from the minimum (0) to the maximum (7)
+  for (std::size_t corner = 0; corner < 8; ++corner) {
+    for (std::size_t axis = 0; axis < vertex_size; ++axis) {
+      model_bounding_box[corner][axis] = (corner >> (2u - axis)) & 1u ? maximum[axis]
+                                                                       : minimum[axis];
+    }
+    model_bounding_box[corner][3] = 0.f;
+  }
+}
+
+void Context::set_surface_area(const unsigned int surface_index) {
+  auto const &surface_buffer = surface_buffers[surface_index];
+  surface_areas[surface_index] = 0.f;
+  if (boundaries_from_triangles) {
+    surface_boundaries[surface_index].clear();
+  }
+  for (unsigned int vertex = surface_buffer.begin;
+       vertex + 2u < surface_buffer.begin + surface_buffer.count; vertex += 3u) {
+    const float *corners[3] = {get_vertex(vertex), get_vertex(vertex + 1u),
+                               get_vertex(vertex + 2u)};
+    vec3 edges[2], cross;
+    vec3_sub(edges[0], corners[1], corners[0]);
+    vec3_sub(edges[1], corners[2], corners[0]);
+    vec3_mul_cross(cross, edges[0], edges[1]);
+    surface_areas[surface_index] += 0.5f * vec3_len(cross);
+    if (boundaries_from_triangles) {
+      Polygon &triangle = surface_boundaries[surface_index].emplace_back();
+      for (auto const corner : corners) {
+        triangle.insert(triangle.end(), corner, corner + vertex_size);
+      }
+    }
+  }
+}
+
+void Context::update_model(const std::vector<float> &vertices_in,
+                           const std::vector<unsigned int> &indices_in,
+                           const std::vector<SurfaceBuffer> &surface_buffers_in,
+                           const std::vector<unsigned int> &changed_surfaces,
+                           const std::vector<std::pair<unsigned int, unsigned int>>
+                               &rewritten_vertices) {
+  if (!model_is_set || surface_buffers_in.size() != surface_buffers.size()) {
+    set_model(vertices_in, indices_in, surface_buffers_in);
+    return;
+  }
+
+  // Appended and rewritten vertices
+  auto const kept_coordinates = std::min(vertices.size(), vertices_in.size());
+  vertices.resize(vertices_in.size());
+  std::copy(vertices_in.begin() + static_cast<std::ptrdiff_t>(kept_coordinates), vertices_in.end(),
+            vertices.begin() + static_cast<std::ptrdiff_t>(kept_coordinates));
+  for (auto const &[first, count] : rewritten_vertices) {
+    auto const begin = vertices_in.begin() + static_cast<std::ptrdiff_t>(first * vertex_size);
+    std::copy(begin, begin + static_cast<std::ptrdiff_t>(count * vertex_size),
+              vertices.begin() + static_cast<std::ptrdiff_t>(first * vertex_size));
+  }
+
+  // Appended indices, and the changed surfaces' ranges before and after
+  auto const kept_indices = std::min(indices.size(), indices_in.size());
+  indices.resize(indices_in.size());
+  std::copy(indices_in.begin() + static_cast<std::ptrdiff_t>(kept_indices), indices_in.end(),
+            indices.begin() + static_cast<std::ptrdiff_t>(kept_indices));
+  auto const copy_indices = [&](const SurfaceBuffer &surface_buffer) {
+    auto const begin = indices_in.begin() + static_cast<std::ptrdiff_t>(surface_buffer.begin);
+    std::copy(begin, begin + static_cast<std::ptrdiff_t>(surface_buffer.count),
+              indices.begin() + static_cast<std::ptrdiff_t>(surface_buffer.begin));
+  };
+  for (auto const surface_index : changed_surfaces) {
+    copy_indices(surface_buffers[surface_index]);
+    surface_buffers[surface_index] = surface_buffers_in[surface_index];
+    copy_indices(surface_buffers[surface_index]);
+  }
+
+  // The bounding box only grows, so it remains conservative (for the near planes of projections)
+  float minimum[3], maximum[3];
+  std::copy(model_bounding_box[0], model_bounding_box[0] + 3, minimum);
+  std::copy(model_bounding_box[7], model_bounding_box[7] + 3, maximum);
+  for (auto const surface_index : changed_surfaces) {
+    auto const &surface_buffer = surface_buffers[surface_index];
+    for (auto vertex = surface_buffer.begin; vertex < surface_buffer.begin + surface_buffer.count;
+         ++vertex) {
+      const float *coordinates = get_vertex(vertex);
+      for (std::size_t axis = 0; axis < vertex_size; ++axis) {
+        minimum[axis] = std::min(coordinates[axis], minimum[axis]);
+        maximum[axis] = std::max(coordinates[axis], maximum[axis]);
+      }
+    }
+  }
+  set_model_bounding_box(minimum, maximum);
+
+  spatial_index.update(vertices, indices, surface_buffers, changed_surfaces);
+  update_potential_shaders(changed_surfaces);
+  leave_coplanar_groups(changed_surfaces);
+  for (auto const surface_index : changed_surfaces) {
+    set_surface_area(surface_index);
+    pssa_errors[surface_index] = 0.f;
+  }
+  clear_receiver_views(); // Moved surfaces may enter or leave any receiver's view
+}
+
+template <typename ForEachVertex>
+Context::SunProjection Context::fit_projection(mat4x4 sun_view, ForEachVertex for_each_vertex,
+                                               bool clip_far) const {
+
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot set scene.", *logger);
+  }
+
+  SunProjection sun_projection{};
+  float &left = sun_projection.left, &right = sun_projection.right;
+  float &bottom = sun_projection.bottom, &top = sun_projection.top;
+  float &near_ = sun_projection.near_, &far_ = sun_projection.far_;
+
+  // calculate clipping planes in rendered coordinates
+  left = MAX_FLOAT;
+  right = -MAX_FLOAT;
+  bottom = MAX_FLOAT;
+  top = -MAX_FLOAT;
+  near_ = -MAX_FLOAT;
+  far_ = MAX_FLOAT;
+
+  for_each_vertex([&](const float *vertex) {
+    vec4 translation;
+    vec4 point = {vertex[0], vertex[1], vertex[2], 0};
+    mat4x4_mul_vec4(translation, sun_view, point);
+    left = std::min(translation[0], left);
+    right = std::max(translation[0], right);
+    bottom = std::min(translation[1], bottom);
+    top = std::max(translation[1], top);
+    // near_ = min(translation[2], near_);
+    far_ = std::min(translation[2], far_);
+  });
+
+  // Use model box to determine near clipping plane (and far if looking interior)
+  for (auto const coordinate : model_bounding_box) {
+    vec4 translation;
+    mat4x4_mul_vec4(translation, sun_view, coordinate);
+    near_ = std::max(translation[2], near_);
+    if (!clip_far) {
+      far_ = std::min(translation[2], far_);
+    }
+  }
+
+  // account for camera position
+  near_ -= 0.999f; // For some reason, -1. is too tight when sun is perpendicular to the surface.
+  far_ -= 1.001f;  // For some reason, -1. is too tight when sun is perpendicular to the surface.
+
+  // Grow horizontal extents of view by one pixel on each side
+
+  const float inverse_size = 1.f / static_cast<float>(size);
+
+  const float delta_x = (right - left) * inverse_size;
+  left -= delta_x;
+  right += delta_x;
+
+  // Grow vertical extents of view by one pixel on each side
+  const float delta_y = (top - bottom) * inverse_size;
+  bottom -= delta_y;
+  top += delta_y;
+
+  // calculate pixel area (A[i]*cos(theta) for each pixel of the surface)
+  // multiplies by the number of pixels to get projected sunlit surface area
+
+  sun_projection.pixel_area = (right - left) * (top - bottom) * inverse_size * inverse_size;
+
+  if (sun_projection.pixel_area > 0.0) {
+    mat4x4 projection;
+    mat4x4_ortho(projection, left, right, bottom, top, -near_, -far_);
+    mat4x4_mul(sun_projection.mvp, projection, sun_view);
+  }
+
+  return sun_projection;
+}
+
+Context::SunProjection Context::calculate_projection(mat4x4 sun_view,
+                                                     const SurfaceBuffer *surface_buffer,
+                                                     bool clip_far) const {
+  // If surface buffer has not been set use entire model instead.
+  if (!surface_buffer) {
+    return fit_projection(
+        sun_view,
+        [&](auto const &visit) {
+          for (std::size_t i = 0; i < vertices.size(); i += vertex_size) {
+            visit(&vertices[i]);
+          }
+        },
+        clip_far);
+  }
+  return fit_projection(
+      sun_view,
+      [&](auto const &visit) {
+        for (unsigned int i = 0; i < surface_buffer->count; ++i) {
+          visit(get_vertex(surface_buffer->begin + i));
+        }
+      },
+      clip_far);
+}
+
+Context::SunProjection
+Context::calculate_projection(mat4x4 sun_view,
+                              const std::vector<unsigned int> &surface_indices) const {
+  return fit_projection(
+      sun_view,
+      [&](auto const &visit) {
+        for (auto const surface_index : surface_indices) {
+          auto const &surface_buffer = surface_buffers[surface_index];
+          for (unsigned int i = 0; i < surface_buffer.count; ++i) {
+            visit(get_vertex(surface_buffer.begin + i));
+          }
+        }
+      },
+      true);
+}
+
+float Context::set_projection(mat4x4 sun_view, const SurfaceBuffer *surface_buffer,
+                              bool clip_far) {
+  auto const *receiver_view =
+      surface_buffer && clip_far
+          ? get_receiver_view(static_cast<unsigned int>(surface_buffer->index), sun_view)
+          : nullptr;
+  if (receiver_view) {
+    set_projection(sun_view, receiver_view->projection);
+    return receiver_view->projection.pixel_area;
+  }
+  auto sun_projection = calculate_projection(sun_view, surface_buffer, clip_far);
+  set_projection(sun_view, sun_projection);
+  return sun_projection.pixel_area;
+}
+
+void Context::set_projection(mat4x4 sun_view, const SunProjection &sun_projection) {
+  mat4x4_dup(view, sun_view);
+  left = sun_projection.left;
+  right = sun_projection.right;
+  bottom = sun_projection.bottom;
+  top = sun_projection.top;
+  near_ = sun_projection.near_;
+  far_ = sun_projection.far_;
+
+  if (sun_projection.pixel_area > 0.0) {
+    std::copy(&sun_projection.mvp[0][0], &sun_projection.mvp[0][0] + 16, &mvp[0][0]);
+  }
+}
+
+Context::SunProjection Context::get_projection() const {
+  SunProjection projection{};
+  std::copy(&mvp[0][0], &mvp[0][0] + 16, &projection.mvp[0][0]);
+  projection.left = left;
+  projection.right = right;
+  projection.bottom = bottom;
+  projection.top = top;
+  projection.near_ = near_;
+  projection.far_ = far_;
+  projection.pixel_area = get_pixel_area(projection, size);
+  return projection;
+}
+
+float Context::get_pixel_area(const SunProjection &projection, const int resolution) {
+  float const inverse_resolution = 1.f / static_cast<float>(resolution);
+  return (projection.right - projection.left) * (projection.top - projection.bottom) *
+         inverse_resolution * inverse_resolution;
+}
+
+float Context::estimate_pssa_error(const unsigned int surface_index, const mat4x4 sun_view,
+                                   const SunProjection &projection, const int resolution,
+                                   const unsigned int samples) const {
+  // Each projected edge passes through about |dx| / pixel width + |dy| / pixel height pixels
+  float const pixel_width = (projection.right - projection.left) / static_cast<float>(resolution);
+  float const pixel_height = (projection.top - projection.bottom) / static_cast<float>(resolution);
+  if (pixel_width <= 0.f || pixel_height <= 0.f) {
+    return 0.f;
+  }
+  float edge_pixels{0.f};
+  for (auto const &boundary : surface_boundaries[surface_index]) {
+    auto const vertex_count = boundary.size() / vertex_size;
+    for (std::size_t i = 0; i < vertex_count; ++i) {
+      const float *a = &boundary[i * vertex_size];
+      const float *b = &boundary[((i + 1) % vertex_count) * vertex_size];
+      float const dx = sun_view[0][0] * (b[0] - a[0]) + sun_view[1][0] * (b[1] - a[1]) +
+                       sun_view[2][0] * (b[2] - a[2]);
+      float const dy = sun_view[0][1] * (b[0] - a[0]) + sun_view[1][1] * (b[1] - a[1]) +
+                       sun_view[2][1] * (b[2] - a[2]);
+      edge_pixels += std::abs(dx) / pixel_width + std::abs(dy) / pixel_height;
+    }
+  }
+  return edge_pixels * pixel_width * pixel_height / std::sqrt(static_cast<float>(samples));
+}
+
+int Context::choose_resolution(const unsigned int surface_index, const mat4x4 sun_view,
+                               const SunProjection &projection) const {
+  if (target_accuracy <= 0.f || size <= minimum_resolution) {
+    return size;
+  }
+  // The estimated error is inversely proportional to the resolution
+  float const cosine =
+      std::abs(surface_normals[surface_index][0] * sun_view[0][2] +
+               surface_normals[surface_index][1] * sun_view[1][2] +
+               surface_normals[surface_index][2] * sun_view[2][2]);
+  float const projected_area = surface_areas[surface_index] * cosine;
+  if (projected_area <= 0.f) {
+    return size;
+  }
+  float const error =
+      estimate_pssa_error(surface_index, sun_view, projection, size, samples_per_pixel);
+  float const resolution =
+      std::ceil(static_cast<float>(size) * error / (target_accuracy * projected_area));
+  return static_cast<int>(
+      std::clamp(resolution, static_cast<float>(minimum_resolution), static_cast<float>(size)));
+}
+
+float Context::get_shading_plane_tolerance() const {
+  vec3 diagonal;
+  vec3_sub(diagonal, model_bounding_box[7], model_bounding_box[0]);
+  return 1e-5f * vec3_len(diagonal);
+}
+
+void Context::set_potential_shaders() {
+  auto const surface_count = surface_buffers.size();
+  if (surface_normals.size() != surface_count) {
+    // Surface polygons were not given. Without their orientation, any surface may shade another.
+    surface_normals.assign(surface_count, {0.f, 0.f, 0.f});
+  }
+  potential_shaders.assign(surface_count, {});
+  shading_plane_offsets.assign(surface_count, -MAX_FLOAT);
+  float const tolerance = get_shading_plane_tolerance();
+  std::vector<unsigned int> candidates;
+  for (unsigned int receiver = 0; receiver < surface_count; ++receiver) {
+    set_potential_shaders(receiver, tolerance, candidates);
+  }
+}
+
+void Context::set_potential_shaders(const unsigned int receiver_index, const float tolerance,
+                                    std::vector<unsigned int> &candidates) {
+  auto &shaders = potential_shaders[receiver_index];
+  shaders.clear();
+  shading_plane_offsets[receiver_index] = -MAX_FLOAT;
+  auto const &normal = surface_normals[receiver_index];
+  if (normal == std::array<float, 3>{0.f, 0.f, 0.f}) {
+    return;
+  }
+
+  auto const &receiver_buffer = surface_buffers[receiver_index];
+  auto const last = receiver_buffer.begin + receiver_buffer.count;
+  float offset{MAX_FLOAT}; // Lowest receiver vertex along the normal
+  for (auto vertex = receiver_buffer.begin; vertex != last; ++vertex) {
+    offset = std::min(vec3_mul_inner(normal.data(), get_vertex(vertex)), offset);
+  }
+  offset += tolerance;
+  shading_plane_offsets[receiver_index] = offset;
+
+  spatial_index.find_surfaces_in_front(normal, offset, candidates);
+  for (auto const candidate : candidates) {
+    if (candidate != receiver_index && extends_beyond(candidate, normal, offset)) {
+      shaders.push_back(candidate);
+    }
+  }
+  std::sort(shaders.begin(), shaders.end());
+}
+
+bool Context::extends_beyond(const unsigned int surface_index, const std::array<float, 3> &normal,
+                             const float offset) const {
+  auto const &surface_buffer = surface_buffers[surface_index];
+  auto const last = surface_buffer.begin + surface_buffer.count;
+  for (auto vertex = surface_buffer.begin; vertex != last; ++vertex) {
+    if (vec3_mul_inner(normal.data(), get_vertex(vertex)) > offset) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Context::update_potential_shaders(const std::vector<unsigned int> &changed_surfaces) {
+  float const tolerance = get_shading_plane_tolerance();
+  std::vector<unsigned int> candidates;
+  for (auto const receiver_index : changed_surfaces) {
+    set_potential_shaders(receiver_index, tolerance, candidates);
+  }
+
+  // Other receivers keep their planes: only the changed surfaces' places in their lists change
+  std::vector<unsigned int> sorted_changes(changed_surfaces);
+  std::sort(sorted_changes.begin(), sorted_changes.end());
+  for (unsigned int receiver_index = 0; receiver_index < potential_shaders.size();
+       ++receiver_index) {
+    auto const &normal = surface_normals[receiver_index];
+    if (normal == std::array<float, 3>{0.f, 0.f, 0.f} ||
+        std::binary_search(sorted_changes.begin(), sorted_changes.end(), receiver_index)) {
+      continue;
+    }
+    auto &shaders = potential_shaders[receiver_index];
+    float const offset = shading_plane_offsets[receiver_index];
+    for (auto const surface_index : sorted_changes) {
+      auto const position = std::lower_bound(shaders.begin(), shaders.end(), surface_index);
+      bool const was_shader = position != shaders.end() && *position == surface_index;
+      bool const is_shader = extends_beyond(surface_index, normal, offset);
+      if (was_shader && !is_shader) {
+        shaders.erase(position);
+      } else if (is_shader && !was_shader) {
+        shaders.insert(position, surface_index);
+      }
+    }
+  }
+}
+
+namespace {
+// Normal and offset of a plane, quantized (see Context::set_coplanar_groups)
+using PlaneCell = std::array<std::int64_t, 4>;
+struct PlaneCellHash {
+  std::size_t operator()(const PlaneCell &cell) const {
+    std::size_t hash{0u};
+    for (auto const coordinate : cell) {
+      hash = hash * 31u + std::hash<std::int64_t>{}(coordinate);
+    }
+    return hash;
+  }
+};
+} // namespace
+
+void Context::set_coplanar_groups() {
+  // Planes within a tolerance relative to the size of the model, so receivers set slightly back
+  // from their neighbors (e.g., windows recessed in a wall) share a plane
+  vec3 diagonal;
+  vec3_sub(diagonal, model_bounding_box[7], model_bounding_box[0]);
+  float const plane_tolerance = 1e-3f * vec3_len(diagonal);
+
+  // Receivers by plane: each plane is given by its first receiver's normal and offset, and a
+  // receiver joins the first plane within the tolerances. Planes are found by cells of normals and
+  // offsets wider than the tolerances (normals differ by at most the chord between them), so a
+  // receiver's plane is in its own cell or a neighboring one.
+  float const normal_cell_size = 1.1f * std::sqrt(2.f - 2.f * coplanar_normal_cosine);
+  float const offset_cell_size = plane_tolerance > 0.f ? 1.1f * plane_tolerance : 1.f;
+  auto const surface_count = surface_buffers.size();
+  std::vector<std::vector<unsigned int>> planes;
+  std::unordered_map<PlaneCell, std::vector<std::size_t>, PlaneCellHash> plane_cells;
+  for (unsigned int surface_index = 0; surface_index < surface_count; ++surface_index) {
+    auto const &normal = surface_normals[surface_index];
+    if (surface_buffers[surface_index].count == 0u ||
+        normal == std::array<float, 3>{0.f, 0.f, 0.f}) {
+      continue;
+    }
+    PlaneCell cell{};
+    for (std::size_t axis = 0; axis < 3; ++axis) {
+      cell[axis] = static_cast<std::int64_t>(std::floor(normal[axis] / normal_cell_size));
+    }
+    cell[3] = static_cast<std::int64_t>(
+        std::floor(shading_plane_offsets[surface_index] / offset_cell_size));
+
+    auto plane = planes.size();
+    for (int neighbor = 0; neighbor < 81; ++neighbor) { // 3 x 3 x 3 x 3 cells
+      auto neighbor_cell = cell;
+      int step = neighbor;
+      for (std::size_t dimension = 0; dimension < 4; ++dimension, step /= 3) {
+        neighbor_cell[dimension] += step % 3 - 1;
+      }
+      auto const found = plane_cells.find(neighbor_cell);
+      if (found == plane_cells.end()) {
+        continue;
+      }
+      for (auto const candidate : found->second) {
+        auto const first = planes[candidate].front();
+        if (candidate < plane &&
+            vec3_mul_inner(normal.data(), surface_normals[first].data()) >
+                coplanar_normal_cosine &&
+            std::abs(shading_plane_offsets[surface_index] - shading_plane_offsets[first]) <=
+                plane_tolerance) {
+          plane = candidate;
+        }
+      }
+    }
+    if (plane == planes.size()) {
+      plane_cells[cell].push_back(planes.size());
+      planes.push_back({surface_index});
+    } else {
+      planes[plane].push_back(surface_index);
+    }
+  }
+
+  // Within a plane, receivers whose bounding boxes are no farther apart than the larger of the
+  // two spans (so a facade's rows of windows join, but distant wings of a building do not)
+  std::vector<std::array<float, 6>> boxes(surface_count); // Minimum, then maximum corner
+  std::vector<unsigned int> roots(surface_count);
+  std::iota(roots.begin(), roots.end(), 0u);
+  auto const find_root = [&](unsigned int surface_index) {
+    while (roots[surface_index] != surface_index) {
+      surface_index = roots[surface_index] = roots[roots[surface_index]];
+    }
+    return surface_index;
+  };
+  for (auto const &receivers : planes) {
+    for (auto const surface_index : receivers) {
+      auto &box = boxes[surface_index];
+      box = {MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT};
+      auto const &surface_buffer = surface_buffers[surface_index];
+      auto const last = surface_buffer.begin + surface_buffer.count;
+      for (auto vertex = surface_buffer.begin; vertex != last; ++vertex) {
+        const float *coordinates = get_vertex(vertex);
+        for (int axis = 0; axis < vertex_size; ++axis) {
+          box[axis] = std::min(coordinates[axis], box[axis]);
+          box[vertex_size + axis] = std::max(coordinates[axis], box[vertex_size + axis]);
+        }
+      }
+    }
+    for (std::size_t i = 0; i < receivers.size(); ++i) {
+      auto const &box = boxes[receivers[i]];
+      for (std::size_t j = i + 1u; j < receivers.size(); ++j) {
+        auto const &other = boxes[receivers[j]];
+        float gap{0.f}, span{0.f};
+        for (int axis = 0; axis < vertex_size; ++axis) {
+          gap = std::max({other[axis] - box[vertex_size + axis],
+                          box[axis] - other[vertex_size + axis], gap});
+          span = std::max({box[vertex_size + axis] - box[axis],
+                           other[vertex_size + axis] - other[axis], span});
+        }
+        if (gap <= span) {
+          roots[find_root(receivers[j])] = find_root(receivers[i]);
+        }
+      }
+    }
+  }
+
+  coplanar_groups.clear();
+  surface_groups.assign(surface_count, -1);
+  std::vector<int> root_groups(surface_count, -1);
+  for (auto const &receivers : planes) {
+    for (auto const surface_index : receivers) {
+      auto &group = root_groups[find_root(surface_index)];
+      if (group < 0) {
+        group = static_cast<int>(coplanar_groups.size());
+        coplanar_groups.emplace_back();
+      }
+      coplanar_groups[static_cast<std::size_t>(group)].push_back(surface_index);
+    }
+  }
+
+  // Only groups of two or more are kept
+  std::size_t kept{0u};
+  for (std::size_t i = 0; i < coplanar_groups.size(); ++i) {
+    if (coplanar_groups[i].size() < 2u) {
+      continue;
+    }
+    for (auto const surface_index : coplanar_groups[i]) {
+      surface_groups[surface_index] = static_cast<int>(kept);
+    }
+    if (kept != i) {
+      coplanar_groups[kept] = std::move(coplanar_groups[i]);
+    }
+    ++kept;
+  }
+  coplanar_groups.resize(kept);
+}
+
+void Context::leave_coplanar_groups(const std::vector<unsigned int> &surface_indices) {
+  bool is_group_dissolved{false};
+  for (auto const surface_index : surface_indices) {
+    auto const group_index = surface_groups[surface_index];
+    if (group_index < 0) {
+      continue;
+    }
+    auto &group = coplanar_groups[static_cast<std::size_t>(group_index)];
+    group.erase(std::find(group.begin(), group.end(), surface_index));
+    surface_groups[surface_index] = -1;
+    if (group.size() == 1u) {
+      surface_groups[group.front()] = -1;
+      group.clear();
+      is_group_dissolved = true;
+    }
+  }
+  if (!is_group_dissolved) {
+    return;
+  }
+
+  // Only groups of two or more are kept
+  std::size_t kept{0u};
+  for (std::size_t i = 0; i < coplanar_groups.size(); ++i) {
+    if (coplanar_groups[i].empty()) {
+      continue;
+    }
+    for (auto const surface_index : coplanar_groups[i]) {
+      surface_groups[surface_index] = static_cast<int>(kept);
+    }
+    if (kept != i) {
+      coplanar_groups[kept] = std::move(coplanar_groups[i]);
+    }
+    ++kept;
+  }
+  coplanar_groups.resize(kept);
+}
+
+std::vector<unsigned int> Context::get_potential_shaders(const unsigned int surface_index) const {
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot find potential shaders.", *logger);
+  }
+  if (surface_index >= potential_shaders.size()) {
+    throw PenumbraException(
+        fmt::format("Surface index, {}, is not in the model set. Cannot find potential shaders.",
+                    surface_index),
+        *logger);
+  }
+  if (surface_normals[surface_index] != std::array<float, 3>{0.f, 0.f, 0.f}) {
+    return potential_shaders[surface_index];
+  }
+  std::vector<unsigned int> shaders;
+  for (unsigned int i = 0; i < potential_shaders.size(); ++i) {
+    if (i != surface_index) {
+      shaders.push_back(i);
+    }
+  }
+  return shaders;
+}
+
+std::vector<std::vector<unsigned int>> Context::get_potential_shaders() const {
+  std::vector<std::vector<unsigned int>> shaders;
+  shaders.reserve(potential_shaders.size());
+  for (unsigned int surface_index = 0; surface_index < potential_shaders.size(); ++surface_index) {
+    shaders.push_back(get_potential_shaders(surface_index));
+  }
+  return shaders;
+}
+
+bool Context::is_potential_shader(const unsigned int receiver_index,
+                                  const unsigned int surface_index) const {
+  if (surface_normals[receiver_index] == std::array<float, 3>{0.f, 0.f, 0.f}) {
+    return surface_index != receiver_index;
+  }
+  auto const &shaders = potential_shaders[receiver_index];
+  return std::binary_search(shaders.begin(), shaders.end(), surface_index);
+}
+
+bool Context::is_sun_in_front(const unsigned int surface_index, const mat4x4 sun_view) const {
+  // The view's z axis points toward the sun
+  auto const &normal = surface_normals[surface_index];
+  return normal[0] * sun_view[0][2] + normal[1] * sun_view[1][2] + normal[2] * sun_view[2][2] >
+         0.f;
+}
+
+void Context::find_surfaces_in_view(const mat4x4 sun_view, const SunProjection &projection,
+                                    const SurfaceBuffer *receiver,
+                                    std::vector<unsigned int> &surface_indices) const {
+  // Extents are in view coordinates without the camera translation (see calculate_projection).
+  // Nothing lies nearer the sun than the near plane, so only the far plane limits depth.
+  float const bounds[2][3] = {{projection.left, projection.bottom, projection.far_ + 1.f},
+                              {projection.right, projection.top, MAX_FLOAT}};
+  spatial_index.find_surfaces(sun_view, bounds, surface_indices);
+
+  if (receiver) {
+    auto const receiver_index = static_cast<unsigned int>(receiver->index);
+    if (is_sun_in_front(receiver_index, sun_view)) {
+      surface_indices.erase(std::remove_if(surface_indices.begin(), surface_indices.end(),
+                                           [&](unsigned int surface_index) {
+                                             return surface_index != receiver_index &&
+                                                    !is_potential_shader(receiver_index,
+                                                                         surface_index);
+                                           }),
+                            surface_indices.end());
+    }
+  }
+}
+
+void Context::find_surfaces_in_view(const SurfaceBuffer *receiver,
+                                    std::vector<unsigned int> &surface_indices) const {
+  SunProjection projection{};
+  projection.left = left;
+  projection.right = right;
+  projection.bottom = bottom;
+  projection.top = top;
+  projection.far_ = far_;
+  find_surfaces_in_view(view, projection, receiver, surface_indices);
+}
+
+void Context::submit_pssa(mat4x4 sun_view) {
+  std::vector<unsigned int> surface_indices(surface_buffers.size());
+  std::iota(surface_indices.begin(), surface_indices.end(), 0u);
+  submit_pssas(surface_indices, sun_view);
+}
+
+std::vector<float> Context::retrieve_pssas(const std::vector<unsigned int> &surface_indices) {
+  std::vector<float> pssas;
+  pssas.reserve(surface_indices.size());
+  for (const unsigned int surface_index : surface_indices) {
+    pssas.push_back(retrieve_pssa(surface_index));
+  }
+  return pssas;
+}
+
+std::vector<float> Context::retrieve_pssa() {
+  std::vector<float> pssas;
+  pssas.reserve(surface_buffers.size());
+  for (auto const &surface_buffer : surface_buffers) {
+    pssas.push_back(retrieve_pssa(surface_buffer.index));
+  }
+  return pssas;
+}
+
+std::vector<float> Context::calculate_pssas(const unsigned int surface_index,
+                                            const std::vector<mat4x4_ptr> &sun_views) {
+  std::vector<float> pssas;
+  pssas.reserve(sun_views.size());
+  for (auto const sun_view : sun_views) {
+    submit_pssa(surface_index, sun_view);
+    pssas.push_back(retrieve_pssa(surface_index));
+  }
+  return pssas;
+}
+
+unsigned int Context::queue_pssa(mat4x4 sun_view) {
+  std::vector<unsigned int> surface_indices(surface_buffers.size());
+  std::iota(surface_indices.begin(), surface_indices.end(), 0u);
+  return queue_pssas(surface_indices, sun_view);
+}
+
+void Context::set_calculation_mode(CalculationMode mode) {
+  calculation_mode = mode;
+}
+
+CalculationMode Context::get_calculation_mode() const {
+  return calculation_mode;
+}
+
+void Context::set_target_accuracy(float relative_error) {
+  if (relative_error < 0.f) {
+    throw PenumbraException(
+        fmt::format("Target accuracy, {}, must not be negative.", relative_error), *logger);
+  }
+  target_accuracy = relative_error;
+}
+
+float Context::get_target_accuracy() const {
+  return target_accuracy;
+}
+
+void Context::set_samples_per_pixel(unsigned int samples) {
+  if (samples == 0u) {
+    throw PenumbraException("Samples per pixel must be at least one.", *logger);
+  }
+  if (samples > 1u) {
+    throw PenumbraException("Multisampling is only available with the OpenGL backend.", *logger);
+  }
+}
+
+void Context::set_maximum_tile_size(unsigned int maximum_tile_size) {
+  if (maximum_tile_size > 0u) {
+    throw PenumbraException("Tiled rendering is only available with the OpenGL backend.",
+                            *logger);
+  }
+}
+
+unsigned int Context::get_samples_per_pixel() const {
+  return samples_per_pixel;
+}
+
+float Context::get_pssa_error(const unsigned int surface_index) const {
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot find PSSA errors.", *logger);
+  }
+  if (surface_index >= pssa_errors.size()) {
+    throw PenumbraException(
+        fmt::format("Surface index, {}, is not in the model set. Cannot find PSSA errors.",
+                    surface_index),
+        *logger);
+  }
+  return pssa_errors[surface_index];
+}
+
+std::vector<float> Context::get_pssa_errors() const {
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot find PSSA errors.", *logger);
+  }
+  return pssa_errors;
+}
+
+void Context::set_minimum_shared_depth_pixels(unsigned int pixels) {
+  minimum_shared_depth_pixels = pixels;
+}
+
+unsigned int Context::get_minimum_shared_depth_pixels() const {
+  return minimum_shared_depth_pixels;
+}
+
+void Context::group_shared_depth_receivers(const std::vector<unsigned int> &surface_indices,
+                                           mat4x4 sun_view, const int shared_size,
+                                           std::vector<ReceiverGroup> &groups,
+                                           std::vector<unsigned int> &individual_indices) const {
+  groups.clear();
+  individual_indices.clear();
+  if (calculation_mode != CalculationMode::coplanar_groups) {
+    auto &group = groups.emplace_back();
+    group.projection = calculate_projection(sun_view);
+    split_shared_depth_receivers(surface_indices, sun_view, group.projection, shared_size,
+                                 minimum_shared_depth_pixels, group.surface_indices,
+                                 individual_indices);
+    if (group.surface_indices.empty()) {
+      groups.clear();
+    }
+    return;
+  }
+
+  std::vector<std::vector<unsigned int>> group_receivers(coplanar_groups.size());
+  for (auto const surface_index : surface_indices) {
+    auto const group_index = surface_groups[surface_index];
+    if (group_index < 0) {
+      individual_indices.push_back(surface_index);
+    } else {
+      group_receivers[static_cast<std::size_t>(group_index)].push_back(surface_index);
+    }
+  }
+  // Each receiver counted must span at least the smallest adaptive viewport. Otherwise, its own
+  // projection resolves it more finely.
+  auto const minimum_pixels =
+      std::max(minimum_shared_depth_pixels, static_cast<unsigned int>(minimum_resolution));
+  ReceiverGroup group;
+  for (auto const &receivers : group_receivers) {
+    if (receivers.size() < 2u) {
+      individual_indices.insert(individual_indices.end(), receivers.begin(), receivers.end());
+      continue;
+    }
+    group.projection = calculate_projection(sun_view, receivers);
+    group.surface_indices.clear();
+    split_shared_depth_receivers(receivers, sun_view, group.projection, shared_size,
+                                 minimum_pixels, group.surface_indices, individual_indices);
+    if (group.surface_indices.size() < 2u) { // Rendered as well on its own
+      individual_indices.insert(individual_indices.end(), group.surface_indices.begin(),
+                                group.surface_indices.end());
+    } else {
+      groups.push_back(group);
+    }
+  }
+}
+
+void Context::split_shared_depth_receivers(const std::vector<unsigned int> &surface_indices,
+                                           const mat4x4 sun_view, const SunProjection &projection,
+                                           const int shared_size,
+                                           const unsigned int minimum_pixels,
+                                           std::vector<unsigned int> &shared_indices,
+                                           std::vector<unsigned int> &individual_indices) const {
+  if (projection.pixel_area <= 0.f) {
+    individual_indices.insert(individual_indices.end(), surface_indices.begin(),
+                              surface_indices.end());
+    return;
+  }
+  if (minimum_pixels == 0u) {
+    shared_indices.insert(shared_indices.end(), surface_indices.begin(), surface_indices.end());
+    return;
+  }
+
+  // Receiver extents in view coordinates, as in calculate_projection
+  float const pixels_per_x = static_cast<float>(shared_size) / (projection.right - projection.left);
+  float const pixels_per_y = static_cast<float>(shared_size) / (projection.top - projection.bottom);
+  for (auto const surface_index : surface_indices) {
+    auto const &surface_buffer = surface_buffers[surface_index];
+    float bounds[2][2] = {{MAX_FLOAT, MAX_FLOAT}, {-MAX_FLOAT, -MAX_FLOAT}};
+    for (unsigned int i = surface_buffer.begin; i < surface_buffer.begin + surface_buffer.count;
+         ++i) {
+      const float *vertex = get_vertex(i);
+      for (int axis = 0; axis < 2; ++axis) {
+        float const coordinate = sun_view[0][axis] * vertex[0] + sun_view[1][axis] * vertex[1] +
+                                 sun_view[2][axis] * vertex[2];
+        bounds[0][axis] = std::min(coordinate, bounds[0][axis]);
+        bounds[1][axis] = std::max(coordinate, bounds[1][axis]);
+      }
+    }
+    if ((bounds[1][0] - bounds[0][0]) * pixels_per_x >= static_cast<float>(minimum_pixels) &&
+        (bounds[1][1] - bounds[0][1]) * pixels_per_y >= static_cast<float>(minimum_pixels)) {
+      shared_indices.push_back(surface_index);
+    } else {
+      individual_indices.push_back(surface_index);
+    }
+  }
+}
+
+void Context::set_back_face_culling(bool enabled) {
+  back_face_culling = enabled;
+}
+
+bool Context::get_back_face_culling() const {
+  return back_face_culling;
+}
+
+void Context::set_horizon_culling(bool enabled) {
+  horizon_culling = enabled;
+}
+
+bool Context::get_horizon_culling() const {
+  return horizon_culling;
+}
+
+PssaStatistics Context::get_pssa_statistics() const {
+  return pssa_statistics;
+}
+
+void Context::reset_pssa_statistics() {
+  pssa_statistics = PssaStatistics{};
+}
+
+bool Context::calculate_analytic_pssa(const unsigned int surface_index, mat4x4 sun_view,
+                                      float &pssa) {
+  // The view's z axis points toward the sun, and the model's z axis points up
+  if (horizon_culling && sun_view[2][2] < 0.f) {
+    ++pssa_statistics.sun_below_horizon;
+    pssa = 0.f;
+    return true;
+  }
+
+  if (surface_buffers[surface_index].count == 0u) {
+    pssa = 0.f; // No triangles in the model (e.g., disabled or removed), and not counted
+    return true;
+  }
+
+  auto const &normal = surface_normals[surface_index];
+  if (normal == std::array<float, 3>{0.f, 0.f, 0.f}) {
+    ++pssa_statistics.rendered; // Orientation unknown
+    return false;
+  }
+  float const cosine =
+      normal[0] * sun_view[0][2] + normal[1] * sun_view[1][2] + normal[2] * sun_view[2][2];
+  if (cosine == 0.f || (back_face_culling && cosine < 0.f)) {
+    ++pssa_statistics.back_facing;
+    pssa = 0.f;
+    return true;
+  }
+
+  // With the sun in front, only the receiver's potential shaders are found in its view. From
+  // behind, any other surface in its view may shade it.
+  // The receiver's view is kept for the backends to render it (see get_receiver_view).
+  if (!std::equal(&sun_view[0][0], &sun_view[0][0] + 16, &receiver_view_sun_view[0][0])) {
+    mat4x4_dup(receiver_view_sun_view, sun_view);
+    clear_receiver_views();
+  }
+  auto const *receiver = &surface_buffers[surface_index];
+  auto &receiver_view = receiver_views[surface_index];
+  receiver_view.projection = calculate_projection(sun_view, receiver);
+  find_surfaces_in_view(sun_view, receiver_view.projection, receiver,
+                        receiver_view.surfaces_in_view);
+  receiver_view_generations[surface_index] = receiver_view_generation;
+  if (std::all_of(receiver_view.surfaces_in_view.begin(), receiver_view.surfaces_in_view.end(),
+                  [&](unsigned int i) { return i == surface_index; })) {
+    ++pssa_statistics.unshaded;
+    pssa = surface_areas[surface_index] * std::abs(cosine);
+    return true;
+  }
+
+  ++pssa_statistics.rendered;
+  return false;
+}
+
+const Context::ReceiverView *Context::get_receiver_view(const unsigned int surface_index,
+                                                        const mat4x4 sun_view) const {
+  if (receiver_view_generations[surface_index] != receiver_view_generation ||
+      !std::equal(&sun_view[0][0], &sun_view[0][0] + 16, &receiver_view_sun_view[0][0])) {
+    return nullptr;
+  }
+  return &receiver_views[surface_index];
+}
+
+void Context::clear_receiver_views() {
+  // Views stamped with an older generation are out of date. The stamps are reset when it wraps.
+  if (++receiver_view_generation == 0u) {
+    std::fill(receiver_view_generations.begin(), receiver_view_generations.end(), 0u);
+    receiver_view_generation = 1u;
+  }
+}
+
+std::vector<unsigned int>
+Context::calculate_analytic_pssas(const std::vector<unsigned int> &surface_indices,
+                                  mat4x4 sun_view, std::vector<float> &results) {
+  std::vector<unsigned int> rendered_surface_indices;
+  rendered_surface_indices.reserve(surface_indices.size());
+  for (auto const surface_index : surface_indices) {
+    if (calculate_analytic_pssa(surface_index, sun_view, results[surface_index])) {
+      pssa_errors[surface_index] = 0.f;
+    } else {
+      rendered_surface_indices.push_back(surface_index);
+    }
+  }
+  return rendered_surface_indices;
+}
+
+} // namespace Penumbra
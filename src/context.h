@@ -0,0 +1,277 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef CONTEXT_H_
+#define CONTEXT_H_
+
+// Standard
+#include <array>
+#include <vector>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+// Vendor
+#include <courierr/courierr.h>
+#include <linmath.h> // Part of GLFW
+
+// Penumbra
+#include <penumbra/penumbra.h>
+#include "sun.h"
+#include "surface-implementation.h"
+#include "surface-index.h"
+
+#define MAX_FLOAT std::numeric_limits<float>::max()
+
+namespace Penumbra {
+
+// Range of model indices (three per triangle) belonging to one surface
+class SurfaceBuffer {
+public:
+  explicit SurfaceBuffer(unsigned int begin = 0u, unsigned int count = 0u, int index = -1);
+  unsigned int begin;
+  unsigned int count;
+  int index;
+};
+
+// Results of queued calculations for backends that complete calculations when they are queued
+class CompletedQueue {
+public:
+  explicit CompletedQueue(Courierr::Courierr *logger);
+  static constexpr unsigned int max_size{4};
+  unsigned int push(std::vector<float> &&pssas); // Returns the ticket
+  void check_ticket(unsigned int ticket) const;
+  std::vector<float> pop(unsigned int ticket);
+  void clear();
+  [[nodiscard]] unsigned int size() const;
+
+private:
+  std::unordered_map<unsigned int, std::vector<float>> queued_pssas;
+  unsigned int next_ticket{1};
+  Courierr::Courierr *logger;
+};
+
+// Interface implemented by each calculation backend
+class Context {
+
+public:
+  Context(int size, Courierr::Courierr *logger);
+  virtual ~Context() = default;
+  virtual void set_model(const std::vector<float> &vertices,
+                         const std::vector<unsigned int> &indices,
+                         const std::vector<SurfaceBuffer> &surface_buffers);
+  // Copies only the changed surfaces' vertices and indices (sets the model if the count differs)
+  virtual void
+  update_model(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+               const std::vector<SurfaceBuffer> &surface_buffers,
+               const std::vector<unsigned int> &changed_surfaces,
+               const std::vector<std::pair<unsigned int, unsigned int>> &rewritten_vertices);
+  virtual void clear_model();
+  // Surface polygons and holes, for backends that use them instead of the tessellated model
+  virtual void set_surfaces(const std::vector<SurfaceImplementation> &surfaces);
+  // As above, after the changed surfaces were edited or moved (before update_model)
+  virtual void update_surfaces(const std::vector<SurfaceImplementation> &surfaces,
+                               const std::vector<unsigned int> &changed_surfaces);
+  virtual void submit_pssa(unsigned int surface_index, mat4x4 sun_view) = 0;
+  virtual void submit_pssas(const std::vector<unsigned int> &surface_indices,
+                            mat4x4 sun_view) = 0;
+  void submit_pssa(mat4x4 sun_view);
+  virtual float retrieve_pssa(unsigned int surface_index) = 0;
+  std::vector<float> retrieve_pssas(const std::vector<unsigned int> &surface_indices);
+  std::vector<float> retrieve_pssa();
+  virtual std::vector<float> calculate_pssas(unsigned int surface_index,
+                                             const std::vector<mat4x4_ptr> &sun_views);
+  virtual unsigned int queue_pssas(const std::vector<unsigned int> &surface_indices,
+                                   mat4x4 sun_view) = 0;
+  unsigned int queue_pssa(mat4x4 sun_view);
+  virtual bool is_queued_pssa_ready(unsigned int ticket) = 0;
+  virtual std::vector<float> retrieve_queued_pssas(unsigned int ticket) = 0;
+  [[nodiscard]] virtual unsigned int get_queued_pssa_count() const = 0; // Not yet retrieved
+  [[nodiscard]] virtual unsigned int get_queue_capacity() const = 0; // Tickets in flight at most
+  void set_calculation_mode(CalculationMode mode);
+  [[nodiscard]] CalculationMode get_calculation_mode() const;
+  void set_minimum_shared_depth_pixels(unsigned int pixels);
+  [[nodiscard]] unsigned int get_minimum_shared_depth_pixels() const;
+  void set_target_accuracy(float relative_error);
+  [[nodiscard]] float get_target_accuracy() const;
+  // Only OpenGL multisamples; other backends throw for more than one sample
+  virtual void set_samples_per_pixel(unsigned int samples);
+  [[nodiscard]] unsigned int get_samples_per_pixel() const;
+  // Only OpenGL renders in tiles; other backends throw for any limit but zero (none)
+  virtual void set_maximum_tile_size(unsigned int maximum_tile_size);
+  [[nodiscard]] float get_pssa_error(unsigned int surface_index) const;
+  [[nodiscard]] std::vector<float> get_pssa_errors() const; // Of every surface in the model set
+  void set_back_face_culling(bool enabled);
+  [[nodiscard]] bool get_back_face_culling() const;
+  void set_horizon_culling(bool enabled);
+  [[nodiscard]] bool get_horizon_culling() const;
+
+  virtual std::unordered_map<unsigned int, float>
+  calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                           const std::vector<unsigned int> &interior_surface_indices,
+                           mat4x4 sun_view) = 0;
+  // Surfaces with any part in front of the surface's plane
+  [[nodiscard]] std::vector<unsigned int> get_potential_shaders(unsigned int surface_index) const;
+  [[nodiscard]] std::vector<std::vector<unsigned int>> get_potential_shaders() const;
+  [[nodiscard]] PssaStatistics get_pssa_statistics() const;
+  void reset_pssa_statistics();
+
+  // Only OpenGL shows renderings; other backends throw
+  virtual void show_rendering(unsigned int surface_index, mat4x4 sun_view);
+  virtual void show_interior_rendering(const std::vector<unsigned int> &hidden_surface_indices,
+                                       unsigned int interior_surface_index, mat4x4 sun_view);
+
+protected:
+  static constexpr int vertex_size{3}; // i.e., 3D
+  int size;
+  std::vector<float> vertices;       // Distinct, shared by the surfaces' triangles
+  std::vector<unsigned int> indices; // Three per triangle, into vertices
+  std::vector<SurfaceBuffer> surface_buffers;
+  bool model_is_set{false};
+  float model_bounding_box[8][4] = {};
+  SurfaceIndex spatial_index;
+  // Unit normals of the surface polygons (zero for degenerate surfaces)
+  std::vector<std::array<float, 3>> surface_normals;
+  // By receiver, sorted (empty for receivers without a normal, which any surface may shade)
+  std::vector<std::vector<unsigned int>> potential_shaders;
+  std::vector<float> surface_areas;                  // Sums of the tessellated triangles' areas
+  // By receiver: only surfaces extending beyond the plane normal . x = offset may shade it
+  std::vector<float> shading_plane_offsets;
+  // Each surface's polygon and holes, or its tessellated triangles if polygons were not given
+  std::vector<std::vector<Polygon>> surface_boundaries;
+  std::vector<float> pssa_errors; // Error estimates of the last submitted PSSAs
+  PssaStatistics pssa_statistics;
+  mat4x4 view = {}, mvp = {};
+  float left{0}, right{0}, bottom{0}, top{0}, near_{0}, far_{0};
+  CalculationMode calculation_mode{CalculationMode::per_surface};
+  static constexpr int shared_depth_scale{4}; // Shared depth buffer resolution relative to size
+  unsigned int minimum_shared_depth_pixels{0u};
+  float target_accuracy{0.f};                  // Relative error. Zero always renders at size.
+  unsigned int samples_per_pixel{1u};          // Depth samples of each rendered pixel
+  static constexpr int minimum_resolution{16}; // Smallest adaptive viewport (pixels on each side)
+  bool back_face_culling{false};
+  bool horizon_culling{false};
+  Courierr::Courierr *logger;
+
+  // Coordinates of the vertex at a position in indices
+  [[nodiscard]] const float *get_vertex(unsigned int index) const {
+    return &vertices[indices[index] * vertex_size];
+  }
+
+  // Orthographic sun projection fitted around a surface, or the entire model if none is given
+  struct SunProjection {
+    mat4x4 mvp;
+    float left, right, bottom, top, near_, far_;
+    float pixel_area; // Area represented by each pixel
+  };
+  [[nodiscard]] SunProjection calculate_projection(mat4x4 sun_view,
+                                                   const SurfaceBuffer *surface_buffer = nullptr,
+                                                   bool clip_far = true) const;
+  // Fitted around several surfaces (e.g., a coplanar group of receivers)
+  [[nodiscard]] SunProjection
+  calculate_projection(mat4x4 sun_view, const std::vector<unsigned int> &surface_indices) const;
+
+  // Sets view, mvp, and extents from calculate_projection, and returns the area of each pixel
+  float set_projection(mat4x4 sun_view, const SurfaceBuffer *surface_buffer = nullptr,
+                       bool clip_far = true);
+  // Sets view, mvp, and extents from a projection already calculated
+  void set_projection(mat4x4 sun_view, const SunProjection &sun_projection);
+  // The projection last set by set_projection
+  [[nodiscard]] SunProjection get_projection() const;
+
+  // Area of each pixel of a projection rendered with resolution pixels on each side
+  [[nodiscard]] static float get_pixel_area(const SunProjection &projection, int resolution);
+
+  // Estimated PSSA error: the area of the pixels the receiver's projected edges pass through
+  [[nodiscard]] float estimate_pssa_error(unsigned int surface_index, const mat4x4 sun_view,
+                                          const SunProjection &projection, int resolution,
+                                          unsigned int samples = 1u) const;
+
+  // Smallest resolution (pixels on each side) meeting the target accuracy, or size if none is set
+  [[nodiscard]] int choose_resolution(unsigned int surface_index, const mat4x4 sun_view,
+                                      const SunProjection &projection) const;
+
+  // True if the sun is in front of the surface, so only its potential shaders may shade it
+  [[nodiscard]] bool is_sun_in_front(unsigned int surface_index, const mat4x4 sun_view) const;
+  [[nodiscard]] bool is_potential_shader(unsigned int receiver_index,
+                                         unsigned int surface_index) const;
+
+  // Surfaces that may appear within a projection and shade the receiver, in model order
+  void find_surfaces_in_view(const mat4x4 sun_view, const SunProjection &projection,
+                             const SurfaceBuffer *receiver,
+                             std::vector<unsigned int> &surface_indices) const;
+  // As above, for the current projection (from set_projection)
+  void find_surfaces_in_view(const SurfaceBuffer *receiver,
+                             std::vector<unsigned int> &surface_indices) const;
+
+  // Receivers counted against one depth buffer, rendered at a projection covering them
+  struct ReceiverGroup {
+    SunProjection projection;
+    std::vector<unsigned int> surface_indices;
+  };
+  // Groups receivers by shared depth buffer (per calculation mode) and returns the rest separately
+  void group_shared_depth_receivers(const std::vector<unsigned int> &surface_indices,
+                                    mat4x4 sun_view, int shared_size,
+                                    std::vector<ReceiverGroup> &groups,
+                                    std::vector<unsigned int> &individual_indices) const;
+
+  // A receiver's projection (fitted around it) and the surfaces in its view
+  struct ReceiverView {
+    SunProjection projection;
+    std::vector<unsigned int> surfaces_in_view;
+  };
+  // The view calculate_analytic_pssa found for the receiver at this sun view, or null if none
+  [[nodiscard]] const ReceiverView *get_receiver_view(unsigned int surface_index,
+                                                      const mat4x4 sun_view) const;
+
+  // Returns true, setting the PSSA, if it needs no rendering (not thread safe)
+  bool calculate_analytic_pssa(unsigned int surface_index, mat4x4 sun_view, float &pssa);
+  // As above by surface, returning the receivers left to render
+  std::vector<unsigned int>
+  calculate_analytic_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                           std::vector<float> &results);
+
+private:
+  // Receiver views by surface (see get_receiver_view), current where their generation matches
+  std::vector<ReceiverView> receiver_views;
+  std::vector<unsigned int> receiver_view_generations;
+  unsigned int receiver_view_generation{0u};
+  mat4x4 receiver_view_sun_view = {};
+  void clear_receiver_views();
+  bool boundaries_from_triangles{false}; // Surface polygons were not given with set_surfaces
+  void set_surface(unsigned int surface_index, const SurfaceImplementation &surface);
+  void set_model_bounding_box(const float (&minimum)[3], const float (&maximum)[3]);
+  // Finds the surface's area (and its boundaries, if taken from its triangles)
+  void set_surface_area(unsigned int surface_index);
+  void set_potential_shaders();
+  // Distance from a receiver's plane (relative to the model size) not counted as in front of it
+  [[nodiscard]] float get_shading_plane_tolerance() const;
+  void set_potential_shaders(unsigned int receiver_index, float tolerance,
+                             std::vector<unsigned int> &candidates);
+  [[nodiscard]] bool extends_beyond(unsigned int surface_index, const std::array<float, 3> &normal,
+                                    float offset) const;
+  void update_potential_shaders(const std::vector<unsigned int> &changed_surfaces);
+
+  // Nearby receivers sharing (nearly) a plane and facing, e.g. windows of a facade (two or more)
+  std::vector<std::vector<unsigned int>> coplanar_groups;
+  std::vector<int> surface_groups; // Into coplanar_groups by surface, or -1 if in none
+  static constexpr float coplanar_normal_cosine{0.9999f}; // Normals within about 0.8 degrees
+  void set_coplanar_groups();
+  void leave_coplanar_groups(const std::vector<unsigned int> &surface_indices);
+
+  // Projection fitted around the vertices visited by for_each_vertex(visit)
+  template <typename ForEachVertex>
+  [[nodiscard]] SunProjection fit_projection(mat4x4 sun_view, ForEachVertex for_each_vertex,
+                                             bool clip_far) const;
+
+  // Appends receivers spanning at least minimum_pixels to shared_indices, the rest individually
+  void split_shared_depth_receivers(const std::vector<unsigned int> &surface_indices,
+                                    const mat4x4 sun_view, const SunProjection &projection,
+                                    int shared_size, unsigned int minimum_pixels,
+                                    std::vector<unsigned int> &shared_indices,
+                                    std::vector<unsigned int> &individual_indices) const;
+};
+
+} // namespace Penumbra
+
+#endif // CONTEXT_H_
@@ -0,0 +1,253 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+
+// Penumbra
+#include <penumbra/logging.h>
+#include "cpu/context.h"
+
+namespace Penumbra {
+
+CPUContext::CPUContext(int size_in, ThreadPool &thread_pool_in, Courierr::Courierr *logger_in)
+    : Context(size_in, logger_in), thread_pool(thread_pool_in),
+      rasterizers(thread_pool.get_slot_count()), queue(logger_in) {}
+
+void CPUContext::set_model(const std::vector<float> &vertices_in,
+                           const std::vector<unsigned int> &indices_in,
+                           const std::vector<SurfaceBuffer> &surface_buffers_in) {
+  Context::set_model(vertices_in, indices_in, surface_buffers_in);
+  pssas.assign(surface_buffers.size(), 0.f);
+  surface_pixel_counts.resize(surface_buffers.size());
+}
+
+void CPUContext::clear_model() {
+  Context::clear_model();
+  pssas.clear();
+  queue.clear();
+  surface_pixel_counts.clear();
+}
+
+void CPUContext::check_model_is_set() const {
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot set scene.", *logger);
+  }
+}
+
+Rasterizer &CPUContext::get_rasterizer(unsigned int slot) {
+  // Allocated on first use, so threads that never run a task do not hold a buffer
+  if (!rasterizers[slot]) {
+    rasterizers[slot] = std::make_unique<Rasterizer>(size);
+  }
+  return *rasterizers[slot];
+}
+
+float CPUContext::calculate_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view,
+                                 Rasterizer &rasterizer, float &error) {
+  auto const surface_index = static_cast<unsigned int>(surface_buffer.index);
+  auto const *receiver_view = get_receiver_view(surface_index, sun_view);
+  auto sun_projection =
+      receiver_view ? receiver_view->projection : calculate_projection(sun_view, &surface_buffer);
+  error = 0.f;
+  if (sun_projection.pixel_area <= 0.f) {
+    return 0.f;
+  }
+  int const resolution = choose_resolution(surface_index, sun_view, sun_projection);
+  error = estimate_pssa_error(surface_index, sun_view, sun_projection, resolution);
+  rasterizer.set_viewport_size(resolution);
+  rasterizer.clear();
+  std::vector<unsigned int> visible_surfaces;
+  if (!receiver_view) {
+    find_surfaces_in_view(sun_view, sun_projection, &surface_buffer, visible_surfaces);
+  }
+  for (auto const visible_index :
+       receiver_view ? receiver_view->surfaces_in_view : visible_surfaces) {
+    rasterizer.draw(vertices, indices, surface_buffers[visible_index], sun_projection.mvp);
+  }
+  auto const pixel_count = rasterizer.count(vertices, indices, surface_buffer, sun_projection.mvp);
+  return static_cast<float>(pixel_count) * get_pixel_area(sun_projection, resolution);
+}
+
+void CPUContext::calculate_pssas(const std::vector<unsigned int> &surface_indices,
+                                 mat4x4 sun_view, std::vector<float> &results) {
+  check_model_is_set();
+  results.resize(surface_buffers.size());
+  auto const rendered_surface_indices =
+      calculate_analytic_pssas(surface_indices, sun_view, results);
+  if (rendered_surface_indices.empty()) {
+    return;
+  }
+
+  if (calculation_mode == CalculationMode::shared_depth_buffer ||
+      calculation_mode == CalculationMode::coplanar_groups) {
+    calculate_shared_depth_pssas(rendered_surface_indices, sun_view, results);
+    return;
+  }
+
+  if (calculation_mode == CalculationMode::surface_id_buffer) {
+    // Render the model once at a projection covering the entire model, and count the pixels
+    // held by each surface
+    auto sun_projection = calculate_projection(sun_view);
+    auto &rasterizer = get_rasterizer(thread_pool.get_slot_count() - 1u);
+    rasterizer.set_viewport_size(size);
+    rasterizer.clear();
+    if (sun_projection.pixel_area > 0.f) {
+      for (auto const &surface_buffer : surface_buffers) {
+        rasterizer.draw(vertices, indices, surface_buffer, sun_projection.mvp);
+      }
+    }
+    rasterizer.count_surface_pixels(surface_pixel_counts);
+    for (auto const surface_index : rendered_surface_indices) {
+      results[surface_index] =
+          static_cast<float>(surface_pixel_counts[surface_index]) * sun_projection.pixel_area;
+      pssa_errors[surface_index] =
+          estimate_pssa_error(surface_index, sun_view, sun_projection, size);
+    }
+    return;
+  }
+
+  thread_pool.parallel_for(rendered_surface_indices.size(), [&](std::size_t i, unsigned int slot) {
+    auto const surface_index = rendered_surface_indices[i];
+    results[surface_index] = calculate_pssa(surface_buffers[surface_index], sun_view,
+                                            get_rasterizer(slot), pssa_errors[surface_index]);
+  });
+}
+
+void CPUContext::calculate_shared_depth_pssas(const std::vector<unsigned int> &surface_indices,
+                                              mat4x4 sun_view, std::vector<float> &results) {
+  int const shared_size = std::max(
+      size, std::min(size, max_shared_depth_size / shared_depth_scale) * shared_depth_scale);
+  std::vector<ReceiverGroup> groups;
+  std::vector<unsigned int> individual_indices;
+  group_shared_depth_receivers(surface_indices, sun_view, shared_size, groups,
+                               individual_indices);
+
+  std::vector<unsigned int> visible_surfaces;
+  for (auto &group : groups) {
+    auto &sun_projection = group.projection;
+    if (!shared_depth_rasterizer) {
+      shared_depth_rasterizer = std::make_unique<Rasterizer>(shared_size);
+    }
+    shared_depth_rasterizer->clear();
+    find_surfaces_in_view(sun_view, sun_projection, nullptr, visible_surfaces);
+    for (auto const surface_index : visible_surfaces) {
+      shared_depth_rasterizer->draw(vertices, indices, surface_buffers[surface_index],
+                                    sun_projection.mvp);
+    }
+    float const pixel_area = get_pixel_area(sun_projection, shared_size);
+    // Counting only reads the depth buffer, so receivers may share it across threads
+    thread_pool.parallel_for(group.surface_indices.size(), [&](std::size_t i, unsigned int) {
+      auto const surface_index = group.surface_indices[i];
+      auto const pixel_count = shared_depth_rasterizer->count(
+          vertices, indices, surface_buffers[surface_index], sun_projection.mvp);
+      results[surface_index] = static_cast<float>(pixel_count) * pixel_area;
+      pssa_errors[surface_index] =
+          estimate_pssa_error(surface_index, sun_view, sun_projection, shared_size);
+    });
+  }
+
+  thread_pool.parallel_for(individual_indices.size(), [&](std::size_t i, unsigned int slot) {
+    auto const surface_index = individual_indices[i];
+    results[surface_index] = calculate_pssa(surface_buffers[surface_index], sun_view,
+                                            get_rasterizer(slot), pssa_errors[surface_index]);
+  });
+}
+
+void CPUContext::submit_pssa(const unsigned int surface_index, mat4x4 sun_view) {
+  calculate_pssas(std::vector<unsigned int>{surface_index}, sun_view, pssas);
+}
+
+void CPUContext::submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) {
+  calculate_pssas(surface_indices, sun_view, pssas);
+}
+
+float CPUContext::retrieve_pssa(const unsigned int surface_index) {
+  return pssas.at(surface_index);
+}
+
+std::vector<float> CPUContext::calculate_pssas(const unsigned int surface_index,
+                                               const std::vector<mat4x4_ptr> &sun_views) {
+  check_model_is_set();
+  std::vector<float> results(sun_views.size());
+  std::vector<std::size_t> rendered_views;
+  for (std::size_t i = 0; i < sun_views.size(); ++i) {
+    if (!calculate_analytic_pssa(surface_index, sun_views[i], results[i])) {
+      rendered_views.push_back(i);
+    }
+  }
+  thread_pool.parallel_for(rendered_views.size(), [&](std::size_t i, unsigned int slot) {
+    auto const view_index = rendered_views[i];
+    float error;
+    results[view_index] = calculate_pssa(surface_buffers[surface_index], sun_views[view_index],
+                                         get_rasterizer(slot), error);
+  });
+  return results;
+}
+
+unsigned int CPUContext::queue_pssas(const std::vector<unsigned int> &surface_indices,
+                                     mat4x4 sun_view) {
+  // Calculations complete before returning. Queuing is supported for parity with the OpenGL
+  // backend.
+  std::vector<float> results;
+  calculate_pssas(surface_indices, sun_view, results);
+  std::vector<float> queued_results;
+  queued_results.reserve(surface_indices.size());
+  for (auto const surface_index : surface_indices) {
+    queued_results.push_back(results[surface_index]);
+  }
+  return queue.push(std::move(queued_results));
+}
+
+bool CPUContext::is_queued_pssa_ready(const unsigned int ticket) {
+  queue.check_ticket(ticket);
+  return true;
+}
+
+std::vector<float> CPUContext::retrieve_queued_pssas(const unsigned int ticket) {
+  return queue.pop(ticket);
+}
+
+unsigned int CPUContext::get_queued_pssa_count() const {
+  return queue.size();
+}
+
+unsigned int CPUContext::get_queue_capacity() const {
+  return CompletedQueue::max_size;
+}
+
+std::unordered_map<unsigned int, float>
+CPUContext::calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                                     const std::vector<unsigned int> &interior_surface_indices,
+                                     mat4x4 sun_view) {
+  std::unordered_map<unsigned int, float> interior_pssas;
+  auto sun_projection =
+      calculate_projection(sun_view, &surface_buffers.at(hidden_surface_indices.at(0)), false);
+  if (sun_projection.pixel_area <= 0.f) {
+    for (auto const interior_surface_index : interior_surface_indices) {
+      interior_pssas[interior_surface_index] = 0.f;
+    }
+    return interior_pssas;
+  }
+
+  auto &rasterizer = get_rasterizer(thread_pool.get_slot_count() - 1u);
+  rasterizer.set_viewport_size(size);
+  rasterizer.clear();
+  for (auto const &surface_buffer : surface_buffers) {
+    if (std::find(hidden_surface_indices.begin(), hidden_surface_indices.end(),
+                  static_cast<unsigned int>(surface_buffer.index)) ==
+        hidden_surface_indices.end()) {
+      rasterizer.draw(vertices, indices, surface_buffer, sun_projection.mvp);
+    }
+  }
+
+  for (auto const interior_surface_index : interior_surface_indices) {
+    auto const pixel_count = rasterizer.count(
+        vertices, indices, surface_buffers.at(interior_surface_index), sun_projection.mvp);
+    interior_pssas[interior_surface_index] =
+        static_cast<float>(pixel_count) * sun_projection.pixel_area;
+  }
+  return interior_pssas;
+}
+
+} // namespace Penumbra
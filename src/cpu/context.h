@@ -0,0 +1,77 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef CPU_CONTEXT_H_
+#define CPU_CONTEXT_H_
+
+// Standard
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Vendor
+#include <courierr/courierr.h>
+
+// Penumbra
+#include "../context.h"
+#include "cpu/rasterizer.h"
+#include "cpu/thread-pool.h"
+
+namespace Penumbra {
+
+// Calculates PSSAs with a software rasterizer, spreading surfaces (or sun positions) across a
+// thread pool. Each thread renders into its own rasterizer.
+class CPUContext : public Context {
+
+public:
+  CPUContext(int size, ThreadPool &thread_pool, Courierr::Courierr *logger);
+  ~CPUContext() override = default;
+  void set_model(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                 const std::vector<SurfaceBuffer> &surface_buffers) override;
+  void clear_model() override;
+  using Context::submit_pssa;
+  void submit_pssa(unsigned int surface_index, mat4x4 sun_view) override;
+  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) override;
+  using Context::retrieve_pssa;
+  float retrieve_pssa(unsigned int surface_index) override;
+  std::vector<float> calculate_pssas(unsigned int surface_index,
+                                     const std::vector<mat4x4_ptr> &sun_views) override;
+  unsigned int queue_pssas(const std::vector<unsigned int> &surface_indices,
+                           mat4x4 sun_view) override;
+  bool is_queued_pssa_ready(unsigned int ticket) override;
+  std::vector<float> retrieve_queued_pssas(unsigned int ticket) override;
+  [[nodiscard]] unsigned int get_queued_pssa_count() const override;
+  [[nodiscard]] unsigned int get_queue_capacity() const override;
+
+  std::unordered_map<unsigned int, float>
+  calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                           const std::vector<unsigned int> &interior_surface_indices,
+                           mat4x4 sun_view) override;
+
+private:
+  ThreadPool &thread_pool; // Owned by PenumbraImplementation
+  std::vector<std::unique_ptr<Rasterizer>> rasterizers; // One per thread pool slot
+  std::unique_ptr<Rasterizer> shared_depth_rasterizer;  // Allocated on first use
+  // Largest shared depth buffer (512 MiB of depths and surface IDs), unless size alone is larger
+  static constexpr int max_shared_depth_size{8192};
+  std::vector<float> pssas;                             // Results of the last submission
+  CompletedQueue queue;
+  std::vector<std::uint64_t> surface_pixel_counts;
+
+  Rasterizer &get_rasterizer(unsigned int slot);
+  // Renders the receiver at the resolution chosen for the target accuracy, setting its error
+  float calculate_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view,
+                       Rasterizer &rasterizer, float &error);
+  void calculate_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                       std::vector<float> &results);
+  // Shared depth buffer and coplanar group modes: each group's view of the model is drawn once,
+  // and its receivers are counted in parallel
+  void calculate_shared_depth_pssas(const std::vector<unsigned int> &surface_indices,
+                                    mat4x4 sun_view, std::vector<float> &results);
+  void check_model_is_set() const;
+};
+
+} // namespace Penumbra
+
+#endif // CPU_CONTEXT_H_
@@ -0,0 +1,464 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+// Without AVX enabled at compile time, GCC and Clang can still build an AVX kernel and select it
+// at run time
+#if !defined(__AVX__) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define PENUMBRA_AVX_DISPATCH
+#define PENUMBRA_TARGET_AVX __attribute__((target("avx")))
+#else
+#define PENUMBRA_TARGET_AVX
+#endif
+
+// Penumbra
+#include "cpu/rasterizer.h"
+
+namespace Penumbra {
+
+// Per-triangle constants for evaluating edge functions and depths along a tile row
+struct TriangleSetup {
+  double x_steps[3];    // Change in each edge function from one pixel to the next
+  double thresholds[3]; // Minimum edge function value inside the triangle (applies fill rule)
+  double weights[3];    // Vertex depth / triangle area, so depth = sum(edge * weight)
+};
+
+// Evaluates the eight pixels of a tile row. Returns a mask with bit i set if pixel i is covered,
+// and writes each pixel's depth. Edge functions hold integers well below 2^53, so they are exact
+// in double precision regardless of the instruction set used. Depths are accumulated in the same
+// order by every kernel, so they match bit for bit.
+using RowEvaluator = unsigned int (*)(const TriangleSetup &setup, const double (&edges)[3],
+                                      float *depths);
+
+#if defined(__AVX__) || defined(PENUMBRA_AVX_DISPATCH)
+PENUMBRA_TARGET_AVX static unsigned int evaluate_row_avx(const TriangleSetup &setup,
+                                                         const double (&edges)[3],
+                                                         float *depths) {
+  unsigned int mask{0u};
+  for (int lane = 0; lane < 8; lane += 4) {
+    __m256d const offsets =
+        _mm256_set_pd(lane + 3., lane + 2., lane + 1., static_cast<double>(lane));
+    __m256d covered = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    __m256d depth = _mm256_setzero_pd();
+    for (int i = 0; i < 3; ++i) {
+      __m256d const edge = _mm256_add_pd(_mm256_set1_pd(edges[i]),
+                                         _mm256_mul_pd(offsets, _mm256_set1_pd(setup.x_steps[i])));
+      covered = _mm256_and_pd(
+          covered, _mm256_cmp_pd(edge, _mm256_set1_pd(setup.thresholds[i]), _CMP_GE_OQ));
+      depth = _mm256_add_pd(depth, _mm256_mul_pd(edge, _mm256_set1_pd(setup.weights[i])));
+    }
+    _mm_storeu_ps(depths + lane, _mm256_cvtpd_ps(depth));
+    mask |= static_cast<unsigned int>(_mm256_movemask_pd(covered)) << lane;
+  }
+  return mask;
+}
+#endif
+
+[[maybe_unused]] static unsigned int evaluate_row(const TriangleSetup &setup,
+                                                 const double (&edges)[3], float *depths) {
+  unsigned int mask{0u};
+#if defined(__SSE2__) || defined(_M_X64)
+  for (int lane = 0; lane < 8; lane += 2) {
+    __m128d const offsets = _mm_set_pd(lane + 1., static_cast<double>(lane));
+    __m128d covered = _mm_castsi128_pd(_mm_set1_epi32(-1));
+    __m128d depth = _mm_setzero_pd();
+    for (int i = 0; i < 3; ++i) {
+      __m128d const edge =
+          _mm_add_pd(_mm_set1_pd(edges[i]), _mm_mul_pd(offsets, _mm_set1_pd(setup.x_steps[i])));
+      covered = _mm_and_pd(covered, _mm_cmpge_pd(edge, _mm_set1_pd(setup.thresholds[i])));
+      depth = _mm_add_pd(depth, _mm_mul_pd(edge, _mm_set1_pd(setup.weights[i])));
+    }
+    _mm_storel_pi(reinterpret_cast<__m64 *>(depths + lane), _mm_cvtpd_ps(depth));
+    mask |= static_cast<unsigned int>(_mm_movemask_pd(covered)) << lane;
+  }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  for (int lane = 0; lane < 8; lane += 2) {
+    double const lane_offsets[2] = {static_cast<double>(lane), lane + 1.};
+    float64x2_t const offsets = vld1q_f64(lane_offsets);
+    uint64x2_t covered = vdupq_n_u64(~0ull);
+    float64x2_t depth = vdupq_n_f64(0.);
+    for (int i = 0; i < 3; ++i) {
+      float64x2_t const edge =
+          vaddq_f64(vdupq_n_f64(edges[i]), vmulq_f64(offsets, vdupq_n_f64(setup.x_steps[i])));
+      covered = vandq_u64(covered, vcgeq_f64(edge, vdupq_n_f64(setup.thresholds[i])));
+      depth = vaddq_f64(depth, vmulq_f64(edge, vdupq_n_f64(setup.weights[i])));
+    }
+    vst1_f32(depths + lane, vcvt_f32_f64(depth));
+    mask |= static_cast<unsigned int>((vgetq_lane_u64(covered, 0) & 1u) |
+                                      ((vgetq_lane_u64(covered, 1) & 1u) << 1u))
+            << lane;
+  }
+#else
+  for (int lane = 0; lane < 8; ++lane) {
+    bool covered{true};
+    double depth{0.};
+    for (int i = 0; i < 3; ++i) {
+      double const edge = edges[i] + lane * setup.x_steps[i];
+      covered = covered && edge >= setup.thresholds[i];
+      depth += edge * setup.weights[i];
+    }
+    depths[lane] = static_cast<float>(depth);
+    mask |= static_cast<unsigned int>(covered) << lane;
+  }
+#endif
+  return mask;
+}
+
+static RowEvaluator get_row_evaluator() {
+#if defined(__AVX__)
+  return evaluate_row_avx;
+#elif defined(PENUMBRA_AVX_DISPATCH)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx") ? evaluate_row_avx : evaluate_row;
+#else
+  return evaluate_row;
+#endif
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// Expands bits 0-3 of a coverage mask into lane masks
+static __m128 expand_mask(unsigned int mask) {
+  __m128i const bits = _mm_setr_epi32(1, 2, 4, 8);
+  return _mm_castsi128_ps(
+      _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(mask)), bits), bits));
+}
+
+// Covered fragments within the near and far planes
+static __m128 clip_depths(__m128 covered, __m128 fragment_depths) {
+  return _mm_and_ps(covered, _mm_and_ps(_mm_cmpge_ps(fragment_depths, _mm_setzero_ps()),
+                                        _mm_cmple_ps(fragment_depths, _mm_set1_ps(1.f))));
+}
+#elif defined(__aarch64__) || defined(_M_ARM64)
+static uint32x4_t expand_mask(unsigned int mask) {
+  const uint32_t bit_values[4] = {1u, 2u, 4u, 8u};
+  uint32x4_t const bits = vld1q_u32(bit_values);
+  return vtstq_u32(vdupq_n_u32(mask), bits);
+}
+
+static uint32x4_t clip_depths(uint32x4_t covered, float32x4_t fragment_depths) {
+  return vandq_u32(covered, vandq_u32(vcgeq_f32(fragment_depths, vdupq_n_f32(0.f)),
+                                      vcleq_f32(fragment_depths, vdupq_n_f32(1.f))));
+}
+#endif
+
+// GL_LESS depth test and write for the covered pixels of a tile row
+static void draw_row(unsigned int mask, const float *fragment_depths, float *depths,
+                     int *surface_indices, int surface_index) {
+#if defined(__SSE2__) || defined(_M_X64)
+  __m128i const index = _mm_set1_epi32(surface_index);
+  for (int lane = 0; lane < 8; lane += 4) {
+    __m128 const fragment_depth = _mm_loadu_ps(fragment_depths + lane);
+    __m128 const depth = _mm_loadu_ps(depths + lane);
+    __m128 const passed =
+        _mm_and_ps(clip_depths(expand_mask(mask >> lane), fragment_depth),
+                   _mm_cmplt_ps(fragment_depth, depth));
+    _mm_storeu_ps(depths + lane,
+                  _mm_or_ps(_mm_and_ps(passed, fragment_depth), _mm_andnot_ps(passed, depth)));
+    auto *indices = reinterpret_cast<__m128i *>(surface_indices + lane);
+    __m128i const passed_indices = _mm_castps_si128(passed);
+    _mm_storeu_si128(indices, _mm_or_si128(_mm_and_si128(passed_indices, index),
+                                           _mm_andnot_si128(passed_indices,
+                                                            _mm_loadu_si128(indices))));
+  }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  int32x4_t const index = vdupq_n_s32(surface_index);
+  for (int lane = 0; lane < 8; lane += 4) {
+    float32x4_t const fragment_depth = vld1q_f32(fragment_depths + lane);
+    float32x4_t const depth = vld1q_f32(depths + lane);
+    uint32x4_t const passed = vandq_u32(clip_depths(expand_mask(mask >> lane), fragment_depth),
+                                        vcltq_f32(fragment_depth, depth));
+    vst1q_f32(depths + lane, vbslq_f32(passed, fragment_depth, depth));
+    vst1q_s32(surface_indices + lane,
+              vbslq_s32(passed, index, vld1q_s32(surface_indices + lane)));
+  }
+#else
+  for (int lane = 0; lane < 8; ++lane) {
+    float const fragment_depth = fragment_depths[lane];
+    if ((mask >> lane) & 1u && fragment_depth >= 0.f && fragment_depth <= 1.f &&
+        fragment_depth < depths[lane]) {
+      depths[lane] = fragment_depth;
+      surface_indices[lane] = surface_index;
+    }
+  }
+#endif
+}
+
+// Number of covered pixels of a tile row passing a GL_EQUAL depth test
+static unsigned int count_row(unsigned int mask, const float *fragment_depths,
+                              const float *depths) {
+  unsigned int passed_count{0u};
+#if defined(__SSE2__) || defined(_M_X64)
+  for (int lane = 0; lane < 8; lane += 4) {
+    __m128 const fragment_depth = _mm_loadu_ps(fragment_depths + lane);
+    __m128 const passed = _mm_and_ps(clip_depths(expand_mask(mask >> lane), fragment_depth),
+                                     _mm_cmpeq_ps(fragment_depth, _mm_loadu_ps(depths + lane)));
+    unsigned int bits = static_cast<unsigned int>(_mm_movemask_ps(passed));
+    for (; bits; bits &= bits - 1u) {
+      ++passed_count;
+    }
+  }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  for (int lane = 0; lane < 8; lane += 4) {
+    float32x4_t const fragment_depth = vld1q_f32(fragment_depths + lane);
+    uint32x4_t const passed = vandq_u32(clip_depths(expand_mask(mask >> lane), fragment_depth),
+                                        vceqq_f32(fragment_depth, vld1q_f32(depths + lane)));
+    passed_count += vaddvq_u32(vshrq_n_u32(passed, 31));
+  }
+#else
+  for (int lane = 0; lane < 8; ++lane) {
+    float const fragment_depth = fragment_depths[lane];
+    if ((mask >> lane) & 1u && fragment_depth >= 0.f && fragment_depth <= 1.f &&
+        fragment_depth == depths[lane]) {
+      ++passed_count;
+    }
+  }
+#endif
+  return passed_count;
+}
+
+Rasterizer::Rasterizer(int size)
+    : size(size), viewport_size(size), tiles_per_row((size + tile_size - 1) / tile_size),
+      depths(static_cast<std::size_t>(tiles_per_row) * tiles_per_row * tile_pixels),
+      surface_indices(depths.size()) {
+  clear();
+}
+
+void Rasterizer::set_viewport_size(int viewport_size_in) {
+  viewport_size = std::clamp(viewport_size_in, 1, size);
+}
+
+void Rasterizer::clear() {
+  int const viewport_tiles = (viewport_size + tile_size - 1) / tile_size;
+  for (int tile_y = 0; tile_y < viewport_tiles; ++tile_y) {
+    auto const begin = static_cast<std::ptrdiff_t>(tile_y) * tiles_per_row * tile_pixels;
+    auto const end = begin + static_cast<std::ptrdiff_t>(viewport_tiles) * tile_pixels;
+    std::fill(depths.begin() + begin, depths.begin() + end, 1.f);
+    std::fill(surface_indices.begin() + begin, surface_indices.begin() + end, -1);
+  }
+}
+
+void Rasterizer::draw(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                      const SurfaceBuffer &surface_buffer, mat4x4 mvp) {
+  rasterize(vertices, indices, surface_buffer, mvp, Mode::draw);
+}
+
+std::uint64_t Rasterizer::count(const std::vector<float> &vertices,
+                                const std::vector<unsigned int> &indices,
+                                const SurfaceBuffer &surface_buffer, mat4x4 mvp) {
+  return rasterize(vertices, indices, surface_buffer, mvp, Mode::count);
+}
+
+void Rasterizer::count_surface_pixels(std::vector<std::uint64_t> &pixel_counts) const {
+  std::fill(pixel_counts.begin(), pixel_counts.end(), 0u);
+  for (auto const surface_index : surface_indices) {
+    if (surface_index >= 0) {
+      ++pixel_counts[surface_index];
+    }
+  }
+}
+
+std::uint64_t Rasterizer::rasterize(const std::vector<float> &vertices,
+                                    const std::vector<unsigned int> &indices,
+                                    const SurfaceBuffer &surface_buffer, mat4x4 mvp, Mode mode) {
+  static constexpr unsigned int vertex_size{3};
+  std::uint64_t pixel_count{0u};
+  unsigned int const end = surface_buffer.begin + surface_buffer.count;
+  for (unsigned int first = surface_buffer.begin; first + 3 <= end; first += 3) {
+    Vertex triangle[3];
+    bool needs_clipping{false};
+    for (unsigned int i = 0; i < 3; ++i) {
+      const float *vertex = &vertices[indices[first + i] * vertex_size];
+      vec4 position = {vertex[0], vertex[1], vertex[2], 1.f};
+      vec4 clip_position;
+      mat4x4_mul_vec4(clip_position, mvp, position);
+      triangle[i] = {clip_position[0] / clip_position[3], clip_position[1] / clip_position[3],
+                     clip_position[2] / clip_position[3]};
+      needs_clipping = needs_clipping || std::abs(triangle[i].x) > guard_band ||
+                       std::abs(triangle[i].y) > guard_band;
+    }
+
+    // Skip triangles entirely outside the view volume
+    bool outside{false};
+    for (double const Vertex::*coordinate : {&Vertex::x, &Vertex::y, &Vertex::z}) {
+      outside = outside || std::all_of(std::begin(triangle), std::end(triangle),
+                                       [&](const Vertex &v) { return v.*coordinate < -1.; });
+      outside = outside || std::all_of(std::begin(triangle), std::end(triangle),
+                                       [&](const Vertex &v) { return v.*coordinate > 1.; });
+    }
+    if (outside) {
+      continue;
+    }
+
+    pixel_count += needs_clipping ? rasterize_clipped(triangle, surface_buffer.index, mode)
+                                  : rasterize_triangle(triangle, surface_buffer.index, mode);
+  }
+  return pixel_count;
+}
+
+std::uint64_t Rasterizer::rasterize_clipped(const Vertex (&triangle)[3], int surface_index,
+                                            Mode mode) {
+  // Clip against the guard band (Sutherland-Hodgman) so snapped coordinates stay small enough
+  // for exact edge functions, then rasterize the result as a triangle fan.
+  static constexpr std::size_t max_vertices{7};
+  Vertex polygon[max_vertices], clipped[max_vertices];
+  std::copy(std::begin(triangle), std::end(triangle), polygon);
+  std::size_t vertex_count{3};
+
+  for (double const Vertex::*coordinate : {&Vertex::x, &Vertex::y}) {
+    for (double const sign : {-1., 1.}) {
+      std::size_t clipped_count{0};
+      for (std::size_t i = 0; i < vertex_count; ++i) {
+        const Vertex &current = polygon[i];
+        const Vertex &next = polygon[(i + 1) % vertex_count];
+        double const current_distance = guard_band - sign * current.*coordinate;
+        double const next_distance = guard_band - sign * next.*coordinate;
+        if (current_distance >= 0.) {
+          clipped[clipped_count++] = current;
+        }
+        if ((current_distance >= 0.) != (next_distance >= 0.)) {
+          double const t = current_distance / (current_distance - next_distance);
+          clipped[clipped_count++] = {current.x + t * (next.x - current.x),
+                                      current.y + t * (next.y - current.y),
+                                      current.z + t * (next.z - current.z)};
+        }
+      }
+      std::copy(clipped, clipped + clipped_count, polygon);
+      vertex_count = clipped_count;
+      if (vertex_count < 3) {
+        return 0u;
+      }
+    }
+  }
+
+  std::uint64_t pixel_count{0u};
+  for (std::size_t i = 1; i + 1 < vertex_count; ++i) {
+    const Vertex fan_triangle[3] = {polygon[0], polygon[i], polygon[i + 1]};
+    pixel_count += rasterize_triangle(fan_triangle, surface_index, mode);
+  }
+  return pixel_count;
+}
+
+std::uint64_t Rasterizer::rasterize_triangle(const Vertex (&triangle)[3], int surface_index,
+                                             Mode mode) {
+  // Snap window coordinates to the subpixel grid. Depths are mapped to [0, 1].
+  double const scale = static_cast<double>(viewport_size) * subpixel_steps;
+  double x[3], y[3], depth[3];
+  for (int i = 0; i < 3; ++i) {
+    x[i] = std::nearbyint((triangle[i].x * 0.5 + 0.5) * scale);
+    y[i] = std::nearbyint((triangle[i].y * 0.5 + 0.5) * scale);
+    depth[i] = triangle[i].z * 0.5 + 0.5;
+  }
+
+  double area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area == 0.) {
+    return 0u;
+  }
+  if (area < 0.) {
+    // No face culling: make the winding counter-clockwise
+    std::swap(x[1], x[2]);
+    std::swap(y[1], y[2]);
+    std::swap(depth[1], depth[2]);
+    area = -area;
+  }
+
+  // Pixel centers sit halfway between subpixel grid lines
+  static constexpr double half_pixel{subpixel_steps / 2};
+  int const min_x = std::max(
+      0, static_cast<int>(std::ceil((*std::min_element(x, x + 3) - half_pixel) / subpixel_steps)));
+  int const max_x =
+      std::min(viewport_size - 1,
+               static_cast<int>(std::floor((*std::max_element(x, x + 3) - half_pixel) /
+                                           subpixel_steps)));
+  int const min_y = std::max(
+      0, static_cast<int>(std::ceil((*std::min_element(y, y + 3) - half_pixel) / subpixel_steps)));
+  int const max_y =
+      std::min(viewport_size - 1,
+               static_cast<int>(std::floor((*std::max_element(y, y + 3) - half_pixel) /
+                                           subpixel_steps)));
+  if (min_x > max_x || min_y > max_y) {
+    return 0u;
+  }
+
+  // Edge i is opposite vertex i, so its edge function weights vertex i's depth
+  TriangleSetup setup{};
+  double x_deltas[3], y_deltas[3], y_steps[3];
+  for (int i = 0; i < 3; ++i) {
+    int const from = (i + 1) % 3, to = (i + 2) % 3;
+    x_deltas[i] = x[to] - x[from];
+    y_deltas[i] = y[to] - y[from];
+    setup.x_steps[i] = -y_deltas[i] * subpixel_steps;
+    y_steps[i] = x_deltas[i] * subpixel_steps;
+    // Top-left rule: pixel centers exactly on an edge belong to top and left edges only
+    bool const is_top_left = y_deltas[i] < 0. || (y_deltas[i] == 0. && x_deltas[i] < 0.);
+    setup.thresholds[i] = is_top_left ? 0. : 1.;
+    setup.weights[i] = depth[i] / area;
+  }
+
+  static const RowEvaluator evaluate_tile_row = get_row_evaluator();
+  static_assert(tile_size == 8, "Row kernels process eight pixels");
+  std::uint64_t pixel_count{0u};
+  float row_depths[tile_size];
+  for (int tile_y = min_y / tile_size; tile_y <= max_y / tile_size; ++tile_y) {
+    int const tile_min_y = tile_y * tile_size;
+    int const first_row = std::max(min_y - tile_min_y, 0);
+    int const last_row = std::min(max_y - tile_min_y, tile_size - 1);
+    for (int tile_x = min_x / tile_size; tile_x <= max_x / tile_size; ++tile_x) {
+      int const tile_min_x = tile_x * tile_size;
+
+      // Edge functions at the center of the tile's first pixel
+      double const center_x = tile_min_x * subpixel_steps + half_pixel;
+      double const center_y = tile_min_y * subpixel_steps + half_pixel;
+      double tile_edges[3];
+      bool rejected{false};
+      for (int i = 0; i < 3; ++i) {
+        int const from = (i + 1) % 3;
+        tile_edges[i] =
+            x_deltas[i] * (center_y - y[from]) - y_deltas[i] * (center_x - x[from]);
+        double const tile_max = tile_edges[i] +
+                                std::max(0., (tile_size - 1) * setup.x_steps[i]) +
+                                std::max(0., (tile_size - 1) * y_steps[i]);
+        rejected = rejected || tile_max < setup.thresholds[i];
+      }
+      if (rejected) {
+        continue;
+      }
+
+      unsigned int const first_column = static_cast<unsigned int>(std::max(min_x - tile_min_x, 0));
+      unsigned int const last_column =
+          static_cast<unsigned int>(std::min(max_x - tile_min_x, tile_size - 1));
+      unsigned int const column_mask = ((2u << last_column) - 1u) & ~((1u << first_column) - 1u);
+      std::size_t const tile_offset =
+          static_cast<std::size_t>(tile_y * tiles_per_row + tile_x) * tile_pixels;
+
+      for (int row = first_row; row <= last_row; ++row) {
+        double const row_edges[3] = {tile_edges[0] + row * y_steps[0],
+                                     tile_edges[1] + row * y_steps[1],
+                                     tile_edges[2] + row * y_steps[2]};
+        unsigned int const mask = evaluate_tile_row(setup, row_edges, row_depths) & column_mask;
+        if (mask == 0u) {
+          continue;
+        }
+        std::size_t const row_offset = tile_offset + static_cast<std::size_t>(row) * tile_size;
+        if (mode == Mode::draw) {
+          draw_row(mask, row_depths, &depths[row_offset], &surface_indices[row_offset],
+                   surface_index);
+        } else {
+          pixel_count += count_row(mask, row_depths, &depths[row_offset]);
+        }
+      }
+    }
+  }
+  return pixel_count;
+}
+
+} // namespace Penumbra
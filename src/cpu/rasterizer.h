@@ -0,0 +1,66 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef RASTERIZER_H_
+#define RASTERIZER_H_
+
+// Standard
+#include <cstdint>
+#include <vector>
+
+// Vendor
+#include <linmath.h> // Part of GLFW
+
+// Penumbra
+#include "../context.h"
+
+namespace Penumbra {
+
+// Depth-only software rasterizer matching OpenGL's GL_LESS draws and GL_EQUAL occlusion counts
+class Rasterizer {
+public:
+  explicit Rasterizer(int size);
+
+  // Pixels on each side (up to size) used from the next clear
+  void set_viewport_size(int viewport_size);
+
+  void clear(); // Within the viewport
+
+  // Draws with a GL_LESS depth test, recording the surface index of each written pixel
+  void draw(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+            const SurfaceBuffer &surface_buffer, mat4x4 mvp);
+
+  // Counts the pixels of the surface's triangles that pass a GL_EQUAL depth test
+  std::uint64_t count(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                      const SurfaceBuffer &surface_buffer, mat4x4 mvp);
+
+  // Number of visible pixels of each surface (by surface index)
+  void count_surface_pixels(std::vector<std::uint64_t> &pixel_counts) const;
+
+private:
+  static constexpr int tile_size{8};
+  static constexpr int tile_pixels{tile_size * tile_size};
+  static constexpr int subpixel_steps{256};
+  static constexpr double guard_band{4.}; // Triangles beyond this (in NDC) are clipped
+  int size;
+  int viewport_size;
+  int tiles_per_row;
+  std::vector<float> depths;
+  std::vector<int> surface_indices;
+
+  enum class Mode { draw, count };
+
+  struct Vertex {
+    double x, y, z; // Normalized device coordinates
+  };
+
+  std::uint64_t rasterize(const std::vector<float> &vertices,
+                          const std::vector<unsigned int> &indices,
+                          const SurfaceBuffer &surface_buffer, mat4x4 mvp, Mode mode);
+  std::uint64_t rasterize_clipped(const Vertex (&triangle)[3], int surface_index, Mode mode);
+  std::uint64_t rasterize_triangle(const Vertex (&triangle)[3], int surface_index, Mode mode);
+};
+
+} // namespace Penumbra
+
+#endif // RASTERIZER_H_
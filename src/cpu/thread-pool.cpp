@@ -0,0 +1,133 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Penumbra
+#include "cpu/thread-pool.h"
+
+namespace Penumbra {
+
+ThreadPool::ThreadPool(unsigned int thread_count) {
+  // The calling thread also runs tasks, so one fewer worker thread is needed
+  unsigned int const worker_count = thread_count > 1u ? thread_count - 1u : 0u;
+  for (unsigned int slot = 0; slot <= worker_count; ++slot) {
+    queues.push_back(std::make_unique<TaskQueue>());
+  }
+  threads.reserve(worker_count);
+  for (unsigned int slot = 0; slot < worker_count; ++slot) {
+    threads.emplace_back(&ThreadPool::run_worker, this, slot);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  job_started.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+unsigned int ThreadPool::get_slot_count() const {
+  return static_cast<unsigned int>(queues.size());
+}
+
+void ThreadPool::parallel_for(std::size_t count,
+                              const std::function<void(std::size_t, unsigned int)> &task_in) {
+  auto const caller_slot = static_cast<unsigned int>(threads.size());
+  if (threads.empty() || count <= 1) {
+    for (std::size_t index = 0; index < count; ++index) {
+      task_in(index, caller_slot);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &task_in;
+    task_exception = nullptr;
+    remaining_tasks = count;
+
+    // Contiguous ranges keep neighboring tasks on the same thread until work is stolen
+    std::size_t const slot_count = queues.size();
+    for (std::size_t slot = 0; slot < slot_count; ++slot) {
+      std::lock_guard<std::mutex> queue_lock(queues[slot]->mutex);
+      for (std::size_t index = slot * count / slot_count;
+           index < (slot + 1) * count / slot_count; ++index) {
+        queues[slot]->indices.push_back(index);
+      }
+    }
+    ++job_number;
+  }
+  job_started.notify_all();
+
+  while (run_next_task(caller_slot)) {
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  job_finished.wait(lock, [this] { return remaining_tasks == 0; });
+  task = nullptr;
+  if (task_exception) {
+    std::rethrow_exception(task_exception);
+  }
+}
+
+void ThreadPool::run_worker(unsigned int slot) {
+  std::size_t last_job_number{0};
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      job_started.wait(lock, [&] { return stopping || job_number != last_job_number; });
+      if (stopping) {
+        return;
+      }
+      last_job_number = job_number;
+    }
+    while (run_next_task(slot)) {
+    }
+  }
+}
+
+bool ThreadPool::run_next_task(unsigned int slot) {
+  std::size_t index{0};
+  bool found{false};
+  {
+    auto &queue = *queues[slot];
+    std::lock_guard<std::mutex> queue_lock(queue.mutex);
+    if (!queue.indices.empty()) {
+      index = queue.indices.front();
+      queue.indices.pop_front();
+      found = true;
+    }
+  }
+  for (std::size_t offset = 1; !found && offset < queues.size(); ++offset) {
+    auto &victim = *queues[(slot + offset) % queues.size()];
+    std::lock_guard<std::mutex> queue_lock(victim.mutex);
+    if (!victim.indices.empty()) {
+      index = victim.indices.back();
+      victim.indices.pop_back();
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  try {
+    (*task)(index, slot);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!task_exception) {
+      task_exception = std::current_exception();
+    }
+  }
+
+  if (--remaining_tasks == 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    job_finished.notify_all();
+  }
+  return true;
+}
+
+} // namespace Penumbra
@@ -0,0 +1,59 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+// Standard
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Penumbra {
+
+// Work-stealing thread pool. Each parallel_for splits its range evenly across one queue per
+// thread. Threads take tasks from the front of their own queue and, once it is empty, steal from
+// the back of the others'.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int thread_count = std::thread::hardware_concurrency());
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Number of threads that may run tasks, including the thread calling parallel_for
+  [[nodiscard]] unsigned int get_slot_count() const;
+
+  // Calls task(index, slot) for each index in [0, count) and blocks until all calls finish. Slot
+  // identifies the running thread (less than get_slot_count()), e.g., to select scratch memory.
+  void parallel_for(std::size_t count,
+                    const std::function<void(std::size_t index, unsigned int slot)> &task);
+
+private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<std::size_t> indices;
+  };
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<TaskQueue>> queues; // One per slot. The last is the caller's.
+  const std::function<void(std::size_t, unsigned int)> *task{nullptr};
+  std::atomic<std::size_t> remaining_tasks{0};
+  std::exception_ptr task_exception;
+  std::mutex mutex;
+  std::condition_variable job_started, job_finished;
+  std::size_t job_number{0};
+  bool stopping{false};
+
+  void run_worker(unsigned int slot);
+  bool run_next_task(unsigned int slot);
+};
+
+} // namespace Penumbra
+
+#endif // THREAD_POOL_H_
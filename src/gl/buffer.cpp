@@ -0,0 +1,38 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Penumbra
+#include "buffer.h"
+
+namespace Penumbra {
+
+bool has_direct_state_access() {
+  bool const is_version_4_5 = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 5);
+  return is_version_4_5 && GLAD_GL_ARB_direct_state_access && GLAD_GL_ARB_buffer_storage;
+}
+
+GLuint create_buffer(GLenum target, GLsizeiptr size, const void *data, bool dynamic) {
+  GLuint buffer;
+  if (has_direct_state_access()) {
+    // Immutable storage lets the driver place the buffer once and skip validating it on each use
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, size, data, dynamic ? GL_DYNAMIC_STORAGE_BIT : 0u);
+  } else {
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    glBufferData(target, size, data, dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+  }
+  return buffer;
+}
+
+void update_buffer(GLenum target, GLuint buffer, GLsizeiptr size, const void *data,
+                   GLintptr offset) {
+  if (has_direct_state_access()) {
+    glNamedBufferSubData(buffer, offset, size, data);
+  } else {
+    glBindBuffer(target, buffer);
+    glBufferSubData(target, offset, size, data);
+  }
+}
+
+} // namespace Penumbra
@@ -0,0 +1,29 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef BUFFER_H_
+#define BUFFER_H_
+
+// Vendor
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+namespace Penumbra {
+
+// True if the current context supports direct state access and immutable buffer storage (OpenGL
+// 4.5). Buffers are then created and updated without binding them.
+bool has_direct_state_access();
+
+// Creates a buffer of size bytes, initialized from data (if not null). Only dynamic buffers may be
+// updated by update_buffer; any buffer may be written by the GPU. Without direct state access the
+// buffer is created with glBufferData and left bound to target.
+GLuint create_buffer(GLenum target, GLsizeiptr size, const void *data, bool dynamic);
+
+// Replaces size bytes of a dynamic buffer, from offset bytes. Without direct state access the
+// buffer is left bound to target.
+void update_buffer(GLenum target, GLuint buffer, GLsizeiptr size, const void *data,
+                   GLintptr offset = 0);
+
+} // namespace Penumbra
+
+#endif // BUFFER_H_
@@ -1,6 +1,12 @@
 /* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
  * See the LICENSE file for additional terms and conditions. */
 
+// Standard
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
 #ifndef NDEBUG
 #ifdef __unix__
 #include <cfenv>
@@ -9,11 +15,11 @@
 
 // Penumbra
 #include <penumbra/logging.h>
-#include "context.h"
+#include "gl/context.h"
 
 namespace Penumbra {
 
-const char *Context::render_vertex_shader_source =
+const char *GLContext::render_vertex_shader_source =
     R"src(
   #version 120
   uniform mat4 MVP;
@@ -27,7 +33,7 @@ const char *Context::render_vertex_shader_source =
   }
 )src";
 
-const char *Context::render_fragment_shader_source =
+const char *GLContext::render_fragment_shader_source =
     R"src(
   #version 120
   varying vec3 color;
@@ -37,7 +43,7 @@ const char *Context::render_fragment_shader_source =
   }
 )src";
 
-const char *Context::calculation_vertex_shader_source =
+const char *GLContext::calculation_vertex_shader_source =
     R"src(
   #version 120
   uniform mat4 MVP;
@@ -48,80 +54,200 @@ const char *Context::calculation_vertex_shader_source =
   }
 )src";
 
-thread_local static Courierr::Courierr *glfw_logger{nullptr};
+// Core profile path: the MVP is read from the view uniform buffer, updated without binding
+const char *GLContext::core_calculation_vertex_shader_source =
+    R"src(
+  #version 450 core
+  layout(std140, binding = 0) uniform View { mat4 MVP; };
+  layout(location = 0) in vec3 vPos;
+  void main()
+  {
+    gl_Position = MVP * vec4(vPos, 1.0);
+  }
+)src";
 
-static void glfw_error_callback(int, const char *description) {
-  if (glfw_logger) {
-    glfw_logger->info(fmt::format("GLFW message: {}", description));
+const char *GLContext::surface_id_fragment_shader_source =
+    R"src(
+  #version 120
+  uniform vec4 surface_id;
+  void main()
+  {
+    gl_FragColor = surface_id;
   }
-}
+)src";
 
-Context::Context(GLint size_in, Courierr::Courierr *logger_in) : size(size_in), logger(logger_in) {
+// Surface IDs by triangle, for drawing the model with one call (requires OpenGL 3.2 for
+// gl_PrimitiveID, which counts the triangles of the draw). Triangles of no surface hold zero.
+const char *GLContext::primitive_surface_id_vertex_shader_source =
+    R"src(
+  #version 150
+  uniform mat4 MVP;
+  in vec3 vPos;
+  void main()
+  {
+    gl_Position = MVP * vec4(vPos, 1.0);
+  }
+)src";
 
-  glfw_logger = logger;
-  glfwSetErrorCallback(glfw_error_callback);
+const char *GLContext::primitive_surface_id_fragment_shader_source =
+    R"src(
+  #version 150
+  uniform sampler2D surface_ids;
+  out vec4 surface_id;
+  void main()
+  {
+    int width = textureSize(surface_ids, 0).x;
+    surface_id = texelFetch(surface_ids, ivec2(gl_PrimitiveID % width, gl_PrimitiveID / width), 0);
+  }
+)src";
+
+// Requires a "#version 410" header enabling gl_ViewportIndex output from vertex shaders
+const char *GLContext::batch_vertex_shader_source =
+    R"src(
+  uniform mat4 MVP[MAX_VIEWS];
+  uniform int view_offset;
+  layout(location = 0) in vec3 vPos;
+  void main()
+  {
+    int view = view_offset + gl_InstanceID;
+    gl_Position = MVP[view] * vec4(vPos, 1.0);
+    gl_ViewportIndex = view;
+  }
+)src";
+
+GLContext::GLContext(GLint size_in, GLPlatform platform, Courierr::Courierr *logger_in)
+    : Context(size_in, logger_in) {
 
-  if (!glfwInit()) {
+  if (!GLPlatformContext::is_supported(platform)) {
     throw PenumbraException(
-        "Unable to initialize GLFW. Either there is no GPU, libraries are missing, or "
-        "some other error happened.",
+        fmt::format("The requested OpenGL platform, {}, is not supported by this build.",
+                    GLPlatformContext::get_name(platform)),
         *logger);
   }
 
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
-#ifndef NDEBUG
-#ifdef __unix__
-  // Temporarily Disable floating point exceptions
-  fedisableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
-#endif
-#endif
-  window = glfwCreateWindow(1, 1, "Penumbra", nullptr, nullptr);
-#ifndef NDEBUG
-#ifdef __unix__
-  feenableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
-#endif
-#endif
-  glfwMakeContextCurrent(window);
-  if (!window) {
+  platform_context = GLPlatformContext::create(platform, logger);
+  if (!platform_context) {
     throw PenumbraException(
         "Unable to create OpenGL context. OpenGL 2.1+ is required to perform GPU "
         "accelerated shading calculations.",
         *logger);
   }
+  window = platform_context->get_window();
 
   // OpenGL extension loader
-  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+  if (!gladLoadGLLoader(platform_context->get_loader())) {
     throw PenumbraException("Failed to load required OpenGL extensions.", *logger);
   }
 
-  if (!glfwExtensionSupported("GL_ARB_vertex_array_object") &&
-      !glfwExtensionSupported("GL_APPLE_vertex_array_object")) {
+  if (!GLAD_GL_ARB_vertex_array_object && !GLAD_GL_APPLE_vertex_array_object) {
     throw PenumbraException("The current version of OpenGL does not support vertex array objects.",
                             *logger);
   }
-  if (!glfwExtensionSupported("GL_EXT_framebuffer_object")) {
+  if (!GLAD_GL_EXT_framebuffer_object) {
     throw PenumbraException("The current version of OpenGL does not support framebuffer objects.",
                             *logger);
   }
 
-  GLint max_view_size[2];
+  // Largest viewport the hardware renders. Without 64-bit query results (or counters), each tile's
+  // occlusion query must also count at most 2^32 - 1 samples, at the largest sample count.
+  GLint max_view_size[2], max_renderbuffer_size, max_samples{1}, query_counter_bits;
   glGetIntegerv(GL_MAX_VIEWPORT_DIMS, &max_view_size[0]);
-  GLint max_res = std::min(GL_MAX_RENDERBUFFER_SIZE_EXT, max_view_size[0]);
-  if (size >= max_res) {
-    logger->warning(
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE_EXT, &max_renderbuffer_size);
+  if (GLAD_GL_ARB_framebuffer_object) {
+    glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+  }
+  glGetQueryiv(GL_SAMPLES_PASSED, GL_QUERY_COUNTER_BITS, &query_counter_bits);
+  auto max_counted_size = std::numeric_limits<GLsizei>::max();
+  if (!GLAD_GL_ARB_timer_query || query_counter_bits <= 32) {
+    max_counted_size = static_cast<GLsizei>(std::sqrt(
+        static_cast<double>(std::numeric_limits<GLuint>::max()) / std::max(max_samples, 1)));
+  }
+  hardware_tile_size =
+      std::min({max_view_size[0], max_view_size[1], max_renderbuffer_size, max_counted_size});
+  tile_size = hardware_tile_size;
+  buffer_size = std::min(size, tile_size);
+  if (size > tile_size) {
+    logger->info(
         fmt::format("The selected resolution, {}, is larger than the maximum allowable by your "
-                    "hardware, {}. The size will be reset to be equal to the maximum allowable.",
-                    size, max_res));
-    size = max_res;
+                    "hardware, {}. Surfaces will be rendered in tiles.",
+                    size, tile_size));
   }
 
-  glViewport(0, 0, size, size);
+  glViewport(0, 0, buffer_size, buffer_size);
 
+  if (window) {
+    initialize_window();
+  }
+
+  glEnable(GL_DEPTH_TEST);
+
+  // Shader programs
+
+  // Program for off-screen calculation. With OpenGL 4.5, a core profile program reads the MVP
+  // from a uniform buffer (see set_mvp).
+  if (has_direct_state_access()) {
+    calculation_program =
+        std::make_unique<GLProgram>(core_calculation_vertex_shader_source, nullptr, logger);
+    view_buffer_object = create_buffer(GL_UNIFORM_BUFFER, sizeof(mat4x4), nullptr, true);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, view_buffer_object);
+    view_buffer_set = true;
+  } else {
+    calculation_program =
+        std::make_unique<GLProgram>(calculation_vertex_shader_source, nullptr, logger);
+  }
+
+  glBindAttribLocation(calculation_program->get(), 0, "vPos");
+
+  // Program for on-screen rendering (mostly for debugging)
+  render_program = std::make_unique<GLProgram>(render_vertex_shader_source,
+                                               render_fragment_shader_source, logger);
+  glBindAttribLocation(render_program->get(), 0, "vPos");
+  vertex_color_location = glGetUniformLocation(render_program->get(), "vCol");
+
+  // Program for off-screen surface ID calculation
+  surface_id_program = std::make_unique<GLProgram>(calculation_vertex_shader_source,
+                                                   surface_id_fragment_shader_source, logger);
+  glBindAttribLocation(surface_id_program->get(), 0, "vPos");
+  surface_id_location = glGetUniformLocation(surface_id_program->get(), "surface_id");
+  bool const is_version_3_2 = GLVersion.major > 3 || (GLVersion.major == 3 && GLVersion.minor >= 2);
+  if (is_version_3_2) {
+    primitive_surface_id_program = std::make_unique<GLProgram>(
+        primitive_surface_id_vertex_shader_source, primitive_surface_id_fragment_shader_source,
+        logger);
+    glBindAttribLocation(primitive_surface_id_program->get(), 0, "vPos");
+    glGenTextures(1, &surface_id_table);
+  }
+
+  // Culling on the GPU, drawing with indirect commands
+  if (GLCuller::is_supported()) {
+    culler = std::make_unique<GLCuller>(logger);
+  }
+
+  // Surface ID buffers counted on the GPU
+  if (GLHistogram::is_supported()) {
+    histogram = std::make_unique<GLHistogram>(logger);
+  }
+
+  // Frame and render buffers
+  glGenFramebuffersEXT(1, &framebuffer_object);
+  glGenRenderbuffersEXT(1, &renderbuffer_object);
+  initialize_off_screen_buffers();
+
+  // Batched (multi-view) rendering requires writing gl_ViewportIndex from the vertex shader
+  bool const is_version_4_1 = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1);
+  if (is_version_4_1 && GLAD_GL_ARB_viewport_array && GLAD_GL_ARB_draw_instanced &&
+      (GLAD_GL_ARB_shader_viewport_layer_array || GLAD_GL_AMD_vertex_shader_viewport_index)) {
+    initialize_batch_buffers();
+  }
+
+  // Start in off-screen mode
+  initialize_off_screen_mode();
+}
+
+void GLContext::initialize_window() {
   // Input callbacks for orbit mode
   glfwSetWindowUserPointer(window, this);
-#define glfwWPtr(w) static_cast<Context *>(glfwGetWindowUserPointer(w))
+#define glfwWPtr(w) static_cast<GLContext *>(glfwGetWindowUserPointer(w))
 
   auto key_callback = [](GLFWwindow *w, int key, int /*scancode*/, int action, int /*mods*/) {
     if (key == GLFW_KEY_W && action == GLFW_PRESS) {
@@ -186,41 +312,39 @@ Context::Context(GLint size_in, Courierr::Courierr *logger_in) : size(size_in),
   glfwSetCursorPosCallback(window, cursor_position_callback);
 
   glfwSwapInterval(1);
-
-  glEnable(GL_DEPTH_TEST);
-
-  // Shader programs
-
-  // Program for off-screen calculation
-  calculation_program =
-      std::make_unique<GLProgram>(calculation_vertex_shader_source, nullptr, logger);
-
-  glBindAttribLocation(calculation_program->get(), 0, "vPos");
-
-  // Program for on-screen rendering (mostly for debugging)
-  render_program = std::make_unique<GLProgram>(render_vertex_shader_source,
-                                               render_fragment_shader_source, logger);
-  glBindAttribLocation(render_program->get(), 0, "vPos");
-  vertex_color_location = glGetUniformLocation(render_program->get(), "vCol");
-
-  // Frame and render buffers
-  glGenFramebuffersEXT(1, &framebuffer_object);
-  glGenRenderbuffersEXT(1, &renderbuffer_object);
-
-  // Start in off-screen mode
-  initialize_off_screen_mode();
 }
 
-Context::~Context() {
-  glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+GLContext::~GLContext() {
+  release_query_set(query_set);
+  for (auto &set : query_ring) {
+    release_query_set(set);
+  }
   glDeleteFramebuffersEXT(1, &framebuffer_object);
   glDeleteRenderbuffersEXT(1, &renderbuffer_object);
+  release_surface_id_buffers();
+  if (shared_depth_buffers_set) {
+    glDeleteFramebuffersEXT(1, &shared_depth_framebuffer_object);
+    glDeleteRenderbuffersEXT(1, &shared_depth_renderbuffer_object);
+  }
+  if (view_buffer_set) {
+    glDeleteBuffers(1, &view_buffer_object);
+  }
   glDeleteProgram(calculation_program->get());
   glDeleteProgram(render_program->get());
+  glDeleteProgram(surface_id_program->get());
+  if (primitive_surface_id_program) {
+    glDeleteProgram(primitive_surface_id_program->get());
+    glDeleteTextures(1, &surface_id_table);
+  }
+  if (batch_program) {
+    glDeleteQueries(static_cast<GLsizei>(batch_queries.size()), batch_queries.data());
+    glDeleteFramebuffersEXT(1, &batch_framebuffer_object);
+    glDeleteRenderbuffersEXT(1, &batch_renderbuffer_object);
+    glDeleteProgram(batch_program->get());
+  }
   model.clear_model();
-  glfwTerminate();
 }
-void Context::toggle_wire_frame_mode() {
+void GLContext::toggle_wire_frame_mode() {
   is_wire_frame_mode = !is_wire_frame_mode;
   if (is_wire_frame_mode) {
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -228,7 +352,7 @@ void Context::toggle_wire_frame_mode() {
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
   }
 }
-void Context::toggle_camera_mode() {
+void GLContext::toggle_camera_mode() {
   is_camera_mode = !is_camera_mode;
   left_mouse_button_pressed =
       false; // There are things, like killing the last window, that may have left this true.
@@ -241,132 +365,104 @@ void Context::toggle_camera_mode() {
   }
 }
 
-std::string Context::get_vendor_name() {
+GLPlatform GLContext::get_platform() const {
+  return platform_context->get_platform();
+}
+
+std::string GLContext::get_vendor_name() {
   return reinterpret_cast<const char *>(glGetString(GL_VENDOR));
 }
 
-void Context::clear_model() {
+void GLContext::clear_model() {
+  Context::clear_model();
   model.clear_model();
-  glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
-  model_is_set = false;
+  if (culler) {
+    culler->clear_model();
+  }
+  surface_id_table_set = false;
+  release_query_set(query_set);
+  for (auto &set : query_ring) {
+    release_query_set(set);
+  }
 }
 
-void Context::set_model(const std::vector<float> &vertices,
-                        const std::vector<SurfaceBuffer> &surface_buffers) {
-  if (model_is_set) {
-    clear_model();
+void GLContext::allocate_query_set(QuerySet &set) {
+  auto const surface_count = model.surface_buffers.size();
+  set.queries.resize(surface_count);
+  set.pixel_areas.resize(surface_count);
+  set.pixel_counts = std::vector<std::uint64_t>(surface_count, 0u);
+  set.pending_queries = std::vector<bool>(surface_count, false);
+  set.analytic_pssas.resize(surface_count);
+  set.is_analytic = std::vector<bool>(surface_count, false);
+  set.tile_queries.resize(surface_count);
+  set.pending_tiles = std::vector<std::size_t>(surface_count, 0u);
+  glGenQueries(static_cast<GLsizei>(surface_count), set.queries.data());
+  if (histogram) {
+    set.counts_buffer = GLHistogram::create_counts(surface_count);
   }
+}
 
-  // set model vertices
-  model.set_vertices(vertices);
-  model.set_surface_buffers(surface_buffers);
-  queries.resize(surface_buffers.size());
-  pixel_areas.resize(surface_buffers.size());
-  pixel_counts = std::vector<GLint>(surface_buffers.size(), -1);
-
-  glGenQueries(static_cast<GLsizei>(queries.size()), queries.data());
-
-  float box_left = MAX_FLOAT, box_bottom = MAX_FLOAT, box_front = MAX_FLOAT;
-  float box_right = -MAX_FLOAT, box_top = -MAX_FLOAT, box_back = -MAX_FLOAT;
-
-  // calculate bounding box
-  for (int i = 0; i < (int)vertices.size(); i += GLModel::vertex_size) {
-    float x = vertices[i];
-    float y = vertices[i + 1];
-    float z = vertices[i + 2];
-    box_left = std::min(x, box_left);
-    box_right = std::max(x, box_right);
-    box_front = std::min(y, box_front);
-    box_back = std::max(y, box_back);
-    box_bottom = std::min(z, box_bottom);
-    box_top = std::max(z, box_top);
-  }
-
-  float tempBox[8][4] = {
-      {box_left, box_front, box_bottom, 0.0},  {box_left, box_front, box_top, 0.0},
-      {box_left, box_back, box_bottom, 0.0},   {box_left, box_back, box_top, 0.0},
-      {box_right, box_front, box_bottom, 0.0}, {box_right, box_front, box_top, 0.0},
-      {box_right, box_back, box_bottom, 0.0},  {box_right, box_back, box_top, 0.0}};
-
-  for (std::size_t i = 0; i < 8; i++) {
-    for (std::size_t j = 0; j < 4; j++) {
-      model_bounding_box[i][j] = tempBox[i][j];
-    }
+void GLContext::release_query_set(QuerySet &set) {
+  glDeleteQueries(static_cast<GLsizei>(set.queries.size()), set.queries.data());
+  set.queries.clear();
+  for (auto &tile_queries : set.tile_queries) {
+    glDeleteQueries(static_cast<GLsizei>(tile_queries.size()), tile_queries.data());
   }
-
-  model_is_set = true;
+  set.tile_queries.clear();
+  if (set.counts_buffer) {
+    glDeleteBuffers(1, &set.counts_buffer);
+    set.counts_buffer = 0;
+  }
+  set.pending_counts = false;
+  if (set.fence) {
+    glDeleteSync(set.fence);
+    set.fence = nullptr;
+  }
+  set.ticket = 0;
 }
 
-float Context::set_scene(mat4x4 sun_view, const SurfaceBuffer *surface_buffer, bool clip_far) {
-
-  if (!model_is_set) {
-    throw PenumbraException("Model has not been set. Cannot set OpenGL scene.", *logger);
+void GLContext::set_model(const std::vector<float> &vertices_in,
+                          const std::vector<unsigned int> &indices_in,
+                          const std::vector<SurfaceBuffer> &surface_buffers_in) {
+  if (model_is_set) {
+    clear_model();
   }
 
-  mat4x4_dup(view, sun_view);
-
-  // calculate clipping planes in rendered coordinates
-  left = MAX_FLOAT;
-  right = -MAX_FLOAT;
-  bottom = MAX_FLOAT;
-  top = -MAX_FLOAT;
-  near_ = -MAX_FLOAT;
-  far_ = MAX_FLOAT;
-
-  // If surface buffer has not been set use entire model instead.
-  GLuint beg = surface_buffer ? surface_buffer->begin * GLModel::vertex_size : 0;
-  GLuint end = surface_buffer ? surface_buffer->begin * GLModel::vertex_size +
-                                    surface_buffer->count * GLModel::vertex_size
-                              : static_cast<GLuint>(model.vertex_array.size());
-
-  for (GLuint i = beg; i < end; i += GLModel::vertex_size) {
-    vec4 translation;
-    vec4 point = {model.vertex_array[i], model.vertex_array[i + 1], model.vertex_array[i + 2], 0};
-    mat4x4_mul_vec4(translation, view, point);
-    left = std::min(translation[0], left);
-    right = std::max(translation[0], right);
-    bottom = std::min(translation[1], bottom);
-    top = std::max(translation[1], top);
-    // near_ = min(translation[2], near_);
-    far_ = std::min(translation[2], far_);
+  Context::set_model(vertices_in, indices_in, surface_buffers_in);
+  model.set_vertices(vertices, indices);
+  model.set_surface_buffers(surface_buffers);
+  if (culler) {
+    culler->set_model(vertices, indices, surface_buffers);
   }
+  surface_id_table_set = false;
+  allocate_query_set(query_set);
+}
 
-  // Use model box to determine near clipping plane (and far if looking interior)
-  for (auto const coordinate : model_bounding_box) {
-    vec4 translation;
-    mat4x4_mul_vec4(translation, view, coordinate);
-    near_ = std::max(translation[2], near_);
-    if (!clip_far) {
-      far_ = std::min(translation[2], far_);
-    }
+void GLContext::update_model(const std::vector<float> &vertices_in,
+                             const std::vector<unsigned int> &indices_in,
+                             const std::vector<SurfaceBuffer> &surface_buffers_in,
+                             const std::vector<unsigned int> &changed_surfaces,
+                             const std::vector<std::pair<unsigned int, unsigned int>>
+                                 &rewritten_vertices) {
+  if (!model_is_set || surface_buffers_in.size() != surface_buffers.size()) {
+    set_model(vertices_in, indices_in, surface_buffers_in);
+    return;
   }
 
-  // account for camera position
-  near_ -= 0.999f; // For some reason, -1. is too tight when sun is perpendicular to the surface.
-  far_ -= 1.001f;  // For some reason, -1. is too tight when sun is perpendicular to the surface.
-
-  // Grow horizontal extents of view by one pixel on each side
-
-  const float inverse_size = 1.f / static_cast<float>(size);
-
-  const float delta_x = (right - left) * inverse_size;
-  left -= delta_x;
-  right += delta_x;
-
-  // Grow vertical extents of view by one pixel on each side
-  const float delta_y = (top - bottom) * inverse_size;
-  bottom -= delta_y;
-  top += delta_y;
-
-  // calculate pixel area (A[i]*cos(theta) for each pixel of the surface)
-  // multiplies by the number of pixels to get projected sunlit surface area
+  // The query sets (one query per surface) are kept
+  Context::update_model(vertices_in, indices_in, surface_buffers_in, changed_surfaces,
+                        rewritten_vertices);
+  model.update_vertices(vertices, indices, surface_buffers, changed_surfaces, rewritten_vertices);
+  if (culler) {
+    culler->update_surfaces(vertices, indices, surface_buffers, changed_surfaces);
+  }
+  surface_id_table_set = false;
+}
 
-  auto const pixel_area = (right - left) * (top - bottom) * inverse_size * inverse_size;
+float GLContext::set_scene(mat4x4 sun_view, const SurfaceBuffer *surface_buffer, bool clip_far) {
+  auto const pixel_area = set_projection(sun_view, surface_buffer, clip_far);
 
   if (pixel_area > 0.0) {
-    mat4x4_ortho(projection, left, right, bottom, top, -near_, -far_);
-    mat4x4_mul(mvp, projection, view);
-
     set_mvp();
   }
 
@@ -375,7 +471,7 @@ float Context::set_scene(mat4x4 sun_view, const SurfaceBuffer *surface_buffer, b
   return pixel_area;
 }
 
-void Context::calculate_camera_view() {
+void GLContext::calculate_camera_view() {
   // Transpose changes the affects of consecutive rotations from local to global space.
   mat4x4 temporary_matrix;
   mat4x4_transpose(temporary_matrix, camera_view);
@@ -384,11 +480,21 @@ void Context::calculate_camera_view() {
   mat4x4_transpose(camera_view, temporary_matrix); // Transpose back.
 }
 
-void Context::set_mvp() {
+void GLContext::set_mvp() {
+  if (mvp_location < 0 && view_buffer_set) {
+    // Core profile calculation program
+    update_buffer(GL_UNIFORM_BUFFER, view_buffer_object, sizeof(mat4x4), mvp);
+    return;
+  }
   glUniformMatrix4fv(mvp_location, 1, GL_FALSE, (const GLfloat *)mvp);
 }
 
-void Context::set_camera_mvp() {
+void GLContext::use_program(const GLProgram &program) {
+  current_program = program.get();
+  glUseProgram(current_program);
+}
+
+void GLContext::set_camera_mvp() {
   float delta_width, delta_height;
   float camera_right = right;
   float camera_left = left;
@@ -417,7 +523,7 @@ void Context::set_camera_mvp() {
   glUniformMatrix4fv(mvp_location, 1, GL_FALSE, (const GLfloat *)camera_mvp);
 }
 
-void Context::draw_model() {
+void GLContext::draw_model(const SurfaceBuffer *receiver, bool cull) {
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 #ifndef NDEBUG
 #ifdef __unix__
@@ -427,7 +533,21 @@ void Context::draw_model() {
 #endif
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   glDepthFunc(GL_LESS);
-  model.draw_all();
+  if (cull) {
+    if (!draw_culled(receiver, false)) {
+      // A receiver's projection is current here (see set_scene), so its cached view applies
+      auto const *receiver_view =
+          receiver ? get_receiver_view(static_cast<unsigned int>(receiver->index), view) : nullptr;
+      if (receiver_view) {
+        model.draw_surfaces(receiver_view->surfaces_in_view);
+      } else {
+        find_surfaces_in_view(receiver, visible_surfaces);
+        model.draw_surfaces(visible_surfaces);
+      }
+    }
+  } else {
+    model.draw_all();
+  }
   glDepthFunc(GL_EQUAL);
 #ifndef NDEBUG
 #ifdef __unix__
@@ -436,7 +556,7 @@ void Context::draw_model() {
 #endif
 }
 
-void Context::draw_except(const std::vector<SurfaceBuffer> &hidden_surfaces) {
+void GLContext::draw_except(const std::vector<SurfaceBuffer> &hidden_surfaces) {
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 #ifndef NDEBUG
 #ifdef __unix__
@@ -446,7 +566,12 @@ void Context::draw_except(const std::vector<SurfaceBuffer> &hidden_surfaces) {
 #endif
   glClear(GL_DEPTH_BUFFER_BIT);
   glDepthFunc(GL_LESS);
-  model.draw_except(hidden_surfaces);
+  if (culler && !viewer_context) {
+    culler->set_hidden_surfaces(hidden_surfaces);
+  }
+  if (!draw_culled(nullptr, true)) {
+    model.draw_except(hidden_surfaces);
+  }
   glDepthFunc(GL_EQUAL);
 #ifndef NDEBUG
 #ifdef __unix__
@@ -455,10 +580,28 @@ void Context::draw_except(const std::vector<SurfaceBuffer> &hidden_surfaces) {
 #endif
 }
 
-void Context::show_rendering(const unsigned int surface_index, mat4x4 sun_view) {
-  glfwSetWindowSize(window, size, size);
-  glfwShowWindow(window);
+bool GLContext::draw_culled(const SurfaceBuffer *receiver, bool skip_hidden) {
+  // The culler's objects belong to the headless context, not the viewer's
+  if (!culler || viewer_context) {
+    return false;
+  }
+  float const bounds[2][3] = {{left, bottom, far_ + 1.f}, {right, top, MAX_FLOAT}};
+  std::array<float, 4> plane{0.f, 0.f, 0.f, -MAX_FLOAT}; // Everything lies beyond
+  int receiver_index{-1};
+  if (receiver) {
+    receiver_index = receiver->index;
+    auto const surface_index = static_cast<unsigned int>(receiver_index);
+    if (is_sun_in_front(surface_index, view)) {
+      auto const &normal = surface_normals[surface_index];
+      plane = {normal[0], normal[1], normal[2], shading_plane_offsets[surface_index]};
+    }
+  }
+  culler->draw(view, bounds, plane, receiver_index, skip_hidden, current_program);
+  return true;
+}
 
+void GLContext::show_rendering(const unsigned int surface_index, mat4x4 sun_view) {
+  open_viewer();
   initialize_render_mode();
 
   auto const &surface_buffer = model.surface_buffers[surface_index];
@@ -466,24 +609,20 @@ void Context::show_rendering(const unsigned int surface_index, mat4x4 sun_view)
 
   while (!glfwWindowShouldClose(window)) {
     glUniform3f(vertex_color_location, 0.5f, 0.5f, 0.5f);
-    draw_model();
+    draw_model(&surface_buffer, !is_camera_mode); // The camera may look beyond the sun's view
     glUniform3f(vertex_color_location, 1.f, 1.f, 1.f);
     GLModel::draw_surface(surface_buffer);
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
-  glfwSetWindowShouldClose(window, 0);
-  glfwHideWindow(window);
-
+  close_viewer();
   initialize_off_screen_mode();
 }
 
-void Context::show_interior_rendering(const std::vector<unsigned int> &hidden_surface_indices,
-                                      const unsigned interior_surface_index, mat4x4 sun_view) {
-  glfwSetWindowSize(window, size, size);
-  glfwShowWindow(window);
-
+void GLContext::show_interior_rendering(const std::vector<unsigned int> &hidden_surface_indices,
+                                        const unsigned interior_surface_index, mat4x4 sun_view) {
+  open_viewer();
   initialize_render_mode();
 
   auto const &interior_surface = model.surface_buffers[interior_surface_index];
@@ -504,72 +643,555 @@ void Context::show_interior_rendering(const std::vector<unsigned int> &hidden_su
     glfwPollEvents();
   }
 
+  close_viewer();
+  initialize_off_screen_mode();
+}
+
+void GLContext::open_viewer() {
+  if (!window) {
+    // Headless platforms have no window. Open one, with its own context, for the duration of the
+    // viewer. Contexts from different platforms cannot share objects, so the model and rendering
+    // program are recreated in the window's context.
+    viewer_context = GLPlatformContext::create(GLPlatform::glfw, logger);
+    if (!viewer_context) {
+      throw PenumbraException("Unable to create a window to show the rendering.", *logger);
+    }
+    window = viewer_context->get_window();
+    gladLoadGLLoader(viewer_context->get_loader());
+    initialize_window();
+    glEnable(GL_DEPTH_TEST);
+
+    GLModel viewer_model;
+    viewer_model.set_vertices(vertices, indices);
+    viewer_model.set_surface_buffers(model.surface_buffers);
+    headless_model = std::exchange(model, viewer_model);
+    headless_render_program = std::exchange(
+        render_program, std::make_unique<GLProgram>(render_vertex_shader_source,
+                                                    render_fragment_shader_source, logger));
+    vertex_color_location = glGetUniformLocation(render_program->get(), "vCol");
+  }
+
+  glfwSetWindowSize(window, size, size);
+  glfwShowWindow(window);
+  glViewport(0, 0, size, size);
+}
+
+void GLContext::close_viewer() {
   glfwSetWindowShouldClose(window, 0);
   glfwHideWindow(window);
 
-  initialize_off_screen_mode();
+  if (viewer_context) {
+    glDeleteProgram(render_program->get());
+    model.clear_model();
+    render_program = std::move(headless_render_program);
+    model = headless_model;
+    viewer_context.reset();
+    window = nullptr;
+
+    platform_context->make_current();
+    gladLoadGLLoader(platform_context->get_loader());
+    vertex_color_location = glGetUniformLocation(render_program->get(), "vCol");
+  }
 }
 
-void Context::submit_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view) {
-  auto const pixel_area = set_scene(sun_view, &surface_buffer);
-  draw_model();
-  glBeginQuery(GL_SAMPLES_PASSED, queries.at(surface_buffer.index));
+void GLContext::submit_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view, QuerySet &set) {
+  auto const surface_index = static_cast<unsigned int>(surface_buffer.index);
+  auto pixel_area = set_scene(sun_view, &surface_buffer);
+  int resolution{size};
+  if (pixel_area > 0.f) {
+    // Render into the lower left corner at the resolution needed for the target accuracy
+    auto const projection = get_projection();
+    resolution = choose_resolution(surface_index, sun_view, projection);
+    pixel_area = get_sample_area(projection, resolution);
+    pssa_errors.at(surface_index) =
+        estimate_pssa_error(surface_index, sun_view, projection, resolution, samples_per_pixel);
+    if (resolution > tile_size) {
+      submit_tiled_pssa(surface_buffer, sun_view, projection, resolution, set);
+      set.pixel_areas[surface_index] = pixel_area;
+      return;
+    }
+  }
+  glViewport(0, 0, std::min(resolution, buffer_size), std::min(resolution, buffer_size));
+  draw_model(&surface_buffer);
+  glBeginQuery(GL_SAMPLES_PASSED, set.queries.at(surface_index));
   GLModel::draw_surface(surface_buffer);
   glEndQuery(GL_SAMPLES_PASSED);
-  pixel_areas.at(surface_buffer.index) = pixel_area;
+  glViewport(0, 0, buffer_size, buffer_size);
+  set.pixel_areas.at(surface_index) = pixel_area;
+  set.pending_queries.at(surface_index) = true;
 }
 
-void Context::submit_pssa(const unsigned int surface_index, mat4x4 sun_view) {
-  submit_pssa(model.surface_buffers[surface_index], sun_view);
+template <typename Render>
+void GLContext::render_tiles(mat4x4 sun_view, const SunProjection &projection,
+                             const int resolution, Render render) {
+  float const pixel_width = (projection.right - projection.left) / static_cast<float>(resolution);
+  float const pixel_height = (projection.top - projection.bottom) / static_cast<float>(resolution);
+  for (int tile_y = 0; tile_y < resolution; tile_y += tile_size) {
+    for (int tile_x = 0; tile_x < resolution; tile_x += tile_size) {
+      GLsizei const width = std::min(tile_size, resolution - tile_x);
+      GLsizei const height = std::min(tile_size, resolution - tile_y);
+      mat4x4 tile_projection;
+      mat4x4_ortho(tile_projection, projection.left + pixel_width * static_cast<float>(tile_x),
+                   projection.left + pixel_width * static_cast<float>(tile_x + width),
+                   projection.bottom + pixel_height * static_cast<float>(tile_y),
+                   projection.bottom + pixel_height * static_cast<float>(tile_y + height),
+                   -projection.near_, -projection.far_);
+      mat4x4_mul(mvp, tile_projection, sun_view);
+      set_mvp();
+      glViewport(0, 0, width, height);
+      render(width, height);
+    }
+  }
 }
 
-void Context::submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) {
-  for (auto const surface_index : surface_indices) {
-    submit_pssa(surface_index, sun_view);
+void GLContext::submit_tiled_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view,
+                                  const SunProjection &projection, int resolution,
+                                  QuerySet &set) {
+  // Each tile is counted with its own query, and the counts are summed when retrieved
+  auto const tile_count = static_cast<std::size_t>((resolution + tile_size - 1) / tile_size);
+  auto &tile_queries = set.tile_queries[surface_buffer.index];
+  if (tile_queries.size() < tile_count * tile_count) {
+    auto const query_count = tile_queries.size();
+    tile_queries.resize(tile_count * tile_count);
+    glGenQueries(static_cast<GLsizei>(tile_queries.size() - query_count),
+                 tile_queries.data() + query_count);
   }
+  std::size_t tile{0u};
+  render_tiles(sun_view, projection, resolution, [&](GLsizei, GLsizei) {
+    draw_model(&surface_buffer);
+    glBeginQuery(GL_SAMPLES_PASSED, tile_queries[tile++]);
+    GLModel::draw_surface(surface_buffer);
+    glEndQuery(GL_SAMPLES_PASSED);
+  });
+  glViewport(0, 0, buffer_size, buffer_size);
+  set.pending_queries[surface_buffer.index] = false;
+  set.pending_tiles[surface_buffer.index] = tile;
 }
 
-void Context::submit_pssa(mat4x4 sun_view) {
+void GLContext::submit_surface_id_pssas(mat4x4 sun_view, QuerySet &set) {
+  // Render every surface once, colored by its (one-based) index, at a projection covering the
+  // entire model. Each surface's pixel count is the number of pixels holding its ID. Sizes beyond
+  // the hardware's limits are rendered and counted in tiles.
+  bool const is_single_draw = initialize_surface_id_table();
+  initialize_surface_id_mode();
+  auto const pixel_area = set_scene(sun_view);
+  auto const projection = get_projection();
+
+  std::fill(set.pixel_counts.begin(), set.pixel_counts.end(), 0u);
+  set.pending_counts = histogram && pixel_area > 0.f;
+  if (set.pending_counts) {
+    GLHistogram::clear_counts(set.counts_buffer, model.surface_buffers.size());
+  }
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  static constexpr float byte_scale = 1.f / 255.f;
+  if (pixel_area > 0.f) {
+    render_tiles(sun_view, projection, size, [&](GLsizei width, GLsizei height) {
+#ifndef NDEBUG
+#ifdef __unix__
+      // Temporarily Disable floating point exceptions
+      fedisableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
+#endif
+#endif
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glDepthFunc(GL_LESS);
+      if (is_single_draw) {
+        model.draw_all();
+      } else {
+        for (auto const &surface_buffer : model.surface_buffers) {
+          auto const id = static_cast<GLuint>(surface_buffer.index) + 1u;
+          glUniform4f(surface_id_location, static_cast<float>(id & 0xFFu) * byte_scale,
+                      static_cast<float>((id >> 8u) & 0xFFu) * byte_scale,
+                      static_cast<float>((id >> 16u) & 0xFFu) * byte_scale,
+                      static_cast<float>((id >> 24u) & 0xFFu) * byte_scale);
+          GLModel::draw_surface(surface_buffer);
+        }
+      }
+      if (histogram) {
+        // Counted on the GPU, and read back when retrieved
+        histogram->count(surface_id_color_texture, width, height, set.counts_buffer,
+                         current_program);
+      } else {
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, surface_id_pixels.data());
+      }
+#ifndef NDEBUG
+#ifdef __unix__
+      feenableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
+#endif
+#endif
+      if (histogram) {
+        return;
+      }
+
+      // Histogram of surface IDs
+      auto const pixel_count = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+      for (std::size_t i = 0; i < 4u * pixel_count; i += 4) {
+        GLuint const id = surface_id_pixels[i] | (surface_id_pixels[i + 1] << 8u) |
+                          (surface_id_pixels[i + 2] << 16u) |
+                          (static_cast<GLuint>(surface_id_pixels[i + 3]) << 24u);
+        if (id > 0u) {
+          ++set.pixel_counts[id - 1u];
+        }
+      }
+    });
+  }
+  std::fill(set.pixel_areas.begin(), set.pixel_areas.end(), pixel_area);
+  std::fill(set.pending_queries.begin(), set.pending_queries.end(), false);
+  std::fill(set.pending_tiles.begin(), set.pending_tiles.end(), 0u);
   for (auto const &surface_buffer : model.surface_buffers) {
-    submit_pssa(surface_buffer, sun_view);
+    auto const surface_index = static_cast<unsigned int>(surface_buffer.index);
+    pssa_errors[surface_index] = estimate_pssa_error(surface_index, sun_view, projection, size);
+  }
+
+  initialize_off_screen_mode();
+}
+
+void GLContext::set_analytic_pssa(const unsigned int surface_index, const float pssa,
+                                  QuerySet &set) {
+  set.analytic_pssas[surface_index] = pssa;
+  set.is_analytic[surface_index] = true;
+  set.pending_queries[surface_index] = false;
+  set.pending_tiles[surface_index] = 0u;
+  pssa_errors[surface_index] = 0.f;
+}
+
+void GLContext::submit_shared_depth_pssas(const std::vector<unsigned int> &surface_indices,
+                                          mat4x4 sun_view, QuerySet &set) {
+  // Render the model once per group (once, at a projection covering the entire model, in shared
+  // depth buffer mode), then count each receiver's pixels against the shared depth buffer
+  initialize_shared_depth_mode();
+  std::vector<ReceiverGroup> groups;
+  std::vector<unsigned int> individual_indices;
+  group_shared_depth_receivers(surface_indices, sun_view, shared_depth_size, groups,
+                               individual_indices);
+
+  for (auto const &group : groups) {
+    auto const &sun_projection = group.projection;
+    set_projection(sun_view, sun_projection);
+    set_mvp();
+    draw_model(nullptr, calculation_mode == CalculationMode::coplanar_groups);
+    float const pixel_area = get_sample_area(sun_projection, shared_depth_size);
+    for (auto const surface_index : group.surface_indices) {
+      glBeginQuery(GL_SAMPLES_PASSED, set.queries[surface_index]);
+      GLModel::draw_surface(model.surface_buffers[surface_index]);
+      glEndQuery(GL_SAMPLES_PASSED);
+      set.pixel_areas[surface_index] = pixel_area;
+      set.pending_queries[surface_index] = true;
+      pssa_errors[surface_index] = estimate_pssa_error(surface_index, sun_view, sun_projection,
+                                                       shared_depth_size, samples_per_pixel);
+    }
+  }
+
+  initialize_off_screen_mode();
+  if (individual_indices.empty()) {
+    return;
+  }
+  if (batch_size > 1) {
+    submit_batched_pssas(individual_indices, sun_view, set);
+    return;
+  }
+  for (auto const surface_index : individual_indices) {
+    submit_pssa(model.surface_buffers[surface_index], sun_view, set);
   }
 }
 
-float Context::retrieve_pssa(const unsigned int surface_index) {
-  glGetQueryObjectiv(queries[surface_index], GL_QUERY_RESULT, &(pixel_counts.at(surface_index)));
-  return static_cast<float>(pixel_counts[surface_index]) * pixel_areas[surface_index];
+void GLContext::submit_pssa(const unsigned int surface_index, mat4x4 sun_view) {
+  float pssa;
+  if (calculate_analytic_pssa(surface_index, sun_view, pssa)) {
+    set_analytic_pssa(surface_index, pssa, query_set);
+    return;
+  }
+  query_set.is_analytic[surface_index] = false;
+  submit_pssa(model.surface_buffers[surface_index], sun_view, query_set);
+}
+
+void GLContext::submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) {
+  submit_pssas(surface_indices, sun_view, query_set);
 }
 
-std::vector<float> Context::retrieve_pssas(const std::vector<unsigned int> &surface_indices) {
+void GLContext::submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                             QuerySet &set) {
+  std::vector<unsigned int> rendered_surface_indices;
+  for (auto const surface_index : surface_indices) {
+    float pssa;
+    if (calculate_analytic_pssa(surface_index, sun_view, pssa)) {
+      set_analytic_pssa(surface_index, pssa, set);
+    } else {
+      set.is_analytic[surface_index] = false;
+      rendered_surface_indices.push_back(surface_index);
+    }
+  }
+
+  if (!rendered_surface_indices.empty()) {
+    if (calculation_mode == CalculationMode::surface_id_buffer) {
+      submit_surface_id_pssas(sun_view, set);
+    } else if (calculation_mode == CalculationMode::shared_depth_buffer ||
+               calculation_mode == CalculationMode::coplanar_groups) {
+      submit_shared_depth_pssas(rendered_surface_indices, sun_view, set);
+    } else if (batch_size > 1) {
+      submit_batched_pssas(rendered_surface_indices, sun_view, set);
+    } else {
+      for (auto const surface_index : rendered_surface_indices) {
+        submit_pssa(model.surface_buffers[surface_index], sun_view, set);
+      }
+    }
+  }
+}
+
+unsigned int GLContext::queue_pssas(const std::vector<unsigned int> &surface_indices,
+                                    mat4x4 sun_view) {
+  auto const ticket = next_ticket;
+  auto &set = query_ring[ticket % query_ring_size];
+  if (set.ticket != 0) {
+    throw PenumbraException(
+        fmt::format("Unable to queue more than {} PSSA calculations. Retrieve a queued "
+                    "calculation before queuing another.",
+                    query_ring_size),
+        *logger);
+  }
+  if (set.queries.size() != model.surface_buffers.size()) {
+    release_query_set(set);
+    allocate_query_set(set);
+  }
+
+  submit_pssas(surface_indices, sun_view, set);
+  set.surface_indices = surface_indices;
+  set.ticket = ticket;
+  if (GLAD_GL_ARB_sync) {
+    set.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  // Make sure the commands reach the GPU while the caller continues with other work
+  glFlush();
+
+  // Skip zero, which marks sets that are not in flight
+  next_ticket = next_ticket == std::numeric_limits<unsigned int>::max() ? 1u : next_ticket + 1u;
+  return ticket;
+}
+
+GLContext::QuerySet &GLContext::get_queued_query_set(const unsigned int ticket) {
+  auto &set = query_ring[ticket % query_ring_size];
+  if (ticket == 0 || set.ticket != ticket) {
+    throw PenumbraException(
+        fmt::format("PSSA ticket, {}, does not refer to a queued calculation.", ticket), *logger);
+  }
+  return set;
+}
+
+bool GLContext::is_queued_pssa_ready(const unsigned int ticket) {
+  auto &set = get_queued_query_set(ticket);
+  if (set.fence) {
+    GLenum const status = glClientWaitSync(set.fence, 0, 0);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+  }
+  for (auto const surface_index : set.surface_indices) {
+    GLint available{GL_TRUE};
+    if (set.pending_queries[surface_index]) {
+      glGetQueryObjectiv(set.queries[surface_index], GL_QUERY_RESULT_AVAILABLE, &available);
+    } else if (set.pending_tiles[surface_index] > 0u) {
+      glGetQueryObjectiv(set.tile_queries[surface_index][set.pending_tiles[surface_index] - 1u],
+                         GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    if (available == GL_FALSE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<float> GLContext::retrieve_queued_pssas(const unsigned int ticket) {
+  auto &set = get_queued_query_set(ticket);
   std::vector<float> pssas;
-  pssas.reserve(surface_indices.size());
-  for (const unsigned int surface_index : surface_indices) {
-    pssas.push_back(retrieve_pssa(surface_index));
+  pssas.reserve(set.surface_indices.size());
+  for (const unsigned int surface_index : set.surface_indices) {
+    pssas.push_back(retrieve_pssa(surface_index, set));
+  }
+  if (set.fence) {
+    glDeleteSync(set.fence);
+    set.fence = nullptr;
   }
+  set.ticket = 0;
   return pssas;
 }
 
-std::vector<float> Context::retrieve_pssa() {
-  std::vector<float> pssas;
-  pssas.reserve(model.surface_buffers.size());
-  for (auto const &surface_buffer : model.surface_buffers) {
-    pssas.push_back(retrieve_pssa(surface_buffer.index));
+unsigned int GLContext::get_queued_pssa_count() const {
+  return static_cast<unsigned int>(std::count_if(
+      query_ring.begin(), query_ring.end(), [](const QuerySet &set) { return set.ticket != 0; }));
+}
+
+unsigned int GLContext::get_queue_capacity() const {
+  return query_ring_size;
+}
+
+void GLContext::submit_batched_pssas(const std::vector<unsigned int> &surface_indices,
+                                     mat4x4 sun_view, QuerySet &set) {
+  std::vector<BatchView> views;
+  views.reserve(static_cast<std::size_t>(batch_size));
+  for (std::size_t i = 0; i < surface_indices.size(); ++i) {
+    auto const &surface_buffer = model.surface_buffers[surface_indices[i]];
+    views.push_back({&surface_buffer, sun_view, set.queries[surface_buffer.index], 0.f, 0.f});
+    if (views.size() == static_cast<std::size_t>(batch_size) || i + 1 == surface_indices.size()) {
+      submit_batch(views);
+      for (auto const &batch_view : views) {
+        set.pixel_areas[batch_view.surface_buffer->index] = batch_view.pixel_area;
+        set.pending_queries[batch_view.surface_buffer->index] = true;
+        pssa_errors[batch_view.surface_buffer->index] = batch_view.error;
+      }
+      views.clear();
+    }
+  }
+}
+
+std::vector<float> GLContext::calculate_pssas(const unsigned int surface_index,
+                                              const std::vector<mat4x4_ptr> &sun_views) {
+  if (batch_size <= 1) {
+    return Context::calculate_pssas(surface_index, sun_views);
+  }
+
+  std::vector<float> pssas(sun_views.size());
+  std::vector<std::size_t> rendered_views;
+  for (std::size_t i = 0; i < sun_views.size(); ++i) {
+    if (!calculate_analytic_pssa(surface_index, sun_views[i], pssas[i])) {
+      rendered_views.push_back(i);
+    }
+  }
+  auto const &surface_buffer = model.surface_buffers[surface_index];
+
+  std::vector<BatchView> views;
+  views.reserve(static_cast<std::size_t>(batch_size));
+  for (std::size_t i = 0; i < rendered_views.size(); ++i) {
+    views.push_back(
+        {&surface_buffer, sun_views[rendered_views[i]], batch_queries[views.size()], 0.f, 0.f});
+    if (views.size() == static_cast<std::size_t>(batch_size) || i + 1 == rendered_views.size()) {
+      submit_batch(views);
+      for (std::size_t j = 0; j < views.size(); ++j) {
+        pssas[rendered_views[i + 1 - views.size() + j]] =
+            static_cast<float>(get_query_result(views[j].query)) * views[j].pixel_area;
+      }
+      views.clear();
+    }
   }
   return pssas;
 }
 
+void GLContext::submit_batch(std::vector<BatchView> &views) {
+  // Each view is rendered into its own tile of the batch framebuffer. The surfaces that may appear
+  // in (and shade the receiver of) any of the views are drawn once, instanced per view, and the
+  // receiving surface of each view is then counted with its own query. Each tile's viewport covers
+  // only the resolution needed for the target accuracy.
+  std::vector<unsigned int> batch_surfaces;
+  for (std::size_t i = 0; i < views.size(); ++i) {
+    views[i].pixel_area = set_projection(views[i].sun_view, views[i].surface_buffer);
+    auto const *mvp_data = reinterpret_cast<const GLfloat *>(mvp);
+    std::copy(mvp_data, mvp_data + 16, batch_mvps.begin() + static_cast<std::ptrdiff_t>(16 * i));
+    int resolution{size};
+    if (views[i].pixel_area > 0.f) {
+      auto const surface_index = static_cast<unsigned int>(views[i].surface_buffer->index);
+      auto const projection = get_projection();
+      resolution = choose_resolution(surface_index, views[i].sun_view, projection);
+      views[i].pixel_area = get_sample_area(projection, resolution);
+      views[i].error = estimate_pssa_error(surface_index, views[i].sun_view, projection,
+                                           resolution, samples_per_pixel);
+    }
+    batch_viewports[4 * i + 2] = static_cast<GLfloat>(resolution);
+    batch_viewports[4 * i + 3] = static_cast<GLfloat>(resolution);
+    if (views[i].pixel_area > 0.f) {
+      auto const *receiver_view = get_receiver_view(
+          static_cast<unsigned int>(views[i].surface_buffer->index), views[i].sun_view);
+      if (!receiver_view) {
+        find_surfaces_in_view(views[i].surface_buffer, visible_surfaces);
+      }
+      auto const &surfaces_in_view =
+          receiver_view ? receiver_view->surfaces_in_view : visible_surfaces;
+      batch_surfaces.insert(batch_surfaces.end(), surfaces_in_view.begin(),
+                            surfaces_in_view.end());
+    }
+  }
+  std::sort(batch_surfaces.begin(), batch_surfaces.end());
+  batch_surfaces.erase(std::unique(batch_surfaces.begin(), batch_surfaces.end()),
+                       batch_surfaces.end());
+  auto const view_count = static_cast<GLsizei>(views.size());
+
+  initialize_batch_mode();
+  glUniformMatrix4fv(batch_mvp_location, view_count, GL_FALSE, batch_mvps.data());
+  glUniform1i(batch_view_offset_location, 0);
+#ifndef NDEBUG
+#ifdef __unix__
+  // Temporarily Disable floating point exceptions
+  fedisableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
+#endif
+#endif
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glDepthFunc(GL_LESS);
+  model.draw_surfaces_instanced(batch_surfaces, view_count);
+  glDepthFunc(GL_EQUAL);
+  for (GLsizei i = 0; i < view_count; ++i) {
+    glUniform1i(batch_view_offset_location, i);
+    glBeginQuery(GL_SAMPLES_PASSED, views[i].query);
+    GLModel::draw_surface(*views[i].surface_buffer);
+    glEndQuery(GL_SAMPLES_PASSED);
+  }
+  // Submit the batch before the next one clears the framebuffer. Without this, Mesa's llvmpipe
+  // was seen to miscount queries of larger framebuffers when many batches were queued at once.
+  glFlush();
+#ifndef NDEBUG
+#ifdef __unix__
+  feenableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
+#endif
+#endif
+
+  initialize_off_screen_mode();
+}
+
+float GLContext::retrieve_pssa(const unsigned int surface_index) {
+  return retrieve_pssa(surface_index, query_set);
+}
+
+float GLContext::retrieve_pssa(const unsigned int surface_index, QuerySet &set) {
+  if (set.is_analytic.at(surface_index)) {
+    return set.analytic_pssas[surface_index];
+  }
+  if (set.pending_counts) {
+    GLHistogram::read_counts(set.counts_buffer, set.pixel_counts);
+    set.pending_counts = false;
+  }
+  if (set.pending_queries[surface_index]) {
+    set.pixel_counts[surface_index] = get_query_result(set.queries[surface_index]);
+    set.pending_queries[surface_index] = false;
+  } else if (set.pending_tiles[surface_index] > 0u) {
+    auto const &tile_queries = set.tile_queries[surface_index];
+    set.pixel_counts[surface_index] = 0u;
+    for (std::size_t tile = 0; tile < set.pending_tiles[surface_index]; ++tile) {
+      set.pixel_counts[surface_index] += get_query_result(tile_queries[tile]);
+    }
+  }
+  set.pending_tiles[surface_index] = 0u;
+  return static_cast<float>(set.pixel_counts[surface_index]) * set.pixel_areas[surface_index];
+}
+
+std::uint64_t GLContext::get_query_result(const GLuint query) {
+  if (GLAD_GL_ARB_timer_query) {
+    GLuint64 pixel_count;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &pixel_count);
+    return pixel_count;
+  }
+  GLuint pixel_count;
+  glGetQueryObjectuiv(query, GL_QUERY_RESULT, &pixel_count);
+  return pixel_count;
+}
+
 std::unordered_map<unsigned int, float>
-Context::calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
-                                  const std::vector<unsigned int> &interior_surface_indices,
-                                  mat4x4 sun_view) {
+GLContext::calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                                    const std::vector<unsigned int> &interior_surface_indices,
+                                    mat4x4 sun_view) {
 
   std::vector<GLuint> interior_queries(interior_surface_indices.size());
   std::unordered_map<unsigned int, float> pssas;
 
   glGenQueries(static_cast<GLsizei>(interior_queries.size()), interior_queries.data());
 
+  // Occlusion queries count samples
   auto const pixel_area =
-      set_scene(sun_view, &model.surface_buffers[hidden_surface_indices.at(0)], false);
+      set_scene(sun_view, &model.surface_buffers[hidden_surface_indices.at(0)], false) /
+      static_cast<float>(samples_per_pixel);
 
   std::vector<SurfaceBuffer> hidden_surfaces;
   hidden_surfaces.reserve(hidden_surface_indices.size());
@@ -582,33 +1204,39 @@ Context::calculate_interior_pssas(const std::vector<unsigned int> &hidden_surfac
     interior_surfaces.push_back(model.surface_buffers[interior_surface]);
   }
 
-  draw_except(hidden_surfaces);
+  // Counts of each tile are read before the next tile reuses the queries
+  std::vector<std::uint64_t> pixel_counts(interior_surfaces.size(), 0u);
+  if (pixel_area > 0.f) {
+    render_tiles(sun_view, get_projection(), size, [&](GLsizei, GLsizei) {
+      draw_except(hidden_surfaces);
 
-  for (size_t i = 0; i < interior_surfaces.size(); ++i) {
-    glBeginQuery(GL_SAMPLES_PASSED, interior_queries[i]);
-    GLModel::draw_surface(interior_surfaces[i]);
-    glEndQuery(GL_SAMPLES_PASSED);
+      for (size_t i = 0; i < interior_surfaces.size(); ++i) {
+        glBeginQuery(GL_SAMPLES_PASSED, interior_queries[i]);
+        GLModel::draw_surface(interior_surfaces[i]);
+        glEndQuery(GL_SAMPLES_PASSED);
+      }
+
+      for (size_t i = 0; i < interior_surfaces.size(); ++i) {
+        pixel_counts[i] += get_query_result(interior_queries[i]);
+      }
+    });
+    glViewport(0, 0, buffer_size, buffer_size);
   }
 
   for (size_t i = 0; i < interior_surfaces.size(); ++i) {
-    GLint pixel_count;
-    glGetQueryObjectiv(interior_queries[i], GL_QUERY_RESULT, &pixel_count);
-
-    pssas[interior_surfaces[i].index] = static_cast<float>(pixel_count) * pixel_area;
+    pssas[interior_surfaces[i].index] = static_cast<float>(pixel_counts[i]) * pixel_area;
   }
 
   glDeleteQueries(static_cast<GLsizei>(interior_queries.size()), interior_queries.data());
   return pssas;
 }
 
-void Context::initialize_off_screen_mode() {
-  glUseProgram(calculation_program->get());
-  mvp_location = glGetUniformLocation(calculation_program->get(), "MVP");
+void GLContext::initialize_off_screen_buffers() {
   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer_object);
   glDrawBuffer(GL_NONE);
   glReadBuffer(GL_NONE);
   glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffer_object);
-  glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, size, size);
+  allocate_depth_renderbuffer(buffer_size, buffer_size);
   glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT,
                                renderbuffer_object);
 
@@ -640,13 +1268,171 @@ void Context::initialize_off_screen_mode() {
     }
     throw PenumbraException(fmt::format("Unable to create framebuffer. {}", reason), *logger);
   }
+}
+
+void GLContext::allocate_depth_renderbuffer(GLsizei width, GLsizei height) const {
+  if (samples_per_pixel > 1u) {
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER_EXT, static_cast<GLsizei>(samples_per_pixel),
+                                     GL_DEPTH_COMPONENT24, width, height);
+  } else {
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+  }
+}
 
+float GLContext::get_sample_area(const SunProjection &projection, int resolution) const {
+  return get_pixel_area(projection, resolution) / static_cast<float>(samples_per_pixel);
+}
+
+void GLContext::set_samples_per_pixel(unsigned int samples) {
+  if (samples == 0u) {
+    throw PenumbraException("Samples per pixel must be at least one.", *logger);
+  }
+  if (samples > 1u && !GLAD_GL_ARB_framebuffer_object) {
+    logger->warning("The current version of OpenGL does not support multisampled framebuffers. "
+                    "Each pixel will be sampled once.");
+    samples = 1u;
+  }
+  if (samples > 1u) {
+    GLint max_samples;
+    glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+    if (samples > static_cast<unsigned int>(max_samples)) {
+      logger->warning(fmt::format("The selected samples per pixel, {}, is more than the maximum "
+                                  "allowable by your hardware, {}. The maximum will be used.",
+                                  samples, max_samples));
+      samples = static_cast<unsigned int>(max_samples);
+    }
+  }
+
+  // Reallocate the depth buffers whose samples are counted by occlusion queries. The surface ID
+  // buffer is read back directly and keeps a single sample.
+  samples_per_pixel = samples;
+  initialize_off_screen_buffers();
+  if (samples_per_pixel > 1u) {
+    // The implementation may round the count up
+    GLint allocated_samples;
+    glGetRenderbufferParameterivEXT(GL_RENDERBUFFER_EXT, GL_RENDERBUFFER_SAMPLES,
+                                    &allocated_samples);
+    samples_per_pixel = std::max(static_cast<unsigned int>(allocated_samples), 1u);
+  }
+  if (batch_size > 1) {
+    GLint batch_size_in_pixels;
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, batch_framebuffer_object);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, batch_renderbuffer_object);
+    glGetRenderbufferParameterivEXT(GL_RENDERBUFFER_EXT, GL_RENDERBUFFER_WIDTH_EXT,
+                                    &batch_size_in_pixels);
+    allocate_depth_renderbuffer(batch_size_in_pixels, batch_size_in_pixels);
+    if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+      logger->info("Unable to create batch framebuffer. Surfaces will be rendered individually.");
+      batch_size = 1;
+    }
+  }
+  if (shared_depth_buffers_set) {
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, shared_depth_framebuffer_object);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, shared_depth_renderbuffer_object);
+    allocate_depth_renderbuffer(shared_depth_size, shared_depth_size);
+    if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+      throw PenumbraException("Unable to create shared depth framebuffer.", *logger);
+    }
+  }
+  initialize_off_screen_mode();
+}
+
+void GLContext::set_maximum_tile_size(unsigned int maximum_tile_size) {
+  tile_size = hardware_tile_size;
+  if (maximum_tile_size > 0u && maximum_tile_size < static_cast<unsigned int>(tile_size)) {
+    tile_size = static_cast<GLsizei>(maximum_tile_size);
+  }
+  buffer_size = std::min(size, tile_size);
+  if (size > tile_size) {
+    batch_size = 1; // Not restored by raising the limit again
+  }
+
+  // The surface ID and shared depth buffers are sized by the tiles, and reallocated when next used
+  release_surface_id_buffers();
+  if (shared_depth_buffers_set) {
+    glDeleteFramebuffersEXT(1, &shared_depth_framebuffer_object);
+    glDeleteRenderbuffersEXT(1, &shared_depth_renderbuffer_object);
+    shared_depth_buffers_set = false;
+  }
+  initialize_off_screen_buffers();
+  initialize_off_screen_mode();
+}
+
+void GLContext::initialize_off_screen_mode() {
+  use_program(*calculation_program);
+  mvp_location = glGetUniformLocation(calculation_program->get(), "MVP");
+  glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer_object);
+  glViewport(0, 0, buffer_size, buffer_size);
   glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 }
 
-void Context::initialize_render_mode() {
+void GLContext::initialize_batch_buffers() {
+  // Each view is a single tile, so sizes rendered in tiles are not batched
+  if (size > tile_size) {
+    batch_size = 1;
+    return;
+  }
+
+  GLint max_viewports, max_renderbuffer_size;
+  glGetIntegerv(GL_MAX_VIEWPORTS, &max_viewports);
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE_EXT, &max_renderbuffer_size);
+
+  // Arrange tiles (one per view) in a square grid that fits within a single renderbuffer
+  GLsizei const grid_size = std::min(static_cast<GLsizei>(std::sqrt(max_batch_size)),
+                                     static_cast<GLsizei>(max_renderbuffer_size / size));
+  batch_size =
+      std::min({max_batch_size, static_cast<GLsizei>(max_viewports), grid_size * grid_size});
+  if (batch_size <= 1) {
+    batch_size = 1;
+    return;
+  }
+
+  std::string const extension = GLAD_GL_ARB_shader_viewport_layer_array
+                                    ? "GL_ARB_shader_viewport_layer_array"
+                                    : "GL_AMD_vertex_shader_viewport_index";
+  std::string const batch_vertex_shader =
+      fmt::format("#version 410\n#extension {} : require\n#define MAX_VIEWS {}\n", extension,
+                  max_batch_size) +
+      batch_vertex_shader_source;
+  batch_program = std::make_unique<GLProgram>(batch_vertex_shader.c_str(), nullptr, logger);
+  batch_mvp_location = glGetUniformLocation(batch_program->get(), "MVP");
+  batch_view_offset_location = glGetUniformLocation(batch_program->get(), "view_offset");
+
+  for (GLsizei i = 0; i < batch_size; ++i) {
+    batch_viewports.insert(
+        batch_viewports.end(),
+        {static_cast<GLfloat>((i % grid_size) * size), static_cast<GLfloat>((i / grid_size) * size),
+         static_cast<GLfloat>(size), static_cast<GLfloat>(size)});
+  }
+  batch_mvps.resize(static_cast<std::size_t>(16 * batch_size));
+  batch_queries.resize(static_cast<std::size_t>(batch_size));
+  glGenQueries(batch_size, batch_queries.data());
+
+  glGenFramebuffersEXT(1, &batch_framebuffer_object);
+  glGenRenderbuffersEXT(1, &batch_renderbuffer_object);
+  glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, batch_framebuffer_object);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, batch_renderbuffer_object);
+  allocate_depth_renderbuffer(grid_size * size, grid_size * size);
+  glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT,
+                               batch_renderbuffer_object);
+  if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+    logger->info("Unable to create batch framebuffer. Surfaces will be rendered individually.");
+    batch_size = 1;
+  }
+}
+
+void GLContext::initialize_batch_mode() {
+  use_program(*batch_program);
+  glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, batch_framebuffer_object);
+  glViewportArrayv(0, batch_size, batch_viewports.data());
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+}
+
+void GLContext::initialize_render_mode() {
   // set to default framebuffer and renderbuffer
-  glUseProgram(render_program->get());
+  use_program(*render_program);
   mvp_location = glGetUniformLocation(render_program->get(), "MVP");
   set_mvp();
   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
@@ -654,4 +1440,134 @@ void Context::initialize_render_mode() {
   glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 }
 
+bool GLContext::initialize_surface_id_table() {
+  if (!primitive_surface_id_program) {
+    return false;
+  }
+  if (surface_id_table_set) {
+    return true;
+  }
+
+  // One RGBA texel per triangle, in rows as wide as allowed
+  GLint max_texture_size;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  auto const triangle_count = static_cast<std::size_t>(model.number_of_indices / 3u);
+  auto const width = std::clamp<std::size_t>(triangle_count, 1u,
+                                             static_cast<std::size_t>(max_texture_size));
+  auto const height = std::max<std::size_t>((triangle_count + width - 1u) / width, 1u);
+  if (height > static_cast<std::size_t>(max_texture_size)) {
+    return false;
+  }
+  std::vector<GLubyte> surface_ids(4u * width * height, 0u);
+  for (auto const &surface_buffer : model.surface_buffers) {
+    auto const id = static_cast<GLuint>(surface_buffer.index) + 1u;
+    for (std::size_t triangle = surface_buffer.begin / 3u;
+         triangle < (surface_buffer.begin + surface_buffer.count) / 3u; ++triangle) {
+      for (unsigned int channel = 0u; channel < 4u; ++channel) {
+        surface_ids[4u * triangle + channel] = static_cast<GLubyte>((id >> (8u * channel)) & 0xFFu);
+      }
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, surface_id_table);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, static_cast<GLsizei>(width),
+               static_cast<GLsizei>(height), 0, GL_RGBA, GL_UNSIGNED_BYTE, surface_ids.data());
+  surface_id_table_set = true;
+  return true;
+}
+
+void GLContext::initialize_surface_id_mode() {
+  auto const &program = surface_id_table_set ? *primitive_surface_id_program : *surface_id_program;
+  use_program(program);
+  mvp_location = glGetUniformLocation(program.get(), "MVP");
+  if (surface_id_table_set) {
+    glUniform1i(glGetUniformLocation(program.get(), "surface_ids"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, surface_id_table);
+  }
+
+  if (!surface_id_buffers_set) {
+    glGenFramebuffersEXT(1, &surface_id_framebuffer_object);
+    glGenRenderbuffersEXT(1, &surface_id_depth_renderbuffer_object);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, surface_id_framebuffer_object);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, surface_id_depth_renderbuffer_object);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, buffer_size,
+                             buffer_size);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT,
+                                 surface_id_depth_renderbuffer_object);
+    if (histogram) {
+      // Read by the histogram's compute shader as an image
+      glGenTextures(1, &surface_id_color_texture);
+      glBindTexture(GL_TEXTURE_2D, surface_id_color_texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, buffer_size, buffer_size, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, nullptr);
+      glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+                                surface_id_color_texture, 0);
+      glBindTexture(GL_TEXTURE_2D, surface_id_table);
+    } else {
+      glGenRenderbuffersEXT(1, &surface_id_color_renderbuffer_object);
+      glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, surface_id_color_renderbuffer_object);
+      glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, buffer_size, buffer_size);
+      glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                   GL_RENDERBUFFER_EXT, surface_id_color_renderbuffer_object);
+      surface_id_pixels.resize(static_cast<std::size_t>(buffer_size) *
+                               static_cast<std::size_t>(buffer_size) * 4u);
+    }
+    if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+      throw PenumbraException("Unable to create surface ID framebuffer.", *logger);
+    }
+    surface_id_buffers_set = true;
+  }
+
+  glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, surface_id_framebuffer_object);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+  glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDisable(GL_DITHER);
+}
+
+void GLContext::release_surface_id_buffers() {
+  if (!surface_id_buffers_set) {
+    return;
+  }
+  glDeleteFramebuffersEXT(1, &surface_id_framebuffer_object);
+  glDeleteRenderbuffersEXT(1, &surface_id_depth_renderbuffer_object);
+  if (histogram) {
+    glDeleteTextures(1, &surface_id_color_texture);
+  } else {
+    glDeleteRenderbuffersEXT(1, &surface_id_color_renderbuffer_object);
+  }
+  surface_id_buffers_set = false;
+}
+
+void GLContext::initialize_shared_depth_mode() {
+  if (!shared_depth_buffers_set) {
+    shared_depth_size = std::min(size * shared_depth_scale, tile_size);
+    glGenFramebuffersEXT(1, &shared_depth_framebuffer_object);
+    glGenRenderbuffersEXT(1, &shared_depth_renderbuffer_object);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, shared_depth_framebuffer_object);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, shared_depth_renderbuffer_object);
+    allocate_depth_renderbuffer(shared_depth_size, shared_depth_size);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT,
+                                 shared_depth_renderbuffer_object);
+    if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+      throw PenumbraException("Unable to create shared depth framebuffer.", *logger);
+    }
+    shared_depth_buffers_set = true;
+  }
+
+  use_program(*calculation_program);
+  mvp_location = glGetUniformLocation(calculation_program->get(), "MVP");
+  glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, shared_depth_framebuffer_object);
+  glViewport(0, 0, shared_depth_size, shared_depth_size);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+}
+
 } // namespace Penumbra
@@ -1,12 +1,13 @@
 /* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
  * See the LICENSE file for additional terms and conditions. */
 
-#ifndef CONTEXT_H_
-#define CONTEXT_H_
+#ifndef GL_CONTEXT_H_
+#define GL_CONTEXT_H_
 
 // Standard
 #include <vector>
 #include <array>
+#include <cstdint>
 #include <limits>
 #include <unordered_map>
 #include <memory>
@@ -19,79 +20,207 @@
 #include <linmath.h> // Part of GLFW
 
 // Penumbra
+#include <penumbra/penumbra.h>
+#include "../context.h"
+#include "gl/buffer.h"
+#include "gl/culler.h"
+#include "gl/histogram.h"
 #include "gl/model.h"
 #include "gl/shader.h"
 #include "gl/program.h"
-
-#define MAX_FLOAT std::numeric_limits<float>::max()
+#include "gl/platform.h"
+#include "sun.h"
 
 namespace Penumbra {
 
-class Context {
+class GLContext : public Context {
 
 public:
-  Context(GLint size, Courierr::Courierr *logger);
-  ~Context();
-  void show_rendering(unsigned int surface_index, mat4x4 sun_view);
-  void set_model(const std::vector<float> &vertices,
-                 const std::vector<SurfaceBuffer> &surface_buffers);
+  GLContext(GLint size, GLPlatform platform, Courierr::Courierr *logger);
+  ~GLContext() override;
+  void show_rendering(unsigned int surface_index, mat4x4 sun_view) override;
+  void set_model(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                 const std::vector<SurfaceBuffer> &surface_buffers) override;
+  void update_model(
+      const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+      const std::vector<SurfaceBuffer> &surface_buffers,
+      const std::vector<unsigned int> &changed_surfaces,
+      const std::vector<std::pair<unsigned int, unsigned int>> &rewritten_vertices) override;
   float set_scene(mat4x4 sun_view, const SurfaceBuffer *surface_buffer = nullptr,
                   bool clip_far = true);
-  void submit_pssa(unsigned int surface_index, mat4x4 sun_view);
-  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view);
-  void submit_pssa(mat4x4 sun_view);
-  float retrieve_pssa(unsigned int surface_index);
-  std::vector<float> retrieve_pssas(const std::vector<unsigned int> &surface_indices);
-  std::vector<float> retrieve_pssa();
+  using Context::submit_pssa;
+  void submit_pssa(unsigned int surface_index, mat4x4 sun_view) override;
+  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) override;
+  using Context::retrieve_pssa;
+  float retrieve_pssa(unsigned int surface_index) override;
+  std::vector<float> calculate_pssas(unsigned int surface_index,
+                                     const std::vector<mat4x4_ptr> &sun_views) override;
+  unsigned int queue_pssas(const std::vector<unsigned int> &surface_indices,
+                           mat4x4 sun_view) override;
+  bool is_queued_pssa_ready(unsigned int ticket) override;
+  std::vector<float> retrieve_queued_pssas(unsigned int ticket) override;
+  [[nodiscard]] unsigned int get_queued_pssa_count() const override;
+  [[nodiscard]] unsigned int get_queue_capacity() const override;
 
   std::unordered_map<unsigned int, float>
   calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
                            const std::vector<unsigned int> &interior_surface_indices,
-                           mat4x4 sun_view);
+                           mat4x4 sun_view) override;
   void show_interior_rendering(const std::vector<unsigned int> &hidden_surface_indices,
-                               unsigned int interior_surface_index, mat4x4 sun_view);
-  void clear_model();
+                               unsigned int interior_surface_index, mat4x4 sun_view) override;
+  void clear_model() override;
   static std::string get_vendor_name();
+  [[nodiscard]] GLPlatform get_platform() const;
+  void set_samples_per_pixel(unsigned int samples) override;
+  void set_maximum_tile_size(unsigned int maximum_tile_size) override;
 
 private:
+  std::unique_ptr<GLPlatformContext> platform_context;
+  std::unique_ptr<GLPlatformContext> viewer_context; // Window opened by a headless context
   GLFWwindow *window{nullptr};
+  // Larger sizes are rendered in tiles of up to tile_size pixels on each side, limited by the
+  // hardware. Off-screen buffers have buffer_size pixels on each side (the smaller of the two).
+  GLsizei hardware_tile_size{0}, tile_size{0}, buffer_size{0};
   GLuint framebuffer_object{}, renderbuffer_object{};
+  // The surface ID color attachment is a texture when the histogram reads it, and a renderbuffer
+  // otherwise
+  GLuint surface_id_framebuffer_object{}, surface_id_depth_renderbuffer_object{},
+      surface_id_color_renderbuffer_object{}, surface_id_color_texture{};
+  bool surface_id_buffers_set{false};
+  GLuint surface_id_table{}; // Surface ID of each triangle of the model, for single draws
+  bool surface_id_table_set{false};
+  GLuint shared_depth_framebuffer_object{}, shared_depth_renderbuffer_object{};
+  bool shared_depth_buffers_set{false};
+  GLsizei shared_depth_size{0}; // Limited by the hardware
+  GLuint batch_framebuffer_object{}, batch_renderbuffer_object{};
   static const char *render_vertex_shader_source;
   static const char *render_fragment_shader_source;
   static const char *calculation_vertex_shader_source;
-  GLint size;
+  static const char *core_calculation_vertex_shader_source;
+  static const char *surface_id_fragment_shader_source;
+  static const char *primitive_surface_id_vertex_shader_source;
+  static const char *primitive_surface_id_fragment_shader_source;
+  static const char *batch_vertex_shader_source;
+  static constexpr GLsizei max_batch_size{16};
   GLModel model;
   std::unique_ptr<GLProgram> render_program;
   std::unique_ptr<GLProgram> calculation_program;
-  bool model_is_set{false};
-  float model_bounding_box[8][4] = {};
-  mat4x4 projection = {}, view = {}, mvp = {};
+  std::unique_ptr<GLProgram> surface_id_program;
+  std::unique_ptr<GLProgram> primitive_surface_id_program; // Null before OpenGL 3.2
+  std::unique_ptr<GLProgram> batch_program;
+  std::unique_ptr<GLProgram> headless_render_program; // Set aside while the viewer is open
+  GLModel headless_model;                             // Set aside while the viewer is open
+  std::unique_ptr<GLCuller> culler;                   // Null without OpenGL 4.3
+  std::unique_ptr<GLHistogram> histogram;             // Null without OpenGL 4.3
+  GLuint current_program{};                           // Last set by use_program
+  // MVP read by the core profile calculation program (OpenGL 4.5)
+  GLuint view_buffer_object{};
+  bool view_buffer_set{false};
   mat4x4 camera_view = {};
-  GLint mvp_location{}, vertex_color_location{};
+  GLint mvp_location{}, vertex_color_location{}, surface_id_location{};
+  GLint batch_mvp_location{}, batch_view_offset_location{};
+  GLsizei batch_size{1};
+  std::vector<GLfloat> batch_viewports;
+  std::vector<GLfloat> batch_mvps;
+  std::vector<GLuint> batch_queries;
   bool is_wire_frame_mode{false};
   bool is_camera_mode{false};
-  float left{0}, right{0}, bottom{0}, top{0}, near_{0}, far_{0};
   float view_scale{1.f};
   double previous_x_position, previous_y_position;
   float camera_x_rotation_angle{0.f}, camera_y_rotation_angle{0.f};
   bool left_mouse_button_pressed{true};
-  std::vector<GLuint> queries;
-  std::vector<float> pixel_areas;
-  std::vector<GLint> pixel_counts;
-  Courierr::Courierr *logger;
 
-  void submit_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view);
-  void draw_model();
+  // Occlusion queries and results for one submission of surfaces
+  struct QuerySet {
+    std::vector<GLuint> queries;
+    std::vector<float> pixel_areas;
+    std::vector<std::uint64_t> pixel_counts; // Sums over tiles
+    std::vector<bool> pending_queries;
+    std::vector<float> analytic_pssas; // Found without rendering (see calculate_analytic_pssa)
+    std::vector<bool> is_analytic;     // Set where the PSSA is in analytic_pssas
+    std::vector<std::vector<GLuint>> tile_queries; // By surface, one per tile of tiled receivers
+    std::vector<std::size_t> pending_tiles;        // Tile queries a tiled receiver's count awaits
+    GLuint counts_buffer{}; // Surface ID buffer counts summed on the GPU (see GLHistogram)
+    bool pending_counts{false};
+    std::vector<unsigned int> surface_indices; // Surfaces submitted with a queued set
+    GLsync fence{nullptr};
+    unsigned int ticket{0}; // Zero when the set is not in flight
+  };
+  QuerySet query_set; // Used by the synchronous submit/retrieve functions
+  static constexpr unsigned int query_ring_size{4};
+  std::array<QuerySet, query_ring_size> query_ring;
+  unsigned int next_ticket{1};
+  std::vector<GLubyte> surface_id_pixels;
+  std::vector<unsigned int> visible_surfaces; // Surfaces that may appear in the current view
+
+  void allocate_query_set(QuerySet &set);
+  void release_query_set(QuerySet &set);
+  QuerySet &get_queued_query_set(unsigned int ticket);
+  void submit_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view, QuerySet &set);
+  // Renders the projection at resolution pixels on each side in tiles, calling render(width,
+  // height) for each tile with the tile's part of the projection set as the MVP and viewport
+  template <typename Render>
+  void render_tiles(mat4x4 sun_view, const SunProjection &projection, int resolution,
+                    Render render);
+  // Counts a receiver rendered beyond the tile size, with one query per tile
+  void submit_tiled_pssa(const SurfaceBuffer &surface_buffer, mat4x4 sun_view,
+                         const SunProjection &projection, int resolution, QuerySet &set);
+  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                    QuerySet &set);
+  void submit_surface_id_pssas(mat4x4 sun_view, QuerySet &set);
+  void submit_shared_depth_pssas(const std::vector<unsigned int> &surface_indices,
+                                 mat4x4 sun_view, QuerySet &set);
+  void submit_batched_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                            QuerySet &set);
+  float retrieve_pssa(unsigned int surface_index, QuerySet &set);
+  // Reads a query's sample count, 64 bits wide where supported
+  [[nodiscard]] static std::uint64_t get_query_result(GLuint query);
+  // Stores a PSSA found without rendering (see calculate_analytic_pssa), retrieved in place of
+  // the surface's query until it is submitted again
+  void set_analytic_pssa(unsigned int surface_index, float pssa, QuerySet &set);
+
+  struct BatchView {
+    const SurfaceBuffer *surface_buffer;
+    mat4x4_ptr sun_view;
+    GLuint query;
+    float pixel_area;
+    float error; // See estimate_pssa_error
+  };
+  void submit_batch(std::vector<BatchView> &views);
+  // Draws only the surfaces that may appear in the current projection (and may shade the
+  // receiver, if given) unless cull is false
+  void draw_model(const SurfaceBuffer *receiver = nullptr, bool cull = true);
   void draw_except(const std::vector<SurfaceBuffer> &hidden_surfaces);
+  // Culls on the GPU (see find_surfaces_in_view) and draws, skipping the culler's hidden surfaces
+  // if requested. False if GPU culling is not available, drawing nothing.
+  bool draw_culled(const SurfaceBuffer *receiver, bool skip_hidden);
+  // Sets the MVP of the current program, in the view buffer if the program reads it from there
   void set_mvp();
+  void use_program(const GLProgram &program);
   void set_camera_mvp();
   void calculate_camera_view();
   void toggle_wire_frame_mode();
   void toggle_camera_mode();
+  void initialize_window();
+  void open_viewer();
+  void close_viewer();
+  void initialize_off_screen_buffers();
+  // Storage for the bound depth renderbuffer, multisampled with more than one sample per pixel
+  void allocate_depth_renderbuffer(GLsizei width, GLsizei height) const;
+  // Area of each sample counted by occlusion queries
+  [[nodiscard]] float get_sample_area(const SunProjection &projection, int resolution) const;
   void initialize_off_screen_mode();
+  void initialize_batch_buffers();
+  void initialize_batch_mode();
   void initialize_render_mode();
+  // Single draws of the model in surface ID buffer mode read each triangle's surface ID from the
+  // table. False, leaving the surfaces to be drawn one at a time, if this is not supported.
+  bool initialize_surface_id_table();
+  void initialize_surface_id_mode();
+  void release_surface_id_buffers();
+  void initialize_shared_depth_mode();
 };
 
 } // namespace Penumbra
 
-#endif // CONTEXT_H_
+#endif // GL_CONTEXT_H_
@@ -0,0 +1,247 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+
+// Penumbra
+#include "gl/buffer.h"
+#include "gl/culler.h"
+
+namespace Penumbra {
+
+// Buffers follow the std430 layouts of SurfaceBounds and DrawElementsIndirectCommand, and the
+// parameters the std140 layout of CullingParameters (below). The work group size matches
+// work_group_size.
+const char *GLCuller::culling_compute_shader_source =
+    R"src(
+  #version 430
+  layout(local_size_x = 64) in;
+  struct Surface {
+    vec4 minimum; // Bounding box corners
+    vec4 maximum;
+    uint first; // Index range
+    uint count;
+  };
+  struct Command {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+  };
+  layout(std430, binding = 0) readonly buffer Surfaces { Surface surfaces[]; };
+  layout(std430, binding = 1) readonly buffer Hidden { uint hidden[]; };
+  layout(std430, binding = 2) writeonly buffer Commands { Command commands[]; };
+  layout(std140, binding = 1) uniform Parameters {
+    mat4 view;
+    vec4 bounds_minimum;
+    vec4 bounds_maximum;
+    vec4 plane;
+    int receiver;
+    int skip_hidden;
+  };
+  void main()
+  {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint(surfaces.length())) {
+      return;
+    }
+    Surface surface = surfaces[i];
+    vec3 center = 0.5 * (surface.minimum.xyz + surface.maximum.xyz);
+    vec3 half_size = 0.5 * (surface.maximum.xyz - surface.minimum.xyz);
+    mat3 rotation = mat3(view);
+    vec3 view_center = rotation * center;
+    vec3 view_half_size = mat3(abs(rotation[0]), abs(rotation[1]), abs(rotation[2])) * half_size;
+    bool visible = surface.count > 0u && !(skip_hidden != 0 && hidden[i] != 0u) &&
+                   all(lessThanEqual(view_center - view_half_size, bounds_maximum.xyz)) &&
+                   all(greaterThanEqual(view_center + view_half_size, bounds_minimum.xyz));
+    if (visible && int(i) != receiver) {
+      // Farthest corner along the normal
+      vec3 corner = mix(surface.minimum.xyz, surface.maximum.xyz, greaterThan(plane.xyz, vec3(0)));
+      visible = dot(plane.xyz, corner) > plane.w;
+    }
+    commands[i] = Command(visible ? surface.count : 0u, 1u, surface.first, 0, 0u);
+  }
+)src";
+
+namespace {
+struct SurfaceBounds {
+  GLfloat minimum[4];
+  GLfloat maximum[4];
+  GLuint first;
+  GLuint count;
+  GLuint padding[2]; // Arrays of std430 structures align to their largest member (a vec4)
+};
+static_assert(sizeof(SurfaceBounds) == 48u);
+
+SurfaceBounds get_bounds(const std::vector<float> &vertices,
+                         const std::vector<unsigned int> &indices,
+                         const SurfaceBuffer &surface_buffer) {
+  SurfaceBounds surface{};
+  std::fill(surface.minimum, surface.minimum + 4, MAX_FLOAT);
+  std::fill(surface.maximum, surface.maximum + 4, -MAX_FLOAT);
+  for (unsigned int index = surface_buffer.begin;
+       index < surface_buffer.begin + surface_buffer.count; ++index) {
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+      float const coordinate = vertices[3u * indices[index] + axis];
+      surface.minimum[axis] = std::min(coordinate, surface.minimum[axis]);
+      surface.maximum[axis] = std::max(coordinate, surface.maximum[axis]);
+    }
+  }
+  surface.first = surface_buffer.begin;
+  surface.count = surface_buffer.count;
+  return surface;
+}
+
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+static_assert(sizeof(DrawElementsIndirectCommand) == 20u); // Tightly packed in std430 and draws
+
+struct CullingParameters {
+  GLfloat view[16];
+  GLfloat bounds_minimum[4];
+  GLfloat bounds_maximum[4];
+  GLfloat plane[4];
+  GLint receiver;
+  GLint skip_hidden;
+  GLint padding[2]; // std140 blocks round up to a multiple of a vec4
+};
+static_assert(sizeof(CullingParameters) == 128u);
+} // namespace
+
+GLCuller::GLCuller(Courierr::Courierr *logger) : program(culling_compute_shader_source, logger) {
+  parameter_buffer_object =
+      create_buffer(GL_UNIFORM_BUFFER, sizeof(CullingParameters), nullptr, true);
+}
+
+GLCuller::~GLCuller() {
+  clear_model();
+  glDeleteBuffers(1, &parameter_buffer_object);
+  glDeleteProgram(program.get());
+}
+
+bool GLCuller::is_supported() {
+  bool const is_version_4_3 = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3);
+  return is_version_4_3 && GLAD_GL_ARB_compute_shader && GLAD_GL_ARB_shader_storage_buffer_object &&
+         GLAD_GL_ARB_shader_image_load_store && GLAD_GL_ARB_uniform_buffer_object &&
+         GLAD_GL_ARB_draw_indirect && GLAD_GL_ARB_multi_draw_indirect;
+}
+
+void GLCuller::set_model(const std::vector<float> &vertices,
+                         const std::vector<unsigned int> &indices,
+                         const std::vector<SurfaceBuffer> &surface_buffers) {
+  clear_model();
+  surface_count = static_cast<GLsizei>(surface_buffers.size());
+  if (surface_count == 0) {
+    return;
+  }
+
+  std::vector<SurfaceBounds> surfaces;
+  surfaces.reserve(surface_buffers.size());
+  for (auto const &surface_buffer : surface_buffers) {
+    surfaces.push_back(get_bounds(vertices, indices, surface_buffer));
+  }
+  hidden_flags.assign(surface_buffers.size(), 0u);
+
+  surface_buffer_object = create_buffer(
+      GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(sizeof(SurfaceBounds) * surfaces.size()),
+      surfaces.data(), true);
+  hidden_buffer_object = create_buffer(
+      GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(sizeof(GLuint) * hidden_flags.size()),
+      hidden_flags.data(), true);
+  command_buffer_object = create_buffer(
+      GL_SHADER_STORAGE_BUFFER,
+      static_cast<GLsizeiptr>(sizeof(DrawElementsIndirectCommand) * surfaces.size()), nullptr,
+      false);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  // Nothing else uses these binding points, so they are bound once for all draws
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, surface_buffer_object);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, hidden_buffer_object);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer_object);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 1, parameter_buffer_object);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_object);
+  buffers_set = true;
+}
+
+void GLCuller::update_surfaces(const std::vector<float> &vertices,
+                               const std::vector<unsigned int> &indices,
+                               const std::vector<SurfaceBuffer> &surface_buffers,
+                               const std::vector<unsigned int> &changed_surfaces) {
+  for (auto const surface_index : changed_surfaces) {
+    auto const surface = get_bounds(vertices, indices, surface_buffers[surface_index]);
+    update_buffer(GL_SHADER_STORAGE_BUFFER, surface_buffer_object, sizeof(SurfaceBounds), &surface,
+                  static_cast<GLintptr>(sizeof(SurfaceBounds) * surface_index));
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GLCuller::clear_model() {
+  if (buffers_set) {
+    glDeleteBuffers(1, &surface_buffer_object);
+    glDeleteBuffers(1, &hidden_buffer_object);
+    glDeleteBuffers(1, &command_buffer_object);
+    buffers_set = false;
+  }
+  surface_count = 0;
+  hidden_flags.clear();
+  hidden_surface_indices.clear();
+}
+
+void GLCuller::set_hidden_surfaces(const std::vector<SurfaceBuffer> &hidden_surfaces) {
+  if (hidden_surfaces.size() == hidden_surface_indices.size() &&
+      std::equal(hidden_surfaces.begin(), hidden_surfaces.end(), hidden_surface_indices.begin(),
+                 [](const SurfaceBuffer &surface_buffer, unsigned int surface_index) {
+                   return static_cast<unsigned int>(surface_buffer.index) == surface_index;
+                 })) {
+    return;
+  }
+  for (auto const surface_index : hidden_surface_indices) {
+    hidden_flags[surface_index] = 0u;
+  }
+  hidden_surface_indices.clear();
+  for (auto const &surface_buffer : hidden_surfaces) {
+    auto const surface_index = static_cast<unsigned int>(surface_buffer.index);
+    hidden_flags[surface_index] = 1u;
+    hidden_surface_indices.push_back(surface_index);
+  }
+  update_buffer(GL_SHADER_STORAGE_BUFFER, hidden_buffer_object,
+                static_cast<GLsizeiptr>(sizeof(GLuint) * hidden_flags.size()), hidden_flags.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GLCuller::draw(const mat4x4 view, const float (&bounds)[2][3],
+                    const std::array<float, 4> &plane, const int receiver_index,
+                    const bool skip_hidden, const GLuint draw_program) {
+  if (surface_count == 0) {
+    return;
+  }
+
+  // All parameters in a single update
+  CullingParameters parameters{};
+  std::copy(&view[0][0], &view[0][0] + 16, parameters.view);
+  std::copy(bounds[0], bounds[0] + 3, parameters.bounds_minimum);
+  std::copy(bounds[1], bounds[1] + 3, parameters.bounds_maximum);
+  std::copy(plane.begin(), plane.end(), parameters.plane);
+  parameters.receiver = receiver_index;
+  parameters.skip_hidden = skip_hidden ? 1 : 0;
+  update_buffer(GL_UNIFORM_BUFFER, parameter_buffer_object, sizeof(CullingParameters),
+                &parameters);
+
+  glUseProgram(program.get());
+  glDispatchCompute((static_cast<GLuint>(surface_count) + work_group_size - 1u) / work_group_size,
+                    1u, 1u);
+  glUseProgram(draw_program);
+
+  // Commands written by the compute shader are read by the draw
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, surface_count, 0);
+}
+
+} // namespace Penumbra
@@ -0,0 +1,67 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef CULLER_H_
+#define CULLER_H_
+
+// Standard
+#include <array>
+#include <vector>
+
+// Vendor
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <courierr/courierr.h>
+#include <linmath.h> // Part of GLFW
+
+// Penumbra
+#include "../context.h"
+#include "gl/program.h"
+
+namespace Penumbra {
+
+// Culls the model's surfaces on the GPU. A compute shader tests each surface's bounding box
+// against the view and a receiver's shading plane, and writes one indirect draw command per
+// surface (empty for culled and hidden surfaces), so the model is drawn with a single call and no
+// per surface work on the CPU. Requires OpenGL 4.3.
+class GLCuller {
+public:
+  explicit GLCuller(Courierr::Courierr *logger);
+  ~GLCuller();
+  GLCuller(const GLCuller &) = delete;
+  GLCuller &operator=(const GLCuller &) = delete;
+  static bool is_supported();
+  void set_model(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                 const std::vector<SurfaceBuffer> &surface_buffers);
+  // Rewrites only the changed surfaces' bounds (see Context::update_model)
+  void update_surfaces(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                       const std::vector<SurfaceBuffer> &surface_buffers,
+                       const std::vector<unsigned int> &changed_surfaces);
+  void clear_model();
+
+  // Surfaces left out by draws that skip hidden surfaces. Uploaded only when the set changes.
+  void set_hidden_surfaces(const std::vector<SurfaceBuffer> &hidden_surfaces);
+
+  // Draws the surfaces whose bounding boxes may overlap the bounds (minimum and maximum corners)
+  // in the view's coordinates, ignoring the view's translation, and extend beyond the plane
+  // normal . x = offset (given as {normal, offset}). The receiver (if not negative) is drawn
+  // regardless of the plane. Uses the model's vertex array (with its element buffer), which must
+  // be bound, and the draw program, which is made current again after culling.
+  void draw(const mat4x4 view, const float (&bounds)[2][3], const std::array<float, 4> &plane,
+            int receiver_index, bool skip_hidden, GLuint draw_program);
+
+private:
+  static const char *culling_compute_shader_source;
+  static constexpr GLuint work_group_size{64u};
+  GLProgram program;
+  GLuint parameter_buffer_object{}; // Uniform block, updated once per draw
+  GLuint surface_buffer_object{}, hidden_buffer_object{}, command_buffer_object{};
+  bool buffers_set{false};
+  GLsizei surface_count{0};
+  std::vector<GLuint> hidden_flags;                 // By surface
+  std::vector<unsigned int> hidden_surface_indices; // Last uploaded by set_hidden_surfaces
+};
+
+} // namespace Penumbra
+
+#endif // CULLER_H_
@@ -0,0 +1,100 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+
+// Penumbra
+#include "gl/buffer.h"
+#include "gl/histogram.h"
+
+namespace Penumbra {
+
+// Surface IDs are one-based, little endian across the channels, with zero for no surface. The
+// counts are bound after the culler's buffers (see GLCuller). The work group size matches
+// work_group_size.
+const char *GLHistogram::histogram_compute_shader_source =
+    R"src(
+  #version 430
+  layout(local_size_x = 16, local_size_y = 16) in;
+  layout(rgba8, binding = 0) readonly uniform image2D surface_ids;
+  layout(std430, binding = 3) buffer Counts { uint counts[]; };
+  uniform ivec2 extent;
+  void main()
+  {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, extent))) {
+      return;
+    }
+    uvec4 bytes = uvec4(round(imageLoad(surface_ids, pixel) * 255.0));
+    uint id = bytes.r | (bytes.g << 8u) | (bytes.b << 16u) | (bytes.a << 24u);
+    if (id > 0u) {
+      atomicAdd(counts[id - 1u], 1u);
+    }
+  }
+)src";
+
+GLHistogram::GLHistogram(Courierr::Courierr *logger)
+    : program(histogram_compute_shader_source, logger) {
+  extent_location = glGetUniformLocation(program.get(), "extent");
+}
+
+GLHistogram::~GLHistogram() {
+  glDeleteProgram(program.get());
+}
+
+bool GLHistogram::is_supported() {
+  bool const is_version_4_3 = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3);
+  return is_version_4_3 && GLAD_GL_ARB_compute_shader && GLAD_GL_ARB_shader_storage_buffer_object &&
+         GLAD_GL_ARB_shader_image_load_store;
+}
+
+GLuint GLHistogram::create_counts(std::size_t surface_count) {
+  // Storage may not be empty
+  auto const buffer = create_buffer(
+      GL_SHADER_STORAGE_BUFFER,
+      static_cast<GLsizeiptr>(sizeof(GLuint) * std::max<std::size_t>(surface_count, 1u)), nullptr,
+      true);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  return buffer;
+}
+
+void GLHistogram::clear_counts(GLuint counts_buffer, std::size_t surface_count) {
+  if (surface_count == 0u) {
+    return;
+  }
+  std::vector<GLuint> const zeros(surface_count, 0u);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT); // After any counts still being added
+  update_buffer(GL_SHADER_STORAGE_BUFFER, counts_buffer,
+                static_cast<GLsizeiptr>(sizeof(GLuint) * surface_count), zeros.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GLHistogram::read_counts(GLuint counts_buffer, std::vector<std::uint64_t> &pixel_counts) {
+  if (pixel_counts.empty()) {
+    return;
+  }
+  std::vector<GLuint> counts(pixel_counts.size());
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counts_buffer);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     static_cast<GLsizeiptr>(sizeof(GLuint) * counts.size()), counts.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  std::copy(counts.begin(), counts.end(), pixel_counts.begin());
+}
+
+void GLHistogram::count(GLuint texture, GLsizei width, GLsizei height, GLuint counts_buffer,
+                        GLuint draw_program) {
+  glUseProgram(program.get());
+  glUniform2i(extent_location, width, height);
+  glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counts_buffer);
+  glDispatchCompute((static_cast<GLuint>(width) + work_group_size - 1u) / work_group_size,
+                    (static_cast<GLuint>(height) + work_group_size - 1u) / work_group_size, 1u);
+  glUseProgram(draw_program);
+
+  // The next tile is drawn over the pixels read here
+  glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+}
+
+} // namespace Penumbra
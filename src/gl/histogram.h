@@ -0,0 +1,51 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+// Standard
+#include <cstdint>
+#include <vector>
+
+// Vendor
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <courierr/courierr.h>
+
+// Penumbra
+#include "gl/program.h"
+
+namespace Penumbra {
+
+// Counts the pixels holding each surface ID of a surface ID buffer on the GPU, so the buffer is
+// not read back. A compute shader adds each pixel to its surface's count in a buffer of unsigned
+// integers (one per surface). Requires OpenGL 4.3.
+class GLHistogram {
+public:
+  explicit GLHistogram(Courierr::Courierr *logger);
+  ~GLHistogram();
+  GLHistogram(const GLHistogram &) = delete;
+  GLHistogram &operator=(const GLHistogram &) = delete;
+  static bool is_supported();
+
+  static GLuint create_counts(std::size_t surface_count);
+  static void clear_counts(GLuint counts_buffer, std::size_t surface_count);
+  // Waits for the counts added before, and replaces pixel_counts (sized by surface) with them
+  static void read_counts(GLuint counts_buffer, std::vector<std::uint64_t> &pixel_counts);
+
+  // Adds the surface IDs of the lower left width by height pixels of an RGBA8 texture (encoded as
+  // in GLContext::submit_surface_id_pssas) to the counts. The draw program is made current again.
+  void count(GLuint texture, GLsizei width, GLsizei height, GLuint counts_buffer,
+             GLuint draw_program);
+
+private:
+  static const char *histogram_compute_shader_source;
+  static constexpr GLuint work_group_size{16u}; // On each side
+  GLProgram program;
+  GLint extent_location{};
+};
+
+} // namespace Penumbra
+
+#endif // HISTOGRAM_H_
@@ -3,8 +3,10 @@
 
 // Standard
 #include <algorithm>
+#include <cstddef>
 
 // Penumbra
+#include "buffer.h"
 #include "model.h"
 
 #ifdef __APPLE__
@@ -19,30 +21,125 @@
 
 namespace Penumbra {
 
-SurfaceBuffer::SurfaceBuffer(GLuint begin, GLuint count, GLint index)
-    : begin(begin), count(count), index(index) {}
-
 void GLModel::clear_model() {
   if (objects_set) {
     glDeleteVertexArraysX(1, &vertex_array_object);
     glDeleteBuffers(1, &vertex_buffer_object);
+    glDeleteBuffers(1, &element_buffer_object);
   }
   surface_buffers.clear();
 }
 
-void GLModel::set_vertices(const std::vector<float> &vertices) {
+void GLModel::set_vertices(const std::vector<float> &vertices,
+                           const std::vector<unsigned int> &indices) {
+  create_objects(vertices, indices, false);
+}
+
+void GLModel::update_vertices(const std::vector<float> &vertices,
+                              const std::vector<unsigned int> &indices,
+                              const std::vector<SurfaceBuffer> &surface_buffers_in,
+                              const std::vector<unsigned int> &changed_surfaces,
+                              const std::vector<std::pair<unsigned int, unsigned int>>
+                                  &rewritten_vertices) {
+  if (vertices.size() > vertex_capacity || indices.size() > index_capacity) {
+    clear_model();
+    create_objects(vertices, indices, true);
+    surface_buffers = surface_buffers_in;
+    return;
+  }
+
+  // Without direct state access, the element buffer is updated through the vertex array's binding
+  glBindVertexArrayX(vertex_array_object);
+
+  for (auto const &[first, count] : rewritten_vertices) {
+    if (vertex_size * first < number_of_vertex_coordinates) { // Appended ones are written below
+      auto const coordinate_count = std::min<std::size_t>(
+          vertex_size * count, number_of_vertex_coordinates - vertex_size * first);
+      update_buffer(GL_ARRAY_BUFFER, vertex_buffer_object,
+                    static_cast<GLsizeiptr>(sizeof(float) * coordinate_count),
+                    &vertices[vertex_size * first],
+                    static_cast<GLintptr>(sizeof(float) * vertex_size * first));
+    }
+  }
+  if (vertices.size() > number_of_vertex_coordinates) {
+    update_buffer(GL_ARRAY_BUFFER, vertex_buffer_object,
+                  static_cast<GLsizeiptr>(sizeof(float) *
+                                          (vertices.size() - number_of_vertex_coordinates)),
+                  &vertices[number_of_vertex_coordinates],
+                  static_cast<GLintptr>(sizeof(float) * number_of_vertex_coordinates));
+  }
+  auto const upload_range = [&](const SurfaceBuffer &surface_buffer) {
+    if (surface_buffer.count > 0u) {
+      update_buffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_object,
+                    static_cast<GLsizeiptr>(sizeof(GLuint) * surface_buffer.count),
+                    &indices[surface_buffer.begin],
+                    static_cast<GLintptr>(sizeof(GLuint) * surface_buffer.begin));
+    }
+  };
+  for (auto const surface_index : changed_surfaces) {
+    upload_range(surface_buffers[surface_index]); // Left as degenerate triangles
+    upload_range(surface_buffers_in[surface_index]);
+  }
+  number_of_indices = static_cast<unsigned int>(indices.size());
+  number_of_vertex_coordinates = vertices.size();
+  surface_buffers = surface_buffers_in;
+}
+
+void GLModel::create_objects(const std::vector<float> &vertices,
+                             const std::vector<unsigned int> &indices, bool dynamic) {
+
+  number_of_indices = static_cast<unsigned int>(indices.size());
+  number_of_vertex_coordinates = vertices.size();
+  auto const vertices_size = static_cast<GLsizeiptr>(sizeof(float) * vertices.size());
+  auto const indices_size = static_cast<GLsizeiptr>(sizeof(GLuint) * indices.size());
+  // Dynamic buffers are twice the model's size, so it may grow without allocating them again
+  vertex_capacity = dynamic ? std::max<std::size_t>(2u * vertices.size(), vertex_size) : 0u;
+  index_capacity = dynamic ? std::max<std::size_t>(2u * indices.size(), 3u) : 0u;
+  auto const vertex_buffer_size =
+      dynamic ? static_cast<GLsizeiptr>(sizeof(float) * vertex_capacity) : vertices_size;
+  auto const element_buffer_size =
+      dynamic ? static_cast<GLsizeiptr>(sizeof(GLuint) * index_capacity) : indices_size;
+
+  if (has_direct_state_access()) {
+    // Immutable buffers and vertex array set up without binding any of them
+    vertex_buffer_object = create_buffer(GL_ARRAY_BUFFER, vertex_buffer_size,
+                                         dynamic ? nullptr : vertices.data(), dynamic);
+    element_buffer_object = create_buffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_size,
+                                          dynamic ? nullptr : indices.data(), dynamic);
+    if (dynamic) {
+      update_buffer(GL_ARRAY_BUFFER, vertex_buffer_object, vertices_size, vertices.data());
+      update_buffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_object, indices_size, indices.data());
+    }
+    glCreateVertexArrays(1, &vertex_array_object);
+    glVertexArrayVertexBuffer(vertex_array_object, 0, vertex_buffer_object, 0, sizeof(float) * 3);
+    glVertexArrayElementBuffer(vertex_array_object, element_buffer_object);
+    glEnableVertexArrayAttrib(vertex_array_object, 0);
+    glVertexArrayAttribFormat(vertex_array_object, 0, 3, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(vertex_array_object, 0, 0);
+    glBindVertexArray(vertex_array_object);
+    objects_set = true;
+    return;
+  }
 
-  vertex_array = vertices;
-  number_of_points = static_cast<unsigned int>(vertices.size()) / vertex_size;
   // Set up vertex array object
   glGenVertexArraysX(1, &vertex_array_object);
   glBindVertexArrayX(vertex_array_object);
 
   // Set up array buffer to store vertex information
+  GLenum const usage = dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
   glGenBuffers(1, &vertex_buffer_object);
   glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_object);
-  glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizei>(sizeof(float) * vertices.size()), &vertices[0],
-               GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, vertex_buffer_size, dynamic ? nullptr : vertices.data(), usage);
+
+  // Set up element buffer (part of the vertex array object's state) to store triangle indices
+  glGenBuffers(1, &element_buffer_object);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_object);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, element_buffer_size, dynamic ? nullptr : indices.data(),
+               usage);
+  if (dynamic) {
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertices_size, vertices.data());
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices_size, indices.data());
+  }
 
   // Set drawing pointers for current vertex buffer
   glEnableVertexAttribArray(0);
@@ -55,53 +152,96 @@ void GLModel::set_surface_buffers(const std::vector<SurfaceBuffer> &surface_buff
   this->surface_buffers = surface_buffers_in;
 }
 
+const void *GLModel::get_offset(GLint first) {
+  return reinterpret_cast<const void *>(sizeof(GLuint) * static_cast<std::size_t>(first));
+}
+
 void GLModel::draw_surface(SurfaceBuffer surface_buffer) {
-  glDrawArrays(GL_TRIANGLES, static_cast<GLint>(surface_buffer.begin),
-               static_cast<GLsizei>(surface_buffer.count));
+  glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(surface_buffer.count), GL_UNSIGNED_INT,
+                 get_offset(static_cast<GLint>(surface_buffer.begin)));
 }
 
 void GLModel::draw_all() const {
-  glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(number_of_points));
+  glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(number_of_indices), GL_UNSIGNED_INT, nullptr);
 }
 
-void GLModel::draw_except(std::vector<SurfaceBuffer> hidden_surfaces) const {
+void GLModel::set_ranges(const std::vector<unsigned int> &surface_indices) {
+  range_firsts.clear();
+  range_counts.clear();
+  for (auto const surface_index : surface_indices) {
+    auto const &surface_buffer = surface_buffers[surface_index];
+    if (surface_buffer.count == 0u) {
+      continue;
+    }
+    auto const first = static_cast<GLint>(surface_buffer.begin);
+    auto const count = static_cast<GLsizei>(surface_buffer.count);
+    // Drawing a few extra triangles costs less than starting another range. Ranges of surfaces
+    // moved by model updates may come before the last range.
+    GLint const gap =
+        range_firsts.empty() ? -1 : first - (range_firsts.back() + range_counts.back());
+    if (gap >= 0 && gap <= max_gap_index_count) {
+      range_counts.back() = first + count - range_firsts.back();
+    } else {
+      range_firsts.push_back(first);
+      range_counts.push_back(count);
+    }
+  }
+}
 
-  if (hidden_surfaces.empty()) { // draw all if no hidden surfaces
-    draw_all();
+void GLModel::multi_draw_ranges() {
+  if (range_firsts.empty()) {
     return;
   }
+  range_offsets.clear();
+  for (auto const first : range_firsts) {
+    range_offsets.push_back(get_offset(first));
+  }
+  glMultiDrawElements(GL_TRIANGLES, range_counts.data(), GL_UNSIGNED_INT, range_offsets.data(),
+                      static_cast<GLsizei>(range_firsts.size()));
+}
 
-  // Sort vector
-  std::sort(
-      hidden_surfaces.begin(), hidden_surfaces.end(),
-      [](const SurfaceBuffer &a, const SurfaceBuffer &b) -> bool { return a.begin > b.begin; });
+void GLModel::draw_surfaces(const std::vector<unsigned int> &surface_indices) {
+  set_ranges(surface_indices);
+  multi_draw_ranges();
+}
 
-  // Begin (if first hidden surface isn't first surface)
-  if (hidden_surfaces[0].begin != 0u) {
-    glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(hidden_surfaces[0].begin));
+void GLModel::draw_surfaces_instanced(const std::vector<unsigned int> &surface_indices,
+                                      GLsizei instance_count) {
+  set_ranges(surface_indices);
+  for (std::size_t i = 0; i < range_firsts.size(); ++i) {
+    glDrawElementsInstancedARB(GL_TRIANGLES, range_counts[i], GL_UNSIGNED_INT,
+                               get_offset(range_firsts[i]), instance_count);
   }
+}
 
-  GLuint nextBegin = hidden_surfaces[0].begin + hidden_surfaces[0].count;
+void GLModel::draw_except(std::vector<SurfaceBuffer> hidden_surfaces) {
 
-  // Loop through all exceptions
-  for (std::size_t i = 1; i < hidden_surfaces.size(); ++i) {
-    if (nextBegin == number_of_points) {
-      // This is the last surface
-      return;
-    }
-    if (nextBegin == hidden_surfaces[i].begin) {
-      // Next surface is also hidden
-      nextBegin = hidden_surfaces[i].begin + hidden_surfaces[i].count;
-      break;
+  if (hidden_surfaces.empty()) { // draw all if no hidden surfaces
+    draw_all();
+    return;
+  }
+
+  std::sort(
+      hidden_surfaces.begin(), hidden_surfaces.end(),
+      [](const SurfaceBuffer &a, const SurfaceBuffer &b) -> bool { return a.begin < b.begin; });
+
+  // Draw the ranges between hidden surfaces (adjacent hidden surfaces leave no range) with one call
+  range_firsts.clear();
+  range_counts.clear();
+  GLuint begin{0u};
+  for (auto const &hidden_surface : hidden_surfaces) {
+    if (hidden_surface.begin > begin) {
+      range_firsts.push_back(static_cast<GLint>(begin));
+      range_counts.push_back(static_cast<GLsizei>(hidden_surface.begin - begin));
     }
-    glDrawArrays(GL_TRIANGLES, static_cast<GLsizei>(nextBegin),
-                 static_cast<GLsizei>(hidden_surfaces[i + 1].begin - 1));
+    begin = std::max(begin, hidden_surface.begin + hidden_surface.count);
   }
 
-  if (nextBegin < number_of_points) {
-    glDrawArrays(GL_TRIANGLES, static_cast<GLsizei>(nextBegin),
-                 static_cast<GLsizei>(number_of_points - nextBegin));
+  if (begin < number_of_indices) {
+    range_firsts.push_back(static_cast<GLint>(begin));
+    range_counts.push_back(static_cast<GLsizei>(number_of_indices - begin));
   }
+  multi_draw_ranges();
 }
 
 } // namespace Penumbra
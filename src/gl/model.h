@@ -5,39 +5,60 @@
 #define MODEL_H_
 
 // Standard
+#include <utility>
 #include <vector>
 
 // Vendor
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-namespace Penumbra {
+// Penumbra
+#include "../context.h"
 
-class SurfaceBuffer {
-public:
-  explicit SurfaceBuffer(GLuint begin = 0u, GLuint count = 0u, GLint index = -1);
-  GLuint begin;
-  GLuint count;
-  GLint index;
-};
+namespace Penumbra {
 
 class GLModel {
 public:
   GLModel() = default;
   ~GLModel() = default;
-  void set_vertices(const std::vector<float> &vertices);
+  // Uploads the distinct vertices and the indices (three per triangle) into them
+  void set_vertices(const std::vector<float> &vertices, const std::vector<unsigned int> &indices);
+  // Uploads the model again after some surfaces changed (see Context::update_model). While the
+  // buffers have room, only the appended and rewritten vertices, and the changed surfaces' index
+  // ranges (before and after), are written. Otherwise, the buffers are allocated again with room
+  // to grow.
+  void
+  update_vertices(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                  const std::vector<SurfaceBuffer> &surface_buffers,
+                  const std::vector<unsigned int> &changed_surfaces,
+                  const std::vector<std::pair<unsigned int, unsigned int>> &rewritten_vertices);
   void set_surface_buffers(const std::vector<SurfaceBuffer> &surface_buffers);
   static void draw_surface(SurfaceBuffer surface_buffer);
   void draw_all() const;
-  void draw_except(std::vector<SurfaceBuffer> hidden_surfaces) const;
+  void draw_except(std::vector<SurfaceBuffer> hidden_surfaces);
+  // Draws the surfaces (in model order) with one call, merging adjacent index ranges
+  void draw_surfaces(const std::vector<unsigned int> &surface_indices);
+  void draw_surfaces_instanced(const std::vector<unsigned int> &surface_indices,
+                               GLsizei instance_count);
   void clear_model();
-  std::vector<float> vertex_array;
   std::vector<SurfaceBuffer> surface_buffers;
-  unsigned int number_of_points{0u};
+  unsigned int number_of_indices{0u};
   static const int vertex_size{3}; // i.e., 3D
 private:
-  GLuint vertex_buffer_object{}, vertex_array_object{};
+  GLuint vertex_buffer_object{}, element_buffer_object{}, vertex_array_object{};
   bool objects_set{false};
+  std::size_t number_of_vertex_coordinates{0u};
+  // Coordinates and indices the buffers hold. Zero for immutable buffers, which are not updated.
+  std::size_t vertex_capacity{0u}, index_capacity{0u};
+  void create_objects(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                      bool dynamic);
+  static constexpr GLint max_gap_index_count{96}; // Largest gap drawn to join two ranges
+  std::vector<GLint> range_firsts;                // Index ranges of the last draw
+  std::vector<GLsizei> range_counts;
+  std::vector<const void *> range_offsets; // Byte offsets of range_firsts in the element buffer
+  void set_ranges(const std::vector<unsigned int> &surface_indices);
+  void multi_draw_ranges();
+  static const void *get_offset(GLint first);
 };
 
 } // namespace Penumbra
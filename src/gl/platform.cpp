@@ -0,0 +1,333 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <cstring>
+#include <vector>
+
+#ifndef NDEBUG
+#ifdef __unix__
+#include <cfenv>
+#endif
+#endif
+
+// Vendor
+#include <glad/glad.h> // Must precede the OSMesa header, which includes GL/gl.h
+#include <fmt/format.h>
+
+#ifdef penumbra_USE_EGL
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef penumbra_USE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+// Penumbra
+#include "gl/platform.h"
+
+namespace Penumbra {
+
+thread_local static Courierr::Courierr *glfw_logger{nullptr};
+
+// GLFW is initialized once for all live contexts and terminated with the last one
+static unsigned int glfw_context_count{0u};
+
+static void glfw_error_callback(int, const char *description) {
+  if (glfw_logger) {
+    glfw_logger->info(fmt::format("GLFW message: {}", description));
+  }
+}
+
+GLPlatformContext::GLPlatformContext(GLPlatform platform) : platform(platform) {}
+
+GLFWwindow *GLPlatformContext::get_window() const {
+  return nullptr;
+}
+
+GLPlatform GLPlatformContext::get_platform() const {
+  return platform;
+}
+
+// GLFW: A hidden window. Requires a display server.
+class GLFWPlatformContext : public GLPlatformContext {
+public:
+  GLFWPlatformContext() : GLPlatformContext(GLPlatform::glfw) {}
+  ~GLFWPlatformContext() override {
+    if (window) {
+      glfwDestroyWindow(window);
+    }
+    if (is_glfw_initialized && --glfw_context_count == 0u) {
+      glfwTerminate();
+    }
+  }
+  bool initialize() {
+    if (!glfwInit()) {
+      return false;
+    }
+    is_glfw_initialized = true;
+    ++glfw_context_count;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    window = glfwCreateWindow(1, 1, "Penumbra", nullptr, nullptr);
+    if (!window) {
+      return false;
+    }
+    make_current();
+    return true;
+  }
+  void make_current() override {
+    glfwMakeContextCurrent(window);
+  }
+  [[nodiscard]] GLADloadproc get_loader() const override {
+    return (GLADloadproc)glfwGetProcAddress;
+  }
+  [[nodiscard]] GLFWwindow *get_window() const override {
+    return window;
+  }
+
+private:
+  GLFWwindow *window{nullptr};
+  bool is_glfw_initialized{false};
+};
+
+#ifdef penumbra_USE_EGL
+static bool has_extension(const char *extensions, const char *extension) {
+  if (!extensions) {
+    return false;
+  }
+  auto const length = std::strlen(extension);
+  for (const char *match = std::strstr(extensions, extension); match;
+       match = std::strstr(match + length, extension)) {
+    if ((match == extensions || match[-1] == ' ') &&
+        (match[length] == ' ' || match[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// EGL: Surfaceless (Mesa) or device (e.g., NVIDIA) platform displays. Rendering is only ever
+// done into framebuffer objects, so no surface is needed.
+class EGLPlatformContext : public GLPlatformContext {
+public:
+  EGLPlatformContext() : GLPlatformContext(GLPlatform::egl) {}
+  ~EGLPlatformContext() override {
+    if (context != EGL_NO_CONTEXT) {
+      eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+      eglDestroyContext(display, context);
+    }
+    if (surface != EGL_NO_SURFACE) {
+      eglDestroySurface(display, surface);
+    }
+    // The display is not terminated since it is shared by all contexts on this platform
+  }
+  bool initialize() {
+    display = get_display();
+    if (display == EGL_NO_DISPLAY || !eglBindAPI(EGL_OPENGL_API)) {
+      return false;
+    }
+
+    const EGLint config_attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE,
+                                        EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config{nullptr};
+    EGLint number_of_configs{0};
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &number_of_configs) ||
+        number_of_configs == 0) {
+      if (!has_extension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_no_config_context")) {
+        return false;
+      }
+      config = EGL_NO_CONFIG_KHR;
+    }
+
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+    if (context == EGL_NO_CONTEXT) {
+      return false;
+    }
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+      // Without EGL_KHR_surfaceless_context, fall back to a minimal pbuffer
+      const EGLint surface_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+      if (config == EGL_NO_CONFIG_KHR) {
+        return false;
+      }
+      surface = eglCreatePbufferSurface(display, config, surface_attributes);
+      if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  void make_current() override {
+    eglMakeCurrent(display, surface, surface, context);
+  }
+  [[nodiscard]] GLADloadproc get_loader() const override {
+    return (GLADloadproc)eglGetProcAddress;
+  }
+
+private:
+  EGLDisplay display{EGL_NO_DISPLAY};
+  EGLContext context{EGL_NO_CONTEXT};
+  EGLSurface surface{EGL_NO_SURFACE};
+
+  static bool initialize_display(EGLDisplay display) {
+    EGLint major, minor;
+    return display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor);
+  }
+
+  static EGLDisplay get_display() {
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+        eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+    if (get_platform_display) {
+      if (has_extension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay display =
+            get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (initialize_display(display)) {
+          return display;
+        }
+      }
+
+      auto query_devices =
+          reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+      if (query_devices && has_extension(client_extensions, "EGL_EXT_platform_device")) {
+        static constexpr EGLint max_devices{16};
+        EGLDeviceEXT devices[max_devices];
+        EGLint number_of_devices{0};
+        if (query_devices(max_devices, devices, &number_of_devices)) {
+          for (EGLint i = 0; i < number_of_devices; ++i) {
+            EGLDisplay display = get_platform_display(EGL_PLATFORM_DEVICE_EXT, devices[i], nullptr);
+            if (initialize_display(display)) {
+              return display;
+            }
+          }
+        }
+      }
+    }
+
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    return initialize_display(display) ? display : EGL_NO_DISPLAY;
+  }
+};
+#endif // penumbra_USE_EGL
+
+#ifdef penumbra_USE_OSMESA
+// OSMesa: Software rendering entirely in-process. Rendering is only ever done into framebuffer
+// objects, so the color buffer is a single pixel.
+class OSMesaPlatformContext : public GLPlatformContext {
+public:
+  OSMesaPlatformContext() : GLPlatformContext(GLPlatform::osmesa) {}
+  ~OSMesaPlatformContext() override {
+    if (context) {
+      OSMesaDestroyContext(context);
+    }
+  }
+  bool initialize() {
+    context = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, nullptr);
+    if (!context) {
+      return false;
+    }
+    return OSMesaMakeCurrent(context, buffer.data(), GL_UNSIGNED_BYTE, 1, 1);
+  }
+  void make_current() override {
+    OSMesaMakeCurrent(context, buffer.data(), GL_UNSIGNED_BYTE, 1, 1);
+  }
+  [[nodiscard]] GLADloadproc get_loader() const override {
+    return (GLADloadproc)OSMesaGetProcAddress;
+  }
+
+private:
+  OSMesaContext context{nullptr};
+  std::vector<GLubyte> buffer = std::vector<GLubyte>(4);
+};
+#endif // penumbra_USE_OSMESA
+
+template <typename T> static std::unique_ptr<GLPlatformContext> create_platform_context() {
+#ifndef NDEBUG
+#ifdef __unix__
+  // Temporarily Disable floating point exceptions
+  fedisableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
+#endif
+#endif
+  auto platform_context = std::make_unique<T>();
+  bool const initialized = platform_context->initialize();
+#ifndef NDEBUG
+#ifdef __unix__
+  feenableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
+#endif
+#endif
+  if (!initialized) {
+    return nullptr;
+  }
+  return platform_context;
+}
+
+bool GLPlatformContext::is_supported(GLPlatform platform) {
+  switch (platform) {
+  case GLPlatform::egl:
+#ifdef penumbra_USE_EGL
+    return true;
+#else
+    return false;
+#endif
+  case GLPlatform::osmesa:
+#ifdef penumbra_USE_OSMESA
+    return true;
+#else
+    return false;
+#endif
+  default:
+    return true;
+  }
+}
+
+const char *GLPlatformContext::get_name(GLPlatform platform) {
+  switch (platform) {
+  case GLPlatform::egl:
+    return "EGL";
+  case GLPlatform::osmesa:
+    return "OSMesa";
+  case GLPlatform::glfw:
+    return "GLFW";
+  default:
+    return "automatic";
+  }
+}
+
+std::unique_ptr<GLPlatformContext> GLPlatformContext::create(GLPlatform platform,
+                                                             Courierr::Courierr *logger) {
+  std::unique_ptr<GLPlatformContext> platform_context;
+#ifdef penumbra_USE_EGL
+  if (platform == GLPlatform::egl || platform == GLPlatform::automatic) {
+    platform_context = create_platform_context<EGLPlatformContext>();
+    if (platform_context) {
+      return platform_context;
+    }
+    if (logger && platform == GLPlatform::automatic) {
+      logger->info("Unable to create an EGL context. Trying other platforms.");
+    }
+  }
+#endif
+#ifdef penumbra_USE_OSMESA
+  if (platform == GLPlatform::osmesa || platform == GLPlatform::automatic) {
+    platform_context = create_platform_context<OSMesaPlatformContext>();
+    if (platform_context) {
+      return platform_context;
+    }
+    if (logger && platform == GLPlatform::automatic) {
+      logger->info("Unable to create an OSMesa context. Trying other platforms.");
+    }
+  }
+#endif
+  if (platform == GLPlatform::glfw || platform == GLPlatform::automatic) {
+    glfw_logger = logger;
+    glfwSetErrorCallback(glfw_error_callback);
+    platform_context = create_platform_context<GLFWPlatformContext>();
+  }
+  return platform_context;
+}
+
+} // namespace Penumbra
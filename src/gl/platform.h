@@ -0,0 +1,46 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef PLATFORM_H_
+#define PLATFORM_H_
+
+// Standard
+#include <memory>
+
+// Vendor
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <courierr/courierr.h>
+
+// Penumbra
+#include <penumbra/penumbra.h>
+
+namespace Penumbra {
+
+// An OpenGL context created through one of the supported platforms (see GLPlatform)
+class GLPlatformContext {
+public:
+  virtual ~GLPlatformContext() = default;
+
+  // Returns nullptr if no context can be created with the requested platform. For
+  // GLPlatform::automatic, headless platforms are tried before GLFW.
+  static std::unique_ptr<GLPlatformContext> create(GLPlatform platform,
+                                                   Courierr::Courierr *logger = nullptr);
+  static bool is_supported(GLPlatform platform); // Whether this build includes the platform
+  static const char *get_name(GLPlatform platform);
+
+  virtual void make_current() = 0;
+  [[nodiscard]] virtual GLADloadproc get_loader() const = 0;
+  [[nodiscard]] virtual GLFWwindow *get_window() const; // nullptr for headless platforms
+  [[nodiscard]] GLPlatform get_platform() const;
+
+protected:
+  explicit GLPlatformContext(GLPlatform platform);
+
+private:
+  GLPlatform platform;
+};
+
+} // namespace Penumbra
+
+#endif // PLATFORM_H_
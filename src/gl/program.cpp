@@ -19,6 +19,13 @@ GLProgram::GLProgram(const char *vertex_source, const char *fragment_source,
   glLinkProgram(program);
 }
 
+GLProgram::GLProgram(const char *compute_source, Courierr::Courierr *logger) {
+  program = glCreateProgram();
+  GLShader compute(GL_COMPUTE_SHADER, compute_source, logger);
+  glAttachShader(program, compute.get());
+  glLinkProgram(program);
+}
+
 GLProgram::~GLProgram() = default;
 
 GLuint GLProgram::get() const {
@@ -14,6 +14,8 @@ namespace Penumbra {
 class GLProgram {
 public:
   GLProgram(const char *vertex_source, const char *fragment_source, Courierr::Courierr *logger);
+  // Compute program (requires OpenGL 4.3)
+  GLProgram(const char *compute_source, Courierr::Courierr *logger);
   ~GLProgram();
   [[nodiscard]] GLuint get() const;
 
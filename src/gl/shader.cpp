@@ -24,7 +24,12 @@ GLShader::GLShader(GLenum type, const char *source, Courierr::Courierr *logger_i
       glGetShaderInfoLog(shader, 8192, &log_length, info_log);
       glDeleteShader(shader);
       shader = 0;
-      std::string shader_type_string = (type == GL_FRAGMENT_SHADER) ? "fragment" : "vertex";
+      std::string shader_type_string{"vertex"};
+      if (type == GL_FRAGMENT_SHADER) {
+        shader_type_string = "fragment";
+      } else if (type == GL_COMPUTE_SHADER) {
+        shader_type_string = "compute";
+      }
       logger->info(fmt::format("OpenGL {} shader: {}", shader_type_string, info_log));
       throw PenumbraException(fmt::format("Unable to compile {} shader.", shader_type_string),
                               *logger);
@@ -2,7 +2,13 @@
  * See the LICENSE file for additional terms and conditions. */
 
 // Standard
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
 #include <memory>
+#include <numeric>
+#include <unordered_map>
 
 #ifndef NDEBUG
 #ifdef __unix__
@@ -12,12 +18,44 @@
 
 // Penumbra
 #include "penumbra-implementation.h"
+#include "gl/context.h"
+#include "cpu/context.h"
+#include "clipping/context.h"
+#include "ray-casting/context.h"
+#ifdef penumbra_USE_VULKAN
+#include "vulkan/context.h"
+#endif
 
 namespace Penumbra {
 
-PenumbraImplementation::PenumbraImplementation(int size,
+std::size_t PenumbraImplementation::VertexKeyHash::operator()(const VertexKey &key) const {
+  std::size_t hash{0u};
+  for (auto const coordinate : key) {
+    hash = hash * 31u + std::hash<float>{}(coordinate);
+  }
+  return hash;
+}
+
+PenumbraImplementation::PenumbraImplementation(int size, CalculationBackend backend,
+                                               GLPlatform platform,
                                                const std::shared_ptr<Courierr::Courierr> &logger_in)
-    : context(size, logger_in.get()), logger(logger_in) {}
+    : backend(backend), logger(logger_in) {
+  if (backend == CalculationBackend::software_rasterizer) {
+    context = std::make_unique<CPUContext>(size, thread_pool, logger.get());
+  } else if (backend == CalculationBackend::polygon_clipping) {
+    context = std::make_unique<ClippingContext>(size, thread_pool, logger.get());
+  } else if (backend == CalculationBackend::ray_casting) {
+    context = std::make_unique<RayCastingContext>(size, thread_pool, logger.get());
+  } else if (backend == CalculationBackend::vulkan) {
+#ifdef penumbra_USE_VULKAN
+    context = std::make_unique<VulkanContext>(size, thread_pool, logger.get());
+#else
+    throw PenumbraException("The Vulkan backend is not supported by this build.", *logger);
+#endif
+  } else {
+    context = std::make_unique<GLContext>(size, platform, logger.get());
+  }
+}
 
 void PenumbraImplementation::add_surface(const Surface &surface) {
   surface.surface->logger = logger;
@@ -25,6 +63,468 @@ void PenumbraImplementation::add_surface(const Surface &surface) {
     surface.surface->name = fmt::format("Surface {}", surfaces.size());
   }
   surfaces.push_back(*surface.surface);
+  surfaces.back().classify();
+  enabled_surfaces.push_back(true);
+  prototypes.push_back(static_cast<unsigned int>(surfaces.size()) - 1u);
+}
+
+void PenumbraImplementation::add_surface_instances(
+    const Surface &prototype, const std::vector<std::array<float, 16>> &transforms) {
+  prototype.surface->logger = logger;
+  SurfaceImplementation instance = *prototype.surface;
+  instance.classify();
+  instance.is_transformed = true;
+  auto const first = static_cast<unsigned int>(surfaces.size());
+  surfaces.reserve(surfaces.size() + transforms.size());
+  for (std::size_t i = 0; i < transforms.size(); ++i) {
+    instance.name = prototype.surface->name.empty()
+                        ? fmt::format("Surface {}", surfaces.size())
+                        : fmt::format("{} {}", prototype.surface->name, i);
+    instance.transform = transforms[i];
+    surfaces.push_back(instance);
+    enabled_surfaces.push_back(true);
+    prototypes.push_back(first);
+  }
+}
+
+void PenumbraImplementation::update_surface(const unsigned int index, const Surface &surface) {
+  check_surface(index);
+  auto previous = std::move(surfaces[index]);
+  surfaces[index] = *surface.surface;
+  surfaces[index].logger = logger;
+  if (surfaces[index].name.empty()) {
+    surfaces[index].name = std::move(previous.name);
+  }
+  surfaces[index].transform = previous.transform;
+  surfaces[index].is_transformed = previous.is_transformed;
+  surfaces[index].classify();
+  unlink_instance(index);
+  set_changed(index, SurfaceChange::tessellated);
+}
+
+void PenumbraImplementation::remove_surface(const unsigned int index) {
+  check_surface(index);
+  unlink_instance(index);
+  surfaces[index].polygon.clear();
+  surfaces[index].holes.clear();
+  surfaces[index].classify();
+  set_changed(index, SurfaceChange::tessellated);
+}
+
+void PenumbraImplementation::set_surface_enabled(const unsigned int index, const bool enabled) {
+  check_surface(index);
+  if (enabled_surfaces[index] != enabled) {
+    enabled_surfaces[index] = enabled;
+    set_changed(index, SurfaceChange::enabled);
+  }
+}
+
+void PenumbraImplementation::set_surface_transform(const unsigned int index,
+                                                   const std::array<float, 16> &transform) {
+  check_surface(index);
+  surfaces[index].transform = transform;
+  surfaces[index].is_transformed = true;
+  set_changed(index, SurfaceChange::transformed);
+}
+
+void PenumbraImplementation::set_changed(const unsigned int index, const SurfaceChange change) {
+  if (!model_is_built || index >= surface_buffers.size()) {
+    return; // Added since the model was built, which is built again
+  }
+  if (std::find(changed_surfaces.begin(), changed_surfaces.end(), index) ==
+      changed_surfaces.end()) {
+    changed_surfaces.push_back(index);
+  }
+  surface_changes[index] = std::max(change, surface_changes[index]);
+}
+
+void PenumbraImplementation::unlink_instance(const unsigned int index) {
+  if (prototypes[index] != index) {
+    prototypes[index] = index;
+    return;
+  }
+  // The other instances share the tessellation of the first one left, so each surface's prototype
+  // comes no later than the surface itself
+  unsigned int next_prototype{index};
+  for (auto i = index + 1u; i < prototypes.size(); ++i) {
+    if (prototypes[i] == index) {
+      next_prototype = next_prototype == index ? i : next_prototype;
+      prototypes[i] = next_prototype;
+    }
+  }
+}
+
+void PenumbraImplementation::update_model() {
+  // Rebuilt in full once moved surfaces leave as many unused indices (or vertices) as are used
+  bool const is_current = model_is_built && surface_buffers.size() == surfaces.size() &&
+                          2u * unused_index_count <= model_indices.size() &&
+                          model.size() <= 2u * built_vertex_count * TessData::vertex_size;
+  if (!is_current) {
+    sky_grid.reset();
+    build_model();
+    context->set_surfaces(surfaces);
+    context->set_model(model, model_indices, surface_buffers);
+  } else if (!changed_surfaces.empty()) {
+    sky_grid.reset();
+    update_surfaces();
+    context->update_surfaces(surfaces, changed_surfaces);
+    context->update_model(model, model_indices, surface_buffers, changed_surfaces,
+                          rewritten_vertices);
+  }
+  changed_surfaces.clear();
+  rewritten_vertices.clear();
+}
+
+void PenumbraImplementation::clear_model() {
+  surfaces.clear();
+  enabled_surfaces.clear();
+  prototypes.clear();
+  model.clear();
+  model_indices.clear();
+  vertex_indices.clear();
+  surface_buffers.clear();
+  index_capacities.clear();
+  disabled_indices.clear();
+  unused_index_count = 0u;
+  built_vertex_count = 0u;
+  owned_vertices.clear();
+  changed_surfaces.clear();
+  surface_changes.clear();
+  rewritten_vertices.clear();
+  model_is_built = false;
+  sky_grid.reset();
+  context->clear_model();
+}
+
+std::vector<std::vector<float>>
+PenumbraImplementation::calculate_pssas(const std::vector<std::pair<float, float>> &sun_positions) {
+  std::vector<std::vector<float>> pssas;
+  pssas.reserve(sun_positions.size());
+  std::vector<unsigned int> tickets;
+  Sun position_sun; // Leaves the current sun position unchanged
+  auto const queue_capacity = context->get_queue_capacity();
+  for (auto const &[azimuth, altitude] : sun_positions) {
+    if (tickets.size() - pssas.size() == queue_capacity) {
+      pssas.push_back(context->retrieve_queued_pssas(tickets[pssas.size()]));
+    }
+    position_sun.set_view(azimuth, altitude);
+    tickets.push_back(context->queue_pssa(position_sun.get_view()));
+  }
+  while (pssas.size() < tickets.size()) {
+    pssas.push_back(context->retrieve_queued_pssas(tickets[pssas.size()]));
+  }
+  return pssas;
+}
+
+void PenumbraImplementation::calculate_sky_grid(unsigned int azimuth_cells,
+                                                unsigned int altitude_cells, float tolerance,
+                                                unsigned int max_refinements) {
+  if (azimuth_cells == 0u || altitude_cells == 0u) {
+    throw PenumbraException("Sky grid must have at least one azimuth and one altitude cell.",
+                            *logger);
+  }
+  if (max_refinements > SkyGrid::max_refinement_count) {
+    throw PenumbraException(fmt::format("Sky grid may be refined at most {} times.",
+                                        SkyGrid::max_refinement_count),
+                            *logger);
+  }
+  if (surfaces.empty() || !model_is_built) {
+    throw PenumbraException("Model must be set before calculating a sky grid.", *logger);
+  }
+  // The grid's calculations use the whole queue
+  auto const queued_count = context->get_queued_pssa_count();
+  if (queued_count > 0u) {
+    throw PenumbraException(
+        fmt::format("Unable to calculate a sky grid while {} queued PSSA calculation(s) are not "
+                    "retrieved. Retrieve them first.",
+                    queued_count),
+        *logger);
+  }
+  sky_grid.reset();
+  sky_grid = std::make_unique<SkyGrid>(
+      azimuth_cells, altitude_cells, tolerance, max_refinements,
+      [this](const std::vector<std::pair<float, float>> &sun_positions) {
+        return calculate_pssas(sun_positions);
+      });
+}
+
+std::vector<float> PenumbraImplementation::interpolate_pssa(float azimuth, float altitude) const {
+  if (!sky_grid) {
+    throw PenumbraException("Sky grid must be calculated before interpolating PSSAs.", *logger);
+  }
+  if (!std::isfinite(azimuth) || !(altitude >= 0.f && altitude <= SkyGrid::zenith)) {
+    throw PenumbraException(fmt::format("Sun position ({}, {}) must have a finite azimuth and an "
+                                        "altitude between 0 and pi/2 to interpolate PSSAs.",
+                                        azimuth, altitude),
+                            *logger);
+  }
+  return sky_grid->interpolate(azimuth, altitude);
+}
+
+std::vector<PenumbraImplementation::Tessellation>
+PenumbraImplementation::tessellate(const std::vector<unsigned int> &surface_indices) {
+  if (tessellators.empty()) {
+    tessellators = std::vector<Tessellator>(thread_pool.get_slot_count());
+    slot_data.resize(thread_pool.get_slot_count());
+  }
+
+  // Each thread appends its surfaces' triangles to its own buffers, so tessellating a surface
+  // allocates no memory of its own
+  for (auto &data : slot_data) {
+    data.vertices.clear();
+    data.indices.clear();
+  }
+  std::vector<Tessellation> tessellations(surface_indices.size());
+  // Failures are reported from this thread, once every task finishes
+  std::vector<char> failed(surface_indices.size(), false);
+  thread_pool.parallel_for(surface_indices.size(), [&](std::size_t i, unsigned int slot) {
+    TessData &data = slot_data[slot];
+    Tessellation &tessellation = tessellations[i];
+    tessellation.slot = slot;
+    tessellation.first_vertex = data.vertices.size() / TessData::vertex_size;
+    tessellation.first_index = data.indices.size();
+    failed[i] = !surfaces[surface_indices[i]].tessellate(tessellators[slot], data);
+    tessellation.vertex_count =
+        data.vertices.size() / TessData::vertex_size - tessellation.first_vertex;
+    tessellation.index_count = data.indices.size() - tessellation.first_index;
+  });
+  auto const failure = std::find(failed.begin(), failed.end(), true);
+  if (failure != failed.end()) {
+    auto const &surface = surfaces[surface_indices[failure - failed.begin()]];
+    throw PenumbraException(fmt::format("Unable to tessellate surface, \"{}\".", surface.name),
+                            *logger);
+  }
+  return tessellations;
+}
+
+unsigned int
+PenumbraImplementation::add_owned_vertices(const unsigned int surface_index,
+                                           std::shared_ptr<const std::vector<float>> coordinates) {
+  auto const first = static_cast<unsigned int>(model.size() / TessData::vertex_size);
+  auto const vertex_count = coordinates->size() / TessData::vertex_size;
+  model.resize(model.size() + coordinates->size());
+  for (std::size_t vertex = 0; vertex < vertex_count; ++vertex) {
+    surfaces[surface_index].transform_point(&(*coordinates)[vertex * TessData::vertex_size],
+                                            &model[(first + vertex) * TessData::vertex_size]);
+  }
+  owned_vertices[surface_index] = {first, std::move(coordinates)};
+  return first;
+}
+
+void PenumbraImplementation::transform_vertices(const unsigned int surface_index,
+                                                std::vector<unsigned int> &triangles) {
+  auto const owned = owned_vertices.find(surface_index);
+  if (owned != owned_vertices.end()) {
+    auto const &coordinates = *owned->second.coordinates;
+    auto const vertex_count = coordinates.size() / TessData::vertex_size;
+    for (std::size_t vertex = 0; vertex < vertex_count; ++vertex) {
+      surfaces[surface_index].transform_point(
+          &coordinates[vertex * TessData::vertex_size],
+          &model[(owned->second.first + vertex) * TessData::vertex_size]);
+    }
+    rewritten_vertices.emplace_back(owned->second.first, static_cast<unsigned int>(vertex_count));
+    return;
+  }
+
+  // Vertices shared with other surfaces stay in place. The surface's copies move instead.
+  std::vector<unsigned int> vertices(triangles);
+  std::sort(vertices.begin(), vertices.end());
+  vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+  auto coordinates = std::make_shared<std::vector<float>>();
+  coordinates->reserve(vertices.size() * TessData::vertex_size);
+  for (auto const vertex : vertices) {
+    auto const begin = model.begin() + vertex * TessData::vertex_size;
+    coordinates->insert(coordinates->end(), begin, begin + TessData::vertex_size);
+  }
+  auto const first = add_owned_vertices(surface_index, std::move(coordinates));
+  for (auto &index : triangles) {
+    index = first + static_cast<unsigned int>(
+                        std::lower_bound(vertices.begin(), vertices.end(), index) -
+                        vertices.begin());
+  }
+}
+
+unsigned int PenumbraImplementation::add_vertex(const float *vertex) {
+  VertexKey key;
+  for (std::size_t axis = 0; axis < key.size(); ++axis) {
+    key[axis] = vertex[axis] + 0.f; // -0 as 0
+  }
+  // Not vertex_indices.size(): transformed surfaces' vertices are stored without keys
+  auto const [entry, is_new] = vertex_indices.try_emplace(
+      key, static_cast<unsigned int>(model.size() / TessData::vertex_size));
+  if (is_new) {
+    model.insert(model.end(), key.begin(), key.end());
+  }
+  return entry->second;
+}
+
+void PenumbraImplementation::build_model() {
+  // Instances share their prototype's tessellation
+  std::vector<unsigned int> tessellated_surfaces;
+  std::vector<std::size_t> surface_tessellations(surfaces.size()); // Into tessellations
+  for (std::size_t i = 0; i < surfaces.size(); ++i) {
+    if (prototypes[i] == i) {
+      surface_tessellations[i] = tessellated_surfaces.size();
+      tessellated_surfaces.push_back(static_cast<unsigned int>(i));
+    } else {
+      surface_tessellations[i] = surface_tessellations[prototypes[i]];
+    }
+  }
+  auto const tessellations = tessellate(tessellated_surfaces);
+  // Untransformed vertices of each tessellation, once one of its surfaces is transformed
+  std::vector<std::shared_ptr<const std::vector<float>>> tessellation_coordinates(
+      tessellations.size());
+
+  // Vertices shared by surfaces (e.g., along common edges) are stored once
+  std::size_t vertex_count{0u}, index_count{0u};
+  for (auto const tessellation_index : surface_tessellations) {
+    vertex_count += tessellations[tessellation_index].vertex_count;
+    index_count += tessellations[tessellation_index].index_count;
+  }
+  model.clear();
+  model.reserve(vertex_count * TessData::vertex_size);
+  owned_vertices.clear();
+  vertex_indices.clear();
+  vertex_indices.reserve(vertex_count);
+  std::vector<unsigned int> vertex_remap(vertex_count); // Model vertex of each surface's vertex
+  std::vector<std::size_t> first_remapped_vertices(surfaces.size());
+  surface_buffers.clear();
+  unsigned int next_index{0u};
+  std::size_t next_remapped_vertex{0u};
+  for (std::size_t i = 0; i < surfaces.size(); ++i) {
+    auto const &tessellation = tessellations[surface_tessellations[i]];
+    const float *vertices = slot_data[tessellation.slot].vertices.data() +
+                            tessellation.first_vertex * TessData::vertex_size;
+    first_remapped_vertices[i] = next_remapped_vertex;
+    if (surfaces[i].is_transformed) {
+      auto &coordinates = tessellation_coordinates[surface_tessellations[i]];
+      if (!coordinates) {
+        coordinates = std::make_shared<const std::vector<float>>(
+            vertices, vertices + tessellation.vertex_count * TessData::vertex_size);
+      }
+      auto const first = add_owned_vertices(static_cast<unsigned int>(i), coordinates);
+      for (std::size_t vertex = 0; vertex < tessellation.vertex_count; ++vertex) {
+        vertex_remap[next_remapped_vertex++] = first + static_cast<unsigned int>(vertex);
+      }
+    } else {
+      for (std::size_t vertex = 0; vertex < tessellation.vertex_count; ++vertex) {
+        vertex_remap[next_remapped_vertex++] =
+            add_vertex(vertices + vertex * TessData::vertex_size);
+      }
+    }
+    surface_buffers.emplace_back(next_index, static_cast<unsigned int>(tessellation.index_count),
+                                 static_cast<int>(i));
+    next_index += static_cast<unsigned int>(tessellation.index_count);
+  }
+
+  // Each surface's triangles are written to its own slice of the model's indices
+  model_indices.resize(index_count);
+  thread_pool.parallel_for(surfaces.size(), [&](std::size_t i, unsigned int) {
+    auto const &tessellation = tessellations[surface_tessellations[i]];
+    auto const &indices = slot_data[tessellation.slot].indices;
+    auto const *remap = &vertex_remap[first_remapped_vertices[i]];
+    for (std::size_t index = 0; index < tessellation.index_count; ++index) {
+      model_indices[surface_buffers[i].begin + index] =
+          remap[indices[tessellation.first_index + index]];
+    }
+  });
+
+  index_capacities.resize(surfaces.size());
+  disabled_indices.clear();
+  for (std::size_t i = 0; i < surfaces.size(); ++i) {
+    index_capacities[i] = surface_buffers[i].count;
+    if (!enabled_surfaces[i]) {
+      auto const &surface_buffer = surface_buffers[i];
+      auto const begin = model_indices.begin() + surface_buffer.begin;
+      place_indices(static_cast<unsigned int>(i),
+                    std::vector<unsigned int>(begin, begin + surface_buffer.count));
+    }
+  }
+  unused_index_count = 0u;
+  built_vertex_count = model.size() / TessData::vertex_size;
+  surface_changes.assign(surfaces.size(), SurfaceChange::none);
+  model_is_built = true;
+}
+
+void PenumbraImplementation::update_surfaces() {
+  std::vector<unsigned int> retessellated_surfaces;
+  for (auto const surface_index : changed_surfaces) {
+    if (surface_changes[surface_index] == SurfaceChange::tessellated) {
+      retessellated_surfaces.push_back(surface_index);
+    }
+  }
+  auto const tessellations = tessellate(retessellated_surfaces);
+  for (std::size_t i = 0; i < retessellated_surfaces.size(); ++i) {
+    auto const surface_index = retessellated_surfaces[i];
+    auto const &tessellation = tessellations[i];
+    auto const &data = slot_data[tessellation.slot];
+    const float *vertices = &data.vertices[tessellation.first_vertex * TessData::vertex_size];
+    std::vector<unsigned int> vertex_remap(tessellation.vertex_count);
+    if (surfaces[surface_index].is_transformed) {
+      auto const first = add_owned_vertices(
+          surface_index,
+          std::make_shared<const std::vector<float>>(
+              vertices, vertices + tessellation.vertex_count * TessData::vertex_size));
+      std::iota(vertex_remap.begin(), vertex_remap.end(), first);
+    } else {
+      for (std::size_t vertex = 0; vertex < tessellation.vertex_count; ++vertex) {
+        vertex_remap[vertex] = add_vertex(vertices + vertex * TessData::vertex_size);
+      }
+    }
+    std::vector<unsigned int> triangles(tessellation.index_count);
+    for (std::size_t index = 0; index < tessellation.index_count; ++index) {
+      triangles[index] = vertex_remap[data.indices[tessellation.first_index + index]];
+    }
+    place_indices(surface_index, std::move(triangles));
+  }
+
+  // Surfaces only moved, enabled, or disabled keep their triangles
+  for (auto const surface_index : changed_surfaces) {
+    if (surface_changes[surface_index] == SurfaceChange::tessellated) {
+      surface_changes[surface_index] = SurfaceChange::none;
+      continue;
+    }
+    std::vector<unsigned int> triangles;
+    auto const disabled = disabled_indices.find(surface_index);
+    if (disabled != disabled_indices.end()) {
+      triangles = std::move(disabled->second);
+    } else {
+      auto const &surface_buffer = surface_buffers[surface_index];
+      auto const begin = model_indices.begin() + surface_buffer.begin;
+      triangles.assign(begin, begin + surface_buffer.count);
+    }
+    if (surface_changes[surface_index] == SurfaceChange::transformed) {
+      transform_vertices(surface_index, triangles);
+    }
+    place_indices(surface_index, std::move(triangles));
+    surface_changes[surface_index] = SurfaceChange::none;
+  }
+}
+
+void PenumbraImplementation::place_indices(const unsigned int surface_index,
+                                           std::vector<unsigned int> &&triangles) {
+  auto &surface_buffer = surface_buffers[surface_index];
+  fill_unused_indices(surface_buffer.begin, surface_buffer.count);
+  if (!enabled_surfaces[surface_index]) {
+    surface_buffer.count = 0u;
+    disabled_indices[surface_index] = std::move(triangles);
+    return;
+  }
+  disabled_indices.erase(surface_index);
+  if (triangles.size() > index_capacities[surface_index]) {
+    // Outgrown ranges are left unused, and the surface moved to the end of the model's indices
+    unused_index_count += index_capacities[surface_index];
+    surface_buffer.begin = static_cast<unsigned int>(model_indices.size());
+    index_capacities[surface_index] = static_cast<unsigned int>(triangles.size());
+    model_indices.resize(model_indices.size() + triangles.size());
+  }
+  std::copy(triangles.begin(), triangles.end(), model_indices.begin() + surface_buffer.begin);
+  surface_buffer.count = static_cast<unsigned int>(triangles.size());
+}
+
+void PenumbraImplementation::fill_unused_indices(const std::size_t begin, const std::size_t count) {
+  // Triangles with three equal vertices have no area to draw
+  std::fill_n(model_indices.begin() + static_cast<std::ptrdiff_t>(begin), count, 0u);
 }
 
 void PenumbraImplementation::check_surface(const unsigned int surface_index,
@@ -5,7 +5,11 @@
 #define PENUMBRA_IMPLEMENTATION_H_
 
 // Standard
+#include <array>
 #include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 // vendor
 #include <courierr/courierr.h>
@@ -15,24 +19,114 @@
 #include <penumbra/surface.h>
 #include "surface-implementation.h"
 #include "sun.h"
-#include "gl/context.h"
+#include "sky-grid.h"
+#include "context.h"
+#include "cpu/thread-pool.h"
 
 namespace Penumbra {
 
 class PenumbraImplementation {
 
 public:
-  PenumbraImplementation(int size, const std::shared_ptr<Courierr::Courierr> &logger);
+  PenumbraImplementation(int size, CalculationBackend backend, GLPlatform platform,
+                         const std::shared_ptr<Courierr::Courierr> &logger);
   ~PenumbraImplementation() = default;
 
 public:
   void add_surface(const Surface &surface);
-  Context context;
+  // Adds a transformed instance of the prototype per transform, all sharing one tessellation
+  void add_surface_instances(const Surface &prototype,
+                             const std::vector<std::array<float, 16>> &transforms);
+  // Changes to surfaces in the model, applied by the next update_model
+  void update_surface(unsigned int index, const Surface &surface);
+  void remove_surface(unsigned int index);
+  void set_surface_enabled(unsigned int index, bool enabled);
+  void set_surface_transform(unsigned int index, const std::array<float, 16> &transform);
+  CalculationBackend backend;
+  ThreadPool thread_pool; // Shared by tessellation and the CPU backends. Outlives the context.
+  std::unique_ptr<Context> context;
   Sun sun;
-  std::vector<float> model;
+  std::vector<float> model;                // Distinct vertices of the tessellated surfaces
+  std::vector<unsigned int> model_indices; // Three per triangle, into model's vertices
   std::vector<SurfaceImplementation> surfaces;
+  std::vector<bool> enabled_surfaces; // By surface. Disabled surfaces are left out of the model.
   std::shared_ptr<Courierr::Courierr> logger;
+  // Sets the context's model. Once the model is built, only surfaces changed since are
+  // re-tessellated, and their index ranges rewritten in place (or appended, if they outgrow them).
+  void update_model();
+  void clear_model();
   void check_surface(unsigned int index, const std::string_view &surface_context = "Surface") const;
+  // Every surface's PSSAs at each sun position, queued in turn to keep the backend busy. Needs the
+  // whole queue, so nothing else may be queued.
+  std::vector<std::vector<float>>
+  calculate_pssas(const std::vector<std::pair<float, float>> &sun_positions);
+  void calculate_sky_grid(unsigned int azimuth_cells, unsigned int altitude_cells, float tolerance,
+                          unsigned int max_refinements);
+  std::vector<float> interpolate_pssa(float azimuth, float altitude) const;
+  std::unique_ptr<SkyGrid> sky_grid; // Discarded when the model changes
+
+private:
+  std::vector<Tessellator> tessellators; // One per thread pool slot, from the first tessellation
+
+  // A surface's triangles, within its thread pool slot's buffers
+  struct Tessellation {
+    unsigned int slot;
+    std::size_t first_vertex, vertex_count;
+    std::size_t first_index, index_count;
+  };
+  std::vector<TessData> slot_data; // By thread pool slot
+
+  using VertexKey = std::array<float, TessData::vertex_size>;
+  struct VertexKeyHash {
+    std::size_t operator()(const VertexKey &key) const;
+  };
+  std::unordered_map<VertexKey, unsigned int, VertexKeyHash> vertex_indices; // Into model
+
+  // Model indices of each surface: the first count of capacity indices from begin. Unused indices
+  // (past a surface's count, of disabled surfaces, or of ranges since moved) form degenerate
+  // triangles, which draw nothing.
+  std::vector<SurfaceBuffer> surface_buffers;
+  std::vector<unsigned int> index_capacities;
+  std::unordered_map<unsigned int, std::vector<unsigned int>> disabled_indices; // Their triangles
+  std::size_t unused_index_count{0u}; // In ranges left by moved surfaces
+  std::size_t built_vertex_count{0u}; // Vertices in the model when it was last built in full
+
+  // By surface: the surface whose tessellation it shares when the model is built. Each surface is
+  // its own, except instances after the first of a prototype (see add_surface_instances).
+  std::vector<unsigned int> prototypes;
+
+  // Vertices of transformed surfaces, from first, in the polygons' coordinates (shared by the
+  // instances of a prototype)
+  struct OwnedVertices {
+    unsigned int first;
+    std::shared_ptr<const std::vector<float>> coordinates;
+  };
+  std::unordered_map<unsigned int, OwnedVertices> owned_vertices; // By surface
+
+  // Ordered so each change includes the ones before it
+  enum class SurfaceChange : unsigned char { none, enabled, transformed, tessellated };
+  std::vector<unsigned int> changed_surfaces;  // Since the model was last set
+  std::vector<SurfaceChange> surface_changes;  // By surface
+  std::vector<std::pair<unsigned int, unsigned int>> rewritten_vertices; // First and count
+  bool model_is_built{false};
+
+  // Tessellates the surfaces in parallel into the model, merging vertices shared by surfaces
+  void build_model();
+  // Tessellates the surfaces in parallel into slot_data
+  std::vector<Tessellation> tessellate(const std::vector<unsigned int> &surface_indices);
+  unsigned int add_vertex(const float *vertex); // Returns its index in model
+  // Appends a transformed surface's vertices, moved by its transform. Returns the first.
+  unsigned int add_owned_vertices(unsigned int surface_index,
+                                  std::shared_ptr<const std::vector<float>> coordinates);
+  // Moves a transformed surface's vertices (in place), or gives the surface its own vertices
+  void transform_vertices(unsigned int surface_index, std::vector<unsigned int> &triangles);
+  void set_changed(unsigned int index, SurfaceChange change);
+  // Gives a surface (changed on its own) its own tessellation, apart from other instances
+  void unlink_instance(unsigned int index);
+  void update_surfaces();
+  // Sets a surface's triangles (unless disabled), in its index range if they fit
+  void place_indices(unsigned int surface_index, std::vector<unsigned int> &&triangles);
+  void fill_unused_indices(std::size_t begin, std::size_t count);
 };
 
 } // namespace Penumbra
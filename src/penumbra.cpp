@@ -5,56 +5,73 @@
 #include <memory>
 #include <iostream>
 
-#ifndef NDEBUG
-#ifdef __unix__
-#include <cfenv>
-#endif
-#endif
-
 // Penumbra
 #include <penumbra/penumbra.h>
 #include "penumbra-implementation.h"
+#include "gl/context.h"
+#ifdef penumbra_USE_VULKAN
+#include "vulkan/context.h"
+#endif
 
 namespace Penumbra {
 
 Penumbra::Penumbra(unsigned int size, const std::shared_ptr<Courierr::Courierr> &logger)
-    : penumbra(std::make_unique<PenumbraImplementation>(static_cast<int>(size), logger)) {}
+    : penumbra(std::make_unique<PenumbraImplementation>(
+          static_cast<int>(size), CalculationBackend::opengl, GLPlatform::automatic, logger)) {}
 
 Penumbra::Penumbra(const std::shared_ptr<Courierr::Courierr> &logger)
-    : penumbra(std::make_unique<PenumbraImplementation>(512, logger)) {}
+    : penumbra(std::make_unique<PenumbraImplementation>(512, CalculationBackend::opengl,
+                                                        GLPlatform::automatic, logger)) {}
+
+Penumbra::Penumbra(unsigned int size, GLPlatform platform,
+                   const std::shared_ptr<Courierr::Courierr> &logger)
+    : penumbra(std::make_unique<PenumbraImplementation>(
+          static_cast<int>(size), CalculationBackend::opengl, platform, logger)) {}
+
+Penumbra::Penumbra(unsigned int size, CalculationBackend backend,
+                   const std::shared_ptr<Courierr::Courierr> &logger)
+    : penumbra(std::make_unique<PenumbraImplementation>(static_cast<int>(size), backend,
+                                                        GLPlatform::automatic, logger)) {}
 
 Penumbra::~Penumbra() = default;
 
-bool Penumbra::is_valid_context() {
-  bool invalid(false);
-  if (!glfwInit()) {
-    invalid = true;
-  }
+bool Penumbra::is_valid_context(GLPlatform platform) {
+  return GLPlatformContext::create(platform) != nullptr;
+}
 
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
-#ifndef NDEBUG
-#ifdef __unix__
-  // Temporarily Disable floating point exceptions
-  fedisableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
-#endif
-#endif
-  GLFWwindow *window = glfwCreateWindow(1, 1, "Penumbra", nullptr, nullptr);
-#ifndef NDEBUG
-#ifdef __unix__
-  feenableexcept(FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW);
-#endif
+bool Penumbra::is_valid_backend(CalculationBackend backend) {
+  if (backend == CalculationBackend::opengl) {
+    return is_valid_context();
+  }
+  if (backend == CalculationBackend::vulkan) {
+#ifdef penumbra_USE_VULKAN
+    return VulkanContext::is_supported();
+#else
+    return false;
 #endif
-  glfwMakeContextCurrent(window);
-  invalid |= !window;
-  glfwDestroyWindow(window);
-  return !invalid;
+  }
+  return true;
+}
+
+GLPlatform Penumbra::get_gl_platform() {
+  auto gl_context = dynamic_cast<GLContext *>(penumbra->context.get());
+  if (!gl_context) {
+    throw PenumbraException("Only the OpenGL backend uses an OpenGL platform.",
+                            *(penumbra->logger));
+  }
+  return gl_context->get_platform();
+}
+
+CalculationBackend Penumbra::get_calculation_backend() {
+  return penumbra->backend;
 }
 
 VendorType Penumbra::get_vendor_name() {
+  if (penumbra->backend != CalculationBackend::opengl) {
+    return VendorType::unknown;
+  }
   VendorType vendor_type;
-  auto vendor_name = Context::get_vendor_name();
+  auto vendor_name = GLContext::get_vendor_name();
   if (vendor_name == "NVIDIA") {
     vendor_type = VendorType::nvidia;
   } else if (vendor_name == "AMD" || vendor_name == "ATI" ||
@@ -79,37 +96,54 @@ unsigned int Penumbra::add_surface(const Surface &surface) {
   return static_cast<unsigned int>(penumbra->surfaces.size()) - 1u;
 }
 
+unsigned int Penumbra::add_surface_instances(const Surface &prototype,
+                                             const std::vector<std::array<float, 16>> &transforms) {
+  auto const first = static_cast<unsigned int>(penumbra->surfaces.size());
+  penumbra->add_surface_instances(prototype, transforms);
+  return first;
+}
+
 unsigned int Penumbra::get_number_of_surfaces() {
   return static_cast<unsigned int>(penumbra->surfaces.size());
 }
 
 void Penumbra::set_model() {
   if (!penumbra->surfaces.empty()) {
-
-    // Tessellate each surface into triangles
-    std::vector<SurfaceBuffer> surface_buffers;
-    unsigned int next_starting_index{0u};
-    unsigned int surface_index{0u};
-    for (auto &surface : penumbra->surfaces) {
-      TessData tess = surface.tessellate();
-      surface_buffers.emplace_back(next_starting_index / TessData::vertex_size,
-                                   tess.number_of_vertices / TessData::vertex_size, surface_index);
-      for (unsigned int i = 0; i < tess.number_of_vertices; ++i) {
-        penumbra->model.push_back(tess.vertices[i]);
-      }
-      next_starting_index += tess.number_of_vertices;
-      ++surface_index;
-    }
-    penumbra->context.set_model(penumbra->model, surface_buffers);
+    penumbra->update_model();
   } else {
     penumbra->logger->warning("No surfaces added to Penumbra before calling set_model().");
   }
 }
 
 void Penumbra::clear_model() {
-  penumbra->surfaces.clear();
-  penumbra->model.clear();
-  penumbra->context.clear_model();
+  penumbra->clear_model();
+}
+
+void Penumbra::update_surface(const unsigned int surface_index, const Surface &surface) {
+  penumbra->update_surface(surface_index, surface);
+}
+
+void Penumbra::remove_surface(const unsigned int surface_index) {
+  penumbra->remove_surface(surface_index);
+}
+
+void Penumbra::set_surface_enabled(const unsigned int surface_index, const bool enabled) {
+  penumbra->set_surface_enabled(surface_index, enabled);
+}
+
+bool Penumbra::get_surface_enabled(const unsigned int surface_index) {
+  penumbra->check_surface(surface_index);
+  return penumbra->enabled_surfaces[surface_index];
+}
+
+void Penumbra::set_surface_transform(const unsigned int surface_index,
+                                     const std::array<float, 16> &transform) {
+  penumbra->set_surface_transform(surface_index, transform);
+}
+
+std::array<float, 16> Penumbra::get_surface_transform(const unsigned int surface_index) {
+  penumbra->check_surface(surface_index);
+  return penumbra->surfaces[surface_index].transform;
 }
 
 void Penumbra::set_sun_position(const float azimuth, // in radians, clockwise, north = 0
@@ -126,36 +160,97 @@ float Penumbra::get_sun_altitude() {
   return penumbra->sun.get_altitude();
 }
 
+void Penumbra::set_calculation_mode(CalculationMode mode) {
+  penumbra->context->set_calculation_mode(mode);
+}
+
+CalculationMode Penumbra::get_calculation_mode() {
+  return penumbra->context->get_calculation_mode();
+}
+
+void Penumbra::set_minimum_shared_depth_pixels(unsigned int pixels) {
+  penumbra->context->set_minimum_shared_depth_pixels(pixels);
+}
+
+unsigned int Penumbra::get_minimum_shared_depth_pixels() {
+  return penumbra->context->get_minimum_shared_depth_pixels();
+}
+
+void Penumbra::set_target_accuracy(float relative_error) {
+  penumbra->context->set_target_accuracy(relative_error);
+}
+
+float Penumbra::get_target_accuracy() {
+  return penumbra->context->get_target_accuracy();
+}
+
+void Penumbra::set_samples_per_pixel(unsigned int samples) {
+  penumbra->context->set_samples_per_pixel(samples);
+}
+
+unsigned int Penumbra::get_samples_per_pixel() {
+  return penumbra->context->get_samples_per_pixel();
+}
+
+void Penumbra::set_maximum_tile_size(unsigned int size) {
+  penumbra->context->set_maximum_tile_size(size);
+}
+
+void Penumbra::set_back_face_culling(bool enabled) {
+  penumbra->context->set_back_face_culling(enabled);
+}
+
+bool Penumbra::get_back_face_culling() {
+  return penumbra->context->get_back_face_culling();
+}
+
+void Penumbra::set_horizon_culling(bool enabled) {
+  penumbra->context->set_horizon_culling(enabled);
+}
+
+bool Penumbra::get_horizon_culling() {
+  return penumbra->context->get_horizon_culling();
+}
+
 void Penumbra::submit_pssa(unsigned int surface_index) {
   penumbra->check_surface(surface_index);
-  penumbra->context.submit_pssa(surface_index, penumbra->sun.get_view());
+  penumbra->context->submit_pssa(surface_index, penumbra->sun.get_view());
 }
 
 void Penumbra::submit_pssa(const std::vector<unsigned int> &surface_indices) {
   for (auto const surface_index : surface_indices) {
     penumbra->check_surface(surface_index);
   }
-  penumbra->context.submit_pssas(surface_indices, penumbra->sun.get_view());
+  penumbra->context->submit_pssas(surface_indices, penumbra->sun.get_view());
 }
 
 void Penumbra::submit_pssa() {
-  penumbra->context.submit_pssa(penumbra->sun.get_view());
+  penumbra->context->submit_pssa(penumbra->sun.get_view());
 }
 
 float Penumbra::retrieve_pssa(unsigned int surface_index) {
   penumbra->check_surface(surface_index);
-  return penumbra->context.retrieve_pssa(surface_index);
+  return penumbra->context->retrieve_pssa(surface_index);
 }
 
 std::vector<float> Penumbra::retrieve_pssa(const std::vector<unsigned int> &surface_indices) {
   for (auto const surface_index : surface_indices) {
     penumbra->check_surface(surface_index);
   }
-  return penumbra->context.retrieve_pssas(surface_indices);
+  return penumbra->context->retrieve_pssas(surface_indices);
 }
 
 std::vector<float> Penumbra::retrieve_pssa() {
-  return penumbra->context.retrieve_pssa();
+  return penumbra->context->retrieve_pssa();
+}
+
+float Penumbra::get_pssa_error(unsigned int surface_index) {
+  penumbra->check_surface(surface_index);
+  return penumbra->context->get_pssa_error(surface_index);
+}
+
+std::vector<float> Penumbra::get_pssa_error() {
+  return penumbra->context->get_pssa_errors();
 }
 
 float Penumbra::calculate_pssa(unsigned int surface_index) {
@@ -173,6 +268,58 @@ std::vector<float> Penumbra::calculate_pssa() {
   return retrieve_pssa();
 }
 
+std::vector<float>
+Penumbra::calculate_pssa(unsigned int surface_index,
+                         const std::vector<std::pair<float, float>> &sun_positions) {
+  penumbra->check_surface(surface_index);
+  std::vector<Sun> suns(sun_positions.size());
+  std::vector<mat4x4_ptr> sun_views;
+  sun_views.reserve(sun_positions.size());
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    suns[i].set_view(sun_positions[i].first, sun_positions[i].second);
+    sun_views.push_back(suns[i].get_view());
+  }
+  return penumbra->context->calculate_pssas(surface_index, sun_views);
+}
+
+unsigned int Penumbra::queue_pssa(const std::vector<unsigned int> &surface_indices) {
+  for (auto const surface_index : surface_indices) {
+    penumbra->check_surface(surface_index);
+  }
+  return penumbra->context->queue_pssas(surface_indices, penumbra->sun.get_view());
+}
+
+unsigned int Penumbra::queue_pssa() {
+  return penumbra->context->queue_pssa(penumbra->sun.get_view());
+}
+
+bool Penumbra::is_pssa_ready(unsigned int ticket) {
+  return penumbra->context->is_queued_pssa_ready(ticket);
+}
+
+std::vector<float> Penumbra::retrieve_queued_pssa(unsigned int ticket) {
+  return penumbra->context->retrieve_queued_pssas(ticket);
+}
+
+void Penumbra::calculate_sky_grid(unsigned int azimuth_cells, unsigned int altitude_cells,
+                                  float tolerance, unsigned int max_refinements) {
+  penumbra->calculate_sky_grid(azimuth_cells, altitude_cells, tolerance, max_refinements);
+}
+
+std::vector<float> Penumbra::interpolate_pssa(float azimuth, float altitude) {
+  return penumbra->interpolate_pssa(azimuth, altitude);
+}
+
+unsigned int Penumbra::get_sky_grid_size() {
+  return penumbra->sky_grid
+             ? static_cast<unsigned int>(penumbra->sky_grid->get_sun_position_count())
+             : 0u;
+}
+
+void Penumbra::clear_sky_grid() {
+  penumbra->sky_grid.reset();
+}
+
 std::unordered_map<unsigned int, float>
 Penumbra::calculate_interior_pssas(const std::vector<unsigned int> &transparent_surface_indices,
                                    const std::vector<unsigned int> &interior_surface_indices) {
@@ -184,7 +331,7 @@ Penumbra::calculate_interior_pssas(const std::vector<unsigned int> &transparent_
     for (auto const interior_surface_index : interior_surface_indices) {
       penumbra->check_surface(interior_surface_index, "Interior surface");
     }
-    pssas = penumbra->context.calculate_interior_pssas(
+    pssas = penumbra->context->calculate_interior_pssas(
         transparent_surface_indices, interior_surface_indices, penumbra->sun.get_view());
 
   } else {
@@ -195,9 +342,26 @@ Penumbra::calculate_interior_pssas(const std::vector<unsigned int> &transparent_
   return pssas;
 }
 
+std::vector<unsigned int> Penumbra::get_potential_shaders(unsigned int surface_index) {
+  penumbra->check_surface(surface_index);
+  return penumbra->context->get_potential_shaders(surface_index);
+}
+
+std::vector<std::vector<unsigned int>> Penumbra::get_potential_shaders() {
+  return penumbra->context->get_potential_shaders();
+}
+
+PssaStatistics Penumbra::get_pssa_statistics() {
+  return penumbra->context->get_pssa_statistics();
+}
+
+void Penumbra::reset_pssa_statistics() {
+  penumbra->context->reset_pssa_statistics();
+}
+
 void Penumbra::render_scene(unsigned int surface_index) {
   penumbra->check_surface(surface_index);
-  penumbra->context.show_rendering(surface_index, penumbra->sun.get_view());
+  penumbra->context->show_rendering(surface_index, penumbra->sun.get_view());
 }
 
 void Penumbra::render_interior_scene(const std::vector<unsigned int> &transparent_surface_indices,
@@ -208,8 +372,8 @@ void Penumbra::render_interior_scene(const std::vector<unsigned int> &transparen
     }
     for (auto const interior_surface_index : interior_surface_indices) {
       penumbra->check_surface(interior_surface_index, "Interior surface");
-      penumbra->context.show_interior_rendering(transparent_surface_indices, interior_surface_index,
-                                                penumbra->sun.get_view());
+      penumbra->context->show_interior_rendering(transparent_surface_indices,
+                                                 interior_surface_index, penumbra->sun.get_view());
     }
   } else {
     throw PenumbraException("Cannot render interior scene without defining at least one "
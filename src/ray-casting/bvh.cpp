@@ -0,0 +1,516 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+// Penumbra
+#include "ray-casting/bvh.h"
+
+namespace Penumbra {
+
+// Four lanes of single precision values. Comparisons return a mask with bit i set for lane i.
+#if defined(__SSE2__) || defined(_M_X64)
+using Lanes = __m128;
+static Lanes splat(float value) {
+  return _mm_set1_ps(value);
+}
+static Lanes load(const float *values) {
+  return _mm_load_ps(values);
+}
+static void store(float *values, Lanes lanes) {
+  _mm_store_ps(values, lanes);
+}
+static Lanes add(Lanes a, Lanes b) {
+  return _mm_add_ps(a, b);
+}
+static Lanes subtract(Lanes a, Lanes b) {
+  return _mm_sub_ps(a, b);
+}
+static Lanes multiply(Lanes a, Lanes b) {
+  return _mm_mul_ps(a, b);
+}
+static Lanes minimum(Lanes a, Lanes b) {
+  return _mm_min_ps(a, b);
+}
+static Lanes maximum(Lanes a, Lanes b) {
+  return _mm_max_ps(a, b);
+}
+static unsigned int less_equal(Lanes a, Lanes b) {
+  return static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(a, b)));
+}
+static unsigned int less(Lanes a, Lanes b) {
+  return static_cast<unsigned int>(_mm_movemask_ps(_mm_cmplt_ps(a, b)));
+}
+#elif defined(__aarch64__) || defined(_M_ARM64)
+using Lanes = float32x4_t;
+static Lanes splat(float value) {
+  return vdupq_n_f32(value);
+}
+static Lanes load(const float *values) {
+  return vld1q_f32(values);
+}
+static void store(float *values, Lanes lanes) {
+  vst1q_f32(values, lanes);
+}
+static Lanes add(Lanes a, Lanes b) {
+  return vaddq_f32(a, b);
+}
+static Lanes subtract(Lanes a, Lanes b) {
+  return vsubq_f32(a, b);
+}
+static Lanes multiply(Lanes a, Lanes b) {
+  return vmulq_f32(a, b);
+}
+static Lanes minimum(Lanes a, Lanes b) {
+  return vminq_f32(a, b);
+}
+static Lanes maximum(Lanes a, Lanes b) {
+  return vmaxq_f32(a, b);
+}
+static unsigned int to_mask(uint32x4_t lanes) {
+  const uint32_t bit_values[4] = {1u, 2u, 4u, 8u};
+  return vaddvq_u32(vandq_u32(lanes, vld1q_u32(bit_values)));
+}
+static unsigned int less_equal(Lanes a, Lanes b) {
+  return to_mask(vcleq_f32(a, b));
+}
+static unsigned int less(Lanes a, Lanes b) {
+  return to_mask(vcltq_f32(a, b));
+}
+#else
+struct Lanes {
+  float values[4];
+};
+template <typename Operation> static Lanes apply(Lanes a, Lanes b, Operation operation) {
+  Lanes result;
+  for (int lane = 0; lane < 4; ++lane) {
+    result.values[lane] = operation(a.values[lane], b.values[lane]);
+  }
+  return result;
+}
+static Lanes splat(float value) {
+  return {{value, value, value, value}};
+}
+static Lanes load(const float *values) {
+  return {{values[0], values[1], values[2], values[3]}};
+}
+static void store(float *values, Lanes lanes) {
+  std::copy(lanes.values, lanes.values + 4, values);
+}
+static Lanes add(Lanes a, Lanes b) {
+  return apply(a, b, [](float x, float y) { return x + y; });
+}
+static Lanes subtract(Lanes a, Lanes b) {
+  return apply(a, b, [](float x, float y) { return x - y; });
+}
+static Lanes multiply(Lanes a, Lanes b) {
+  return apply(a, b, [](float x, float y) { return x * y; });
+}
+static Lanes minimum(Lanes a, Lanes b) {
+  return apply(a, b, [](float x, float y) { return std::min(x, y); });
+}
+static Lanes maximum(Lanes a, Lanes b) {
+  return apply(a, b, [](float x, float y) { return std::max(x, y); });
+}
+static unsigned int less_equal(Lanes a, Lanes b) {
+  unsigned int mask{0u};
+  for (int lane = 0; lane < 4; ++lane) {
+    mask |= static_cast<unsigned int>(a.values[lane] <= b.values[lane]) << lane;
+  }
+  return mask;
+}
+static unsigned int less(Lanes a, Lanes b) {
+  unsigned int mask{0u};
+  for (int lane = 0; lane < 4; ++lane) {
+    mask |= static_cast<unsigned int>(a.values[lane] < b.values[lane]) << lane;
+  }
+  return mask;
+}
+#endif
+
+static constexpr int lane_count{4};
+static constexpr unsigned int lane_mask{(1u << lane_count) - 1u};
+
+static Lanes dot(Lanes x, Lanes y, Lanes z, const float (&vector)[3]) {
+  return add(add(multiply(x, splat(vector[0])), multiply(y, splat(vector[1]))),
+             multiply(z, splat(vector[2])));
+}
+
+static void cross(const float (&a)[3], const float (&b)[3], float (&result)[3]) {
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Whether any ray in the mask passes through the box within its [t_min, t_max]
+static bool intersect_box(const RayPacket &packet, unsigned int mask, const float (&bounds)[2][3],
+                          const float (&inverse_direction)[3]) {
+  for (int first = 0; first < RayPacket::size; first += lane_count) {
+    if (!((mask >> first) & lane_mask)) {
+      continue;
+    }
+    Lanes const origins[3] = {load(packet.origin_x + first), load(packet.origin_y + first),
+                              load(packet.origin_z + first)};
+    Lanes t_near = load(packet.t_min + first);
+    Lanes t_far = load(packet.t_max + first);
+    for (int axis = 0; axis < 3; ++axis) {
+      Lanes const inverse = splat(inverse_direction[axis]);
+      Lanes const t_low = multiply(subtract(splat(bounds[0][axis]), origins[axis]), inverse);
+      Lanes const t_high = multiply(subtract(splat(bounds[1][axis]), origins[axis]), inverse);
+      t_near = maximum(t_near, minimum(t_low, t_high));
+      t_far = minimum(t_far, maximum(t_low, t_high));
+    }
+    if (less_equal(t_near, t_far) & (mask >> first)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether the box's projection onto each beam axis overlaps the beam's bounds
+static bool overlaps(const Beam &beam, const float (&bounds)[2][3]) {
+  for (int axis = 0; axis < 3; ++axis) {
+    float center{0.f}, half_size{0.f};
+    for (int component = 0; component < 3; ++component) {
+      center += beam.axes[axis][component] * 0.5f * (bounds[0][component] + bounds[1][component]);
+      half_size += std::abs(beam.axes[axis][component]) * 0.5f *
+                   (bounds[1][component] - bounds[0][component]);
+    }
+    if (center - half_size > beam.bounds[1][axis] || center + half_size < beam.bounds[0][axis]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool prepare_triangle(const Triangle &triangle, const float (&direction)[3],
+                      PreparedTriangle &prepared) {
+  // Moller-Trumbore, with the direction shared by all rays
+  float const determinant =
+      -(direction[0] * triangle.normal[0] + direction[1] * triangle.normal[1] +
+        direction[2] * triangle.normal[2]);
+  if (determinant == 0.f) {
+    return false;
+  }
+  float const inverse_determinant = 1.f / determinant;
+  cross(direction, triangle.edges[1], prepared.u_axis);
+  cross(triangle.edges[0], direction, prepared.v_axis);
+  for (int component = 0; component < 3; ++component) {
+    prepared.vertex[component] = triangle.vertex[component];
+    prepared.u_axis[component] *= inverse_determinant;
+    prepared.v_axis[component] *= inverse_determinant;
+    prepared.t_axis[component] = triangle.normal[component] * inverse_determinant;
+  }
+  prepared.surface_index = triangle.surface_index;
+  return true;
+}
+
+unsigned int intersect_triangle(RayPacket &packet, unsigned int mask,
+                                const PreparedTriangle &triangle) {
+  unsigned int hits{0u};
+  for (int first = 0; first < RayPacket::size; first += lane_count) {
+    if (!((mask >> first) & lane_mask)) {
+      continue;
+    }
+    Lanes const x = subtract(load(packet.origin_x + first), splat(triangle.vertex[0]));
+    Lanes const y = subtract(load(packet.origin_y + first), splat(triangle.vertex[1]));
+    Lanes const z = subtract(load(packet.origin_z + first), splat(triangle.vertex[2]));
+    Lanes const u = dot(x, y, z, triangle.u_axis);
+    Lanes const v = dot(x, y, z, triangle.v_axis);
+    Lanes const t = dot(x, y, z, triangle.t_axis);
+    unsigned int const lane_hits =
+        less_equal(splat(0.f), u) & less_equal(splat(0.f), v) &
+        less_equal(add(u, v), splat(1.f)) & less_equal(load(packet.t_min + first), t) &
+        less(t, load(packet.t_max + first)) & (mask >> first);
+    if (lane_hits) {
+      alignas(16) float t_values[lane_count];
+      store(t_values, t);
+      for (int lane = 0; lane < lane_count; ++lane) {
+        if ((lane_hits >> lane) & 1u) {
+          packet.t_max[first + lane] = t_values[lane];
+          packet.surface_indices[first + lane] = triangle.surface_index;
+        }
+      }
+      hits |= (lane_hits & lane_mask) << first;
+    }
+  }
+  return hits;
+}
+
+struct Box {
+  float bounds[2][3] = {{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::max()},
+                        {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max()}};
+  void grow(const float (&point)[3]) {
+    for (int axis = 0; axis < 3; ++axis) {
+      bounds[0][axis] = std::min(point[axis], bounds[0][axis]);
+      bounds[1][axis] = std::max(point[axis], bounds[1][axis]);
+    }
+  }
+  void grow(const Box &box) {
+    for (int axis = 0; axis < 3; ++axis) {
+      bounds[0][axis] = std::min(box.bounds[0][axis], bounds[0][axis]);
+      bounds[1][axis] = std::max(box.bounds[1][axis], bounds[1][axis]);
+    }
+  }
+  [[nodiscard]] float half_area() const {
+    if (bounds[0][0] > bounds[1][0]) {
+      return 0.f; // Empty
+    }
+    float const x = bounds[1][0] - bounds[0][0];
+    float const y = bounds[1][1] - bounds[0][1];
+    float const z = bounds[1][2] - bounds[0][2];
+    return x * y + y * z + z * x;
+  }
+};
+
+struct BVH::BuildItem {
+  Box box;
+  float centroid[3];
+  std::uint32_t triangle;
+};
+
+void BVH::build(std::vector<Triangle> triangles_in) {
+  clear();
+  if (triangles_in.empty()) {
+    return;
+  }
+  std::vector<BuildItem> items(triangles_in.size());
+  for (std::size_t i = 0; i < triangles_in.size(); ++i) {
+    const Triangle &triangle = triangles_in[i];
+    BuildItem &item = items[i];
+    item.triangle = static_cast<std::uint32_t>(i);
+    item.box.grow(triangle.vertex);
+    for (auto const &edge : triangle.edges) {
+      float const point[3] = {triangle.vertex[0] + edge[0], triangle.vertex[1] + edge[1],
+                              triangle.vertex[2] + edge[2]};
+      item.box.grow(point);
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+      item.centroid[axis] = 0.5f * (item.box.bounds[0][axis] + item.box.bounds[1][axis]);
+    }
+  }
+  nodes.reserve(2 * items.size());
+  build_node(items, 0, items.size(), 0);
+
+  // Store triangles in leaf order
+  triangles.reserve(items.size());
+  for (auto const &item : items) {
+    triangles.push_back(triangles_in[item.triangle]);
+  }
+}
+
+void BVH::clear() {
+  nodes.clear();
+  triangles.clear();
+}
+
+std::uint32_t BVH::build_node(std::vector<BuildItem> &items, std::size_t begin, std::size_t end,
+                              int depth) {
+  auto const node_index = static_cast<std::uint32_t>(nodes.size());
+  nodes.emplace_back();
+
+  Box box, centroid_box;
+  for (std::size_t i = begin; i < end; ++i) {
+    box.grow(items[i].box);
+    centroid_box.grow(items[i].centroid);
+  }
+  auto set_bounds = [&](Node &node) {
+    std::copy(&box.bounds[0][0], &box.bounds[0][0] + 6, &node.bounds[0][0]);
+  };
+  auto make_leaf = [&]() {
+    Node &node = nodes[node_index];
+    set_bounds(node);
+    node.offset = static_cast<std::uint32_t>(begin);
+    node.count = static_cast<std::uint32_t>(end - begin);
+    node.axis = 0u;
+    return node_index;
+  };
+  auto const count = end - begin;
+  if (count <= 1u || depth >= max_depth - 1) {
+    return make_leaf();
+  }
+
+  // Find the bin boundary minimizing the SAH cost, relative to the cost of intersecting one
+  // triangle
+  static constexpr float traversal_cost{1.f};
+  float best_cost{std::numeric_limits<float>::max()};
+  int best_axis{-1}, best_split{0};
+  auto bin_of = [&](const BuildItem &item, int axis) {
+    float const extent = centroid_box.bounds[1][axis] - centroid_box.bounds[0][axis];
+    auto const bin = static_cast<int>((item.centroid[axis] - centroid_box.bounds[0][axis]) *
+                                      (static_cast<float>(bin_count) / extent));
+    return std::min(bin, bin_count - 1);
+  };
+  for (int axis = 0; axis < 3; ++axis) {
+    if (centroid_box.bounds[1][axis] <= centroid_box.bounds[0][axis]) {
+      continue;
+    }
+    Box bin_boxes[bin_count];
+    std::size_t bin_counts[bin_count] = {};
+    for (std::size_t i = begin; i < end; ++i) {
+      auto const bin = bin_of(items[i], axis);
+      bin_boxes[bin].grow(items[i].box);
+      ++bin_counts[bin];
+    }
+    float right_areas[bin_count];
+    std::size_t right_counts[bin_count];
+    Box right_box;
+    std::size_t right_count{0u};
+    for (int bin = bin_count - 1; bin > 0; --bin) {
+      right_box.grow(bin_boxes[bin]);
+      right_count += bin_counts[bin];
+      right_areas[bin] = right_box.half_area();
+      right_counts[bin] = right_count;
+    }
+    Box left_box;
+    std::size_t left_count{0u};
+    for (int split = 1; split < bin_count; ++split) {
+      left_box.grow(bin_boxes[split - 1]);
+      left_count += bin_counts[split - 1];
+      if (left_count == 0u || right_counts[split] == 0u) {
+        continue;
+      }
+      float const cost = left_box.half_area() * static_cast<float>(left_count) +
+                         right_areas[split] * static_cast<float>(right_counts[split]);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = split;
+      }
+    }
+  }
+
+  float const leaf_cost = box.half_area() * static_cast<float>(count);
+  best_cost += traversal_cost * box.half_area();
+  if (count <= max_leaf_size && (best_axis < 0 || leaf_cost <= best_cost)) {
+    return make_leaf();
+  }
+
+  std::size_t middle;
+  if (best_axis >= 0) {
+    auto const is_left = [&](const BuildItem &item) {
+      return bin_of(item, best_axis) < best_split;
+    };
+    middle = static_cast<std::size_t>(
+        std::partition(items.begin() + static_cast<std::ptrdiff_t>(begin),
+                       items.begin() + static_cast<std::ptrdiff_t>(end), is_left) -
+        items.begin());
+  } else {
+    // Coincident centroids. Split evenly.
+    middle = begin + count / 2u;
+    best_axis = 0;
+  }
+
+  build_node(items, begin, middle, depth + 1);
+  auto const second_child = build_node(items, middle, end, depth + 1);
+  Node &node = nodes[node_index];
+  set_bounds(node);
+  node.offset = second_child;
+  node.count = 0u;
+  node.axis = static_cast<std::uint32_t>(best_axis);
+  return node_index;
+}
+
+template <bool any_hit>
+unsigned int BVH::traverse(RayPacket &packet, unsigned int mask, int receiver_index,
+                           const std::vector<bool> &excluded_surfaces) const {
+  unsigned int hits{0u};
+  if (nodes.empty() || !mask) {
+    return hits;
+  }
+
+  // Large finite values in place of infinities keep slab distances from becoming NaN
+  static constexpr float huge{1e30f};
+  float inverse_direction[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    float const direction = packet.direction[axis];
+    inverse_direction[axis] = direction != 0.f ? 1.f / direction : std::copysign(huge, direction);
+  }
+
+  std::uint32_t stack[max_depth];
+  int stack_size{0};
+  stack[stack_size++] = 0u;
+  while (stack_size > 0) {
+    auto const node_index = stack[--stack_size];
+    const Node &node = nodes[node_index];
+    if (!intersect_box(packet, mask, node.bounds, inverse_direction)) {
+      continue;
+    }
+    if (node.count > 0u) {
+      for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+        auto const surface_index = triangles[i].surface_index;
+        PreparedTriangle prepared;
+        if (surface_index == receiver_index ||
+            (static_cast<std::size_t>(surface_index) < excluded_surfaces.size() &&
+             excluded_surfaces[static_cast<std::size_t>(surface_index)]) ||
+            !prepare_triangle(triangles[i], packet.direction, prepared)) {
+          continue;
+        }
+        auto const triangle_hits = intersect_triangle(packet, mask, prepared);
+        hits |= triangle_hits;
+        if (any_hit) {
+          mask &= ~triangle_hits;
+          if (!mask) {
+            return hits;
+          }
+        }
+      }
+    } else {
+      // Visit the child nearer the ray origins first
+      if (packet.direction[node.axis] < 0.f) {
+        stack[stack_size++] = node_index + 1u;
+        stack[stack_size++] = node.offset;
+      } else {
+        stack[stack_size++] = node.offset;
+        stack[stack_size++] = node_index + 1u;
+      }
+    }
+  }
+  return hits;
+}
+
+unsigned int BVH::occluded(RayPacket &packet, unsigned int mask, int receiver_index,
+                           const std::vector<bool> &excluded_surfaces) const {
+  return traverse<true>(packet, mask, receiver_index, excluded_surfaces);
+}
+
+unsigned int BVH::intersect(RayPacket &packet, unsigned int mask) const {
+  return traverse<false>(packet, mask, -1, {});
+}
+
+void BVH::find_triangles(const Beam &beam, std::vector<const Triangle *> &found) const {
+  if (nodes.empty()) {
+    return;
+  }
+  std::uint32_t stack[max_depth];
+  int stack_size{0};
+  stack[stack_size++] = 0u;
+  while (stack_size > 0) {
+    auto const node_index = stack[--stack_size];
+    const Node &node = nodes[node_index];
+    if (!overlaps(beam, node.bounds)) {
+      continue;
+    }
+    if (node.count > 0u) {
+      for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+        found.push_back(&triangles[i]);
+      }
+    } else {
+      stack[stack_size++] = node.offset;
+      stack[stack_size++] = node_index + 1u;
+    }
+  }
+}
+
+} // namespace Penumbra
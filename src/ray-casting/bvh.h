@@ -0,0 +1,103 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef BVH_H_
+#define BVH_H_
+
+// Standard
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Penumbra {
+
+// Model triangle, with coordinates relative to the center of the model
+struct Triangle {
+  float vertex[3];
+  float edges[2][3]; // From vertex to the other two vertices
+  float normal[3];   // edges[0] x edges[1]
+  int surface_index;
+};
+
+// Parallel rays, origin + t * direction, hitting triangles for t in [t_min, t_max]. Rays are
+// processed four at a time with SIMD instructions. A mask selects which rays take part in a query
+// (bit i for ray i).
+struct RayPacket {
+  static constexpr int size{16};
+  float direction[3];
+  alignas(16) float origin_x[size];
+  alignas(16) float origin_y[size];
+  alignas(16) float origin_z[size];
+  alignas(16) float t_min[size];
+  alignas(16) float t_max[size];
+  int surface_indices[size]; // Surface of the nearest hit
+};
+
+// Region swept by parallel rays, bounded along two axes spanning the plane perpendicular to the
+// rays and along the rays themselves
+struct Beam {
+  float axes[3][3];
+  float bounds[2][3]; // Minimum and maximum coordinates
+};
+
+// A triangle set up for rays in one direction, so only the per-ray dot products remain
+struct PreparedTriangle {
+  float vertex[3];
+  float u_axis[3], v_axis[3], t_axis[3]; // Barycentric coordinates and t, relative to vertex
+  int surface_index;
+};
+
+// Returns false for triangles parallel to the direction, which no ray can hit
+bool prepare_triangle(const Triangle &triangle, const float (&direction)[3],
+                      PreparedTriangle &prepared);
+
+// Finds the hits of rays in the mask nearer than t_max, reducing t_max to the hit. Returns the
+// mask of rays that hit the triangle.
+unsigned int intersect_triangle(RayPacket &packet, unsigned int mask,
+                                const PreparedTriangle &triangle);
+
+// Bounding volume hierarchy over the model's triangles, built with a binned surface area
+// heuristic (SAH). Packets are traversed together, visiting a node if any of their rays hit it.
+class BVH {
+public:
+  void build(std::vector<Triangle> triangles);
+  void clear();
+
+  // Mask of the rays hitting any triangle, ignoring the receiving surface and excluded surfaces
+  // (indexed by surface). Stops as soon as every ray is occluded.
+  unsigned int occluded(RayPacket &packet, unsigned int mask, int receiver_index,
+                        const std::vector<bool> &excluded_surfaces) const;
+
+  // Finds the nearest hit of each ray. Returns the mask of rays that hit any triangle.
+  unsigned int intersect(RayPacket &packet, unsigned int mask) const;
+
+  // Triangles in leaves whose bounding boxes may overlap the beam (a conservative test)
+  void find_triangles(const Beam &beam, std::vector<const Triangle *> &found) const;
+
+private:
+  static constexpr int max_depth{64};
+  static constexpr unsigned int max_leaf_size{4u};
+  static constexpr int bin_count{16};
+
+  struct Node {
+    float bounds[2][3];       // Minimum and maximum corners
+    std::uint32_t offset;     // First triangle of leaves, or second child of interior nodes (the
+                              // first child follows its parent)
+    std::uint32_t count : 30; // Number of triangles, or zero for interior nodes
+    std::uint32_t axis : 2;   // Split axis of interior nodes
+  };
+  std::vector<Node> nodes;
+  std::vector<Triangle> triangles;
+
+  struct BuildItem;
+  std::uint32_t build_node(std::vector<BuildItem> &items, std::size_t begin, std::size_t end,
+                           int depth);
+
+  template <bool any_hit>
+  unsigned int traverse(RayPacket &packet, unsigned int mask, int receiver_index,
+                        const std::vector<bool> &excluded_surfaces) const;
+};
+
+} // namespace Penumbra
+
+#endif // BVH_H_
@@ -0,0 +1,536 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+
+// Penumbra
+#include <penumbra/logging.h>
+#include "ray-casting/context.h"
+
+namespace Penumbra {
+
+static constexpr unsigned int triangle_vertex_count{3u};
+
+RayCastingContext::RayCastingContext(int size_in, ThreadPool &thread_pool_in,
+                                     Courierr::Courierr *logger_in)
+    : Context(size_in, logger_in), thread_pool(thread_pool_in), queue(logger_in),
+      scratch(thread_pool.get_slot_count()) {}
+
+void RayCastingContext::set_model(const std::vector<float> &vertices_in,
+                                  const std::vector<unsigned int> &indices_in,
+                                  const std::vector<SurfaceBuffer> &surface_buffers_in) {
+  Context::set_model(vertices_in, indices_in, surface_buffers_in);
+
+  // Opposite corners of the model bounding box
+  const float(&minimum)[4] = model_bounding_box[0];
+  const float(&maximum)[4] = model_bounding_box[7];
+  float squared_radius{0.f};
+  for (int axis = 0; axis < vertex_size; ++axis) {
+    center[axis] = 0.5f * (minimum[axis] + maximum[axis]);
+    squared_radius += 0.25f * (maximum[axis] - minimum[axis]) * (maximum[axis] - minimum[axis]);
+  }
+  radius = std::sqrt(squared_radius);
+
+  // Relative to the size of the model, well above the precision of single precision hits
+  static constexpr float relative_tolerance{1e-5f};
+  coplanar_tolerance = relative_tolerance * 2.f * radius;
+
+  triangles.clear();
+  triangles.reserve(indices.size() / triangle_vertex_count);
+  surface_triangles.clear();
+  surface_triangles.reserve(surface_buffers.size());
+  for (auto const &surface_buffer : surface_buffers) {
+    // Index ranges may be left with gaps by model updates, so triangles are counted by surface
+    surface_triangles.emplace_back(static_cast<unsigned int>(triangles.size()),
+                                   surface_buffer.count / triangle_vertex_count);
+    for (unsigned int i = surface_buffer.begin;
+         i + triangle_vertex_count <= surface_buffer.begin + surface_buffer.count;
+         i += triangle_vertex_count) {
+      Triangle triangle{};
+      float points[triangle_vertex_count][vertex_size];
+      for (unsigned int point = 0; point < triangle_vertex_count; ++point) {
+        const float *vertex = get_vertex(i + point);
+        for (int axis = 0; axis < vertex_size; ++axis) {
+          points[point][axis] = vertex[axis] - center[axis];
+        }
+      }
+      for (int axis = 0; axis < vertex_size; ++axis) {
+        triangle.vertex[axis] = points[0][axis];
+        triangle.edges[0][axis] = points[1][axis] - points[0][axis];
+        triangle.edges[1][axis] = points[2][axis] - points[0][axis];
+      }
+      const auto &edges = triangle.edges;
+      triangle.normal[0] = edges[0][1] * edges[1][2] - edges[0][2] * edges[1][1];
+      triangle.normal[1] = edges[0][2] * edges[1][0] - edges[0][0] * edges[1][2];
+      triangle.normal[2] = edges[0][0] * edges[1][1] - edges[0][1] * edges[1][0];
+      triangle.surface_index = surface_buffer.index;
+      triangles.push_back(triangle);
+    }
+  }
+  bvh.build(triangles);
+  pssas.assign(surface_buffers.size(), 0.f);
+}
+
+void RayCastingContext::update_model(const std::vector<float> &vertices_in,
+                                     const std::vector<unsigned int> &indices_in,
+                                     const std::vector<SurfaceBuffer> &surface_buffers_in,
+                                     const std::vector<unsigned int> &,
+                                     const std::vector<std::pair<unsigned int, unsigned int>> &) {
+  set_model(vertices_in, indices_in, surface_buffers_in);
+}
+
+void RayCastingContext::clear_model() {
+  Context::clear_model();
+  bvh.clear();
+  triangles.clear();
+  surface_triangles.clear();
+  pssas.clear();
+  queue.clear();
+}
+
+void RayCastingContext::check_model_is_set() const {
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot set scene.", *logger);
+  }
+}
+
+RayCastingContext::SampleGrid
+RayCastingContext::get_sample_grid(mat4x4 sun_view, const SurfaceBuffer *surface_buffer,
+                                   bool toward_sun, bool clip_far, bool adaptive) const {
+  SampleGrid grid{};
+  auto const *receiver_view =
+      surface_buffer && clip_far
+          ? get_receiver_view(static_cast<unsigned int>(surface_buffer->index), sun_view)
+          : nullptr;
+  auto const sun_projection = receiver_view
+                                  ? receiver_view->projection
+                                  : calculate_projection(sun_view, surface_buffer, clip_far);
+  if (sun_projection.pixel_area <= 0.f) {
+    return grid;
+  }
+  grid.resolution = size;
+  if (adaptive && surface_buffer) {
+    auto const surface_index = static_cast<unsigned int>(surface_buffer->index);
+    grid.resolution = choose_resolution(surface_index, sun_view, sun_projection);
+    grid.error = estimate_pssa_error(surface_index, sun_view, sun_projection, grid.resolution);
+  }
+  grid.sample_area = get_pixel_area(sun_projection, grid.resolution);
+
+  // View axes in model coordinates. The z axis points toward the sun.
+  float axes[3][3];
+  for (int axis = 0; axis < 3; ++axis) {
+    for (int component = 0; component < 3; ++component) {
+      axes[axis][component] = sun_view[component][axis];
+    }
+  }
+  float const center_x = axes[0][0] * center[0] + axes[0][1] * center[1] +
+                         axes[0][2] * center[2] + sun_view[3][0];
+  float const center_y = axes[1][0] * center[0] + axes[1][1] * center[1] +
+                         axes[1][2] * center[2] + sun_view[3][1];
+
+  // Samples at the center of each pixel
+  float const inverse_resolution = 1.f / static_cast<float>(grid.resolution);
+  float const step_x = (sun_projection.right - sun_projection.left) * inverse_resolution;
+  float const step_y = (sun_projection.top - sun_projection.bottom) * inverse_resolution;
+  float const first_x = sun_projection.left + 0.5f * step_x - center_x;
+  float const first_y = sun_projection.bottom + 0.5f * step_y - center_y;
+  float const depth = toward_sun ? -radius : radius;
+  grid.first_x = first_x;
+  grid.first_y = first_y;
+  grid.step_x = step_x;
+  grid.step_y = step_y;
+  for (int component = 0; component < 3; ++component) {
+    grid.origin[component] =
+        first_x * axes[0][component] + first_y * axes[1][component] + depth * axes[2][component];
+    grid.x_step[component] = step_x * axes[0][component];
+    grid.y_step[component] = step_y * axes[1][component];
+    grid.direction[component] = toward_sun ? axes[2][component] : -axes[2][component];
+    grid.plane_axes[0][component] = axes[0][component];
+    grid.plane_axes[1][component] = axes[1][component];
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      grid.lane_offsets[component][lane] =
+          static_cast<float>(lane % packet_width) * grid.x_step[component] +
+          static_cast<float>(lane / packet_width) * grid.y_step[component];
+    }
+  }
+  return grid;
+}
+
+void RayCastingContext::fill_packet(const SampleGrid &grid, int packet_row, int packet_column,
+                                    RayPacket &packet, unsigned int &mask) const {
+  std::copy(grid.direction, grid.direction + 3, packet.direction);
+  auto const x = static_cast<float>(packet_column * packet_width);
+  auto const y = static_cast<float>(packet_row * packet_width);
+  float *origins[3] = {packet.origin_x, packet.origin_y, packet.origin_z};
+  for (int component = 0; component < 3; ++component) {
+    float const first_origin =
+        grid.origin[component] + x * grid.x_step[component] + y * grid.y_step[component];
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      origins[component][lane] = first_origin + grid.lane_offsets[component][lane];
+    }
+  }
+  std::fill(packet.t_min, packet.t_min + RayPacket::size, 0.f);
+  std::fill(packet.t_max, packet.t_max + RayPacket::size, MAX_FLOAT);
+  std::fill(packet.surface_indices, packet.surface_indices + RayPacket::size, -1);
+
+  // Packets at the last row or column may extend past the grid
+  int const columns = std::min(packet_width, grid.resolution - packet_column * packet_width);
+  int const rows = std::min(packet_width, grid.resolution - packet_row * packet_width);
+  mask = 0u;
+  for (int row = 0; row < rows; ++row) {
+    mask |= ((1u << columns) - 1u) << (row * packet_width);
+  }
+}
+
+void RayCastingContext::add_grid_triangle(const Triangle &triangle, const SampleGrid &grid,
+                                          const float (&bounds)[2][2],
+                                          std::vector<GridTriangle> &list) {
+  GridTriangle grid_triangle{};
+  for (int axis = 0; axis < 2; ++axis) {
+    const float(&plane_axis)[3] = grid.plane_axes[axis];
+    float const coordinate = plane_axis[0] * triangle.vertex[0] +
+                             plane_axis[1] * triangle.vertex[1] +
+                             plane_axis[2] * triangle.vertex[2];
+    float minimum_offset{0.f}, maximum_offset{0.f};
+    for (auto const &edge : triangle.edges) {
+      float const offset =
+          plane_axis[0] * edge[0] + plane_axis[1] * edge[1] + plane_axis[2] * edge[2];
+      minimum_offset = std::min(offset, minimum_offset);
+      maximum_offset = std::max(offset, maximum_offset);
+    }
+    grid_triangle.bounds[0][axis] = coordinate + minimum_offset;
+    grid_triangle.bounds[1][axis] = coordinate + maximum_offset;
+    if (grid_triangle.bounds[0][axis] > bounds[1][axis] ||
+        grid_triangle.bounds[1][axis] < bounds[0][axis]) {
+      return;
+    }
+  }
+  if (prepare_triangle(triangle, grid.direction, grid_triangle.triangle)) {
+    list.push_back(grid_triangle);
+  }
+}
+
+std::uint64_t RayCastingContext::count_unshaded_samples(const unsigned int receiver_index,
+                                                        const SampleGrid &grid,
+                                                        const int packet_row,
+                                                        const std::vector<bool> &excluded_surfaces,
+                                                        Scratch &strip_scratch) const {
+  // Plane coordinates of the strip's samples, padded by half a sample
+  int const first_row = packet_row * packet_width;
+  float strip_bounds[2][2] = {
+      {grid.first_x - 0.5f * grid.step_x,
+       grid.first_y + (static_cast<float>(first_row) - 0.5f) * grid.step_y},
+      {grid.first_x + (static_cast<float>(grid.resolution) - 0.5f) * grid.step_x,
+       grid.first_y + (static_cast<float>(first_row + packet_width) - 0.5f) * grid.step_y}};
+
+  // Receiver triangles crossing the strip
+  auto const [first_triangle, triangle_count] = surface_triangles[receiver_index];
+  auto &receiver_triangles = strip_scratch.receiver_triangles;
+  receiver_triangles.clear();
+  float normal[3] = {0.f, 0.f, 0.f};
+  for (auto i = first_triangle; i < first_triangle + triangle_count; ++i) {
+    add_grid_triangle(triangles[i], grid, strip_bounds, receiver_triangles);
+    for (int axis = 0; axis < 3; ++axis) {
+      normal[axis] += triangles[i].normal[axis];
+    }
+  }
+  float const normal_along_rays = normal[0] * grid.direction[0] +
+                                  normal[1] * grid.direction[1] + normal[2] * grid.direction[2];
+  if (receiver_triangles.empty() || normal_along_rays == 0.f) {
+    return 0u;
+  }
+
+  // Occluders: triangles crossing the strip with any part in front of the receiver's plane (by
+  // more than the coplanar tolerance)
+  Beam beam{};
+  for (int component = 0; component < 3; ++component) {
+    beam.axes[0][component] = grid.plane_axes[0][component];
+    beam.axes[1][component] = grid.plane_axes[1][component];
+    beam.axes[2][component] = grid.direction[component];
+  }
+  for (int axis = 0; axis < 2; ++axis) {
+    beam.bounds[0][axis] = strip_bounds[0][axis];
+    beam.bounds[1][axis] = strip_bounds[1][axis];
+  }
+  beam.bounds[0][2] = -MAX_FLOAT;
+  beam.bounds[1][2] = MAX_FLOAT;
+  auto &found_triangles = strip_scratch.found_triangles;
+  found_triangles.clear();
+  bvh.find_triangles(beam, found_triangles);
+
+  const float(&plane_point)[3] = triangles[first_triangle].vertex;
+  auto const is_in_front = [&](const Triangle &triangle) {
+    float const offset[3] = {triangle.vertex[0] - plane_point[0],
+                             triangle.vertex[1] - plane_point[1],
+                             triangle.vertex[2] - plane_point[2]};
+    float const distance = offset[0] * normal[0] + offset[1] * normal[1] + offset[2] * normal[2];
+    float maximum_distance{distance}; // Along the rays, times normal_along_rays
+    float minimum_distance{distance};
+    for (auto const &edge : triangle.edges) {
+      float const edge_distance =
+          distance + edge[0] * normal[0] + edge[1] * normal[1] + edge[2] * normal[2];
+      maximum_distance = std::max(edge_distance, maximum_distance);
+      minimum_distance = std::min(edge_distance, minimum_distance);
+    }
+    return (normal_along_rays > 0.f ? maximum_distance : -minimum_distance) >
+           coplanar_tolerance * std::abs(normal_along_rays);
+  };
+  auto &occluders = strip_scratch.occluders;
+  occluders.clear();
+  for (auto const *triangle : found_triangles) {
+    auto const surface_index = static_cast<std::size_t>(triangle->surface_index);
+    if (surface_index == receiver_index ||
+        (surface_index < excluded_surfaces.size() && excluded_surfaces[surface_index]) ||
+        !is_in_front(*triangle)) {
+      continue;
+    }
+    add_grid_triangle(*triangle, grid, strip_bounds, occluders);
+    if (occluders.size() > max_listed_occluders) {
+      break; // Traverse the hierarchy instead
+    }
+  }
+  bool const list_occluders = occluders.size() <= max_listed_occluders;
+
+  auto overlaps_packet = [&](const GridTriangle &triangle, const float (&bounds)[2][2]) {
+    return triangle.bounds[0][0] <= bounds[1][0] && triangle.bounds[1][0] >= bounds[0][0];
+  };
+
+  std::uint64_t unshaded_count{0u};
+  RayPacket packet;
+  unsigned int mask;
+  int const packet_columns = (grid.resolution + packet_width - 1) / packet_width;
+  for (int packet_column = 0; packet_column < packet_columns; ++packet_column) {
+    int const first_column = packet_column * packet_width;
+    float const packet_bounds[2][2] = {
+        {grid.first_x + (static_cast<float>(first_column) - 0.5f) * grid.step_x,
+         strip_bounds[0][1]},
+        {grid.first_x + (static_cast<float>(first_column + packet_width) - 0.5f) * grid.step_x,
+         strip_bounds[1][1]}};
+    unsigned int receiver_hits{0u};
+    bool filled{false};
+    for (auto const &triangle : receiver_triangles) {
+      if (!overlaps_packet(triangle, packet_bounds)) {
+        continue;
+      }
+      if (!filled) {
+        fill_packet(grid, packet_row, packet_column, packet, mask);
+        filled = true;
+      }
+      receiver_hits |= intersect_triangle(packet, mask, triangle.triangle);
+    }
+    if (!receiver_hits) {
+      continue;
+    }
+
+    // Look for anything between the receiver and the sun
+    for (int lane = 0; lane < RayPacket::size; ++lane) {
+      packet.t_min[lane] = packet.t_max[lane] + coplanar_tolerance;
+      packet.t_max[lane] = MAX_FLOAT;
+    }
+    unsigned int unshaded = receiver_hits;
+    if (list_occluders) {
+      for (auto const &occluder : occluders) {
+        if (overlaps_packet(occluder, packet_bounds)) {
+          unshaded &= ~intersect_triangle(packet, unshaded, occluder.triangle);
+          if (!unshaded) {
+            break;
+          }
+        }
+      }
+    } else {
+      unshaded &= ~bvh.occluded(packet, unshaded, static_cast<int>(receiver_index),
+                                excluded_surfaces);
+    }
+    unshaded_count += std::bitset<RayPacket::size>(unshaded).count();
+  }
+  return unshaded_count;
+}
+
+std::vector<float>
+RayCastingContext::calculate_unshaded_areas(const std::vector<unsigned int> &receiver_indices,
+                                            const std::vector<SampleGrid> &grids,
+                                            const std::vector<bool> &excluded_surfaces) {
+  // Rows of the largest grids. Smaller grids skip the rows beyond them.
+  auto const packet_rows = static_cast<std::size_t>((size + packet_width - 1) / packet_width);
+  auto get_grid = [&](std::size_t i) -> const SampleGrid & {
+    return grids.size() == 1u ? grids[0] : grids[i];
+  };
+
+  std::vector<std::uint64_t> counts(receiver_indices.size() * packet_rows, 0u);
+  thread_pool.parallel_for(counts.size(), [&](std::size_t task, unsigned int slot) {
+    auto const i = task / packet_rows;
+    auto const packet_row = static_cast<int>(task % packet_rows);
+    if (get_grid(i).sample_area > 0.f && packet_row * packet_width < get_grid(i).resolution) {
+      counts[task] = count_unshaded_samples(receiver_indices[i], get_grid(i), packet_row,
+                                            excluded_surfaces, scratch[slot]);
+    }
+  });
+
+  std::vector<float> areas(receiver_indices.size());
+  for (std::size_t i = 0; i < receiver_indices.size(); ++i) {
+    std::uint64_t sample_count{0u};
+    for (std::size_t row = 0; row < packet_rows; ++row) {
+      sample_count += counts[i * packet_rows + row];
+    }
+    areas[i] = static_cast<float>(sample_count) * get_grid(i).sample_area;
+  }
+  return areas;
+}
+
+void RayCastingContext::calculate_visible_areas(mat4x4 sun_view, std::vector<float> &results) {
+  // Cast rays from the sun across the entire model, and count the samples hitting each surface
+  auto const grid = get_sample_grid(sun_view, nullptr, false);
+  std::vector<std::vector<std::uint64_t>> slot_counts(
+      thread_pool.get_slot_count(), std::vector<std::uint64_t>(surface_buffers.size(), 0u));
+  if (grid.sample_area > 0.f) {
+    int const packet_count = (grid.resolution + packet_width - 1) / packet_width;
+    thread_pool.parallel_for(
+        static_cast<std::size_t>(packet_count), [&](std::size_t packet_row, unsigned int slot) {
+          auto &counts = slot_counts[slot];
+          RayPacket packet;
+          unsigned int mask;
+          for (int packet_column = 0; packet_column < packet_count; ++packet_column) {
+            fill_packet(grid, static_cast<int>(packet_row), packet_column, packet, mask);
+            auto const hits = bvh.intersect(packet, mask);
+            for (int lane = 0; lane < RayPacket::size; ++lane) {
+              if ((hits >> lane) & 1u) {
+                ++counts[static_cast<std::size_t>(packet.surface_indices[lane])];
+              }
+            }
+          }
+        });
+  }
+  for (std::size_t i = 0; i < surface_buffers.size(); ++i) {
+    std::uint64_t sample_count{0u};
+    for (auto const &counts : slot_counts) {
+      sample_count += counts[i];
+    }
+    results[i] = static_cast<float>(sample_count) * grid.sample_area;
+  }
+}
+
+void RayCastingContext::calculate_pssas(const std::vector<unsigned int> &surface_indices,
+                                        mat4x4 sun_view, std::vector<float> &results) {
+  check_model_is_set();
+  results.resize(surface_buffers.size());
+  auto const cast_surface_indices = calculate_analytic_pssas(surface_indices, sun_view, results);
+  if (cast_surface_indices.empty()) {
+    return;
+  }
+
+  if (calculation_mode == CalculationMode::surface_id_buffer) {
+    std::vector<float> visible_areas(surface_buffers.size());
+    calculate_visible_areas(sun_view, visible_areas);
+    auto const sun_projection = calculate_projection(sun_view);
+    for (auto const surface_index : cast_surface_indices) {
+      results[surface_index] = visible_areas[surface_index];
+      pssa_errors[surface_index] =
+          estimate_pssa_error(surface_index, sun_view, sun_projection, size);
+    }
+    return;
+  }
+
+  std::vector<SampleGrid> grids;
+  grids.reserve(cast_surface_indices.size());
+  for (auto const surface_index : cast_surface_indices) {
+    grids.push_back(get_sample_grid(sun_view, &surface_buffers[surface_index], true, true, true));
+  }
+  auto const areas = calculate_unshaded_areas(cast_surface_indices, grids);
+  for (std::size_t i = 0; i < cast_surface_indices.size(); ++i) {
+    results[cast_surface_indices[i]] = areas[i];
+    pssa_errors[cast_surface_indices[i]] = grids[i].error;
+  }
+}
+
+void RayCastingContext::submit_pssa(const unsigned int surface_index, mat4x4 sun_view) {
+  calculate_pssas(std::vector<unsigned int>{surface_index}, sun_view, pssas);
+}
+
+void RayCastingContext::submit_pssas(const std::vector<unsigned int> &surface_indices,
+                                     mat4x4 sun_view) {
+  calculate_pssas(surface_indices, sun_view, pssas);
+}
+
+float RayCastingContext::retrieve_pssa(const unsigned int surface_index) {
+  return pssas.at(surface_index);
+}
+
+std::vector<float> RayCastingContext::calculate_pssas(const unsigned int surface_index,
+                                                      const std::vector<mat4x4_ptr> &sun_views) {
+  check_model_is_set();
+  std::vector<float> results(sun_views.size());
+  std::vector<std::size_t> cast_views;
+  std::vector<SampleGrid> grids;
+  for (std::size_t i = 0; i < sun_views.size(); ++i) {
+    if (!calculate_analytic_pssa(surface_index, sun_views[i], results[i])) {
+      cast_views.push_back(i);
+      grids.push_back(
+          get_sample_grid(sun_views[i], &surface_buffers[surface_index], true, true, true));
+    }
+  }
+  if (!grids.empty()) {
+    auto const areas = calculate_unshaded_areas(
+        std::vector<unsigned int>(cast_views.size(), surface_index), grids);
+    for (std::size_t i = 0; i < cast_views.size(); ++i) {
+      results[cast_views[i]] = areas[i];
+    }
+  }
+  return results;
+}
+
+unsigned int RayCastingContext::queue_pssas(const std::vector<unsigned int> &surface_indices,
+                                            mat4x4 sun_view) {
+  // Calculations complete before returning. Queuing is supported for parity with the OpenGL
+  // backend.
+  std::vector<float> results;
+  calculate_pssas(surface_indices, sun_view, results);
+  std::vector<float> queued_results;
+  queued_results.reserve(surface_indices.size());
+  for (auto const surface_index : surface_indices) {
+    queued_results.push_back(results[surface_index]);
+  }
+  return queue.push(std::move(queued_results));
+}
+
+bool RayCastingContext::is_queued_pssa_ready(const unsigned int ticket) {
+  queue.check_ticket(ticket);
+  return true;
+}
+
+std::vector<float> RayCastingContext::retrieve_queued_pssas(const unsigned int ticket) {
+  return queue.pop(ticket);
+}
+
+unsigned int RayCastingContext::get_queued_pssa_count() const {
+  return queue.size();
+}
+
+unsigned int RayCastingContext::get_queue_capacity() const {
+  return CompletedQueue::max_size;
+}
+
+std::unordered_map<unsigned int, float> RayCastingContext::calculate_interior_pssas(
+    const std::vector<unsigned int> &hidden_surface_indices,
+    const std::vector<unsigned int> &interior_surface_indices, mat4x4 sun_view) {
+  check_model_is_set();
+
+  // As with pixel counting, sunlight enters through the extents of the first hidden surface
+  std::vector<SampleGrid> const grid{
+      get_sample_grid(sun_view, &surface_buffers.at(hidden_surface_indices.at(0)), true, false)};
+  std::vector<bool> excluded_surfaces(surface_buffers.size(), false);
+  for (auto const hidden_surface_index : hidden_surface_indices) {
+    excluded_surfaces.at(hidden_surface_index) = true;
+  }
+  auto const areas = calculate_unshaded_areas(interior_surface_indices, grid, excluded_surfaces);
+
+  std::unordered_map<unsigned int, float> interior_pssas;
+  for (std::size_t i = 0; i < interior_surface_indices.size(); ++i) {
+    interior_pssas[interior_surface_indices[i]] = areas[i];
+  }
+  return interior_pssas;
+}
+
+} // namespace Penumbra
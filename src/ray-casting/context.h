@@ -0,0 +1,127 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef RAY_CASTING_CONTEXT_H_
+#define RAY_CASTING_CONTEXT_H_
+
+// Standard
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Vendor
+#include <courierr/courierr.h>
+
+// Penumbra
+#include "../context.h"
+#include "cpu/thread-pool.h"
+#include "ray-casting/bvh.h"
+
+namespace Penumbra {
+
+// Calculates PSSAs by casting packets of rays toward the sun through a bounding volume hierarchy
+class RayCastingContext : public Context {
+
+public:
+  RayCastingContext(int size, ThreadPool &thread_pool, Courierr::Courierr *logger);
+  ~RayCastingContext() override = default;
+  void set_model(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                 const std::vector<SurfaceBuffer> &surface_buffers) override;
+  // Builds the triangles and their hierarchy again (as set_model)
+  void update_model(
+      const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+      const std::vector<SurfaceBuffer> &surface_buffers,
+      const std::vector<unsigned int> &changed_surfaces,
+      const std::vector<std::pair<unsigned int, unsigned int>> &rewritten_vertices) override;
+  void clear_model() override;
+  using Context::submit_pssa;
+  void submit_pssa(unsigned int surface_index, mat4x4 sun_view) override;
+  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) override;
+  using Context::retrieve_pssa;
+  float retrieve_pssa(unsigned int surface_index) override;
+  std::vector<float> calculate_pssas(unsigned int surface_index,
+                                     const std::vector<mat4x4_ptr> &sun_views) override;
+  unsigned int queue_pssas(const std::vector<unsigned int> &surface_indices,
+                           mat4x4 sun_view) override;
+  bool is_queued_pssa_ready(unsigned int ticket) override;
+  std::vector<float> retrieve_queued_pssas(unsigned int ticket) override;
+  [[nodiscard]] unsigned int get_queued_pssa_count() const override;
+  [[nodiscard]] unsigned int get_queue_capacity() const override;
+
+  std::unordered_map<unsigned int, float>
+  calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                           const std::vector<unsigned int> &interior_surface_indices,
+                           mat4x4 sun_view) override;
+
+private:
+  static constexpr int packet_width{4}; // Packets cover packet_width x packet_width samples
+  static_assert(packet_width * packet_width == RayPacket::size);
+  ThreadPool &thread_pool; // Owned by PenumbraImplementation
+  BVH bvh;
+  std::vector<Triangle> triangles; // Each surface's triangles in turn, in model order
+  std::vector<std::pair<unsigned int, unsigned int>> surface_triangles; // First and count
+  float center[3]{};               // Triangle coordinates are relative to the model center
+  float radius{0.f};               // Distance from the center to the farthest model corner
+  float coplanar_tolerance{0.f};   // Surfaces closer than this to a receiver do not shade it
+  std::vector<float> pssas;        // Results of the last submission
+  CompletedQueue queue;
+
+  // Rays cast toward the sun from a grid of samples beyond the model (relative to its center)
+  struct SampleGrid {
+    float origin[3];        // Origin of the first sample's ray
+    float x_step[3];        // Change in origin from one sample to the next in a row
+    float y_step[3];        // Change in origin from one row to the next
+    float direction[3];
+    float plane_axes[2][3]; // View x and y axes
+    float first_x, first_y; // Plane coordinates of the first sample
+    float step_x, step_y;   // Distance between samples in plane coordinates
+    float sample_area;      // Projected area represented by each sample (zero if empty)
+    int resolution;         // Samples on each side
+    float error;            // Error estimate of adaptive grids (see estimate_pssa_error)
+    float lane_offsets[3][RayPacket::size]; // Offset of each ray's origin from a packet's first
+  };
+  // Sampled at size, or at the resolution chosen for the target accuracy if adaptive
+  [[nodiscard]] SampleGrid get_sample_grid(mat4x4 sun_view, const SurfaceBuffer *surface_buffer,
+                                           bool toward_sun, bool clip_far = true,
+                                           bool adaptive = false) const;
+  void fill_packet(const SampleGrid &grid, int packet_row, int packet_column,
+                   RayPacket &packet, unsigned int &mask) const;
+
+  // A triangle prepared for a grid's rays, with its extents in plane coordinates
+  struct GridTriangle {
+    PreparedTriangle triangle;
+    float bounds[2][2];
+  };
+  // Adds the triangle if it may overlap the bounds (in plane coordinates)
+  static void add_grid_triangle(const Triangle &triangle, const SampleGrid &grid,
+                                const float (&bounds)[2][2], std::vector<GridTriangle> &list);
+
+  // Per thread scratch memory
+  struct Scratch {
+    std::vector<const Triangle *> found_triangles;
+    std::vector<GridTriangle> receiver_triangles;
+    std::vector<GridTriangle> occluders;
+  };
+  std::vector<Scratch> scratch; // One per thread pool slot
+  static constexpr std::size_t max_listed_occluders{64u};
+
+  // Unshaded projected area of each receiver, on its own grid or one shared grid
+  std::vector<float> calculate_unshaded_areas(const std::vector<unsigned int> &receiver_indices,
+                                              const std::vector<SampleGrid> &grids,
+                                              const std::vector<bool> &excluded_surfaces = {});
+  std::uint64_t count_unshaded_samples(unsigned int receiver_index, const SampleGrid &grid,
+                                       int packet_row, const std::vector<bool> &excluded_surfaces,
+                                       Scratch &strip_scratch) const;
+
+  // Surface ID buffer mode: the projected area of each surface seen from the sun
+  void calculate_visible_areas(mat4x4 sun_view, std::vector<float> &results);
+
+  void calculate_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                       std::vector<float> &results);
+  void check_model_is_set() const;
+};
+
+} // namespace Penumbra
+
+#endif // RAY_CASTING_CONTEXT_H_
@@ -0,0 +1,235 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <cmath>
+
+// Penumbra
+#include "sky-grid.h"
+
+namespace Penumbra {
+
+namespace {
+constexpr float pi{2.f * SkyGrid::zenith};
+// The sun's view is undefined at the zenith, so its PSSAs are calculated just below it
+constexpr float max_altitude{SkyGrid::zenith - 1e-3f};
+} // namespace
+
+SkyGrid::SkyGrid(const unsigned int azimuth_cells_in, const unsigned int altitude_cells_in,
+                 const float tolerance, const unsigned int max_refinements,
+                 const Calculator &calculate)
+    : azimuth_cells(azimuth_cells_in), altitude_cells(altitude_cells_in),
+      scale(1u << max_refinements) {
+  std::vector<Point> points;
+  for (std::uint32_t altitude = 0; altitude <= altitude_cells; ++altitude) {
+    for (std::uint32_t azimuth = 0; azimuth < azimuth_cells; ++azimuth) {
+      points.push_back({azimuth * scale, altitude * scale});
+    }
+  }
+  calculate_points(points, calculate);
+
+  // Each refinement checks the centers of the cells split by the one before
+  std::vector<Point> cells; // Lower left corners
+  for (std::uint32_t altitude = 0; altitude < altitude_cells; ++altitude) {
+    for (std::uint32_t azimuth = 0; azimuth < azimuth_cells; ++azimuth) {
+      cells.push_back({azimuth * scale, altitude * scale});
+    }
+  }
+  for (std::uint32_t size = scale; size > 1u && !cells.empty(); size /= 2u) {
+    auto const half = size / 2u;
+    points.clear();
+    for (auto const &cell : cells) {
+      points.push_back({cell.azimuth + half, cell.altitude + half});
+    }
+    calculate_points(points, calculate);
+
+    std::vector<Point> quarters;
+    points.clear();
+    for (auto const &cell : cells) {
+      const float *corners[4] = {
+          get_pssas(cell), get_pssas({cell.azimuth + size, cell.altitude}),
+          get_pssas({cell.azimuth, cell.altitude + size}),
+          get_pssas({cell.azimuth + size, cell.altitude + size})};
+      const float *center = get_pssas({cell.azimuth + half, cell.altitude + half});
+      bool is_split{false};
+      for (std::size_t surface = 0; surface < surface_count && !is_split; ++surface) {
+        float const interpolated = 0.25f * (corners[0][surface] + corners[1][surface] +
+                                            corners[2][surface] + corners[3][surface]);
+        is_split = std::abs(center[surface] - interpolated) > tolerance;
+      }
+      if (!is_split) {
+        continue;
+      }
+      split_cells.insert(get_cell_key(cell, size));
+      quarters.push_back(cell);
+      quarters.push_back({cell.azimuth + half, cell.altitude});
+      quarters.push_back({cell.azimuth, cell.altitude + half});
+      quarters.push_back({cell.azimuth + half, cell.altitude + half});
+      // Midpoints of the edges, which become the quarters' corners
+      points.push_back({cell.azimuth + half, cell.altitude});
+      points.push_back({cell.azimuth, cell.altitude + half});
+      points.push_back({cell.azimuth + size, cell.altitude + half});
+      points.push_back({cell.azimuth + half, cell.altitude + size});
+    }
+    calculate_points(points, calculate);
+    cells = std::move(quarters);
+  }
+
+  corner_pssas = pssas;
+  std::vector<bool> is_constrained(positions.size(), false);
+  for (auto const &position : positions) {
+    constrain_corner({static_cast<std::uint32_t>(position.first >> 32u),
+                      static_cast<std::uint32_t>(position.first & 0xFFFFFFFFu)},
+                     is_constrained);
+  }
+}
+
+std::vector<float> SkyGrid::interpolate(const float azimuth, const float altitude) const {
+  // Position in lattice steps, with azimuths wrapped to [0, 2 pi)
+  auto const azimuth_steps = static_cast<float>(azimuth_cells * scale);
+  auto const altitude_steps = static_cast<float>(altitude_cells * scale);
+  float x = azimuth / (2.f * pi);
+  x = (x - std::floor(x)) * azimuth_steps;
+  float const y = std::clamp(altitude / zenith, 0.f, 1.f) * altitude_steps;
+
+  auto const point_x = std::min(static_cast<std::uint32_t>(x), azimuth_cells * scale - 1u);
+  auto const point_y = std::min(static_cast<std::uint32_t>(y), altitude_cells * scale - 1u);
+  Point cell;
+  auto const size = find_cell({point_x, point_y}, cell);
+
+  float const u = (x - static_cast<float>(cell.azimuth)) / static_cast<float>(size);
+  float const v = (y - static_cast<float>(cell.altitude)) / static_cast<float>(size);
+  auto const get_corner_pssas = [&](const Point corner) {
+    return &corner_pssas[positions.at(get_key(corner)) * surface_count];
+  };
+  const float *corners[4] = {get_corner_pssas(cell),
+                             get_corner_pssas({cell.azimuth + size, cell.altitude}),
+                             get_corner_pssas({cell.azimuth, cell.altitude + size}),
+                             get_corner_pssas({cell.azimuth + size, cell.altitude + size})};
+  std::vector<float> results(surface_count);
+  for (std::size_t surface = 0; surface < surface_count; ++surface) {
+    results[surface] = (1.f - v) * ((1.f - u) * corners[0][surface] + u * corners[1][surface]) +
+                       v * ((1.f - u) * corners[2][surface] + u * corners[3][surface]);
+  }
+  return results;
+}
+
+std::size_t SkyGrid::get_sun_position_count() const {
+  return positions.size();
+}
+
+std::uint64_t SkyGrid::get_key(const Point point) const {
+  auto const azimuth = point.azimuth % (azimuth_cells * scale);
+  return (static_cast<std::uint64_t>(azimuth) << 32u) | point.altitude;
+}
+
+std::uint64_t SkyGrid::get_cell_key(const Point corner, const std::uint32_t size) {
+  // Sizes are at most 2^max_refinement_count, below 2^8; lattice points below 2^28
+  return (static_cast<std::uint64_t>(size) << 56u) |
+         (static_cast<std::uint64_t>(corner.azimuth) << 28u) | corner.altitude;
+}
+
+std::pair<float, float> SkyGrid::get_sun_position(const Point point) const {
+  float const azimuth = 2.f * pi * static_cast<float>(point.azimuth) /
+                        static_cast<float>(azimuth_cells * scale);
+  float const altitude = zenith * static_cast<float>(point.altitude) /
+                         static_cast<float>(altitude_cells * scale);
+  return {azimuth, std::min(altitude, max_altitude)};
+}
+
+std::uint32_t SkyGrid::find_cell(const Point point, Point &cell) const {
+  // Descend from the unrefined cell holding the point to the smallest cell holding it
+  std::uint32_t size = scale;
+  cell = {point.azimuth / scale * scale, point.altitude / scale * scale};
+  while (size > 1u && split_cells.count(get_cell_key(cell, size)) > 0u) {
+    size /= 2u;
+    cell = {cell.azimuth + (point.azimuth - cell.azimuth) / size * size,
+            cell.altitude + (point.altitude - cell.altitude) / size * size};
+  }
+  return size;
+}
+
+const float *SkyGrid::get_pssas(const Point point) const {
+  return &pssas[positions.at(get_key(point)) * surface_count];
+}
+
+void SkyGrid::calculate_points(const std::vector<Point> &points, const Calculator &calculate) {
+  std::vector<std::pair<float, float>> sun_positions;
+  for (auto const &point : points) {
+    auto const key = get_key(point);
+    if (positions.count(key) == 0u) {
+      positions.emplace(key, positions.size());
+      sun_positions.push_back(get_sun_position(point));
+    }
+  }
+  if (sun_positions.empty()) {
+    return;
+  }
+  auto const results = calculate(sun_positions);
+  surface_count = results.front().size();
+  for (auto const &result : results) {
+    pssas.insert(pssas.end(), result.begin(), result.end());
+  }
+}
+
+void SkyGrid::constrain_corner(const Point point, std::vector<bool> &is_constrained) {
+  auto const index = positions.at(get_key(point));
+  if (is_constrained[index]) {
+    return;
+  }
+  is_constrained[index] = true;
+
+  // Of the (up to four) smallest cells around the point, the largest one it is not a corner of
+  // holds it on an edge. Its PSSAs are then those interpolated between that edge's ends.
+  auto const azimuth_steps = azimuth_cells * scale;
+  auto const altitude_steps = altitude_cells * scale;
+  std::uint32_t edge_size{0u};
+  Point edge_start{}, edge_end{};
+  std::uint32_t edge_offset{0u};
+  for (std::uint32_t quadrant = 0; quadrant < 4u; ++quadrant) {
+    bool const is_left = (quadrant & 1u) != 0u, is_below = (quadrant & 2u) != 0u;
+    if ((is_below && point.altitude == 0u) || (!is_below && point.altitude == altitude_steps)) {
+      continue;
+    }
+    Point cell;
+    auto const size =
+        find_cell({(point.azimuth % azimuth_steps + (is_left ? azimuth_steps - 1u : 0u)) %
+                       azimuth_steps,
+                   is_below ? point.altitude - 1u : point.altitude},
+                  cell);
+    if (size <= edge_size) {
+      continue;
+    }
+    auto const x = (point.azimuth % azimuth_steps + azimuth_steps - cell.azimuth) % azimuth_steps;
+    auto const y = point.altitude - cell.altitude;
+    bool const is_on_side = x == 0u || x == size, is_on_base = y == 0u || y == size;
+    if (is_on_side && !is_on_base) {
+      edge_start = {cell.azimuth + x, cell.altitude};
+      edge_end = {cell.azimuth + x, cell.altitude + size};
+      edge_offset = y;
+    } else if (is_on_base && !is_on_side) {
+      edge_start = {cell.azimuth, cell.altitude + y};
+      edge_end = {cell.azimuth + size, cell.altitude + y};
+      edge_offset = x;
+    } else {
+      continue; // A corner of the cell, or inside it
+    }
+    edge_size = size;
+  }
+  if (edge_size == 0u) {
+    return;
+  }
+
+  constrain_corner(edge_start, is_constrained);
+  constrain_corner(edge_end, is_constrained);
+  float const t = static_cast<float>(edge_offset) / static_cast<float>(edge_size);
+  auto const start = positions.at(get_key(edge_start)) * surface_count;
+  auto const end = positions.at(get_key(edge_end)) * surface_count;
+  for (std::size_t surface = 0; surface < surface_count; ++surface) {
+    corner_pssas[index * surface_count + surface] =
+        (1.f - t) * corner_pssas[start + surface] + t * corner_pssas[end + surface];
+  }
+}
+
+} // namespace Penumbra
@@ -0,0 +1,70 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef SKY_GRID_H_
+#define SKY_GRID_H_
+
+// Standard
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace Penumbra {
+
+// Every surface's PSSA at sun positions on a grid over the sky dome: cells spanning equal angles
+// of azimuth (around the horizon) and altitude (from the horizon to the zenith). PSSAs at other
+// sun positions are interpolated bilinearly from the corners of the cell holding them.
+//
+// Cells whose PSSAs, interpolated at their centers, differ from those calculated there by more
+// than the tolerance are split in four, and their quarters checked in turn, up to a number of
+// refinements. Sun positions are kept on a lattice at the finest refinement, so cells share the
+// positions at their corners. Corners lying on the edge of a larger neighboring cell take the
+// PSSAs interpolated along that edge, so interpolation is continuous across refinement levels.
+class SkyGrid {
+public:
+  // Every surface's PSSAs at each sun position (azimuth and altitude)
+  using Calculator = std::function<std::vector<std::vector<float>>(
+      const std::vector<std::pair<float, float>> &sun_positions)>;
+
+  SkyGrid(unsigned int azimuth_cells, unsigned int altitude_cells, float tolerance,
+          unsigned int max_refinements, const Calculator &calculate);
+
+  static constexpr float zenith{1.57079633f}; // Altitude, pi/2
+  static constexpr unsigned int max_refinement_count{7u};
+
+  // Altitudes from 0 to the zenith. Azimuths are taken around the horizon.
+  [[nodiscard]] std::vector<float> interpolate(float azimuth, float altitude) const;
+  [[nodiscard]] std::size_t get_sun_position_count() const;
+
+private:
+  unsigned int azimuth_cells, altitude_cells;
+  std::uint32_t scale; // Lattice points along each edge of an unrefined cell
+  std::size_t surface_count{0u};
+  std::vector<float> pssas;        // surface_count by calculated sun position
+  std::vector<float> corner_pssas; // As pssas, but constrained to larger neighbors' edges
+  std::unordered_map<std::uint64_t, std::size_t> positions; // Lattice point to calculated index
+  std::unordered_set<std::uint64_t> split_cells;            // By size and lower left point
+
+  // Lattice points: azimuth (wrapping around) and altitude steps of the finest refinement
+  struct Point {
+    std::uint32_t azimuth, altitude;
+  };
+  [[nodiscard]] std::uint64_t get_key(Point point) const;
+  [[nodiscard]] static std::uint64_t get_cell_key(Point corner, std::uint32_t size);
+  [[nodiscard]] std::pair<float, float> get_sun_position(Point point) const;
+  // Smallest cell holding the finest cell with this lower left point. Returns its size.
+  [[nodiscard]] std::uint32_t find_cell(Point point, Point &cell) const;
+  // PSSAs calculated at a lattice point
+  [[nodiscard]] const float *get_pssas(Point point) const;
+  // Calculates the points not yet calculated
+  void calculate_points(const std::vector<Point> &points, const Calculator &calculate);
+  // Sets the corner PSSAs of a calculated point, and of the corners it is interpolated from
+  void constrain_corner(Point point, std::vector<bool> &is_constrained);
+};
+
+} // namespace Penumbra
+
+#endif // SKY_GRID_H_
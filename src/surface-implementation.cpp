@@ -2,6 +2,12 @@
  * See the LICENSE file for additional terms and conditions. */
 
 // Standard
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <numeric>
 #include <vector>
 #include <array>
 
@@ -12,19 +18,414 @@
 
 namespace Penumbra {
 
-TessData::TessData(const float *array, unsigned number_of_vertices)
-    : number_of_vertices(number_of_vertices) {
-  vertices.insert(vertices.end(), (const float *)array, (const float *)array + number_of_vertices);
+namespace {
+using Point = std::array<double, 2>;
+
+// Twice the signed area of the triangle o, a, b (positive if counterclockwise)
+double cross(const Point &o, const Point &a, const Point &b) {
+  return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+bool is_in_triangle(const Point &a, const Point &b, const Point &c, const Point &point) {
+  double const sides[3] = {cross(a, b, point), cross(b, c, point), cross(c, a, point)};
+  bool const has_negative = sides[0] < 0. || sides[1] < 0. || sides[2] < 0.;
+  bool const has_positive = sides[0] > 0. || sides[1] > 0. || sides[2] > 0.;
+  return !(has_negative && has_positive); // Includes the edges
+}
+
+// Twice the signed area of the contour of points [begin, end)
+double get_area(const std::vector<Point> &points, std::size_t begin, std::size_t end) {
+  double area{0.};
+  for (std::size_t i = begin, j = end - 1u; i < end; j = i++) {
+    area += points[j][0] * points[i][1] - points[i][0] * points[j][1];
+  }
+  return area;
+}
+
+// Appends the contour's vertices, projected onto the plane of the axes
+void project(const Polygon &contour, const std::array<int, 2> &axes, std::vector<Point> &points) {
+  for (std::size_t i = 0; i + 2 < contour.size(); i += TessData::vertex_size) {
+    points.push_back({contour[i + axes[0]], contour[i + axes[1]]});
+  }
+}
+
+// True if the (counterclockwise) contour turns the same way at every vertex, and only once around
+bool is_convex(const std::vector<Point> &points) {
+  std::size_t const count = points.size();
+  int sign_changes[2] = {0, 0};
+  int signs[2] = {0, 0};
+  for (std::size_t i = 0; i < count; ++i) {
+    auto const &previous = points[(i + count - 1u) % count];
+    auto const &next = points[(i + 1u) % count];
+    if (cross(previous, points[i], next) < 0.) {
+      return false;
+    }
+    for (int axis = 0; axis < 2; ++axis) {
+      double const step = next[axis] - points[i][axis];
+      int const sign = (step > 0.) - (step < 0.);
+      if (sign != 0) {
+        sign_changes[axis] += signs[axis] != 0 && sign != signs[axis];
+        signs[axis] = sign;
+      }
+    }
+  }
+  // A single loop reverses direction along each axis twice (the wrap around may hide one)
+  return sign_changes[0] <= 2 && sign_changes[1] <= 2;
+}
+
+// Joins a hole (its vertices in clockwise order) to the (counterclockwise) ring with a bridge from
+// the hole's rightmost vertex to a ring vertex visible from it. The bridge's two edges coincide.
+bool bridge_hole(const std::vector<Point> &points, const std::vector<unsigned int> &hole,
+                 std::vector<unsigned int> &ring) {
+  std::size_t hole_vertex{0u};
+  for (std::size_t i = 1u; i < hole.size(); ++i) {
+    if (points[hole[i]][0] > points[hole[hole_vertex]][0]) {
+      hole_vertex = i;
+    }
+  }
+  Point const &m = points[hole[hole_vertex]];
+
+  // Nearest ring edge crossed by a ray from the hole vertex toward +x
+  double nearest{std::numeric_limits<double>::max()};
+  std::size_t candidate{ring.size()};
+  for (std::size_t i = 0; i < ring.size(); ++i) {
+    Point const &a = points[ring[i]];
+    Point const &b = points[ring[(i + 1u) % ring.size()]];
+    if (a[1] == b[1] || std::min(a[1], b[1]) > m[1] || std::max(a[1], b[1]) < m[1]) {
+      continue;
+    }
+    double const x = a[0] + (m[1] - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+    if (x >= m[0] && x < nearest) {
+      nearest = x;
+      candidate = a[0] > b[0] ? i : (i + 1u) % ring.size();
+    }
+  }
+  if (candidate == ring.size() || nearest == m[0]) {
+    return false; // Outside the ring, or touching it
+  }
+
+  // Unless the ray hits the candidate, ring vertices within the triangle between the ray and the
+  // candidate may block the bridge. The one closest in angle to the ray (then nearest) is visible.
+  Point const crossing{nearest, m[1]};
+  Point const candidate_point = points[ring[candidate]];
+  double best_slope{std::numeric_limits<double>::max()};
+  for (std::size_t i = 0; i < ring.size() && candidate_point != crossing; ++i) {
+    Point const &point = points[ring[i]];
+    if (point == candidate_point || point[0] <= m[0] ||
+        !is_in_triangle(m, crossing, candidate_point, point)) {
+      continue;
+    }
+    double const slope = std::abs(point[1] - m[1]) / (point[0] - m[0]);
+    if (slope < best_slope || (slope == best_slope && point[0] < points[ring[candidate]][0])) {
+      best_slope = slope;
+      candidate = i;
+    }
+  }
+
+  std::vector<unsigned int> bridge;
+  bridge.reserve(hole.size() + 2u);
+  for (std::size_t i = 0; i <= hole.size(); ++i) {
+    bridge.push_back(hole[(hole_vertex + i) % hole.size()]);
+  }
+  bridge.push_back(ring[candidate]);
+  ring.insert(ring.begin() + static_cast<std::ptrdiff_t>(candidate) + 1, bridge.begin(),
+              bridge.end());
+  return true;
+}
+
+// Clips ears off the (counterclockwise) ring, appending their vertices to triangles
+bool clip_ring(const std::vector<Point> &points, const std::vector<unsigned int> &ring,
+               std::vector<unsigned int> &triangles) {
+  std::size_t const count = ring.size();
+  std::vector<std::size_t> previous(count), next(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    previous[i] = (i + count - 1u) % count;
+    next[i] = (i + 1u) % count;
+  }
+  auto const is_ear = [&](std::size_t vertex) {
+    unsigned int const corners[3] = {ring[previous[vertex]], ring[vertex], ring[next[vertex]]};
+    Point const &a = points[corners[0]], &b = points[corners[1]], &c = points[corners[2]];
+    if (cross(a, b, c) <= 0.) {
+      return false;
+    }
+    for (auto i = next[next[vertex]]; i != previous[vertex]; i = next[i]) {
+      if (ring[i] != corners[0] && ring[i] != corners[1] && ring[i] != corners[2] &&
+          is_in_triangle(a, b, c, points[ring[i]])) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  std::size_t vertex{0u}, remaining{count}, misses{0u};
+  while (remaining > 3u) {
+    unsigned int const corners[3] = {ring[previous[vertex]], ring[vertex], ring[next[vertex]]};
+    double const area = cross(points[corners[0]], points[corners[1]], points[corners[2]]);
+    // Vertices between collinear neighbors are dropped without a triangle
+    if (area == 0. || is_ear(vertex)) {
+      if (area != 0.) {
+        triangles.insert(triangles.end(), corners, corners + 3);
+      }
+      next[previous[vertex]] = next[vertex];
+      previous[next[vertex]] = previous[vertex];
+      vertex = next[vertex];
+      --remaining;
+      misses = 0u;
+    } else if (++misses > remaining) {
+      return false; // No ears left, e.g., in a self-intersecting ring
+    } else {
+      vertex = next[vertex];
+    }
+  }
+  triangles.insert(triangles.end(), {ring[previous[vertex]], ring[vertex], ring[next[vertex]]});
+  return true;
+}
+} // namespace
+
+Tessellator::Tessellator() { reset(); }
+
+Tessellator::~Tessellator() {
+  if (tess) {
+    tessDeleteTess(tess);
+  }
+}
+
+void Tessellator::reset() {
+  if (tess) {
+    tessDeleteTess(tess);
+  }
+  block_index = 0u;
+  offset = 0u;
+  TESSalloc allocator{};
+  allocator.memalloc = &Tessellator::allocate;
+  allocator.memrealloc = &Tessellator::reallocate;
+  allocator.memfree = &Tessellator::free;
+  allocator.userData = this;
+  // Buckets sized for surfaces with tens of vertices (rather than hundreds, the defaults), as
+  // each bucket's free list is built when it is allocated
+  allocator.meshEdgeBucketSize = 64;
+  allocator.meshVertexBucketSize = 64;
+  allocator.meshFaceBucketSize = 32;
+  allocator.dictNodeBucketSize = 32;
+  allocator.regionBucketSize = 32;
+  tess = tessNewTess(&allocator);
+  base_block = block_index;
+  base_offset = offset;
+}
+
+TESStesselator *Tessellator::begin() {
+  block_index = base_block;
+  offset = base_offset;
+  return tess;
+}
+
+void *Tessellator::allocate(std::size_t size) {
+  // Each allocation is preceded by its size (for reallocation), keeping the alignment of malloc
+  static constexpr std::size_t alignment{alignof(std::max_align_t)};
+  std::size_t const total_size = (sizeof(std::max_align_t) + size + alignment - 1u) / alignment *
+                                 alignment;
+  for (; block_index < blocks.size(); ++block_index, offset = 0u) {
+    if (offset + total_size <= blocks[block_index].size) {
+      break;
+    }
+  }
+  if (block_index == blocks.size()) {
+    std::size_t const new_block_size = std::max(block_size, total_size);
+    auto *data = new (std::nothrow) std::max_align_t[new_block_size / sizeof(std::max_align_t)];
+    if (!data) {
+      return nullptr; // libtess2 reports running out of memory as a failed tessellation
+    }
+    blocks.push_back({std::unique_ptr<std::max_align_t[]>(data), new_block_size});
+    offset = 0u;
+  }
+  auto *header = reinterpret_cast<std::byte *>(blocks[block_index].data.get()) + offset;
+  offset += total_size;
+  *reinterpret_cast<std::size_t *>(header) = size;
+  return header + sizeof(std::max_align_t);
+}
+
+void *Tessellator::allocate(void *arena, unsigned int size) {
+  return static_cast<Tessellator *>(arena)->allocate(size);
+}
+
+void *Tessellator::reallocate(void *arena, void *pointer, unsigned int size) {
+  void *reallocated = allocate(arena, size);
+  if (pointer && reallocated) {
+    auto *header = static_cast<std::byte *>(pointer) - sizeof(std::max_align_t);
+    std::size_t const previous_size = *reinterpret_cast<std::size_t *>(header);
+    std::memcpy(reallocated, pointer, std::min(previous_size, static_cast<std::size_t>(size)));
+  }
+  return reallocated;
+}
+
+void Tessellator::free(void *, void *) {
+  // Memory is reclaimed when the arena is rewound
 }
 
 SurfaceImplementation::SurfaceImplementation(Polygon polygon) : polygon(std::move(polygon)) {}
 
-TessData SurfaceImplementation::tessellate() {
-  TESStesselator *tess = tessNewTess(nullptr);
+void SurfaceImplementation::classify() {
+  triangulation = Triangulation::tessellator;
+  std::size_t const vertex_count = polygon.size() / TessData::vertex_size;
+  std::size_t total_vertex_count{vertex_count};
+  for (auto const &hole : holes) {
+    if (hole.size() / TessData::vertex_size < 3u) {
+      return;
+    }
+    total_vertex_count += hole.size() / TessData::vertex_size;
+  }
+  if (vertex_count < 3u || total_vertex_count > max_ear_clipping_vertices) {
+    return;
+  }
+
+  // Project onto the coordinate plane most nearly parallel to the polygon (by Newell's method),
+  // with the axes ordered so the polygon winds counterclockwise
+  double normal[3] = {0., 0., 0.};
+  for (std::size_t i = 0; i < vertex_count; ++i) {
+    const float *a = &polygon[i * TessData::vertex_size];
+    const float *b = &polygon[(i + 1u) % vertex_count * TessData::vertex_size];
+    normal[0] += (double(a[1]) - b[1]) * (double(a[2]) + b[2]);
+    normal[1] += (double(a[2]) - b[2]) * (double(a[0]) + b[0]);
+    normal[2] += (double(a[0]) - b[0]) * (double(a[1]) + b[1]);
+  }
+  int const normal_axis = static_cast<int>(
+      std::max_element(normal, normal + 3,
+                       [](double a, double b) { return std::abs(a) < std::abs(b); }) -
+      normal);
+  if (normal[normal_axis] == 0.) {
+    return; // Degenerate
+  }
+  projection_axes = {(normal_axis + 1) % 3, (normal_axis + 2) % 3};
+  if (normal[normal_axis] < 0.) {
+    std::swap(projection_axes[0], projection_axes[1]);
+  }
+
+  std::vector<Point> points;
+  project(polygon, projection_axes, points);
+  for (std::size_t i = 0; i < vertex_count; ++i) {
+    if (points[i] == points[(i + 1u) % vertex_count]) {
+      return; // Repeated vertices are left to libtess2, which merges them
+    }
+  }
+  triangulation = holes.empty() && is_convex(points) ? Triangulation::fan
+                                                     : Triangulation::ear_clipping;
+}
+
+Polygon SurfaceImplementation::transform_contour(const Polygon &contour) const {
+  if (!is_transformed) {
+    return contour;
+  }
+  Polygon transformed(contour.size());
+  for (std::size_t i = 0; i + 2 < contour.size(); i += TessData::vertex_size) {
+    transform_point(&contour[i], &transformed[i]);
+  }
+  return transformed;
+}
+
+void SurfaceImplementation::transform_point(const float *point, float *transformed) const {
+  for (int row = 0; row < 3; ++row) {
+    transformed[row] = transform[row] * point[0] + transform[4 + row] * point[1] +
+                       transform[8 + row] * point[2] + transform[12 + row];
+  }
+}
+
+bool SurfaceImplementation::clip_ears(TessData &data) const {
+  std::vector<Point> points;
+  project(polygon, projection_axes, points);
+  double const polygon_area = get_area(points, 0u, points.size());
+  if (polygon_area <= 0.) {
+    return false;
+  }
+  std::vector<unsigned int> ring(points.size());
+  std::iota(ring.begin(), ring.end(), 0u);
+
+  // Holes are walked clockwise, and bridged from right to left so that each bridge stays clear
+  // of the holes bridged after it
+  double expected_area{polygon_area};
+  std::vector<std::vector<unsigned int>> hole_rings;
+  for (auto const &hole : holes) {
+    auto const begin = static_cast<unsigned int>(points.size());
+    project(hole, projection_axes, points);
+    double const hole_area = get_area(points, begin, points.size());
+    if (hole_area == 0.) {
+      return false;
+    }
+    expected_area -= std::abs(hole_area);
+    auto &hole_ring = hole_rings.emplace_back(points.size() - begin);
+    std::iota(hole_ring.begin(), hole_ring.end(), begin);
+    if (hole_area > 0.) {
+      std::reverse(hole_ring.begin(), hole_ring.end());
+    }
+  }
+  auto const get_right = [&](const std::vector<unsigned int> &hole_ring) {
+    double right{-std::numeric_limits<double>::max()};
+    for (auto const vertex : hole_ring) {
+      right = std::max(points[vertex][0], right);
+    }
+    return right;
+  };
+  std::sort(hole_rings.begin(), hole_rings.end(),
+            [&](const std::vector<unsigned int> &a, const std::vector<unsigned int> &b) {
+              return get_right(a) > get_right(b);
+            });
+  for (auto const &hole_ring : hole_rings) {
+    if (!bridge_hole(points, hole_ring, ring)) {
+      return false;
+    }
+  }
+
+  std::vector<unsigned int> triangles;
+  triangles.reserve(3u * ring.size());
+  if (!clip_ring(points, ring, triangles)) {
+    return false;
+  }
+
+  // Overlapping triangles (from self-intersecting or overlapping contours) cover too much area
+  double area{0.};
+  for (std::size_t i = 0; i < triangles.size(); i += 3u) {
+    area += cross(points[triangles[i]], points[triangles[i + 1u]], points[triangles[i + 2u]]);
+  }
+  static constexpr double relative_tolerance{1e-6};
+  if (std::abs(area - expected_area) > relative_tolerance * polygon_area) {
+    return false;
+  }
+
+  // Vertices are numbered as projected: the polygon's, then each hole's
+  auto const append = [&](const Polygon &contour) {
+    data.vertices.insert(data.vertices.end(), contour.begin(),
+                         contour.begin() + static_cast<std::ptrdiff_t>(
+                                               contour.size() / TessData::vertex_size *
+                                               TessData::vertex_size));
+  };
+  append(polygon);
+  for (auto const &hole : holes) {
+    append(hole);
+  }
+  data.indices.insert(data.indices.end(), triangles.begin(), triangles.end());
+  return true;
+}
+
+bool SurfaceImplementation::tessellate(Tessellator &tessellator, TessData &data) const {
+  if (polygon.empty()) {
+    return true; // Removed from the model
+  }
+  if (triangulation == Triangulation::fan) {
+    auto const count = static_cast<unsigned int>(polygon.size() / TessData::vertex_size);
+    data.vertices.insert(data.vertices.end(), polygon.begin(),
+                         polygon.begin() + count * TessData::vertex_size);
+    for (unsigned int i = 1u; i + 1u < count; ++i) {
+      data.indices.insert(data.indices.end(), {0u, i, i + 1u});
+    }
+    return true;
+  }
+  if (triangulation == Triangulation::ear_clipping && clip_ears(data)) {
+    return true;
+  }
+
+  TESStesselator *tess = tessellator.begin();
 
   if (!tess) {
-    throw PenumbraException(fmt::format("Unable to create tessellator for surface, \"{}\".", name),
-                            *logger);
+    return false;
   }
 
   // Add primary polygon
@@ -39,27 +440,18 @@ TessData SurfaceImplementation::tessellate() {
 
   if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_POLYGONS, TessData::polygon_size,
                      TessData::vertex_size, nullptr)) {
-    throw PenumbraException(fmt::format("Unable to tessellate surface, \"{}\".", name), *logger);
+    tessellator.reset();
+    return false;
   }
 
-  // For now convert to glDrawArrays() style of vertices, sometime may change to glDrawElements
-  // (with element buffers)
-  std::vector<float> vertex_array;
+  // Each vertex is output once, however many triangles share it
   const TESSreal *vertices = tessGetVertices(tess);
-  const int number_of_elements = tessGetElementCount(tess);
   const TESSindex *elements = tessGetElements(tess);
-  for (int i = 0; i < number_of_elements * TessData::polygon_size; ++i) {
-    const int vertex = *(elements + i);
-    for (int j = 0; j < TessData::vertex_size; ++j) {
-      vertex_array.push_back(vertices[vertex * TessData::vertex_size + j]);
-    }
-  }
-
-  TessData data(&vertex_array[0], static_cast<unsigned int>(vertex_array.size()));
-
-  tessDeleteTess(tess);
-
-  return data;
+  data.vertices.insert(data.vertices.end(), vertices,
+                       vertices + tessGetVertexCount(tess) * TessData::vertex_size);
+  data.indices.insert(data.indices.end(), elements,
+                      elements + tessGetElementCount(tess) * TessData::polygon_size);
+  return true;
 }
 
 } // namespace Penumbra
@@ -5,6 +5,8 @@
 #define SURFACE_IMPLEMENTATION_H_
 
 // Standard
+#include <cstddef>
+#include <memory>
 #include <vector>
 #include <array>
 
@@ -14,23 +16,79 @@
 
 namespace Penumbra {
 
+// Triangles of tessellated surfaces. Each tessellation appends a surface's distinct vertices and
+// its triangles, which index them relative to the surface's first vertex.
 struct TessData {
-  TessData(const float *array, unsigned int number_of_vertices);
-  std::vector<float> vertices;
-  unsigned int number_of_vertices;
-  static const int polygon_size{3}; // making triangles
-  static const int vertex_size{3};  // i.e., 3D
+  std::vector<float> vertices;       // vertex_size coordinates each
+  std::vector<unsigned int> indices; // polygon_size per triangle
+  static const int polygon_size{3};  // making triangles
+  static const int vertex_size{3};   // i.e., 3D
+};
+
+// A libtess2 tessellator reused for many surfaces. Its allocations come from an arena of blocks
+// that is rewound before each surface rather than freed piece by piece, so after the first few
+// surfaces tessellation allocates no memory. Not thread safe: use one per thread.
+class Tessellator {
+public:
+  Tessellator();
+  ~Tessellator();
+  Tessellator(const Tessellator &) = delete;
+  Tessellator &operator=(const Tessellator &) = delete;
+
+  // The tessellator with the arena rewound, or nullptr if it could not be created. Results of
+  // the previous tessellation are no longer valid.
+  TESStesselator *begin();
+  // Replaces the tessellator after a failed tessellation, which may leave its mesh behind
+  void reset();
+
+private:
+  static constexpr std::size_t block_size{1u << 20u};
+  struct Block {
+    std::unique_ptr<std::max_align_t[]> data;
+    std::size_t size; // In bytes
+  };
+  std::vector<Block> blocks;
+  std::size_t block_index{0u}, offset{0u};     // Next allocation
+  std::size_t base_block{0u}, base_offset{0u}; // First allocation after the tessellator itself
+  TESStesselator *tess{nullptr};
+
+  void *allocate(std::size_t size);
+  static void *allocate(void *arena, unsigned int size);
+  static void *reallocate(void *arena, void *pointer, unsigned int size);
+  static void free(void *arena, void *pointer);
 };
 
 class SurfaceImplementation {
 public:
   SurfaceImplementation() = default;
   explicit SurfaceImplementation(Polygon polygon);
-  TessData tessellate();
+  // Chooses how the polygon and holes are triangulated. Called once they are complete.
+  void classify();
+  // Appends the surface's triangles to data. Returns false if tessellation fails.
+  [[nodiscard]] bool tessellate(Tessellator &tessellator, TessData &data) const;
+  // The contour (the polygon or a hole) moved by the transform, into model coordinates
+  [[nodiscard]] Polygon transform_contour(const Polygon &contour) const;
+  void transform_point(const float *point, float *transformed) const;
   Polygon polygon;
   std::vector<Polygon> holes;
   std::shared_ptr<Courierr::Courierr> logger;
   std::string name;
+  // Column-major transform from the polygon's coordinates to the model's. Once given one, a
+  // surface keeps its own vertices in the model (shared with no other surface), so it may move
+  // without being tessellated again.
+  std::array<float, 16> transform{1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f,
+                                  0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f};
+  bool is_transformed{false};
+
+private:
+  // Convex polygons without holes are split into a fan of triangles from their first vertex.
+  // Other polygons (and holes) with few vertices are clipped ear by ear, falling back to libtess2
+  // if that fails. libtess2 handles the rest (large, degenerate, or unclassified polygons).
+  enum class Triangulation { fan, ear_clipping, tessellator };
+  Triangulation triangulation{Triangulation::tessellator};
+  static constexpr std::size_t max_ear_clipping_vertices{256};
+  std::array<int, 2> projection_axes{0, 1}; // Plane the contours are classified and clipped in
+  bool clip_ears(TessData &data) const;
 };
 
 } // namespace Penumbra
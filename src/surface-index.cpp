@@ -0,0 +1,221 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <cmath>
+
+// Penumbra
+#include "context.h"
+#include "surface-index.h"
+
+namespace Penumbra {
+
+void SurfaceIndex::clear() {
+  nodes.clear();
+  parents.clear();
+  surfaces.clear();
+  surface_boxes.clear();
+  surface_leaves.clear();
+}
+
+void SurfaceIndex::set_surface_box(const unsigned int surface_index,
+                                   const std::vector<float> &vertices,
+                                   const std::vector<unsigned int> &indices,
+                                   const SurfaceBuffer &surface_buffer) {
+  Box &box = surface_boxes[surface_index];
+  std::fill(&box.bounds[0][0], &box.bounds[0][0] + 3, MAX_FLOAT);
+  std::fill(&box.bounds[1][0], &box.bounds[1][0] + 3, -MAX_FLOAT);
+  for (unsigned int vertex = surface_buffer.begin;
+       vertex < surface_buffer.begin + surface_buffer.count; ++vertex) {
+    for (int axis = 0; axis < 3; ++axis) {
+      float const coordinate = vertices[3u * indices[vertex] + static_cast<unsigned int>(axis)];
+      box.bounds[0][axis] = std::min(coordinate, box.bounds[0][axis]);
+      box.bounds[1][axis] = std::max(coordinate, box.bounds[1][axis]);
+    }
+  }
+}
+
+void SurfaceIndex::build(const std::vector<float> &vertices,
+                         const std::vector<unsigned int> &indices,
+                         const std::vector<SurfaceBuffer> &surface_buffers) {
+  clear();
+  surface_boxes.resize(surface_buffers.size());
+  surface_leaves.assign(surface_buffers.size(), no_node);
+  for (std::size_t i = 0; i < surface_buffers.size(); ++i) {
+    auto const &surface_buffer = surface_buffers[i];
+    if (surface_buffer.count == 0u) {
+      continue; // Nothing to draw
+    }
+    set_surface_box(static_cast<unsigned int>(i), vertices, indices, surface_buffer);
+    surfaces.push_back(static_cast<unsigned int>(i));
+  }
+
+  if (!surfaces.empty()) {
+    nodes.reserve(2u * surfaces.size());
+    parents.reserve(2u * surfaces.size());
+    build_node(0u, surfaces.size(), no_node);
+  }
+}
+
+void SurfaceIndex::update(const std::vector<float> &vertices,
+                          const std::vector<unsigned int> &indices,
+                          const std::vector<SurfaceBuffer> &surface_buffers,
+                          const std::vector<unsigned int> &changed_surfaces) {
+  for (auto const surface_index : changed_surfaces) {
+    if (surface_leaves[surface_index] == no_node && surface_buffers[surface_index].count > 0u) {
+      build(vertices, indices, surface_buffers);
+      return;
+    }
+  }
+
+  for (auto const surface_index : changed_surfaces) {
+    auto node_index = surface_leaves[surface_index];
+    if (node_index == no_node) {
+      continue;
+    }
+    set_surface_box(surface_index, vertices, indices, surface_buffers[surface_index]);
+    for (; node_index != no_node; node_index = parents[node_index]) {
+      Node &node = nodes[node_index];
+      Box box{{{MAX_FLOAT, MAX_FLOAT, MAX_FLOAT}, {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT}}};
+      auto const merge = [&](const Box &other) {
+        for (int axis = 0; axis < 3; ++axis) {
+          box.bounds[0][axis] = std::min(other.bounds[0][axis], box.bounds[0][axis]);
+          box.bounds[1][axis] = std::max(other.bounds[1][axis], box.bounds[1][axis]);
+        }
+      };
+      if (node.count > 0u) {
+        for (auto i = node.offset; i < node.offset + node.count; ++i) {
+          merge(surface_boxes[surfaces[i]]);
+        }
+      } else {
+        merge(nodes[node_index + 1u].box);
+        merge(nodes[node.offset].box);
+      }
+      node.box = box;
+    }
+  }
+}
+
+std::uint32_t SurfaceIndex::build_node(const std::size_t begin, const std::size_t end,
+                                       const std::uint32_t parent) {
+  auto const node_index = static_cast<std::uint32_t>(nodes.size());
+  nodes.emplace_back();
+  parents.push_back(parent);
+
+  Box box{{{MAX_FLOAT, MAX_FLOAT, MAX_FLOAT}, {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT}}};
+  float centroid_bounds[2][3] = {{MAX_FLOAT, MAX_FLOAT, MAX_FLOAT},
+                                 {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT}};
+  for (std::size_t i = begin; i < end; ++i) {
+    const Box &surface_box = surface_boxes[surfaces[i]];
+    for (int axis = 0; axis < 3; ++axis) {
+      box.bounds[0][axis] = std::min(surface_box.bounds[0][axis], box.bounds[0][axis]);
+      box.bounds[1][axis] = std::max(surface_box.bounds[1][axis], box.bounds[1][axis]);
+      float const centroid = 0.5f * (surface_box.bounds[0][axis] + surface_box.bounds[1][axis]);
+      centroid_bounds[0][axis] = std::min(centroid, centroid_bounds[0][axis]);
+      centroid_bounds[1][axis] = std::max(centroid, centroid_bounds[1][axis]);
+    }
+  }
+  nodes[node_index].box = box;
+
+  auto const count = end - begin;
+  if (count <= max_leaf_size) {
+    nodes[node_index].offset = static_cast<std::uint32_t>(begin);
+    nodes[node_index].count = static_cast<std::uint32_t>(count);
+    for (std::size_t i = begin; i < end; ++i) {
+      surface_leaves[surfaces[i]] = node_index;
+    }
+    return node_index;
+  }
+
+  // Split at the median centroid along the axis where centroids are most spread out
+  int split_axis{0};
+  for (int axis = 1; axis < 3; ++axis) {
+    if (centroid_bounds[1][axis] - centroid_bounds[0][axis] >
+        centroid_bounds[1][split_axis] - centroid_bounds[0][split_axis]) {
+      split_axis = axis;
+    }
+  }
+  auto const first = surfaces.begin() + static_cast<std::ptrdiff_t>(begin);
+  auto const middle = first + static_cast<std::ptrdiff_t>(count / 2u);
+  std::nth_element(first, middle, surfaces.begin() + static_cast<std::ptrdiff_t>(end),
+                   [&](unsigned int a, unsigned int b) {
+                     const Box &box_a = surface_boxes[a];
+                     const Box &box_b = surface_boxes[b];
+                     return box_a.bounds[0][split_axis] + box_a.bounds[1][split_axis] <
+                            box_b.bounds[0][split_axis] + box_b.bounds[1][split_axis];
+                   });
+
+  build_node(begin, begin + count / 2u, node_index);
+  auto const second_child = build_node(begin + count / 2u, end, node_index);
+  nodes[node_index].offset = second_child;
+  nodes[node_index].count = 0u;
+  return node_index;
+}
+
+template <typename Predicate>
+void SurfaceIndex::find(Predicate overlaps, std::vector<unsigned int> &surface_indices) const {
+  surface_indices.clear();
+  if (nodes.empty()) {
+    return;
+  }
+
+  std::vector<std::uint32_t> stack{0u};
+  while (!stack.empty()) {
+    auto const node_index = stack.back();
+    stack.pop_back();
+    const Node &node = nodes[node_index];
+    if (is_empty(node.box) || !overlaps(node.box)) {
+      continue;
+    }
+    if (node.count > 0u) {
+      for (auto i = node.offset; i < node.offset + node.count; ++i) {
+        const Box &box = surface_boxes[surfaces[i]];
+        if (node.count == 1u || (!is_empty(box) && overlaps(box))) {
+          surface_indices.push_back(surfaces[i]);
+        }
+      }
+    } else {
+      stack.push_back(node.offset);
+      stack.push_back(node_index + 1u);
+    }
+  }
+}
+
+void SurfaceIndex::find_surfaces(const mat4x4 view, const float (&bounds)[2][3],
+                                 std::vector<unsigned int> &surface_indices) const {
+  // Compare each box's extents in view coordinates (a conservative test)
+  auto const overlaps = [&](const Box &box) {
+    for (int view_axis = 0; view_axis < 3; ++view_axis) {
+      float center{0.f}, half_size{0.f};
+      for (int axis = 0; axis < 3; ++axis) {
+        center += view[axis][view_axis] * 0.5f * (box.bounds[0][axis] + box.bounds[1][axis]);
+        half_size +=
+            std::abs(view[axis][view_axis]) * 0.5f * (box.bounds[1][axis] - box.bounds[0][axis]);
+      }
+      if (center - half_size > bounds[1][view_axis] ||
+          center + half_size < bounds[0][view_axis]) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  find(overlaps, surface_indices);
+  std::sort(surface_indices.begin(), surface_indices.end());
+}
+
+void SurfaceIndex::find_surfaces_in_front(const std::array<float, 3> &normal,
+                                          const float offset,
+                                          std::vector<unsigned int> &surface_indices) const {
+  auto const overlaps = [&](const Box &box) {
+    float distance{-offset};
+    for (int axis = 0; axis < 3; ++axis) {
+      distance += normal[axis] * box.bounds[normal[axis] > 0.f ? 1 : 0][axis];
+    }
+    return distance > 0.f;
+  };
+  find(overlaps, surface_indices);
+}
+
+} // namespace Penumbra
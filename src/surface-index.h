@@ -0,0 +1,79 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef SURFACE_INDEX_H_
+#define SURFACE_INDEX_H_
+
+// Standard
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Vendor
+#include <linmath.h> // Part of GLFW
+
+namespace Penumbra {
+
+class SurfaceBuffer;
+
+// Bounding volume hierarchy over the bounding boxes of the model's surfaces, used to find the
+// surfaces that may appear in a view without visiting every surface.
+class SurfaceIndex {
+public:
+  void build(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+             const std::vector<SurfaceBuffer> &surface_buffers);
+  // Refits the boxes of the changed surfaces and the nodes above them, keeping the hierarchy.
+  // Builds the index again if a changed surface was left out of it (having had no triangles).
+  void update(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+              const std::vector<SurfaceBuffer> &surface_buffers,
+              const std::vector<unsigned int> &changed_surfaces);
+  void clear();
+
+  // Finds the surfaces whose bounding boxes may overlap the bounds (minimum and maximum corners)
+  // in the view's coordinates, ignoring the view's translation. Surfaces are found in model
+  // order.
+  void find_surfaces(const mat4x4 view, const float (&bounds)[2][3],
+                     std::vector<unsigned int> &surface_indices) const;
+
+  // Finds the surfaces whose bounding boxes extend beyond the plane normal . x = offset, on the
+  // side the normal points to. Surfaces are found in no particular order.
+  void find_surfaces_in_front(const std::array<float, 3> &normal, float offset,
+                              std::vector<unsigned int> &surface_indices) const;
+
+private:
+  static constexpr unsigned int max_leaf_size{4u};
+
+  struct Box {
+    float bounds[2][3]; // Minimum and maximum corners
+  };
+  // Boxes of surfaces that lost their triangles (and nodes holding only those) contain nothing
+  static bool is_empty(const Box &box) {
+    return box.bounds[0][0] > box.bounds[1][0];
+  }
+  struct Node {
+    Box box;
+    std::uint32_t offset; // First surface of leaves, or second child of interior nodes (the first
+                          // child follows its parent)
+    std::uint32_t count;  // Number of surfaces, or zero for interior nodes
+  };
+  static constexpr std::uint32_t no_node{~0u};
+  std::vector<Node> nodes;
+  std::vector<std::uint32_t> parents;   // By node. No node for the root.
+  std::vector<unsigned int> surfaces;   // Surface indices, ordered by leaf
+  std::vector<Box> surface_boxes;
+  std::vector<std::uint32_t> surface_leaves; // By surface. No node for surfaces left out.
+
+  // Empty (matching nothing) for surfaces without triangles
+  void set_surface_box(unsigned int surface_index, const std::vector<float> &vertices,
+                       const std::vector<unsigned int> &indices,
+                       const SurfaceBuffer &surface_buffer);
+  std::uint32_t build_node(std::size_t begin, std::size_t end, std::uint32_t parent);
+
+  // Surfaces whose boxes overlap, skipping nodes whose boxes do not
+  template <typename Predicate>
+  void find(Predicate overlaps, std::vector<unsigned int> &surface_indices) const;
+};
+
+} // namespace Penumbra
+
+#endif // SURFACE_INDEX_H_
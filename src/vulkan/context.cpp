@@ -0,0 +1,816 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Vendor
+#include <fmt/format.h>
+
+// Penumbra
+#include <penumbra/logging.h>
+#include "vulkan/context.h"
+
+namespace Penumbra {
+
+// SPIR-V of the following vertex shader. Depths are only compared between surfaces drawn with the
+// same MVP, so the position is invariant across the depth and count pipelines.
+//   #version 450
+//   layout(push_constant) uniform View { mat4 MVP; };
+//   layout(location = 0) in vec3 vPos;
+//   invariant gl_Position;
+//   void main() { gl_Position = MVP * vec4(vPos, 1.0); }
+const std::uint32_t VulkanContext::calculation_vertex_shader_code[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x0000001c, 0x00000000, 0x00020011,
+    0x00000001, 0x0003000e, 0x00000000, 0x00000001, 0x0007000f, 0x00000000,
+    0x00000001, 0x6e69616d, 0x00000000, 0x00000002, 0x00000003, 0x00030047,
+    0x00000004, 0x00000002, 0x00040048, 0x00000004, 0x00000000, 0x00000005,
+    0x00050048, 0x00000004, 0x00000000, 0x00000023, 0x00000000, 0x00050048,
+    0x00000004, 0x00000000, 0x00000007, 0x00000010, 0x00040047, 0x00000002,
+    0x0000001e, 0x00000000, 0x00030047, 0x00000005, 0x00000002, 0x00050048,
+    0x00000005, 0x00000000, 0x0000000b, 0x00000000, 0x00040048, 0x00000005,
+    0x00000000, 0x00000012, 0x00020013, 0x00000006, 0x00030021, 0x00000007,
+    0x00000006, 0x00030016, 0x00000008, 0x00000020, 0x00040017, 0x00000009,
+    0x00000008, 0x00000003, 0x00040017, 0x0000000a, 0x00000008, 0x00000004,
+    0x00040018, 0x0000000b, 0x0000000a, 0x00000004, 0x0003001e, 0x00000004,
+    0x0000000b, 0x00040020, 0x0000000c, 0x00000009, 0x00000004, 0x0004003b,
+    0x0000000c, 0x0000000d, 0x00000009, 0x00040015, 0x0000000e, 0x00000020,
+    0x00000001, 0x0004002b, 0x0000000e, 0x0000000f, 0x00000000, 0x00040020,
+    0x00000010, 0x00000009, 0x0000000b, 0x00040020, 0x00000011, 0x00000001,
+    0x00000009, 0x0004003b, 0x00000011, 0x00000002, 0x00000001, 0x0004002b,
+    0x00000008, 0x00000012, 0x3f800000, 0x0003001e, 0x00000005, 0x0000000a,
+    0x00040020, 0x00000013, 0x00000003, 0x00000005, 0x0004003b, 0x00000013,
+    0x00000003, 0x00000003, 0x00040020, 0x00000014, 0x00000003, 0x0000000a,
+    0x00050036, 0x00000006, 0x00000001, 0x00000000, 0x00000007, 0x000200f8,
+    0x00000015, 0x00050041, 0x00000010, 0x00000016, 0x0000000d, 0x0000000f,
+    0x0004003d, 0x0000000b, 0x00000017, 0x00000016, 0x0004003d, 0x00000009,
+    0x00000018, 0x00000002, 0x00050050, 0x0000000a, 0x00000019, 0x00000018,
+    0x00000012, 0x00050091, 0x0000000a, 0x0000001a, 0x00000017, 0x00000019,
+    0x00050041, 0x00000014, 0x0000001b, 0x00000003, 0x0000000f, 0x0003003e,
+    0x0000001b, 0x0000001a, 0x000100fd, 0x00010038,
+};
+
+const std::size_t VulkanContext::calculation_vertex_shader_size =
+    sizeof(VulkanContext::calculation_vertex_shader_code);
+
+VulkanContext::VulkanContext(int size_in, ThreadPool &thread_pool_in, Courierr::Courierr *logger_in)
+    : Context(size_in, logger_in), thread_pool(thread_pool_in),
+      targets(thread_pool.get_slot_count()) {
+  device = VulkanDevice::create(logger);
+  if (!device) {
+    throw PenumbraException("Unable to find a Vulkan device supporting precise occlusion queries.",
+                            *logger);
+  }
+
+  auto const &limits = device->get_limits();
+  max_target_size = std::min({limits.maxFramebufferWidth, limits.maxFramebufferHeight,
+                              limits.maxImageDimension2D, limits.maxViewportDimensions[0],
+                              limits.maxViewportDimensions[1]});
+  buffer_size = std::min(static_cast<std::uint32_t>(size), max_target_size);
+  if (static_cast<std::uint32_t>(size) > buffer_size) {
+    logger->info(
+        fmt::format("The selected resolution, {}, is larger than the maximum allowable by your "
+                    "hardware, {}. Surfaces will be rendered at the maximum resolution.",
+                    size, buffer_size));
+  }
+
+  create_pipelines();
+
+  command_pools.resize(thread_pool.get_slot_count());
+  VkCommandPoolCreateInfo pool_info{};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  pool_info.queueFamilyIndex = device->get_queue_family_index();
+  for (auto &command_pool : command_pools) {
+    device->check(vkCreateCommandPool(device->get(), &pool_info, nullptr, &command_pool),
+                  "create a command pool");
+  }
+  create_submission(submission);
+  create_submission(view_submission);
+  for (auto &set : queue_ring) {
+    create_submission(set);
+  }
+}
+
+VulkanContext::~VulkanContext() {
+  auto const vulkan_device = device->get();
+  vkDeviceWaitIdle(vulkan_device);
+  destroy_submission(submission);
+  destroy_submission(view_submission);
+  for (auto &set : queue_ring) {
+    destroy_submission(set);
+  }
+  for (auto const command_pool : command_pools) {
+    vkDestroyCommandPool(vulkan_device, command_pool, nullptr);
+  }
+  for (auto &target : targets) {
+    destroy(target);
+  }
+  destroy(shared_depth_target);
+  device->destroy(vertex_buffer);
+  device->destroy(index_buffer);
+  vkDestroyPipeline(vulkan_device, depth_pipeline, nullptr);
+  vkDestroyPipeline(vulkan_device, count_pipeline, nullptr);
+  vkDestroyPipelineLayout(vulkan_device, pipeline_layout, nullptr);
+  vkDestroyRenderPass(vulkan_device, render_pass, nullptr);
+}
+
+bool VulkanContext::is_supported() {
+  return VulkanDevice::create() != nullptr;
+}
+
+void VulkanContext::create_pipelines() {
+  auto const vulkan_device = device->get();
+
+  // Depth only: surfaces are drawn into a cleared depth buffer, and receivers then counted
+  VkAttachmentDescription depth_attachment{};
+  depth_attachment.format = device->get_depth_format();
+  depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  VkAttachmentReference depth_reference{0u, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.pDepthStencilAttachment = &depth_reference;
+  // Each render pass clears the depth buffer the previous one (on the same queue) tested against
+  VkSubpassDependency dependency{};
+  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.dstSubpass = 0u;
+  dependency.srcStageMask =
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependency.dstStageMask = dependency.srcStageMask;
+  dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependency.dstAccessMask =
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  VkRenderPassCreateInfo render_pass_info{};
+  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  render_pass_info.attachmentCount = 1u;
+  render_pass_info.pAttachments = &depth_attachment;
+  render_pass_info.subpassCount = 1u;
+  render_pass_info.pSubpasses = &subpass;
+  render_pass_info.dependencyCount = 1u;
+  render_pass_info.pDependencies = &dependency;
+  device->check(vkCreateRenderPass(vulkan_device, &render_pass_info, nullptr, &render_pass),
+                "create a render pass");
+
+  VkPushConstantRange push_constant_range{VK_SHADER_STAGE_VERTEX_BIT, 0u, sizeof(mat4x4)};
+  VkPipelineLayoutCreateInfo layout_info{};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.pushConstantRangeCount = 1u;
+  layout_info.pPushConstantRanges = &push_constant_range;
+  device->check(vkCreatePipelineLayout(vulkan_device, &layout_info, nullptr, &pipeline_layout),
+                "create a pipeline layout");
+
+  VkShaderModuleCreateInfo module_info{};
+  module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  module_info.codeSize = calculation_vertex_shader_size;
+  module_info.pCode = calculation_vertex_shader_code;
+  VkShaderModule vertex_module;
+  device->check(vkCreateShaderModule(vulkan_device, &module_info, nullptr, &vertex_module),
+                "create a shader module");
+
+  // No fragment shader: only depths are written
+  VkPipelineShaderStageCreateInfo stage_info{};
+  stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stage_info.module = vertex_module;
+  stage_info.pName = "main";
+  VkVertexInputBindingDescription binding{0u, sizeof(float) * vertex_size,
+                                          VK_VERTEX_INPUT_RATE_VERTEX};
+  VkVertexInputAttributeDescription attribute{0u, 0u, VK_FORMAT_R32G32B32_SFLOAT, 0u};
+  VkPipelineVertexInputStateCreateInfo vertex_input_info{};
+  vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertex_input_info.vertexBindingDescriptionCount = 1u;
+  vertex_input_info.pVertexBindingDescriptions = &binding;
+  vertex_input_info.vertexAttributeDescriptionCount = 1u;
+  vertex_input_info.pVertexAttributeDescriptions = &attribute;
+  VkPipelineInputAssemblyStateCreateInfo input_assembly_info{};
+  input_assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkPipelineViewportStateCreateInfo viewport_info{};
+  viewport_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_info.viewportCount = 1u;
+  viewport_info.scissorCount = 1u;
+  VkPipelineRasterizationStateCreateInfo rasterization_info{};
+  rasterization_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterization_info.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterization_info.cullMode = VK_CULL_MODE_NONE;
+  rasterization_info.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  rasterization_info.lineWidth = 1.f;
+  VkPipelineMultisampleStateCreateInfo multisample_info{};
+  multisample_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisample_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  std::array<VkPipelineDepthStencilStateCreateInfo, 2> depth_stencil_infos{};
+  for (auto &depth_stencil_info : depth_stencil_infos) {
+    depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil_info.depthTestEnable = VK_TRUE;
+  }
+  depth_stencil_infos[0].depthWriteEnable = VK_TRUE;
+  depth_stencil_infos[0].depthCompareOp = VK_COMPARE_OP_LESS;
+  depth_stencil_infos[1].depthWriteEnable = VK_FALSE;
+  depth_stencil_infos[1].depthCompareOp = VK_COMPARE_OP_EQUAL;
+  std::array<VkDynamicState, 2> const dynamic_states{VK_DYNAMIC_STATE_VIEWPORT,
+                                                     VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamic_info{};
+  dynamic_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_info.dynamicStateCount = static_cast<std::uint32_t>(dynamic_states.size());
+  dynamic_info.pDynamicStates = dynamic_states.data();
+
+  std::array<VkGraphicsPipelineCreateInfo, 2> pipeline_infos{};
+  for (std::size_t i = 0; i < pipeline_infos.size(); ++i) {
+    auto &pipeline_info = pipeline_infos[i];
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.stageCount = 1u;
+    pipeline_info.pStages = &stage_info;
+    pipeline_info.pVertexInputState = &vertex_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly_info;
+    pipeline_info.pViewportState = &viewport_info;
+    pipeline_info.pRasterizationState = &rasterization_info;
+    pipeline_info.pMultisampleState = &multisample_info;
+    pipeline_info.pDepthStencilState = &depth_stencil_infos[i];
+    pipeline_info.pDynamicState = &dynamic_info;
+    pipeline_info.layout = pipeline_layout;
+    pipeline_info.renderPass = render_pass;
+    pipeline_info.subpass = 0u;
+  }
+  std::array<VkPipeline, 2> pipelines{};
+  auto const result = vkCreateGraphicsPipelines(
+      vulkan_device, VK_NULL_HANDLE, static_cast<std::uint32_t>(pipeline_infos.size()),
+      pipeline_infos.data(), nullptr, pipelines.data());
+  vkDestroyShaderModule(vulkan_device, vertex_module, nullptr);
+  device->check(result, "create graphics pipelines");
+  depth_pipeline = pipelines[0];
+  count_pipeline = pipelines[1];
+}
+
+VulkanContext::RenderTarget VulkanContext::create_render_target(std::uint32_t target_size) {
+  RenderTarget target;
+  target.size = target_size;
+  target.depth = device->create_depth_image(target_size);
+  VkFramebufferCreateInfo framebuffer_info{};
+  framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebuffer_info.renderPass = render_pass;
+  framebuffer_info.attachmentCount = 1u;
+  framebuffer_info.pAttachments = &target.depth.view;
+  framebuffer_info.width = target_size;
+  framebuffer_info.height = target_size;
+  framebuffer_info.layers = 1u;
+  device->check(
+      vkCreateFramebuffer(device->get(), &framebuffer_info, nullptr, &target.framebuffer),
+      "create a framebuffer");
+  return target;
+}
+
+void VulkanContext::destroy(RenderTarget &target) {
+  if (target.framebuffer != VK_NULL_HANDLE) {
+    vkDestroyFramebuffer(device->get(), target.framebuffer, nullptr);
+  }
+  device->destroy(target.depth);
+  target = RenderTarget{};
+}
+
+void VulkanContext::create_submission(Submission &set) {
+  set.command_buffers.resize(command_pools.size());
+  VkCommandBufferAllocateInfo allocate_info{};
+  allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocate_info.commandBufferCount = 1u;
+  for (std::size_t slot = 0; slot < command_pools.size(); ++slot) {
+    allocate_info.commandPool = command_pools[slot];
+    device->check(
+        vkAllocateCommandBuffers(device->get(), &allocate_info, &set.command_buffers[slot]),
+        "allocate a command buffer");
+  }
+  VkFenceCreateInfo fence_info{};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  device->check(vkCreateFence(device->get(), &fence_info, nullptr, &set.fence),
+                "create a fence");
+}
+
+void VulkanContext::destroy_submission(Submission &set) {
+  release_queries(set);
+  for (std::size_t slot = 0; slot < set.command_buffers.size(); ++slot) {
+    vkFreeCommandBuffers(device->get(), command_pools[slot], 1u, &set.command_buffers[slot]);
+  }
+  set.command_buffers.clear();
+  vkDestroyFence(device->get(), set.fence, nullptr);
+}
+
+void VulkanContext::reserve_queries(Submission &set, std::uint32_t query_count) {
+  if (query_count > set.query_count) {
+    release_queries(set);
+    VkQueryPoolCreateInfo query_pool_info{};
+    query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_info.queryType = VK_QUERY_TYPE_OCCLUSION;
+    query_pool_info.queryCount = query_count;
+    device->check(vkCreateQueryPool(device->get(), &query_pool_info, nullptr, &set.query_pool),
+                  "create a query pool");
+    set.query_count = query_count;
+  }
+  set.pixel_areas.resize(set.query_count);
+  set.pixel_counts.resize(set.query_count);
+  set.pending_queries.resize(set.query_count);
+}
+
+void VulkanContext::release_queries(Submission &set) {
+  wait(set);
+  if (set.query_pool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(device->get(), set.query_pool, nullptr);
+    set.query_pool = VK_NULL_HANDLE;
+  }
+  set.query_count = 0u;
+  set.pixel_areas.clear();
+  set.pixel_counts.clear();
+  set.pending_queries.clear();
+  set.ticket = 0;
+}
+
+void VulkanContext::wait(Submission &set) {
+  if (set.in_flight) {
+    device->check(vkWaitForFences(device->get(), 1u, &set.fence, VK_TRUE,
+                                  std::numeric_limits<std::uint64_t>::max()),
+                  "wait for a fence");
+    device->check(vkResetFences(device->get(), 1u, &set.fence), "reset a fence");
+    set.in_flight = false;
+  }
+}
+
+void VulkanContext::submit(Submission &set, std::uint32_t command_buffer_count) {
+  VkSubmitInfo submit_info{};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = command_buffer_count;
+  submit_info.pCommandBuffers = set.command_buffers.data();
+  device->check(vkQueueSubmit(device->get_queue(), 1u, &submit_info, set.fence),
+                "submit commands");
+  set.in_flight = true;
+}
+
+void VulkanContext::check_model_is_set() const {
+  if (!model_is_set) {
+    throw PenumbraException("Model has not been set. Cannot set scene.", *logger);
+  }
+}
+
+void VulkanContext::set_model(const std::vector<float> &vertices_in,
+                              const std::vector<unsigned int> &indices_in,
+                              const std::vector<SurfaceBuffer> &surface_buffers_in) {
+  if (model_is_set) {
+    clear_model();
+  }
+  Context::set_model(vertices_in, indices_in, surface_buffers_in);
+  create_model_buffers();
+  reserve_queries(submission, static_cast<std::uint32_t>(surface_buffers.size()));
+}
+
+void VulkanContext::update_model(const std::vector<float> &vertices_in,
+                                 const std::vector<unsigned int> &indices_in,
+                                 const std::vector<SurfaceBuffer> &surface_buffers_in,
+                                 const std::vector<unsigned int> &changed_surfaces,
+                                 const std::vector<std::pair<unsigned int, unsigned int>>
+                                     &rewritten_vertices) {
+  if (!model_is_set || surface_buffers_in.size() != surface_buffers.size()) {
+    set_model(vertices_in, indices_in, surface_buffers_in);
+    return;
+  }
+  Context::update_model(vertices_in, indices_in, surface_buffers_in, changed_surfaces,
+                        rewritten_vertices);
+  // Queued submissions may still draw from the buffers
+  vkDeviceWaitIdle(device->get());
+  device->destroy(vertex_buffer);
+  device->destroy(index_buffer);
+  create_model_buffers();
+}
+
+void VulkanContext::create_model_buffers() {
+  if (!indices.empty()) {
+    vertex_buffer =
+        device->create_buffer(static_cast<VkDeviceSize>(sizeof(float) * vertices.size()),
+                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertices.data());
+    index_buffer =
+        device->create_buffer(static_cast<VkDeviceSize>(sizeof(std::uint32_t) * indices.size()),
+                              VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indices.data());
+  }
+}
+
+void VulkanContext::clear_model() {
+  Context::clear_model();
+  vkDeviceWaitIdle(device->get());
+  for (auto *set : {&submission, &view_submission}) {
+    release_queries(*set);
+  }
+  for (auto &set : queue_ring) {
+    release_queries(set);
+  }
+  device->destroy(vertex_buffer);
+  device->destroy(index_buffer);
+}
+
+void VulkanContext::begin_command_buffer(VkCommandBuffer command_buffer) const {
+  VkCommandBufferBeginInfo begin_info{};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  device->check(vkBeginCommandBuffer(command_buffer, &begin_info), "begin a command buffer");
+  VkDeviceSize const offset{0u};
+  if (vertex_buffer.buffer != VK_NULL_HANDLE) {
+    vkCmdBindVertexBuffers(command_buffer, 0u, 1u, &vertex_buffer.buffer, &offset);
+    vkCmdBindIndexBuffer(command_buffer, index_buffer.buffer, offset, VK_INDEX_TYPE_UINT32);
+  }
+}
+
+void VulkanContext::begin_render_pass(VkCommandBuffer command_buffer, const RenderTarget &target,
+                                      std::uint32_t resolution) const {
+  VkClearValue clear_value{};
+  clear_value.depthStencil.depth = 1.f;
+  VkRenderPassBeginInfo begin_info{};
+  begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  begin_info.renderPass = render_pass;
+  begin_info.framebuffer = target.framebuffer;
+  begin_info.renderArea.extent = {resolution, resolution};
+  begin_info.clearValueCount = 1u;
+  begin_info.pClearValues = &clear_value;
+  vkCmdBeginRenderPass(command_buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+  VkViewport viewport{0.f, 0.f, static_cast<float>(resolution), static_cast<float>(resolution),
+                      0.f, 1.f};
+  vkCmdSetViewport(command_buffer, 0u, 1u, &viewport);
+  vkCmdSetScissor(command_buffer, 0u, 1u, &begin_info.renderArea);
+}
+
+void VulkanContext::push_mvp(VkCommandBuffer command_buffer, VkPipelineLayout layout,
+                             const mat4x4 mvp) {
+  // Vulkan clips depths to [0, 1] rather than OpenGL's [-1, 1]
+  mat4x4 depth_correction;
+  mat4x4_identity(depth_correction);
+  depth_correction[2][2] = 0.5f;
+  depth_correction[3][2] = 0.5f;
+  mat4x4 vulkan_mvp;
+  mat4x4_mul(vulkan_mvp, depth_correction, mvp);
+  vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0u, sizeof(mat4x4),
+                     vulkan_mvp);
+}
+
+void VulkanContext::draw_surface(VkCommandBuffer command_buffer,
+                                 const SurfaceBuffer &surface_buffer) {
+  vkCmdDrawIndexed(command_buffer, surface_buffer.count, 1u, surface_buffer.begin, 0, 0u);
+}
+
+void VulkanContext::draw_surfaces(VkCommandBuffer command_buffer,
+                                  const std::vector<unsigned int> &surface_indices) const {
+  std::uint32_t first{0u}, count{0u};
+  for (auto const surface_index : surface_indices) {
+    auto const &surface_buffer = surface_buffers[surface_index];
+    if (surface_buffer.begin != first + count) {
+      if (count > 0u) {
+        vkCmdDrawIndexed(command_buffer, count, 1u, first, 0, 0u);
+      }
+      first = surface_buffer.begin;
+      count = 0u;
+    }
+    count += surface_buffer.count;
+  }
+  if (count > 0u) {
+    vkCmdDrawIndexed(command_buffer, count, 1u, first, 0, 0u);
+  }
+}
+
+void VulkanContext::record_receiver(VkCommandBuffer command_buffer, const RenderTarget &target,
+                                    VkQueryPool query_pool, Receiver &receiver,
+                                    std::vector<unsigned int> &visible_surfaces) const {
+  auto const surface_index = static_cast<unsigned int>(receiver.surface_buffer->index);
+  auto const *receiver_view = get_receiver_view(surface_index, receiver.sun_view);
+  auto const projection = receiver_view
+                              ? receiver_view->projection
+                              : calculate_projection(receiver.sun_view, receiver.surface_buffer);
+  receiver.pixel_area = 0.f;
+  receiver.error = 0.f;
+  if (projection.pixel_area <= 0.f) {
+    return;
+  }
+  int const resolution = std::min(choose_resolution(surface_index, receiver.sun_view, projection),
+                                  static_cast<int>(target.size));
+  receiver.pixel_area = get_pixel_area(projection, resolution);
+  receiver.error = estimate_pssa_error(surface_index, receiver.sun_view, projection, resolution);
+  if (!receiver_view) {
+    find_surfaces_in_view(receiver.sun_view, projection, receiver.surface_buffer,
+                          visible_surfaces);
+  }
+
+  vkCmdResetQueryPool(command_buffer, query_pool, receiver.query, 1u);
+  begin_render_pass(command_buffer, target, static_cast<std::uint32_t>(resolution));
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pipeline);
+  push_mvp(command_buffer, pipeline_layout, projection.mvp);
+  draw_surfaces(command_buffer, receiver_view ? receiver_view->surfaces_in_view : visible_surfaces);
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, count_pipeline);
+  vkCmdBeginQuery(command_buffer, query_pool, receiver.query, VK_QUERY_CONTROL_PRECISE_BIT);
+  draw_surface(command_buffer, *receiver.surface_buffer);
+  vkCmdEndQuery(command_buffer, query_pool, receiver.query);
+  vkCmdEndRenderPass(command_buffer);
+}
+
+void VulkanContext::submit_receivers(Submission &set, std::vector<Receiver> &receivers,
+                                     const std::function<void(VkCommandBuffer)> &prefix) {
+  // Contiguous runs of receivers, one per command buffer
+  std::size_t const chunk_count =
+      std::min(static_cast<std::size_t>(thread_pool.get_slot_count()),
+               std::max(receivers.size(), static_cast<std::size_t>(prefix ? 1u : 0u)));
+  if (chunk_count == 0u) {
+    return;
+  }
+  thread_pool.parallel_for(chunk_count, [&](std::size_t chunk, unsigned int) {
+    // Each chunk records with its own command pool and depth buffer, whichever thread runs it
+    auto const command_buffer = set.command_buffers[chunk];
+    auto &target = targets[chunk];
+    if (target.size == 0u) {
+      target = create_render_target(buffer_size);
+    }
+    begin_command_buffer(command_buffer);
+    if (chunk == 0u && prefix) {
+      prefix(command_buffer);
+    }
+    std::vector<unsigned int> visible_surfaces;
+    for (std::size_t i = receivers.size() * chunk / chunk_count;
+         i < receivers.size() * (chunk + 1u) / chunk_count; ++i) {
+      record_receiver(command_buffer, target, set.query_pool, receivers[i], visible_surfaces);
+    }
+    device->check(vkEndCommandBuffer(command_buffer), "record a command buffer");
+  });
+  submit(set, static_cast<std::uint32_t>(chunk_count));
+}
+
+void VulkanContext::set_analytic_pssa(const unsigned int surface_index, const float pssa,
+                                      Submission &set) {
+  set.pixel_counts[surface_index] = 1;
+  set.pixel_areas[surface_index] = pssa;
+  set.pending_queries[surface_index] = false;
+  pssa_errors[surface_index] = 0.f;
+}
+
+void VulkanContext::submit_pssa(const unsigned int surface_index, mat4x4 sun_view) {
+  submit_pssas(std::vector<unsigned int>{surface_index}, sun_view, submission);
+}
+
+void VulkanContext::submit_pssas(const std::vector<unsigned int> &surface_indices,
+                                 mat4x4 sun_view) {
+  submit_pssas(surface_indices, sun_view, submission);
+}
+
+void VulkanContext::submit_pssas(const std::vector<unsigned int> &surface_indices,
+                                 mat4x4 sun_view, Submission &set) {
+  check_model_is_set();
+  wait(set);
+  std::vector<unsigned int> rendered_surface_indices;
+  for (auto const surface_index : surface_indices) {
+    float pssa;
+    if (calculate_analytic_pssa(surface_index, sun_view, pssa)) {
+      set_analytic_pssa(surface_index, pssa, set);
+    } else {
+      rendered_surface_indices.push_back(surface_index);
+    }
+  }
+
+  // Shared depth buffer and coplanar group modes: the model is drawn once per group, ahead of the
+  // individual receivers
+  std::function<void(VkCommandBuffer)> prefix;
+  std::vector<ReceiverGroup> groups;
+  std::vector<unsigned int> individual_indices;
+  if ((calculation_mode == CalculationMode::shared_depth_buffer ||
+       calculation_mode == CalculationMode::coplanar_groups) &&
+      !rendered_surface_indices.empty()) {
+    if (shared_depth_target.size == 0u) {
+      shared_depth_target = create_render_target(
+          std::min(static_cast<std::uint32_t>(size * shared_depth_scale), max_target_size));
+    }
+    auto const shared_size = static_cast<int>(shared_depth_target.size);
+    group_shared_depth_receivers(rendered_surface_indices, sun_view, shared_size, groups,
+                                 individual_indices);
+    for (auto const &group : groups) {
+      float const pixel_area = get_pixel_area(group.projection, shared_size);
+      for (auto const surface_index : group.surface_indices) {
+        set.pixel_areas[surface_index] = pixel_area;
+        set.pending_queries[surface_index] = true;
+        pssa_errors[surface_index] =
+            estimate_pssa_error(surface_index, sun_view, group.projection, shared_size);
+      }
+    }
+    if (!groups.empty()) {
+      prefix = [&](VkCommandBuffer command_buffer) {
+        for (auto const &group : groups) {
+          for (auto const surface_index : group.surface_indices) {
+            vkCmdResetQueryPool(command_buffer, set.query_pool, surface_index, 1u);
+          }
+        }
+        std::vector<unsigned int> visible_surfaces;
+        for (auto const &group : groups) {
+          begin_render_pass(command_buffer, shared_depth_target, shared_depth_target.size);
+          vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pipeline);
+          push_mvp(command_buffer, pipeline_layout, group.projection.mvp);
+          if (calculation_mode == CalculationMode::coplanar_groups) {
+            find_surfaces_in_view(sun_view, group.projection, nullptr, visible_surfaces);
+            draw_surfaces(command_buffer, visible_surfaces);
+          } else {
+            vkCmdDrawIndexed(command_buffer, static_cast<std::uint32_t>(indices.size()), 1u, 0u,
+                             0, 0u);
+          }
+          vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, count_pipeline);
+          for (auto const surface_index : group.surface_indices) {
+            vkCmdBeginQuery(command_buffer, set.query_pool, surface_index,
+                            VK_QUERY_CONTROL_PRECISE_BIT);
+            draw_surface(command_buffer, surface_buffers[surface_index]);
+            vkCmdEndQuery(command_buffer, set.query_pool, surface_index);
+          }
+          vkCmdEndRenderPass(command_buffer);
+        }
+      };
+    }
+  } else {
+    individual_indices = std::move(rendered_surface_indices);
+  }
+
+  std::vector<Receiver> receivers;
+  receivers.reserve(individual_indices.size());
+  for (auto const surface_index : individual_indices) {
+    receivers.push_back({&surface_buffers[surface_index], sun_view, surface_index, 0.f, 0.f});
+  }
+  submit_receivers(set, receivers, prefix);
+  for (auto const &receiver : receivers) {
+    auto const surface_index = static_cast<unsigned int>(receiver.surface_buffer->index);
+    set.pixel_areas[surface_index] = receiver.pixel_area;
+    set.pixel_counts[surface_index] = 0u;
+    set.pending_queries[surface_index] = receiver.pixel_area > 0.f;
+    pssa_errors[surface_index] = receiver.error;
+  }
+}
+
+float VulkanContext::retrieve_pssa(const unsigned int surface_index) {
+  return retrieve_pssa(surface_index, submission);
+}
+
+float VulkanContext::retrieve_pssa(const unsigned int surface_index, Submission &set) {
+  if (set.pending_queries.at(surface_index)) {
+    wait(set);
+    device->check(vkGetQueryPoolResults(device->get(), set.query_pool, surface_index, 1u,
+                                        sizeof(std::uint64_t), &set.pixel_counts[surface_index],
+                                        sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT),
+                  "get query results");
+    set.pending_queries[surface_index] = false;
+  }
+  return static_cast<float>(set.pixel_counts[surface_index]) * set.pixel_areas[surface_index];
+}
+
+std::vector<float> VulkanContext::calculate_pssas(const unsigned int surface_index,
+                                                  const std::vector<mat4x4_ptr> &sun_views) {
+  check_model_is_set();
+  // Every sun view is rendered in one submission, counted with one query each
+  std::vector<float> pssas(sun_views.size());
+  std::vector<std::size_t> rendered_views;
+  std::vector<Receiver> receivers;
+  for (std::size_t i = 0; i < sun_views.size(); ++i) {
+    if (!calculate_analytic_pssa(surface_index, sun_views[i], pssas[i])) {
+      receivers.push_back({&surface_buffers[surface_index], sun_views[i],
+                           static_cast<std::uint32_t>(receivers.size()), 0.f, 0.f});
+      rendered_views.push_back(i);
+    }
+  }
+  auto &set = view_submission;
+  wait(set);
+  reserve_queries(set, static_cast<std::uint32_t>(receivers.size()));
+  submit_receivers(set, receivers);
+  wait(set);
+  for (std::size_t i = 0; i < receivers.size(); ++i) {
+    std::uint64_t pixel_count{0u};
+    if (receivers[i].pixel_area > 0.f) {
+      device->check(vkGetQueryPoolResults(device->get(), set.query_pool, receivers[i].query, 1u,
+                                          sizeof(pixel_count), &pixel_count, sizeof(pixel_count),
+                                          VK_QUERY_RESULT_64_BIT),
+                    "get query results");
+    }
+    pssas[rendered_views[i]] = static_cast<float>(pixel_count) * receivers[i].pixel_area;
+  }
+  return pssas;
+}
+
+unsigned int VulkanContext::queue_pssas(const std::vector<unsigned int> &surface_indices,
+                                        mat4x4 sun_view) {
+  auto const ticket = next_ticket;
+  auto &set = queue_ring[ticket % queue_ring_size];
+  if (set.ticket != 0) {
+    throw PenumbraException(
+        fmt::format("Unable to queue more than {} PSSA calculations. Retrieve a queued "
+                    "calculation before queuing another.",
+                    queue_ring_size),
+        *logger);
+  }
+  reserve_queries(set, static_cast<std::uint32_t>(surface_buffers.size()));
+
+  submit_pssas(surface_indices, sun_view, set);
+  set.surface_indices = surface_indices;
+  set.ticket = ticket;
+
+  // Skip zero, which marks submissions that are not queued
+  next_ticket = next_ticket == std::numeric_limits<unsigned int>::max() ? 1u : next_ticket + 1u;
+  return ticket;
+}
+
+VulkanContext::Submission &VulkanContext::get_queued_submission(const unsigned int ticket) {
+  auto &set = queue_ring[ticket % queue_ring_size];
+  if (ticket == 0 || set.ticket != ticket) {
+    throw PenumbraException(
+        fmt::format("PSSA ticket, {}, does not refer to a queued calculation.", ticket), *logger);
+  }
+  return set;
+}
+
+bool VulkanContext::is_queued_pssa_ready(const unsigned int ticket) {
+  auto &set = get_queued_submission(ticket);
+  return !set.in_flight || vkGetFenceStatus(device->get(), set.fence) == VK_SUCCESS;
+}
+
+std::vector<float> VulkanContext::retrieve_queued_pssas(const unsigned int ticket) {
+  auto &set = get_queued_submission(ticket);
+  std::vector<float> pssas;
+  pssas.reserve(set.surface_indices.size());
+  for (auto const surface_index : set.surface_indices) {
+    pssas.push_back(retrieve_pssa(surface_index, set));
+  }
+  set.ticket = 0;
+  return pssas;
+}
+
+unsigned int VulkanContext::get_queued_pssa_count() const {
+  return static_cast<unsigned int>(
+      std::count_if(queue_ring.begin(), queue_ring.end(),
+                    [](const Submission &queued) { return queued.ticket != 0; }));
+}
+
+unsigned int VulkanContext::get_queue_capacity() const {
+  return queue_ring_size;
+}
+
+std::unordered_map<unsigned int, float> VulkanContext::calculate_interior_pssas(
+    const std::vector<unsigned int> &hidden_surface_indices,
+    const std::vector<unsigned int> &interior_surface_indices, mat4x4 sun_view) {
+  check_model_is_set();
+  std::unordered_map<unsigned int, float> pssas;
+  auto const projection =
+      calculate_projection(sun_view, &surface_buffers.at(hidden_surface_indices.at(0)), false);
+  if (projection.pixel_area <= 0.f || interior_surface_indices.empty()) {
+    for (auto const interior_surface_index : interior_surface_indices) {
+      pssas[interior_surface_index] = 0.f;
+    }
+    return pssas;
+  }
+
+  std::vector<unsigned int> drawn_surfaces;
+  for (auto const &surface_buffer : surface_buffers) {
+    auto const surface_index = static_cast<unsigned int>(surface_buffer.index);
+    if (std::find(hidden_surface_indices.begin(), hidden_surface_indices.end(), surface_index) ==
+        hidden_surface_indices.end()) {
+      drawn_surfaces.push_back(surface_index);
+    }
+  }
+
+  // One render pass: the model without the hidden surfaces, then each interior surface counted
+  auto &set = view_submission;
+  wait(set);
+  auto const query_count = static_cast<std::uint32_t>(interior_surface_indices.size());
+  reserve_queries(set, query_count);
+  auto &target = targets[0];
+  if (target.size == 0u) {
+    target = create_render_target(buffer_size);
+  }
+  auto const command_buffer = set.command_buffers[0];
+  begin_command_buffer(command_buffer);
+  vkCmdResetQueryPool(command_buffer, set.query_pool, 0u, query_count);
+  begin_render_pass(command_buffer, target, buffer_size);
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pipeline);
+  push_mvp(command_buffer, pipeline_layout, projection.mvp);
+  draw_surfaces(command_buffer, drawn_surfaces);
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, count_pipeline);
+  for (std::uint32_t i = 0; i < query_count; ++i) {
+    vkCmdBeginQuery(command_buffer, set.query_pool, i, VK_QUERY_CONTROL_PRECISE_BIT);
+    draw_surface(command_buffer, surface_buffers.at(interior_surface_indices[i]));
+    vkCmdEndQuery(command_buffer, set.query_pool, i);
+  }
+  vkCmdEndRenderPass(command_buffer);
+  device->check(vkEndCommandBuffer(command_buffer), "record a command buffer");
+  submit(set, 1u);
+  wait(set);
+
+  std::vector<std::uint64_t> pixel_counts(query_count);
+  device->check(vkGetQueryPoolResults(device->get(), set.query_pool, 0u, query_count,
+                                      sizeof(std::uint64_t) * query_count, pixel_counts.data(),
+                                      sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT),
+                "get query results");
+  float const pixel_area = get_pixel_area(projection, static_cast<int>(buffer_size));
+  for (std::uint32_t i = 0; i < query_count; ++i) {
+    pssas[interior_surface_indices[i]] = static_cast<float>(pixel_counts[i]) * pixel_area;
+  }
+  return pssas;
+}
+
+} // namespace Penumbra
@@ -0,0 +1,161 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef VULKAN_CONTEXT_H_
+#define VULKAN_CONTEXT_H_
+
+// Standard
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Vendor
+#include <vulkan/vulkan.h>
+#include <courierr/courierr.h>
+
+// Penumbra
+#include "../context.h"
+#include "cpu/thread-pool.h"
+#include "vulkan/device.h"
+
+namespace Penumbra {
+
+// Counts each receiver's unshaded pixels with occlusion queries on a Vulkan device, rendering
+// into depth-only render passes. A submission's receivers are split into one command buffer per
+// thread pool slot, recorded in parallel (each with its own command pool and depth buffer), and
+// submitted to the queue together.
+class VulkanContext : public Context {
+
+public:
+  VulkanContext(int size, ThreadPool &thread_pool, Courierr::Courierr *logger);
+  ~VulkanContext() override;
+  static bool is_supported(); // Whether a suitable device is available
+  void set_model(const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+                 const std::vector<SurfaceBuffer> &surface_buffers) override;
+  // Uploads the vertices and indices again, keeping the query pools
+  void update_model(
+      const std::vector<float> &vertices, const std::vector<unsigned int> &indices,
+      const std::vector<SurfaceBuffer> &surface_buffers,
+      const std::vector<unsigned int> &changed_surfaces,
+      const std::vector<std::pair<unsigned int, unsigned int>> &rewritten_vertices) override;
+  void clear_model() override;
+  using Context::submit_pssa;
+  void submit_pssa(unsigned int surface_index, mat4x4 sun_view) override;
+  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view) override;
+  using Context::retrieve_pssa;
+  float retrieve_pssa(unsigned int surface_index) override;
+  std::vector<float> calculate_pssas(unsigned int surface_index,
+                                     const std::vector<mat4x4_ptr> &sun_views) override;
+  unsigned int queue_pssas(const std::vector<unsigned int> &surface_indices,
+                           mat4x4 sun_view) override;
+  bool is_queued_pssa_ready(unsigned int ticket) override;
+  std::vector<float> retrieve_queued_pssas(unsigned int ticket) override;
+  [[nodiscard]] unsigned int get_queued_pssa_count() const override;
+  [[nodiscard]] unsigned int get_queue_capacity() const override;
+
+  std::unordered_map<unsigned int, float>
+  calculate_interior_pssas(const std::vector<unsigned int> &hidden_surface_indices,
+                           const std::vector<unsigned int> &interior_surface_indices,
+                           mat4x4 sun_view) override;
+
+private:
+  static const std::uint32_t calculation_vertex_shader_code[];
+  static const std::size_t calculation_vertex_shader_size; // In bytes
+  std::unique_ptr<VulkanDevice> device;
+  ThreadPool &thread_pool; // Owned by PenumbraImplementation
+  std::uint32_t max_target_size{0u}; // Largest framebuffer the hardware renders
+  // Larger sizes are rendered at buffer_size pixels on each side
+  std::uint32_t buffer_size{0u};
+  VkRenderPass render_pass{VK_NULL_HANDLE};
+  VkPipelineLayout pipeline_layout{VK_NULL_HANDLE};
+  VkPipeline depth_pipeline{VK_NULL_HANDLE}; // Draws surfaces into the depth buffer
+  VkPipeline count_pipeline{VK_NULL_HANDLE}; // Draws receivers at equal depths, without writing
+  VulkanBuffer vertex_buffer;
+  VulkanBuffer index_buffer; // Three per triangle, into vertex_buffer
+
+  // Depth buffer rendered into by one command buffer at a time
+  struct RenderTarget {
+    VulkanImage depth;
+    VkFramebuffer framebuffer{VK_NULL_HANDLE};
+    std::uint32_t size{0u};
+  };
+  std::vector<RenderTarget> targets; // One per thread pool slot
+  RenderTarget shared_depth_target;  // Allocated on first use
+  std::vector<VkCommandPool> command_pools; // One per thread pool slot
+
+  // Command buffers, occlusion queries, and results of one queue submission
+  struct Submission {
+    std::vector<VkCommandBuffer> command_buffers; // One per thread pool slot
+    VkFence fence{VK_NULL_HANDLE};
+    bool in_flight{false}; // Submitted, and the fence not yet waited on
+    VkQueryPool query_pool{VK_NULL_HANDLE};
+    std::uint32_t query_count{0u};
+    std::vector<float> pixel_areas;
+    std::vector<std::uint64_t> pixel_counts;
+    std::vector<bool> pending_queries;
+    std::vector<unsigned int> surface_indices; // Surfaces submitted with a queued submission
+    unsigned int ticket{0};                    // Zero when the submission is not queued
+  };
+  Submission submission; // Used by the synchronous submit/retrieve functions
+  Submission view_submission; // Used by calculate_pssas (queries by sun view) and interior PSSAs
+  static constexpr unsigned int queue_ring_size{4};
+  std::array<Submission, queue_ring_size> queue_ring;
+  unsigned int next_ticket{1};
+
+  // A receiver rendered from one sun view and counted with one query
+  struct Receiver {
+    const SurfaceBuffer *surface_buffer;
+    mat4x4_ptr sun_view;
+    std::uint32_t query;
+    float pixel_area; // Set when recorded. Zero if nothing was rendered.
+    float error;      // See estimate_pssa_error
+  };
+
+  void create_pipelines();
+  void create_model_buffers(); // From the model's vertices and indices
+  RenderTarget create_render_target(std::uint32_t target_size);
+  void destroy(RenderTarget &target);
+  void create_submission(Submission &set);
+  void destroy_submission(Submission &set);
+  // Sizes the submission's query pool (and results) for at least query_count queries
+  void reserve_queries(Submission &set, std::uint32_t query_count);
+  void release_queries(Submission &set);
+  // Waits for the submission's commands to finish, so its command buffers may be recorded again.
+  // Query results are read only after waiting: until the submission's query resets execute, the
+  // queries remain available with the previous submission's results.
+  void wait(Submission &set);
+  // Submits the first command_buffer_count command buffers, signaling the submission's fence
+  void submit(Submission &set, std::uint32_t command_buffer_count);
+  Submission &get_queued_submission(unsigned int ticket);
+
+  // Begins a one time command buffer with the model's vertices and indices bound
+  void begin_command_buffer(VkCommandBuffer command_buffer) const;
+  void begin_render_pass(VkCommandBuffer command_buffer, const RenderTarget &target,
+                         std::uint32_t resolution) const;
+  static void push_mvp(VkCommandBuffer command_buffer, VkPipelineLayout layout,
+                       const mat4x4 mvp);
+  // Draws the surfaces (in model order), merging adjacent index ranges
+  void draw_surfaces(VkCommandBuffer command_buffer,
+                     const std::vector<unsigned int> &surface_indices) const;
+  static void draw_surface(VkCommandBuffer command_buffer, const SurfaceBuffer &surface_buffer);
+  // Records the receiver's render pass, at the resolution chosen for the target accuracy
+  void record_receiver(VkCommandBuffer command_buffer, const RenderTarget &target,
+                       VkQueryPool query_pool, Receiver &receiver,
+                       std::vector<unsigned int> &visible_surfaces) const;
+  // Records the receivers across the submission's command buffers in parallel. Slot 0's command
+  // buffer begins with the commands recorded by prefix (if given). Submits the command buffers.
+  void submit_receivers(Submission &set, std::vector<Receiver> &receivers,
+                        const std::function<void(VkCommandBuffer)> &prefix = nullptr);
+  void submit_pssas(const std::vector<unsigned int> &surface_indices, mat4x4 sun_view,
+                    Submission &set);
+  float retrieve_pssa(unsigned int surface_index, Submission &set);
+  void set_analytic_pssa(unsigned int surface_index, float pssa, Submission &set);
+  void check_model_is_set() const;
+};
+
+} // namespace Penumbra
+
+#endif // VULKAN_CONTEXT_H_
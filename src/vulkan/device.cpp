@@ -0,0 +1,322 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+// Standard
+#include <cstring>
+#include <vector>
+
+// Vendor
+#include <fmt/format.h>
+
+// Penumbra
+#include <penumbra/logging.h>
+#include "vulkan/device.h"
+
+namespace Penumbra {
+
+VulkanDevice::~VulkanDevice() {
+  if (device != VK_NULL_HANDLE) {
+    vkDeviceWaitIdle(device);
+    if (transfer_command_pool != VK_NULL_HANDLE) {
+      vkDestroyCommandPool(device, transfer_command_pool, nullptr);
+    }
+    vkDestroyDevice(device, nullptr);
+  }
+  if (instance != VK_NULL_HANDLE) {
+    vkDestroyInstance(instance, nullptr);
+  }
+}
+
+std::unique_ptr<VulkanDevice> VulkanDevice::create(Courierr::Courierr *logger) {
+  std::unique_ptr<VulkanDevice> device(new VulkanDevice());
+  if (!device->initialize(logger)) {
+    return nullptr;
+  }
+  return device;
+}
+
+bool VulkanDevice::initialize(Courierr::Courierr *logger_in) {
+  logger = logger_in;
+  VkApplicationInfo application_info{};
+  application_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  application_info.pApplicationName = "Penumbra";
+  application_info.pEngineName = "Penumbra";
+  application_info.apiVersion = VK_API_VERSION_1_0;
+  VkInstanceCreateInfo instance_info{};
+  instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instance_info.pApplicationInfo = &application_info;
+  if (vkCreateInstance(&instance_info, nullptr, &instance) != VK_SUCCESS) {
+    instance = VK_NULL_HANDLE;
+    return false;
+  }
+
+  std::uint32_t device_count{0u};
+  vkEnumeratePhysicalDevices(instance, &device_count, nullptr);
+  std::vector<VkPhysicalDevice> physical_devices(device_count);
+  vkEnumeratePhysicalDevices(instance, &device_count, physical_devices.data());
+
+  // Rank suitable devices by type, keeping the first of the best type
+  auto const get_rank = [](VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+      return 4;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+      return 3;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+      return 2;
+    default:
+      return 1;
+    }
+  };
+  int best_rank{0};
+  for (auto const candidate : physical_devices) {
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(candidate, &features);
+    if (!features.occlusionQueryPrecise) {
+      continue;
+    }
+
+    std::uint32_t family_count{0u};
+    vkGetPhysicalDeviceQueueFamilyProperties(candidate, &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(candidate, &family_count, families.data());
+    std::uint32_t family_index{0u};
+    while (family_index < family_count &&
+           (families[family_index].queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0u) {
+      ++family_index;
+    }
+    if (family_index == family_count) {
+      continue;
+    }
+
+    // Every device supports one of the 24 or 32 bit formats (the 16 bit format is a last resort)
+    VkFormat candidate_depth_format{VK_FORMAT_UNDEFINED};
+    for (auto const format :
+         {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM}) {
+      VkFormatProperties format_properties;
+      vkGetPhysicalDeviceFormatProperties(candidate, format, &format_properties);
+      if (format_properties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+        candidate_depth_format = format;
+        break;
+      }
+    }
+    if (candidate_depth_format == VK_FORMAT_UNDEFINED) {
+      continue;
+    }
+
+    VkPhysicalDeviceProperties candidate_properties;
+    vkGetPhysicalDeviceProperties(candidate, &candidate_properties);
+    int const rank = get_rank(candidate_properties.deviceType);
+    if (rank > best_rank) {
+      best_rank = rank;
+      physical_device = candidate;
+      properties = candidate_properties;
+      queue_family_index = family_index;
+      depth_format = candidate_depth_format;
+    }
+  }
+  if (physical_device == VK_NULL_HANDLE) {
+    return false;
+  }
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+  float const queue_priority{1.f};
+  VkDeviceQueueCreateInfo queue_info{};
+  queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queue_info.queueFamilyIndex = queue_family_index;
+  queue_info.queueCount = 1u;
+  queue_info.pQueuePriorities = &queue_priority;
+  VkPhysicalDeviceFeatures enabled_features{};
+  enabled_features.occlusionQueryPrecise = VK_TRUE;
+  VkDeviceCreateInfo device_info{};
+  device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  device_info.queueCreateInfoCount = 1u;
+  device_info.pQueueCreateInfos = &queue_info;
+  device_info.pEnabledFeatures = &enabled_features;
+  if (vkCreateDevice(physical_device, &device_info, nullptr, &device) != VK_SUCCESS) {
+    device = VK_NULL_HANDLE;
+    return false;
+  }
+  vkGetDeviceQueue(device, queue_family_index, 0u, &queue);
+
+  VkCommandPoolCreateInfo pool_info{};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  pool_info.queueFamilyIndex = queue_family_index;
+  if (vkCreateCommandPool(device, &pool_info, nullptr, &transfer_command_pool) != VK_SUCCESS) {
+    transfer_command_pool = VK_NULL_HANDLE;
+    return false;
+  }
+
+  if (logger) {
+    logger->info(fmt::format("Using Vulkan device: {}", properties.deviceName));
+  }
+  return true;
+}
+
+VkDevice VulkanDevice::get() const {
+  return device;
+}
+
+VkQueue VulkanDevice::get_queue() const {
+  return queue;
+}
+
+std::uint32_t VulkanDevice::get_queue_family_index() const {
+  return queue_family_index;
+}
+
+const VkPhysicalDeviceLimits &VulkanDevice::get_limits() const {
+  return properties.limits;
+}
+
+VkFormat VulkanDevice::get_depth_format() const {
+  return depth_format;
+}
+
+void VulkanDevice::check(VkResult result, const char *operation) const {
+  if (result != VK_SUCCESS) {
+    throw PenumbraException(
+        fmt::format("Vulkan failed to {} (error {}).", operation, static_cast<int>(result)),
+        *logger);
+  }
+}
+
+std::uint32_t VulkanDevice::find_memory_type(std::uint32_t type_bits,
+                                             VkMemoryPropertyFlags required_properties) const {
+  for (std::uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
+    if ((type_bits & (1u << i)) != 0u &&
+        (memory_properties.memoryTypes[i].propertyFlags & required_properties) ==
+            required_properties) {
+      return i;
+    }
+  }
+  throw PenumbraException("Vulkan device has no suitable memory type.", *logger);
+}
+
+VkDeviceMemory VulkanDevice::allocate_memory(const VkMemoryRequirements &requirements,
+                                             VkMemoryPropertyFlags required_properties) {
+  VkMemoryAllocateInfo allocate_info{};
+  allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocate_info.allocationSize = requirements.size;
+  allocate_info.memoryTypeIndex =
+      find_memory_type(requirements.memoryTypeBits, required_properties);
+  VkDeviceMemory memory;
+  check(vkAllocateMemory(device, &allocate_info, nullptr, &memory), "allocate memory");
+  return memory;
+}
+
+void VulkanDevice::submit_once(const std::function<void(VkCommandBuffer)> &record) {
+  VkCommandBufferAllocateInfo allocate_info{};
+  allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocate_info.commandPool = transfer_command_pool;
+  allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocate_info.commandBufferCount = 1u;
+  VkCommandBuffer command_buffer;
+  check(vkAllocateCommandBuffers(device, &allocate_info, &command_buffer),
+        "allocate a command buffer");
+
+  VkCommandBufferBeginInfo begin_info{};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(command_buffer, &begin_info);
+  record(command_buffer);
+  check(vkEndCommandBuffer(command_buffer), "record a command buffer");
+
+  VkSubmitInfo submit_info{};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1u;
+  submit_info.pCommandBuffers = &command_buffer;
+  check(vkQueueSubmit(queue, 1u, &submit_info, VK_NULL_HANDLE), "submit commands");
+  check(vkQueueWaitIdle(queue), "wait for commands");
+  vkFreeCommandBuffers(device, transfer_command_pool, 1u, &command_buffer);
+}
+
+VulkanBuffer VulkanDevice::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                                         const void *data) {
+  VkBufferCreateInfo buffer_info{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkMemoryRequirements requirements;
+
+  // Host visible staging buffer holding a copy of the data
+  VulkanBuffer staging;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  check(vkCreateBuffer(device, &buffer_info, nullptr, &staging.buffer), "create a buffer");
+  vkGetBufferMemoryRequirements(device, staging.buffer, &requirements);
+  staging.memory = allocate_memory(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  check(vkBindBufferMemory(device, staging.buffer, staging.memory, 0u), "bind buffer memory");
+  void *mapped_data;
+  check(vkMapMemory(device, staging.memory, 0u, size, 0u, &mapped_data), "map buffer memory");
+  std::memcpy(mapped_data, data, static_cast<std::size_t>(size));
+  vkUnmapMemory(device, staging.memory);
+
+  VulkanBuffer buffer;
+  buffer_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  check(vkCreateBuffer(device, &buffer_info, nullptr, &buffer.buffer), "create a buffer");
+  vkGetBufferMemoryRequirements(device, buffer.buffer, &requirements);
+  buffer.memory = allocate_memory(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  check(vkBindBufferMemory(device, buffer.buffer, buffer.memory, 0u), "bind buffer memory");
+
+  submit_once([&](VkCommandBuffer command_buffer) {
+    VkBufferCopy region{};
+    region.size = size;
+    vkCmdCopyBuffer(command_buffer, staging.buffer, buffer.buffer, 1u, &region);
+  });
+  destroy(staging);
+  return buffer;
+}
+
+VulkanImage VulkanDevice::create_depth_image(std::uint32_t size) {
+  VulkanImage image;
+  VkImageCreateInfo image_info{};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.format = depth_format;
+  image_info.extent = {size, size, 1u};
+  image_info.mipLevels = 1u;
+  image_info.arrayLayers = 1u;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  check(vkCreateImage(device, &image_info, nullptr, &image.image), "create a depth image");
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device, image.image, &requirements);
+  image.memory = allocate_memory(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  check(vkBindImageMemory(device, image.image, image.memory, 0u), "bind image memory");
+
+  VkImageViewCreateInfo view_info{};
+  view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  view_info.image = image.image;
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  view_info.format = depth_format;
+  view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+  view_info.subresourceRange.levelCount = 1u;
+  view_info.subresourceRange.layerCount = 1u;
+  check(vkCreateImageView(device, &view_info, nullptr, &image.view), "create a depth image view");
+  return image;
+}
+
+void VulkanDevice::destroy(VulkanBuffer &buffer) const {
+  if (buffer.buffer != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device, buffer.buffer, nullptr);
+    vkFreeMemory(device, buffer.memory, nullptr);
+  }
+  buffer = VulkanBuffer{};
+}
+
+void VulkanDevice::destroy(VulkanImage &image) const {
+  if (image.image != VK_NULL_HANDLE) {
+    vkDestroyImageView(device, image.view, nullptr);
+    vkDestroyImage(device, image.image, nullptr);
+    vkFreeMemory(device, image.memory, nullptr);
+  }
+  image = VulkanImage{};
+}
+
+} // namespace Penumbra
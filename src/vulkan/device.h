@@ -0,0 +1,82 @@
+/* Copyright (c) 2017 Big Ladder Software LLC. All rights reserved.
+ * See the LICENSE file for additional terms and conditions. */
+
+#ifndef VULKAN_DEVICE_H_
+#define VULKAN_DEVICE_H_
+
+// Standard
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Vendor
+#include <vulkan/vulkan.h>
+#include <courierr/courierr.h>
+
+namespace Penumbra {
+
+// Buffer or image memory bound to its object
+struct VulkanBuffer {
+  VkBuffer buffer{VK_NULL_HANDLE};
+  VkDeviceMemory memory{VK_NULL_HANDLE};
+};
+
+struct VulkanImage {
+  VkImage image{VK_NULL_HANDLE};
+  VkDeviceMemory memory{VK_NULL_HANDLE};
+  VkImageView view{VK_NULL_HANDLE};
+};
+
+// A Vulkan instance and logical device with one graphics queue. Devices must support precise
+// occlusion queries. Discrete and integrated GPUs are preferred over virtual and software (e.g.,
+// Mesa's lavapipe) devices.
+class VulkanDevice {
+public:
+  ~VulkanDevice();
+  VulkanDevice(const VulkanDevice &) = delete;
+  VulkanDevice &operator=(const VulkanDevice &) = delete;
+
+  // Returns nullptr if no suitable device is found
+  static std::unique_ptr<VulkanDevice> create(Courierr::Courierr *logger = nullptr);
+
+  [[nodiscard]] VkDevice get() const;
+  [[nodiscard]] VkQueue get_queue() const;
+  [[nodiscard]] std::uint32_t get_queue_family_index() const;
+  [[nodiscard]] const VkPhysicalDeviceLimits &get_limits() const;
+  [[nodiscard]] VkFormat get_depth_format() const;
+
+  // Throws, naming the operation, unless the result is VK_SUCCESS
+  void check(VkResult result, const char *operation) const;
+
+  // Device local buffer holding size bytes of data, copied through a staging buffer
+  VulkanBuffer create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, const void *data);
+  // Depth attachment of size pixels on each side, in the device's depth format
+  VulkanImage create_depth_image(std::uint32_t size);
+  void destroy(VulkanBuffer &buffer) const;
+  void destroy(VulkanImage &image) const;
+
+private:
+  VulkanDevice() = default;
+  bool initialize(Courierr::Courierr *logger);
+  VkInstance instance{VK_NULL_HANDLE};
+  VkPhysicalDevice physical_device{VK_NULL_HANDLE};
+  VkDevice device{VK_NULL_HANDLE};
+  VkQueue queue{VK_NULL_HANDLE};
+  std::uint32_t queue_family_index{0u};
+  VkPhysicalDeviceProperties properties{};
+  VkPhysicalDeviceMemoryProperties memory_properties{};
+  VkFormat depth_format{VK_FORMAT_UNDEFINED};
+  VkCommandPool transfer_command_pool{VK_NULL_HANDLE}; // For staging copies
+  Courierr::Courierr *logger{nullptr};
+
+  // Memory type with the properties among the allowed types (bits of type_bits). Throws if none.
+  std::uint32_t find_memory_type(std::uint32_t type_bits, VkMemoryPropertyFlags properties) const;
+  VkDeviceMemory allocate_memory(const VkMemoryRequirements &requirements,
+                                 VkMemoryPropertyFlags properties);
+  // Records commands into a one time command buffer, submits it, and waits for it to finish
+  void submit_once(const std::function<void(VkCommandBuffer)> &record);
+};
+
+} // namespace Penumbra
+
+#endif // VULKAN_DEVICE_H_
@@ -2,7 +2,11 @@
  * See the LICENSE file for additional terms and conditions. */
 
 #define _USE_MATH_DEFINES
+#include <array>
 #include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
 
 #include "gtest/gtest.h"
 
@@ -31,6 +35,80 @@ float calculate_surface_exposure(float azimuth, float altitude) {
 
 const std::string invalid_context_string = "A valid context could not be created. Test skipped.";
 
+// A Penumbra for each backend available, starting with polygon clipping (exact)
+std::vector<std::unique_ptr<Penumbra::Penumbra>> create_backends() {
+  std::vector<std::unique_ptr<Penumbra::Penumbra>> penumbras;
+  for (auto const backend : {Penumbra::CalculationBackend::polygon_clipping,
+                             Penumbra::CalculationBackend::software_rasterizer,
+                             Penumbra::CalculationBackend::ray_casting,
+                             Penumbra::CalculationBackend::opengl,
+                             Penumbra::CalculationBackend::vulkan}) {
+    if (Penumbra::Penumbra::is_valid_backend(backend)) {
+      penumbras.push_back(std::make_unique<Penumbra::Penumbra>(512u, backend));
+    }
+  }
+  return penumbras;
+}
+
+// A unit wall facing south (-y), shaded by an awning halfway up and a fin along its east edge
+std::vector<Penumbra::Surface> create_shaded_wall(bool with_fin = true) {
+  std::vector<Penumbra::Surface> surfaces{
+      Penumbra::Surface({0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 1.f, 0.f, 0.f, 1.f}, "Wall"),
+      Penumbra::Surface({0.f, 0.f, 0.5f, 1.f, 0.f, 0.5f, 1.f, -0.5f, 0.5f, 0.f, -0.5f, 0.5f},
+                        "Awning")};
+  if (with_fin) {
+    surfaces.emplace_back(
+        Penumbra::Polygon{1.f, -0.5f, 1.f, 1.f, -0.5f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 1.f}, "Fin");
+  }
+  return surfaces;
+}
+
+void set_model(Penumbra::Penumbra &penumbra, const std::vector<Penumbra::Surface> &surfaces) {
+  for (auto const &surface : surfaces) {
+    penumbra.add_surface(surface);
+  }
+  penumbra.set_model();
+}
+
+// Expects every surface's PSSA to match the reference's (with the same model) at each sun
+// position, within the tolerance plus the relative tolerance of the reference PSSA
+void expect_matching_pssas(Penumbra::Penumbra &penumbra, Penumbra::Penumbra &reference,
+                           const std::vector<std::pair<float, float>> &sun_positions,
+                           float tolerance, float relative_tolerance = 0.f,
+                           const std::string &step = "") {
+  for (auto const &sun_position : sun_positions) {
+    penumbra.set_sun_position(sun_position.first, sun_position.second);
+    reference.set_sun_position(sun_position.first, sun_position.second);
+    auto const pssas = penumbra.calculate_pssa();
+    auto const expected = reference.calculate_pssa();
+    ASSERT_EQ(pssas.size(), expected.size()) << step;
+    for (std::size_t i = 0; i < pssas.size(); ++i) {
+      EXPECT_NEAR(pssas[i], expected[i], tolerance + relative_tolerance * expected[i])
+          << step << "surface " << i << " at azimuth " << sun_position.first << ", altitude "
+          << sun_position.second;
+    }
+  }
+}
+
+// Expects the models (each set after the same edits) to match one built from the edited surfaces:
+// the same potential shaders, and PSSAs matching exactly with polygon clipping, or within 0.01
+void expect_matching_models(const std::vector<std::unique_ptr<Penumbra::Penumbra>> &penumbras,
+                            const std::function<void(Penumbra::Penumbra &)> &add_surfaces,
+                            const std::string &step) {
+  Penumbra::Penumbra built(512u, Penumbra::CalculationBackend::polygon_clipping);
+  add_surfaces(built);
+  built.set_model();
+  auto const potential_shaders = built.get_potential_shaders();
+  for (std::size_t backend = 0; backend < penumbras.size(); ++backend) {
+    auto &penumbra = *penumbras[backend];
+    EXPECT_EQ(penumbra.get_potential_shaders(), potential_shaders)
+        << "backend " << backend << ", " << step;
+    expect_matching_pssas(penumbra, built, {{m_pi_f, 0.6f}, {2.5f, 0.3f}, {3.6f, 1.2f}},
+                          backend == 0 ? 0.0001f : 0.01f, 0.f,
+                          "backend " + std::to_string(backend) + ", " + step + ", ");
+  }
+}
+
 TEST(PenumbraTest, check_azimuth) {
 
   if (!Penumbra::Penumbra::is_valid_context()) {
@@ -213,6 +291,40 @@ TEST(PenumbraTest, interior) {
   // right_wall_id});
 }
 
+TEST(PenumbraTest, interior_adjacent_windows) {
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+  // Two windows, next to each other in the model, light a back wall through a front wall
+  Penumbra::Polygon left_window_polygon = {-0.75f, 0.5f, -0.25f, -0.25f, 0.5f, -0.25f,
+                                           -0.25f, 0.5f, 0.25f,  -0.75f, 0.5f, 0.25f};
+  Penumbra::Polygon right_window_polygon = {0.25f, 0.5f, -0.25f, 0.75f, 0.5f, -0.25f,
+                                            0.75f, 0.5f, 0.25f,  0.25f, 0.5f, 0.25f};
+  Penumbra::Surface front_wall(
+      {-1.f, 0.5f, -0.5f, 1.f, 0.5f, -0.5f, 1.f, 0.5f, 0.5f, -1.f, 0.5f, 0.5f});
+  front_wall.add_hole(left_window_polygon);
+  front_wall.add_hole(right_window_polygon);
+  Penumbra::Surface back_wall(
+      {1.f, -0.5f, -0.5f, -1.f, -0.5f, -0.5f, -1.f, -0.5f, 0.5f, 1.f, -0.5f, 0.5f});
+
+  Penumbra::Penumbra penumbra;
+  unsigned int const front_wall_id = penumbra.add_surface(front_wall);
+  unsigned int const left_window_id = penumbra.add_surface(Penumbra::Surface(left_window_polygon));
+  unsigned int const right_window_id =
+      penumbra.add_surface(Penumbra::Surface(right_window_polygon));
+  unsigned int const back_wall_id = penumbra.add_surface(back_wall);
+  penumbra.set_model();
+  penumbra.set_sun_position(0.f, 0.f);
+
+  EXPECT_NEAR(penumbra.calculate_interior_pssas({left_window_id}, {back_wall_id})[back_wall_id],
+              0.25f, 0.01);
+  // With the wall transparent too (the projection fits the first transparent surface), nothing
+  // between the adjacent transparent surfaces is drawn
+  EXPECT_NEAR(penumbra.calculate_interior_pssas({front_wall_id, left_window_id, right_window_id},
+                                                {back_wall_id})[back_wall_id],
+              2.f, 0.01);
+}
+
 TEST(PenumbraTest, calculate_pssa_multiple_surfaces) {
   if (!Penumbra::Penumbra::is_valid_context()) {
     GTEST_SKIP() << invalid_context_string << std::endl;
@@ -378,6 +490,1034 @@ TEST(PenumbraTest, calculate_pssa_multiple_surfaces) {
   }
 }
 
+TEST(PenumbraTest, surface_id_buffer) {
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  Penumbra::Penumbra penumbra;
+  Penumbra::Penumbra per_surface;
+  for (auto *calculator : {&penumbra, &per_surface}) {
+    set_model(*calculator, create_shaded_wall());
+  }
+
+  EXPECT_EQ(penumbra.get_calculation_mode(), Penumbra::CalculationMode::per_surface);
+  penumbra.set_calculation_mode(Penumbra::CalculationMode::surface_id_buffer);
+  expect_matching_pssas(
+      penumbra, per_surface,
+      {{0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {m_pi_f, 0.2f}}, 0.01f);
+
+  // Surface IDs follow edits to the model: a wider awning, with more triangles than its index
+  // range holds, and a disabled fin
+  const Penumbra::Surface wide_awning({0.f, 0.f, 0.5f, 1.f, 0.f, 0.5f, 1.2f, -0.25f, 0.5f, 1.f,
+                                       -0.5f, 0.5f, 0.f, -0.5f, 0.5f, -0.2f, -0.25f, 0.5f});
+  for (auto *calculator : {&penumbra, &per_surface}) {
+    calculator->update_surface(1, wide_awning);
+    calculator->set_surface_enabled(2, false);
+    calculator->set_model();
+  }
+  expect_matching_pssas(penumbra, per_surface, {{m_pi_4_f, 0.3f}, {-0.5f, 0.8f}}, 0.01f, 0.f,
+                        "edited, ");
+
+  // Single surface submissions still use per-surface projections
+  penumbra.set_sun_position(0.0f, 0.0f);
+  EXPECT_NEAR(penumbra.calculate_pssa(0), 1.f, 0.01);
+}
+
+TEST(PenumbraTest, shared_depth_buffer) {
+  auto const surfaces = create_shaded_wall();
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  set_model(clipping, surfaces);
+  std::vector<Penumbra::CalculationBackend> backends{
+      Penumbra::CalculationBackend::software_rasterizer};
+  if (Penumbra::Penumbra::is_valid_context()) {
+    backends.push_back(Penumbra::CalculationBackend::opengl);
+  }
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {m_pi_f, 0.2f}};
+
+  for (auto const backend : backends) {
+    Penumbra::Penumbra penumbra(512u, backend);
+    Penumbra::Penumbra per_surface(512u, backend);
+    for (auto *calculator : {&penumbra, &per_surface}) {
+      set_model(*calculator, surfaces);
+    }
+    penumbra.set_calculation_mode(Penumbra::CalculationMode::shared_depth_buffer);
+    EXPECT_EQ(penumbra.get_calculation_mode(), Penumbra::CalculationMode::shared_depth_buffer);
+    EXPECT_EQ(penumbra.get_minimum_shared_depth_pixels(), 0u);
+    expect_matching_pssas(penumbra, clipping, sun_positions, 0.01f);
+
+    // Surfaces below the minimum size are rendered individually, as in per surface mode
+    penumbra.set_minimum_shared_depth_pixels(1000000u);
+    expect_matching_pssas(penumbra, per_surface, sun_positions, 0.f);
+  }
+}
+
+TEST(PenumbraTest, coplanar_groups) {
+  // A facade of windows shaded by overhangs, with a vent too small to count in its group, and a
+  // distant wing in the same plane, grouped apart from it
+  auto const rectangle = [](float x0, float x1, float z0, float z1) {
+    return Penumbra::Polygon{x0, 0.f, z0, x1, 0.f, z0, x1, 0.f, z1, x0, 0.f, z1};
+  };
+  auto const overhang = [](float x0, float x1, float z) {
+    return Penumbra::Surface({x0, 0.f, z, x1, 0.f, z, x1, -0.5f, z, x0, -0.5f, z});
+  };
+  std::vector<Penumbra::Surface> surfaces;
+  Penumbra::Surface wall(rectangle(0.f, 8.f, 0.f, 3.f), "Wall");
+  for (int i = 0; i < 4; ++i) {
+    auto const x = 1.f + 2.f * static_cast<float>(i);
+    wall.add_hole(rectangle(x, x + 1.f, 1.f, 2.f));
+    surfaces.emplace_back(rectangle(x, x + 1.f, 1.f, 2.f));
+    surfaces.push_back(overhang(x - 0.2f, x + 1.2f, 2.2f));
+  }
+  wall.add_hole(rectangle(0.2f, 0.22f, 0.2f, 0.22f));
+  surfaces.push_back(wall);
+  surfaces.emplace_back(rectangle(0.2f, 0.22f, 0.2f, 0.22f), "Vent");
+  auto const vent_index = surfaces.size() - 1u;
+  Penumbra::Surface wing(rectangle(60.f, 64.f, 0.f, 3.f), "Wing");
+  wing.add_hole(rectangle(61.f, 62.f, 1.f, 2.f));
+  surfaces.push_back(wing);
+  surfaces.emplace_back(rectangle(61.f, 62.f, 1.f, 2.f));
+  surfaces.push_back(overhang(60.8f, 62.2f, 2.2f));
+
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  set_model(clipping, surfaces);
+  std::vector<Penumbra::CalculationBackend> backends{
+      Penumbra::CalculationBackend::software_rasterizer};
+  if (Penumbra::Penumbra::is_valid_context()) {
+    backends.push_back(Penumbra::CalculationBackend::opengl);
+  }
+  if (Penumbra::Penumbra::is_valid_backend(Penumbra::CalculationBackend::vulkan)) {
+    backends.push_back(Penumbra::CalculationBackend::vulkan);
+  }
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {m_pi_f, 0.6f}, {2.5f, 0.3f}, {3.6f, 1.1f}, {0.0f, 0.5f}};
+
+  for (auto const backend : backends) {
+    Penumbra::Penumbra penumbra(512u, backend);
+    Penumbra::Penumbra per_surface(512u, backend);
+    for (auto *calculator : {&penumbra, &per_surface}) {
+      set_model(*calculator, surfaces);
+    }
+    penumbra.set_calculation_mode(Penumbra::CalculationMode::coplanar_groups);
+    expect_matching_pssas(penumbra, clipping, sun_positions, 0.001f, 0.01f);
+
+    for (auto const &sun_position : sun_positions) {
+      // Too small to count against its group's depth buffer, so rendered on its own
+      penumbra.set_sun_position(sun_position.first, sun_position.second);
+      per_surface.set_sun_position(sun_position.first, sun_position.second);
+      EXPECT_EQ(penumbra.calculate_pssa()[vent_index], per_surface.calculate_pssa()[vent_index])
+          << "azimuth " << sun_position.first;
+    }
+
+    // Every receiver below the minimum size is rendered individually
+    penumbra.set_minimum_shared_depth_pixels(1000000u);
+    expect_matching_pssas(penumbra, per_surface, sun_positions, 0.f);
+  }
+}
+
+TEST(PenumbraTest, target_accuracy) {
+  auto const surfaces = create_shaded_wall(false);
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  set_model(clipping, surfaces);
+  EXPECT_THROW(clipping.set_target_accuracy(-0.1f), Penumbra::PenumbraException);
+
+  std::vector<Penumbra::CalculationBackend> backends{
+      Penumbra::CalculationBackend::software_rasterizer,
+      Penumbra::CalculationBackend::ray_casting};
+  if (Penumbra::Penumbra::is_valid_context()) {
+    backends.push_back(Penumbra::CalculationBackend::opengl);
+  }
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {m_pi_f, 0.3f}, {2.5f, 0.8f}, {-2.8f, 0.5f}};
+
+  for (auto const backend : backends) {
+    Penumbra::Penumbra penumbra(512u, backend);
+    set_model(penumbra, surfaces);
+    EXPECT_EQ(penumbra.get_target_accuracy(), 0.f);
+
+    // Coarser rendering stays within the target
+    penumbra.set_target_accuracy(0.02f);
+    expect_matching_pssas(penumbra, clipping, sun_positions, 0.02f);
+
+    // With larger error estimates
+    for (auto const &sun_position : sun_positions) {
+      penumbra.set_sun_position(sun_position.first, sun_position.second);
+      clipping.set_sun_position(sun_position.first, sun_position.second);
+      std::vector<float> exact_results = clipping.calculate_pssa();
+      EXPECT_EQ(clipping.get_pssa_error(), std::vector<float>(exact_results.size(), 0.f));
+
+      penumbra.set_target_accuracy(0.f);
+      penumbra.calculate_pssa();
+      std::vector<float> full_resolution_errors = penumbra.get_pssa_error();
+      penumbra.set_target_accuracy(0.02f);
+      penumbra.calculate_pssa();
+      std::vector<float> errors = penumbra.get_pssa_error();
+      for (std::size_t i = 0; i < exact_results.size(); ++i) {
+        EXPECT_GT(full_resolution_errors[i], 0.f);
+        EXPECT_GE(errors[i], full_resolution_errors[i]);
+        EXPECT_LE(errors[i], 0.02f * exact_results[i] + full_resolution_errors[i])
+            << "surface " << i << " at azimuth " << sun_position.first;
+      }
+    }
+  }
+}
+
+TEST(PenumbraTest, multisampling) {
+  auto const surfaces = create_shaded_wall(false);
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  set_model(clipping, surfaces);
+  EXPECT_THROW(clipping.set_samples_per_pixel(0u), Penumbra::PenumbraException);
+  EXPECT_THROW(clipping.set_samples_per_pixel(4u), Penumbra::PenumbraException);
+  clipping.set_samples_per_pixel(1u);
+  EXPECT_EQ(clipping.get_samples_per_pixel(), 1u);
+
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  // Multisampling at a low resolution
+  Penumbra::Penumbra penumbra(64u, Penumbra::CalculationBackend::opengl);
+  set_model(penumbra, surfaces);
+  penumbra.set_samples_per_pixel(4u);
+  EXPECT_GE(penumbra.get_samples_per_pixel(), 1u);
+
+  for (auto const mode :
+       {Penumbra::CalculationMode::per_surface, Penumbra::CalculationMode::shared_depth_buffer}) {
+    penumbra.set_calculation_mode(mode);
+    expect_matching_pssas(penumbra, clipping, {{m_pi_f, 0.3f}, {2.5f, 0.8f}, {-2.8f, 0.5f}},
+                          0.01f);
+  }
+}
+
+TEST(PenumbraTest, tiled_rendering) {
+  auto const surfaces = create_shaded_wall();
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  set_model(clipping, surfaces);
+  EXPECT_THROW(clipping.set_maximum_tile_size(100u), Penumbra::PenumbraException);
+  clipping.set_maximum_tile_size(0u);
+
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  // Tiles smaller than the size, which they do not divide evenly
+  Penumbra::Penumbra tiled;
+  Penumbra::Penumbra untiled;
+  for (auto *penumbra : {&tiled, &untiled}) {
+    set_model(*penumbra, surfaces);
+  }
+  tiled.set_maximum_tile_size(200u);
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {m_pi_f, 0.6f}};
+  for (auto const mode :
+       {Penumbra::CalculationMode::per_surface, Penumbra::CalculationMode::surface_id_buffer}) {
+    tiled.set_calculation_mode(mode);
+    untiled.set_calculation_mode(mode);
+    expect_matching_pssas(tiled, untiled, sun_positions, 0.0001f);
+    expect_matching_pssas(tiled, clipping, sun_positions, 0.01f);
+  }
+
+  // Queued calculations and several sun positions at once
+  for (auto *penumbra : {&tiled, &untiled}) {
+    penumbra->set_calculation_mode(Penumbra::CalculationMode::per_surface);
+  }
+  tiled.set_sun_position(sun_positions[1].first, sun_positions[1].second);
+  untiled.set_sun_position(sun_positions[1].first, sun_positions[1].second);
+  auto const ticket = tiled.queue_pssa();
+  auto const untiled_results = untiled.calculate_pssa();
+  auto const queued_results = tiled.retrieve_queued_pssa(ticket);
+  for (std::size_t i = 0; i < untiled_results.size(); ++i) {
+    EXPECT_NEAR(queued_results[i], untiled_results[i], 0.0001) << "surface " << i;
+  }
+  auto const tiled_results = tiled.calculate_pssa(0, sun_positions);
+  auto const clipping_results = clipping.calculate_pssa(0, sun_positions);
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    EXPECT_NEAR(tiled_results[i], clipping_results[i], 0.01) << "sun position " << i;
+  }
+
+  // Without the limit, the size is rendered whole again
+  tiled.set_maximum_tile_size(0u);
+  expect_matching_pssas(tiled, untiled, sun_positions, 0.f);
+}
+
+TEST(PenumbraTest, multiple_sun_positions) {
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  Penumbra::Penumbra penumbra;
+  set_model(penumbra, create_shaded_wall(false));
+  unsigned int const wall_id{0u};
+
+  // More positions than a single batch to exercise partial batches
+  std::vector<std::pair<float, float>> sun_positions;
+  for (int i = 0; i < 37; ++i) {
+    sun_positions.emplace_back(-1.2f + 0.065f * static_cast<float>(i),
+                               0.05f + 0.04f * static_cast<float>(i));
+  }
+
+  std::vector<float> batched_results = penumbra.calculate_pssa(wall_id, sun_positions);
+  ASSERT_EQ(batched_results.size(), sun_positions.size());
+
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    penumbra.set_sun_position(sun_positions[i].first, sun_positions[i].second);
+    EXPECT_NEAR(batched_results[i], penumbra.calculate_pssa(wall_id), 0.0001)
+        << "sun position " << i;
+  }
+}
+
+TEST(PenumbraTest, queued_pssas) {
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  Penumbra::Penumbra penumbra;
+  set_model(penumbra, create_shaded_wall(false));
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {0.2f, 0.5f}};
+
+  // Keep several sun positions in flight before retrieving any results
+  std::vector<unsigned int> tickets;
+  for (auto const &sun_position : sun_positions) {
+    penumbra.set_sun_position(sun_position.first, sun_position.second);
+    tickets.push_back(penumbra.queue_pssa());
+  }
+  EXPECT_THROW(penumbra.queue_pssa(), Penumbra::PenumbraException);
+
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    std::vector<float> queued_results = penumbra.retrieve_queued_pssa(tickets[i]);
+    penumbra.set_sun_position(sun_positions[i].first, sun_positions[i].second);
+    std::vector<float> results = penumbra.calculate_pssa();
+    ASSERT_EQ(queued_results.size(), results.size());
+    for (std::size_t j = 0; j < results.size(); ++j) {
+      EXPECT_NEAR(queued_results[j], results[j], 0.0001) << "sun position " << i;
+    }
+  }
+
+  // Tickets may only be retrieved once
+  EXPECT_THROW(penumbra.retrieve_queued_pssa(tickets[0]), Penumbra::PenumbraException);
+
+  auto const ticket = penumbra.queue_pssa({0});
+  while (!penumbra.is_pssa_ready(ticket)) {
+  }
+  EXPECT_EQ(penumbra.retrieve_queued_pssa(ticket).size(), 1u);
+}
+
+TEST(PenumbraTest, sky_grid) {
+  Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::polygon_clipping);
+  EXPECT_THROW(penumbra.calculate_sky_grid(8u, 4u), Penumbra::PenumbraException);
+  set_model(penumbra, create_shaded_wall());
+  penumbra.set_sun_position(0.3f, 0.4f);
+
+  EXPECT_THROW(penumbra.interpolate_pssa(0.f, 0.5f), Penumbra::PenumbraException);
+  EXPECT_THROW(penumbra.calculate_sky_grid(0u, 4u), Penumbra::PenumbraException);
+
+  // Grid corners hold the PSSAs calculated there, from every azimuth and altitude step
+  penumbra.calculate_sky_grid(8u, 4u);
+  EXPECT_EQ(penumbra.get_sky_grid_size(), 8u * 5u);
+  EXPECT_EQ(penumbra.get_sun_azimuth(), 0.3f);
+  EXPECT_EQ(penumbra.get_sun_altitude(), 0.4f);
+  std::vector<float> interpolated = penumbra.interpolate_pssa(3.f * m_pi_4_f, m_pi_4_f);
+  penumbra.set_sun_position(3.f * m_pi_4_f, m_pi_4_f);
+  std::vector<float> calculated = penumbra.calculate_pssa();
+  ASSERT_EQ(interpolated.size(), calculated.size());
+  for (std::size_t i = 0; i < calculated.size(); ++i) {
+    EXPECT_NEAR(interpolated[i], calculated[i], 0.0001) << "surface " << i;
+  }
+  // Azimuths wrap around the horizon
+  std::vector<float> wrapped = penumbra.interpolate_pssa(3.f * m_pi_4_f - 2.f * m_pi_f, m_pi_4_f);
+  for (std::size_t i = 0; i < calculated.size(); ++i) {
+    EXPECT_NEAR(wrapped[i], interpolated[i], 0.0001) << "surface " << i;
+  }
+  EXPECT_THROW(penumbra.interpolate_pssa(0.f, m_pi_2_f + 0.1f), Penumbra::PenumbraException);
+  EXPECT_THROW(penumbra.interpolate_pssa(0.f, -0.1f), Penumbra::PenumbraException);
+
+  // Refined cells interpolate closer to the PSSAs calculated between the corners
+  const std::vector<std::pair<float, float>> sun_positions{
+      {0.1f, 0.2f}, {m_pi_4_f + 0.1f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {m_pi_f, 1.2f}};
+  auto const max_error = [&]() {
+    float error{0.f};
+    for (auto const &sun_position : sun_positions) {
+      interpolated = penumbra.interpolate_pssa(sun_position.first, sun_position.second);
+      penumbra.set_sun_position(sun_position.first, sun_position.second);
+      calculated = penumbra.calculate_pssa();
+      for (std::size_t i = 0; i < calculated.size(); ++i) {
+        error = std::max(error, std::abs(interpolated[i] - calculated[i]));
+      }
+    }
+    return error;
+  };
+  float const coarse_error = max_error();
+  penumbra.calculate_sky_grid(8u, 4u, 0.01f, 3u);
+  EXPECT_GT(penumbra.get_sky_grid_size(), 8u * 5u);
+  float const refined_error = max_error();
+  EXPECT_LT(refined_error, coarse_error);
+  EXPECT_LT(refined_error, 0.05f);
+
+  // Interpolation is continuous where refined cells meet larger ones
+  float max_step{0.f};
+  for (float const altitude : {0.3f, 0.7f, 1.1f}) {
+    std::vector<float> previous = penumbra.interpolate_pssa(0.f, altitude);
+    for (int step = 1; step <= 6284; ++step) {
+      auto const next = penumbra.interpolate_pssa(0.001f * static_cast<float>(step), altitude);
+      for (std::size_t i = 0; i < next.size(); ++i) {
+        max_step = std::max(max_step, std::abs(next[i] - previous[i]));
+      }
+      previous = next;
+    }
+  }
+  EXPECT_LT(max_step, 0.002f);
+
+  // The grid's calculations need the whole queue
+  auto const ticket = penumbra.queue_pssa();
+  EXPECT_THROW(penumbra.calculate_sky_grid(8u, 4u), Penumbra::PenumbraException);
+  penumbra.retrieve_queued_pssa(ticket);
+
+  // Changing the model discards the grid
+  penumbra.set_surface_enabled(2u, false);
+  penumbra.set_model();
+  EXPECT_EQ(penumbra.get_sky_grid_size(), 0u);
+  EXPECT_THROW(penumbra.interpolate_pssa(0.f, 0.5f), Penumbra::PenumbraException);
+
+  // Rasterized grids match the clipped grid within the rasterization error
+  Penumbra::Penumbra software(256u, Penumbra::CalculationBackend::software_rasterizer);
+  set_model(software, create_shaded_wall(false));
+  software.calculate_sky_grid(8u, 4u);
+  penumbra.calculate_sky_grid(8u, 4u);
+  for (auto const &sun_position : sun_positions) {
+    std::vector<float> rasterized = software.interpolate_pssa(sun_position.first,
+                                                              sun_position.second);
+    std::vector<float> clipped = penumbra.interpolate_pssa(sun_position.first,
+                                                           sun_position.second);
+    EXPECT_NEAR(rasterized[0], clipped[0], 0.01) << "azimuth " << sun_position.first;
+    EXPECT_NEAR(rasterized[1], clipped[1], 0.01) << "azimuth " << sun_position.first;
+  }
+}
+
+TEST(PenumbraTest, frustum_culling) {
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  // A row of walls with awnings, and a distant free-standing screen. Each wall's view only
+  // contains its neighbors, except when the sun is behind the screen.
+  Penumbra::Penumbra opengl;
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  for (auto penumbra : {&opengl, &clipping}) {
+    for (int i = 0; i < 12; ++i) {
+      auto const x = static_cast<float>(i);
+      penumbra->add_surface(
+          Penumbra::Surface({x, 0.f, 0.f, x + 1.f, 0.f, 0.f, x + 1.f, 0.f, 1.f, x, 0.f, 1.f}));
+      penumbra->add_surface(Penumbra::Surface(
+          {x, 0.f, 0.5f, x + 1.f, 0.f, 0.5f, x + 1.f, -0.5f, 0.5f, x, -0.5f, 0.5f}));
+    }
+    penumbra->add_surface(
+        Penumbra::Surface({3.f, -6.f, 0.f, 5.5f, -6.f, 0.f, 5.5f, -6.f, 2.f, 3.f, -6.f, 2.f}));
+    penumbra->set_model();
+  }
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {m_pi_f, 0.1f}, {m_pi_f, 0.3f}, {2.8f, 0.2f}, {3.6f, 0.6f}, {m_pi_2_f, 0.4f}};
+  expect_matching_pssas(opengl, clipping, sun_positions, 0.01f);
+
+  // Batched views draw the surfaces found for any view in the batch
+  unsigned int const shaded_wall{8u}; // Behind the screen at low altitudes
+  std::vector<float> batched_results = opengl.calculate_pssa(shaded_wall, sun_positions);
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    clipping.set_sun_position(sun_positions[i].first, sun_positions[i].second);
+    EXPECT_NEAR(batched_results[i], clipping.calculate_pssa(shaded_wall), 0.01)
+        << "sun position " << i;
+  }
+}
+
+TEST(PenumbraTest, potential_shaders) {
+  auto surfaces = create_shaded_wall();
+  Penumbra::Surface neighbor({1.f, 0.f, 0.f, 2.f, 0.f, 0.f, 2.f, 0.f, 1.f, 1.f, 0.f, 1.f},
+                             "Coplanar neighbor");
+  Penumbra::Surface back({0.f, 1.f, 0.f, 1.f, 1.f, 0.f, 1.f, 1.f, 1.f, 0.f, 1.f, 1.f}, "Back");
+
+  Penumbra::Penumbra penumbra(512u, Penumbra::CalculationBackend::polygon_clipping);
+  surfaces.push_back(neighbor);
+  surfaces.push_back(back);
+  for (auto const &surface : surfaces) {
+    penumbra.add_surface(surface);
+  }
+  EXPECT_THROW(penumbra.get_potential_shaders(0), Penumbra::PenumbraException);
+  penumbra.set_model();
+
+  // The wall and its neighbor face south (-y), the awning faces down, the fin faces east (+x),
+  // and the back surface faces the back of the wall
+  EXPECT_EQ(penumbra.get_potential_shaders(0), (std::vector<unsigned int>{1, 2}));
+  EXPECT_EQ(penumbra.get_potential_shaders(1), (std::vector<unsigned int>{0, 2, 3, 4}));
+  EXPECT_EQ(penumbra.get_potential_shaders(2), (std::vector<unsigned int>{3}));
+  EXPECT_EQ(penumbra.get_potential_shaders(3), (std::vector<unsigned int>{1, 2}));
+  EXPECT_EQ(penumbra.get_potential_shaders(4), (std::vector<unsigned int>{0, 1, 2, 3}));
+  auto const potential_shaders = penumbra.get_potential_shaders();
+  ASSERT_EQ(potential_shaders.size(), 5u);
+  for (unsigned int i = 0; i < potential_shaders.size(); ++i) {
+    EXPECT_EQ(potential_shaders[i], penumbra.get_potential_shaders(i));
+  }
+  EXPECT_THROW(penumbra.get_potential_shaders(5), Penumbra::SurfaceException);
+
+  // Surfaces added since the model was set have none until it is set again
+  penumbra.add_surface(surfaces[1]);
+  EXPECT_EQ(penumbra.get_potential_shaders().size(), 5u);
+  EXPECT_EQ(penumbra.get_pssa_error().size(), 5u);
+  EXPECT_THROW(penumbra.get_potential_shaders(5), Penumbra::PenumbraException);
+  EXPECT_THROW(penumbra.get_pssa_error(5), Penumbra::PenumbraException);
+  penumbra.remove_surface(5);
+
+  // With the sun behind the wall, every surface is still considered: the back surface shades the
+  // wall's back up to tan(altitude)
+  float const altitude{0.4f};
+  penumbra.set_sun_position(0.f, altitude);
+  EXPECT_NEAR(penumbra.calculate_pssa(0), std::tan(altitude) * std::cos(altitude), 0.0001);
+}
+
+TEST(PenumbraTest, analytic_pssas) {
+  auto surfaces = create_shaded_wall(false);
+  Penumbra::Surface lone_wall({5.f, 0.f, 0.f, 6.f, 0.f, 0.f, 6.f, 0.f, 1.f, 5.f, 0.f, 1.f},
+                              "Lone wall");
+
+  std::vector<Penumbra::CalculationBackend> backends{
+      Penumbra::CalculationBackend::software_rasterizer,
+      Penumbra::CalculationBackend::polygon_clipping, Penumbra::CalculationBackend::ray_casting};
+  if (Penumbra::Penumbra::is_valid_context()) {
+    backends.push_back(Penumbra::CalculationBackend::opengl);
+  }
+  if (Penumbra::Penumbra::is_valid_backend(Penumbra::CalculationBackend::vulkan)) {
+    backends.push_back(Penumbra::CalculationBackend::vulkan);
+  }
+
+  float const altitude{0.4f};
+  const std::vector<std::pair<float, float>> sun_positions{
+      {m_pi_f, altitude}, {0.f, altitude}, {m_pi_f, -altitude}};
+
+  for (auto const backend : backends) {
+    Penumbra::Penumbra penumbra(512u, backend);
+    set_model(penumbra, surfaces);
+    unsigned int const lone_wall_id = penumbra.add_surface(lone_wall);
+    penumbra.set_model();
+    EXPECT_FALSE(penumbra.get_back_face_culling());
+    EXPECT_FALSE(penumbra.get_horizon_culling());
+
+    // Both sides are sunlit by default. Nothing may shade the lone wall from either side.
+    penumbra.set_sun_position(0.f, altitude);
+    auto results = penumbra.calculate_pssa();
+    EXPECT_NEAR(results[lone_wall_id], std::cos(altitude), 0.0001);
+    auto statistics = penumbra.get_pssa_statistics();
+    EXPECT_EQ(statistics.unshaded, 1u);
+    EXPECT_EQ(statistics.rendered, 2u);
+    EXPECT_EQ(statistics.back_facing + statistics.sun_below_horizon, 0u);
+
+    penumbra.reset_pssa_statistics();
+    penumbra.set_back_face_culling(true);
+    penumbra.set_horizon_culling(true);
+
+    // Sun in front of the walls (south) and behind the awning (which faces down)
+    penumbra.set_sun_position(sun_positions[0].first, sun_positions[0].second);
+    results = penumbra.calculate_pssa();
+    EXPECT_GT(results[0], 0.f);
+    EXPECT_LT(results[0], std::cos(altitude));
+    EXPECT_EQ(results[1], 0.f);
+    EXPECT_NEAR(results[lone_wall_id], std::cos(altitude), 0.0001);
+    statistics = penumbra.get_pssa_statistics();
+    EXPECT_EQ(statistics.rendered, 1u);
+    EXPECT_EQ(statistics.back_facing, 1u);
+    EXPECT_EQ(statistics.unshaded, 1u);
+
+    // Sun behind every surface
+    penumbra.set_sun_position(sun_positions[1].first, sun_positions[1].second);
+    EXPECT_EQ(penumbra.calculate_pssa(), (std::vector<float>{0.f, 0.f, 0.f}));
+    EXPECT_EQ(penumbra.get_pssa_statistics().back_facing, 4u);
+
+    // Sun below the horizon
+    penumbra.set_sun_position(sun_positions[2].first, sun_positions[2].second);
+    EXPECT_EQ(penumbra.calculate_pssa(), (std::vector<float>{0.f, 0.f, 0.f}));
+    EXPECT_EQ(penumbra.get_pssa_statistics().sun_below_horizon, 3u);
+
+    // Several sun positions at once
+    auto const wall_results = penumbra.calculate_pssa(0, sun_positions);
+    EXPECT_NEAR(wall_results[0], results[0], 0.0001);
+    EXPECT_EQ(wall_results[1], 0.f);
+    EXPECT_EQ(wall_results[2], 0.f);
+
+    penumbra.reset_pssa_statistics();
+    statistics = penumbra.get_pssa_statistics();
+    EXPECT_EQ(statistics.sun_below_horizon + statistics.back_facing + statistics.unshaded +
+                  statistics.rendered,
+              0u);
+  }
+}
+
+TEST(PenumbraTest, gl_platforms) {
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  Penumbra::Surface wall({0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 1.f, 0.f, 0.f, 1.f}, "Wall");
+
+  {
+    Penumbra::Penumbra penumbra;
+    EXPECT_NE(penumbra.get_gl_platform(), Penumbra::GLPlatform::automatic);
+  }
+
+  for (auto const platform :
+       {Penumbra::GLPlatform::egl, Penumbra::GLPlatform::osmesa, Penumbra::GLPlatform::glfw}) {
+    if (!Penumbra::Penumbra::is_valid_context(platform)) {
+      continue;
+    }
+    Penumbra::Penumbra penumbra(512u, platform);
+    EXPECT_EQ(penumbra.get_gl_platform(), platform);
+    unsigned int wall_id = penumbra.add_surface(wall);
+    penumbra.set_model();
+    penumbra.set_sun_position(0.0f, 0.0f);
+    EXPECT_NEAR(penumbra.calculate_pssa(wall_id), 1.f, 0.01);
+  }
+}
+
+TEST(PenumbraTest, software_rasterizer) {
+  auto const surfaces = create_shaded_wall();
+
+  // Does not require an OpenGL context
+  Penumbra::Penumbra software(512u, Penumbra::CalculationBackend::software_rasterizer);
+  EXPECT_EQ(software.get_calculation_backend(),
+            Penumbra::CalculationBackend::software_rasterizer);
+  EXPECT_EQ(software.get_vendor_name(), Penumbra::VendorType::unknown);
+  set_model(software, surfaces);
+  unsigned int const wall_id{0u};
+
+  software.set_sun_position(0.0f, 0.0f);
+  EXPECT_NEAR(software.calculate_pssa(wall_id), 1.f, 0.01);
+  EXPECT_THROW(software.render_scene(wall_id), Penumbra::PenumbraException);
+
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  Penumbra::Penumbra opengl;
+  set_model(opengl, surfaces);
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {0.3f, 1.4f}};
+
+  for (auto const mode :
+       {Penumbra::CalculationMode::per_surface, Penumbra::CalculationMode::surface_id_buffer}) {
+    software.set_calculation_mode(mode);
+    opengl.set_calculation_mode(mode);
+    expect_matching_pssas(software, opengl, sun_positions, 0.01f);
+  }
+
+  software.set_calculation_mode(Penumbra::CalculationMode::per_surface);
+  std::vector<float> software_results = software.calculate_pssa(wall_id, sun_positions);
+  std::vector<float> opengl_results = opengl.calculate_pssa(wall_id, sun_positions);
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    EXPECT_NEAR(software_results[i], opengl_results[i], 0.01) << "sun position " << i;
+  }
+}
+
+TEST(PenumbraTest, polygon_clipping) {
+  auto const surfaces = create_shaded_wall();
+
+  // Does not require an OpenGL context, and results do not depend on size
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  Penumbra::Penumbra coarse_clipping(8u, Penumbra::CalculationBackend::polygon_clipping);
+  for (auto penumbra : {&clipping, &coarse_clipping}) {
+    set_model(*penumbra, create_shaded_wall(false));
+  }
+
+  // Sun facing the wall: the awning shades the wall from its edge down to
+  // 0.5 - 0.5 * tan(altitude)
+  for (auto const altitude : {0.3f, 0.6f, 1.2f}) {
+    float const lit_area = 0.5f + std::max(0.5f - 0.5f * std::tan(altitude), 0.f);
+    clipping.set_sun_position(m_pi_f, altitude);
+    coarse_clipping.set_sun_position(m_pi_f, altitude);
+    EXPECT_NEAR(clipping.calculate_pssa(0), lit_area * std::cos(altitude), 0.0001)
+        << "altitude " << altitude;
+    EXPECT_FLOAT_EQ(coarse_clipping.calculate_pssa(0), clipping.calculate_pssa(0));
+  }
+
+  if (!Penumbra::Penumbra::is_valid_context()) {
+    GTEST_SKIP() << invalid_context_string << std::endl;
+  }
+
+  clipping.clear_model();
+  Penumbra::Penumbra opengl;
+  for (auto penumbra : {&clipping, &opengl}) {
+    set_model(*penumbra, surfaces);
+  }
+  expect_matching_pssas(
+      opengl, clipping,
+      {{0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {0.3f, 1.4f}}, 0.01f);
+}
+
+TEST(PenumbraTest, ray_casting) {
+  // Does not require an OpenGL context. Compare to exact areas.
+  Penumbra::Penumbra ray_casting(512u, Penumbra::CalculationBackend::ray_casting);
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  EXPECT_EQ(ray_casting.get_calculation_backend(), Penumbra::CalculationBackend::ray_casting);
+  for (auto penumbra : {&ray_casting, &clipping}) {
+    set_model(*penumbra, create_shaded_wall());
+  }
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {0.3f, 1.4f}, {m_pi_f, 0.6f}};
+  for (auto const mode :
+       {Penumbra::CalculationMode::per_surface, Penumbra::CalculationMode::surface_id_buffer}) {
+    ray_casting.set_calculation_mode(mode);
+    expect_matching_pssas(ray_casting, clipping, sun_positions, 0.005f);
+  }
+
+  // Many sun positions at once
+  ray_casting.set_calculation_mode(Penumbra::CalculationMode::per_surface);
+  std::vector<float> ray_casting_results = ray_casting.calculate_pssa(0, sun_positions);
+  std::vector<float> clipping_results = clipping.calculate_pssa(0, sun_positions);
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    EXPECT_NEAR(ray_casting_results[i], clipping_results[i], 0.005) << "sun position " << i;
+  }
+}
+
+TEST(PenumbraTest, vulkan) {
+  if (!Penumbra::Penumbra::is_valid_backend(Penumbra::CalculationBackend::vulkan)) {
+    GTEST_SKIP() << "Vulkan backend is not available." << std::endl;
+  }
+  Penumbra::Penumbra vulkan(512u, Penumbra::CalculationBackend::vulkan);
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  EXPECT_EQ(vulkan.get_calculation_backend(), Penumbra::CalculationBackend::vulkan);
+  for (auto penumbra : {&vulkan, &clipping}) {
+    set_model(*penumbra, create_shaded_wall());
+  }
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {0.0f, 0.0f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {0.3f, 1.4f}, {m_pi_f, 0.6f}};
+  for (auto const mode :
+       {Penumbra::CalculationMode::per_surface, Penumbra::CalculationMode::shared_depth_buffer}) {
+    vulkan.set_calculation_mode(mode);
+    expect_matching_pssas(vulkan, clipping, sun_positions, 0.005f);
+  }
+
+  // Queued calculations and many sun positions at once
+  vulkan.set_calculation_mode(Penumbra::CalculationMode::per_surface);
+  std::vector<unsigned int> tickets;
+  for (auto const &sun_position : sun_positions) {
+    vulkan.set_sun_position(sun_position.first, sun_position.second);
+    tickets.push_back(vulkan.queue_pssa());
+    if (tickets.size() == 4u) {
+      break;
+    }
+  }
+  for (std::size_t i = 0; i < tickets.size(); ++i) {
+    clipping.set_sun_position(sun_positions[i].first, sun_positions[i].second);
+    std::vector<float> vulkan_results = vulkan.retrieve_queued_pssa(tickets[i]);
+    std::vector<float> clipping_results = clipping.calculate_pssa();
+    for (std::size_t j = 0; j < vulkan_results.size(); ++j) {
+      EXPECT_NEAR(vulkan_results[j], clipping_results[j], 0.005) << "queued calculation " << i;
+    }
+  }
+  std::vector<float> vulkan_results = vulkan.calculate_pssa(0, sun_positions);
+  std::vector<float> clipping_results = clipping.calculate_pssa(0, sun_positions);
+  for (std::size_t i = 0; i < sun_positions.size(); ++i) {
+    EXPECT_NEAR(vulkan_results[i], clipping_results[i], 0.005) << "sun position " << i;
+  }
+}
+
+TEST(PenumbraTest, shared_vertices) {
+  // A closed box and a canopy along its top edge share every corner
+  const std::vector<Penumbra::Polygon> box{
+      {0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 1.f, 0.f, 0.f, 1.f},  // Front
+      {1.f, 1.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 1.f, 1.f, 1.f, 1.f},  // Back
+      {0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 1.f, 1.f},  // Left
+      {1.f, 0.f, 0.f, 1.f, 1.f, 0.f, 1.f, 1.f, 1.f, 1.f, 0.f, 1.f},  // Right
+      {0.f, 0.f, 1.f, 1.f, 0.f, 1.f, 1.f, 1.f, 1.f, 0.f, 1.f, 1.f},  // Top
+      {0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 1.f, 1.f, 0.f, 1.f, 0.f, 0.f}}; // Bottom
+  Penumbra::Surface canopy({0.f, 0.f, 1.f, 0.f, -0.5f, 1.f, 1.f, -0.5f, 1.f, 1.f, 0.f, 1.f},
+                           "Canopy");
+
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  Penumbra::Penumbra software(512u, Penumbra::CalculationBackend::software_rasterizer);
+  std::vector<Penumbra::Penumbra *> penumbras{&clipping, &software};
+  std::unique_ptr<Penumbra::Penumbra> opengl;
+  if (Penumbra::Penumbra::is_valid_context()) {
+    opengl = std::make_unique<Penumbra::Penumbra>();
+    penumbras.push_back(opengl.get());
+  }
+
+  // Setting the model again, after adding a surface, indexes the new model's vertices
+  for (auto penumbra : penumbras) {
+    for (auto const &face : box) {
+      penumbra->add_surface(Penumbra::Surface(face));
+    }
+    penumbra->set_model();
+    penumbra->add_surface(canopy);
+    penumbra->set_model();
+  }
+
+  const std::vector<std::pair<float, float>> sun_positions{
+      {m_pi_f, 0.6f}, {m_pi_4_f, 0.3f}, {-0.5f, 0.8f}, {2.5f, 0.3f}, {0.3f, 1.4f}};
+  for (auto const &sun_position : sun_positions) {
+    std::vector<std::vector<float>> results;
+    for (auto penumbra : penumbras) {
+      penumbra->set_sun_position(sun_position.first, sun_position.second);
+      results.push_back(penumbra->calculate_pssa());
+    }
+    for (std::size_t backend = 1; backend < results.size(); ++backend) {
+      ASSERT_EQ(results[backend].size(), box.size() + 1u);
+      for (std::size_t i = 0; i < results[0].size(); ++i) {
+        EXPECT_NEAR(results[backend][i], results[0][i], 0.01)
+            << "backend " << backend << ", surface " << i << " at azimuth " << sun_position.first;
+      }
+    }
+  }
+
+  // Sun facing the front: the canopy shades it from its top edge down to 1 - 0.5 * tan(altitude)
+  clipping.set_sun_position(m_pi_f, 0.6f);
+  EXPECT_NEAR(clipping.calculate_pssa(0), (1.f - 0.5f * std::tan(0.6f)) * std::cos(0.6f), 0.0001);
+}
+
+TEST(PenumbraTest, triangulation) {
+  // A wall with two windows, shaded by a concave (L-shaped) panel, and a convex disk beside it
+  Penumbra::Surface wall({0.f, 0.f, 0.f, 4.f, 0.f, 0.f, 4.f, 0.f, 2.f, 0.f, 0.f, 2.f}, "Wall");
+  wall.add_hole({0.5f, 0.f, 0.5f, 1.5f, 0.f, 0.5f, 1.5f, 0.f, 1.5f, 0.5f, 0.f, 1.5f});
+  wall.add_hole({2.5f, 0.f, 0.5f, 3.5f, 0.f, 0.5f, 3.5f, 0.f, 1.5f, 2.5f, 0.f, 1.5f});
+  // Includes a vertex between collinear neighbors
+  Penumbra::Surface panel({1.f, -0.5f, 1.f, 2.f, -0.5f, 1.f, 3.f, -0.5f, 1.f, 3.f, -0.5f, 1.5f,
+                           2.f, -0.5f, 1.5f, 2.f, -0.5f, 2.5f, 1.f, -0.5f, 2.5f},
+                          "Panel");
+  Penumbra::Polygon disk_polygon;
+  constexpr int disk_sides{64};
+  for (int i = 0; i < disk_sides; ++i) {
+    float const angle = 2.f * m_pi_f * static_cast<float>(i) / disk_sides;
+    disk_polygon.insert(disk_polygon.end(),
+                        {6.f + std::cos(angle), -0.5f, 1.f + std::sin(angle)});
+  }
+  Penumbra::Surface disk(disk_polygon, "Disk");
+
+  Penumbra::Penumbra clipping(512u, Penumbra::CalculationBackend::polygon_clipping);
+  Penumbra::Penumbra software(512u, Penumbra::CalculationBackend::software_rasterizer);
+  for (auto penumbra : {&clipping, &software}) {
+    penumbra->add_surface(wall);
+    penumbra->add_surface(panel);
+    penumbra->add_surface(disk);
+    penumbra->set_model();
+  }
+
+  // Polygon clipping works on the surfaces' contours, so it checks the triangles rasterized
+  const std::vector<std::pair<float, float>> sun_positions{
+      {m_pi_f, 0.6f}, {2.5f, 0.3f}, {3.6f, 0.9f}, {m_pi_f, 1.2f}};
+  for (auto const &sun_position : sun_positions) {
+    clipping.set_sun_position(sun_position.first, sun_position.second);
+    software.set_sun_position(sun_position.first, sun_position.second);
+    auto const expected = clipping.calculate_pssa();
+    auto const pssas = software.calculate_pssa();
+    ASSERT_EQ(pssas.size(), 3u);
+    for (std::size_t i = 0; i < pssas.size(); ++i) {
+      EXPECT_NEAR(pssas[i], expected[i], 0.01f * std::max(expected[i], 1.f))
+          << "surface " << i << " at azimuth " << sun_position.first;
+    }
+  }
+
+  // Sun normal to the front: the whole panel is lit
+  software.set_sun_position(m_pi_f, 0.f);
+  EXPECT_NEAR(software.calculate_pssa(1), 2.f, 0.02f);
+}
+
+TEST(PenumbraTest, model_editing) {
+  const Penumbra::Surface wall({0.f, 0.f, 0.f, 2.f, 0.f, 0.f, 2.f, 0.f, 2.f, 0.f, 0.f, 2.f},
+                               "Wall");
+  const Penumbra::Surface overhang(
+      {0.f, 0.f, 2.f, 0.f, -0.5f, 2.f, 2.f, -0.5f, 2.f, 2.f, 0.f, 2.f}, "Overhang");
+  const Penumbra::Surface fin({2.f, 0.f, 0.f, 2.f, 0.f, 2.f, 2.f, -1.f, 2.f, 2.f, -1.f, 0.f},
+                              "Fin");
+  // Deeper, with more triangles than the overhang's index range holds
+  const Penumbra::Surface deep_overhang({0.f, 0.f, 2.f, -0.5f, -0.5f, 2.f, 0.f, -1.f, 2.f, 2.f,
+                                         -1.f, 2.f, 2.5f, -0.5f, 2.f, 2.f, 0.f, 2.f});
+
+  auto const penumbras = create_backends();
+  std::vector<std::function<void(Penumbra::Penumbra &)>> edits{[&](Penumbra::Penumbra &penumbra) {
+    penumbra.add_surface(wall);
+    penumbra.add_surface(overhang);
+    penumbra.add_surface(fin);
+  }};
+  for (auto const &penumbra : penumbras) {
+    edits.front()(*penumbra);
+    penumbra->set_model();
+  }
+
+  // After each edit, applied by set_model, the models match one built with the edited surfaces
+  auto const check = [&](const std::function<void(Penumbra::Penumbra &)> &edit) {
+    edits.push_back(edit);
+    for (auto const &penumbra : penumbras) {
+      edit(*penumbra);
+      penumbra->set_model();
+    }
+    expect_matching_models(
+        penumbras,
+        [&](Penumbra::Penumbra &built) {
+          for (auto const &previous_edit : edits) {
+            previous_edit(built);
+          }
+        },
+        "edit " + std::to_string(edits.size() - 1u));
+  };
+
+  auto &software = *penumbras[1];
+  check([&](Penumbra::Penumbra &penumbra) { penumbra.update_surface(1, deep_overhang); });
+  check([&](Penumbra::Penumbra &penumbra) { penumbra.set_surface_enabled(2, false); });
+  EXPECT_FALSE(software.get_surface_enabled(2));
+  EXPECT_EQ(software.calculate_pssa(2), 0.f);
+  check([&](Penumbra::Penumbra &penumbra) {
+    penumbra.update_surface(1, overhang); // Fits in the deeper overhang's index range
+    penumbra.set_surface_enabled(2, true);
+  });
+  check([&](Penumbra::Penumbra &penumbra) { penumbra.remove_surface(1); });
+  EXPECT_EQ(software.calculate_pssa(1), 0.f);
+  EXPECT_EQ(software.get_number_of_surfaces(), 3u);
+}
+
+TEST(PenumbraTest, surface_transforms) {
+  const Penumbra::Surface wall({0.f, 0.f, 0.f, 2.f, 0.f, 0.f, 2.f, 0.f, 2.f, 0.f, 0.f, 2.f},
+                               "Wall");
+  const Penumbra::Polygon louver{0.f, 0.f, 2.f, 0.f, -0.5f, 2.f, 2.f, -0.5f, 2.f, 2.f, 0.f, 2.f};
+  const Penumbra::Surface fin({2.f, 0.f, 0.f, 2.f, 0.f, 2.f, 2.f, -1.f, 2.f, 2.f, -1.f, 0.f},
+                              "Fin");
+
+  // Rotation about the louver's hinge, along the top of the wall
+  auto const rotation = [](float angle) {
+    float const c = std::cos(angle), s = std::sin(angle);
+    return std::array<float, 16>{1.f, 0.f, 0.f, 0.f, 0.f, c,   s,          0.f,
+                                 0.f, -s, c,   0.f, 0.f, 2.f * s, 2.f - 2.f * c, 1.f};
+  };
+  auto const rotate = [](const Penumbra::Polygon &polygon, const std::array<float, 16> &matrix) {
+    Penumbra::Polygon rotated(polygon.size());
+    for (std::size_t i = 0; i < polygon.size(); i += 3) {
+      for (std::size_t row = 0; row < 3; ++row) {
+        rotated[i + row] = matrix[row] * polygon[i] + matrix[4 + row] * polygon[i + 1] +
+                           matrix[8 + row] * polygon[i + 2] + matrix[12 + row];
+      }
+    }
+    return rotated;
+  };
+
+  auto const penumbras = create_backends();
+  for (auto const &penumbra : penumbras) {
+    penumbra->add_surface(wall);
+    penumbra->add_surface(Penumbra::Surface(louver, "Louver"));
+    penumbra->set_model();
+  }
+
+  // Each transformed model matches one built with the louver rotated
+  bool has_fin{false};
+  auto const check = [&](float angle) {
+    expect_matching_models(
+        penumbras,
+        [&](Penumbra::Penumbra &built) {
+          built.add_surface(wall);
+          built.add_surface(Penumbra::Surface(rotate(louver, rotation(angle))));
+          if (has_fin) {
+            built.add_surface(fin);
+          }
+        },
+        "angle " + std::to_string(angle));
+  };
+
+  // Each timestep moves the louver's vertices in place
+  for (float const angle : {0.4f, -0.3f, 0.8f}) {
+    for (auto const &penumbra : penumbras) {
+      penumbra->set_surface_transform(1, rotation(angle));
+      penumbra->set_model();
+    }
+    check(angle);
+  }
+  EXPECT_EQ(penumbras[1]->get_surface_transform(1), rotation(0.8f));
+
+  // Rebuilding the model (after adding a surface) keeps the transform
+  for (auto const &penumbra : penumbras) {
+    penumbra->add_surface(fin);
+    penumbra->set_model();
+  }
+  has_fin = true;
+  check(0.8f);
+}
+
+TEST(PenumbraTest, surface_instances) {
+  const Penumbra::Surface wall({0.f, 0.f, 0.f, 6.f, 0.f, 0.f, 6.f, 0.f, 2.f, 0.f, 0.f, 2.f},
+                               "Wall");
+  // A perforated shade, repeated along the wall at alternating heights
+  const Penumbra::Polygon shade_polygon{0.f, 0.f,  0.f, 0.f, -0.5f, 0.f,
+                                        1.f, -0.5f, 0.f, 1.f, 0.f,  0.f};
+  const Penumbra::Polygon shade_hole{0.25f, -0.125f, 0.f, 0.25f, -0.375f, 0.f,
+                                     0.75f, -0.375f, 0.f, 0.75f, -0.125f, 0.f};
+  Penumbra::Surface shade(shade_polygon, "Shade");
+  shade.add_hole(shade_hole);
+  const Penumbra::Surface fin({6.f, 0.f, 0.f, 6.f, 0.f, 2.f, 6.f, -1.f, 2.f, 6.f, -1.f, 0.f},
+                              "Fin");
+  std::vector<std::array<float, 3>> offsets;
+  std::vector<std::array<float, 16>> transforms;
+  for (int i = 0; i < 4; ++i) {
+    offsets.push_back({0.5f + 1.5f * static_cast<float>(i), 0.f, i % 2 == 0 ? 2.f : 1.6f});
+    transforms.push_back({1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f,
+                          offsets.back()[0], offsets.back()[1], offsets.back()[2], 1.f});
+  }
+  auto const translate = [](Penumbra::Polygon polygon, const std::array<float, 3> &offset) {
+    for (std::size_t i = 0; i < polygon.size(); ++i) {
+      polygon[i] += offset[i % 3];
+    }
+    return polygon;
+  };
+
+  auto const penumbras = create_backends();
+  for (auto const &penumbra : penumbras) {
+    penumbra->add_surface(wall);
+    EXPECT_EQ(penumbra->add_surface_instances(shade, transforms), 1u);
+    penumbra->set_model();
+  }
+  EXPECT_EQ(penumbras[1]->get_number_of_surfaces(), 5u);
+  EXPECT_EQ(penumbras[1]->get_surface_transform(3), transforms[2]);
+
+  // Each instance's PSSA matches that of a surface placed by hand
+  bool is_first_shade_solid{false};
+  bool has_fin{false};
+  auto const check = [&](const std::string &step) {
+    expect_matching_models(
+        penumbras,
+        [&](Penumbra::Penumbra &built) {
+          built.add_surface(wall);
+          for (std::size_t i = 0; i < offsets.size(); ++i) {
+            Penumbra::Surface placed(translate(shade_polygon, offsets[i]));
+            if (i > 0 || !is_first_shade_solid) {
+              placed.add_hole(translate(shade_hole, offsets[i]));
+            }
+            built.add_surface(placed);
+          }
+          if (has_fin) {
+            built.add_surface(fin);
+          }
+        },
+        step);
+  };
+  check("instances");
+
+  // Changing the first instance leaves the others sharing a tessellation, also once rebuilt
+  for (auto const &penumbra : penumbras) {
+    penumbra->update_surface(1, Penumbra::Surface(shade_polygon));
+    penumbra->set_model();
+  }
+  is_first_shade_solid = true;
+  check("first instance changed");
+  for (auto const &penumbra : penumbras) {
+    penumbra->add_surface(fin);
+    penumbra->set_model();
+  }
+  has_fin = true;
+  check("rebuilt");
+}
+
 TEST(PenumbraTest, vendor_name) {
   if (!Penumbra::Penumbra::is_valid_context()) {
     GTEST_SKIP() << invalid_context_string << std::endl;